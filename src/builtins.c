@@ -5,54 +5,79 @@
 #include "object.h"
 #include "builtins.h"
 
-#define MAKE_BUILTIN(fn) ((struct object) {                     \
-    .type = OBJ_BUILTIN,                                        \
-    .value = { .fn_builtin = &fn }    \
-    }) 
-
-static struct object builtin_len(const struct object_list* args);
-static struct object builtin_print(const struct object_list* args);
-static struct object builtin_type(const struct object_list* args);
-static struct object builtin_int(const struct object_list* args);
-static struct object builtin_array_pop(const struct object_list* args);
-static struct object builtin_array_push(const struct object_list* args);
-static struct object builtin_file_get_contents(const struct object_list* args);
-static struct object str_split(const struct object_list* args);
-static struct object str_contains(const struct object_list* args);
+// aligned so the function pointer leaves room for the type tag in a tagged object
+#define BUILTIN static __attribute__((aligned(16))) struct object
+
+BUILTIN builtin_len(const struct object* args, const uint32_t num_args);
+BUILTIN builtin_print(const struct object* args, const uint32_t num_args);
+BUILTIN builtin_type(const struct object* args, const uint32_t num_args);
+BUILTIN builtin_int(const struct object* args, const uint32_t num_args);
+BUILTIN builtin_array_pop(const struct object* args, const uint32_t num_args);
+BUILTIN builtin_array_push(const struct object* args, const uint32_t num_args);
+BUILTIN builtin_file_get_contents(const struct object* args, const uint32_t num_args);
+BUILTIN str_split(const struct object* args, const uint32_t num_args);
+BUILTIN str_contains(const struct object* args, const uint32_t num_args);
 
 
 // here we store the built-in function directly on the pointer by casting it to the wrong value
 // this saves us a level of indirection when calling built-in functions
+// pure functions only depend on their arguments and have no side effects, so the compiler may call them on constant arguments
+// the others may still be known to leave their arguments alone, which lets the compiler move pure calls out of loops calling them
+// calls with the right number of arguments to functions with an intrinsic compile to that instruction instead of OPCODE_CALL
 const struct {
     const char* name;
-    struct object fn_obj;
+    builtin_function fn;
+    bool pure;
+    bool mutates_arguments;
+    enum opcode intrinsic;
+    uint8_t intrinsic_args;
 } builtin_functions[] = {
-    { "print", MAKE_BUILTIN(builtin_print) },
-    { "len", MAKE_BUILTIN(builtin_len) },
-    { "type", MAKE_BUILTIN(builtin_type) },
-    { "int", MAKE_BUILTIN(builtin_int) },
-    { "array_pop", MAKE_BUILTIN(builtin_array_pop) },
-    { "array_push", MAKE_BUILTIN(builtin_array_push) },
-    { "file_get_contents", MAKE_BUILTIN(builtin_file_get_contents) },
-    { "str_split", MAKE_BUILTIN(str_split) },
-    { "str_contains", MAKE_BUILTIN(str_contains) }
+    { "print", builtin_print, false, false, OPCODE_CALL, 0 },
+    { "len", builtin_len, true, false, OPCODE_LEN, 1 },
+    { "type", builtin_type, true, false, OPCODE_CALL, 0 },
+    { "int", builtin_int, true, false, OPCODE_INT, 1 },
+    { "array_pop", builtin_array_pop, false, true, OPCODE_ARRAY_POP, 1 },
+    { "array_push", builtin_array_push, false, true, OPCODE_ARRAY_PUSH, 2 },
+    { "file_get_contents", builtin_file_get_contents, false, false, OPCODE_CALL, 0 },
+    { "str_split", str_split, false, false, OPCODE_CALL, 0 },
+    { "str_contains", str_contains, true, false, OPCODE_CALL, 0 }
 };
 
 inline 
 struct object get_builtin_by_index(const uint8_t index) {
-    return builtin_functions[index].fn_obj;
+    return make_builtin_object(builtin_functions[index].fn);
+}
+
+bool builtin_is_pure(const uint8_t index) {
+    return builtin_functions[index].pure;
+}
+
+bool builtin_mutates_arguments(const uint8_t index) {
+    return builtin_functions[index].mutates_arguments;
+}
+
+enum opcode builtin_intrinsic(const uint8_t index, const uint32_t num_args) {
+    return builtin_functions[index].intrinsic_args == num_args ? builtin_functions[index].intrinsic : OPCODE_CALL;
+}
+
+builtin_function intrinsic_builtin(const enum opcode intrinsic) {
+    for (unsigned i = 0; i < sizeof(builtin_functions) / sizeof(builtin_functions[0]); i++) {
+        if (builtin_functions[i].intrinsic == intrinsic) {
+            return builtin_functions[i].fn;
+        }
+    }
+
+    return NULL;
 }
 
 struct object get_builtin(const char* name) {
     for (unsigned i = 0; i < sizeof(builtin_functions) / sizeof(builtin_functions[0]); i++) {
         if (strcmp(name, builtin_functions[i].name) == 0) {
-            return builtin_functions[i].fn_obj;
+            return make_builtin_object(builtin_functions[i].fn);
         }
     }
     
-    return (struct object) {
-        .type = OBJ_NULL,
-    };
+    return make_null_object();
 }
 
 
@@ -63,63 +88,62 @@ void define_builtins(struct symbol_table* st) {
     }
 }
 
-static struct object builtin_len(const struct object_list* args) {
-    if (args->size != 1) {
-        return make_error_object("wrong number of arguments: expected 1, got %d", args->size);
+BUILTIN builtin_len(const struct object* args, const uint32_t num_args) {
+    if (num_args != 1) {
+        return make_error_object("wrong number of arguments: expected 1, got %d", num_args);
     }
 
-    struct object arg = args->values[0];
-    switch (arg.type) {
+    struct object arg = args[0];
+    switch (obj_type(arg)) {
         case OBJ_STRING:
-            return make_integer_object(arg.value.string->length);
+            return make_integer_object(obj_string(arg)->length);
         break;
 
         case OBJ_ARRAY:
-            return make_integer_object(arg.value.list->size);
+            return make_integer_object(obj_list(arg)->size);
         break;
 
         default:
-            return make_error_object("argument to len() not supported: got %s", object_type_to_str(arg.type));
+            return make_error_object("argument to len() not supported: got %s", object_type_to_str(obj_type(arg)));
         break;
     }
 
 }
 
-static struct object builtin_print(const struct object_list* args) {
-    for (unsigned i=0; i < args->size; i++) {
-        print_object(args->values[i]);
+BUILTIN builtin_print(const struct object* args, const uint32_t num_args) {
+    for (unsigned i=0; i < num_args; i++) {
+        print_object(args[i]);
     }
 
     printf("\n");
-    return (struct object) {
-        .type = OBJ_NULL,
-    };
+    return make_null_object();
 }
 
-static struct object builtin_type(const struct object_list *args) {
-    if (args->size != 1) {
-        return make_error_object("wrong number of arguments: expected 1, got %d", args->size);
+BUILTIN builtin_type(const struct object* args, const uint32_t num_args) {
+    if (num_args != 1) {
+        return make_error_object("wrong number of arguments: expected 1, got %d", num_args);
     }
-    return make_string_object(object_type_to_str(args->values[0].type));
+    return make_string_object(object_type_to_str(obj_type(args[0])));
 }
 
-static struct object builtin_int(const struct object_list *args) {
-    if (args->size != 1) {
-        return make_error_object("wrong number of arguments: expected 1, got %d", args->size);
+BUILTIN builtin_int(const struct object* args, const uint32_t num_args) {
+    if (num_args != 1) {
+        return make_error_object("wrong number of arguments: expected 1, got %d", num_args);
     }
 
-    struct object* obj = &args->values[0];
-    switch (obj->type) {
+    const struct object* obj = &args[0];
+    switch (obj_type(*obj)) {
         case OBJ_INT:
-            return *obj;
+            // a new object, since the result belongs to the caller while a boxed argument may already be on the heap
+            return make_integer_object(obj_int(*obj));
         break;
 
         case OBJ_STRING:
-            return make_integer_object(atoi(obj->value.string->value));
+            return make_integer_object(atoi(obj_string(*obj)->value));
         break;
 
         case OBJ_BOOL:
-            return make_integer_object(obj->value.boolean ? 1 : 0);
+            return make_integer_object(obj_bool(*obj) ? 1 : 0);
         break;
 
         default:
@@ -130,50 +154,50 @@ static struct object builtin_int(const struct object_list *args) {
     return make_error_object("invalid object type");
 }
 
-static struct object builtin_array_pop(const struct object_list *args) {
-    if (args->size != 1) {
-        return make_error_object("wrong number of arguments: expected 1, got %d", args->size);
+BUILTIN builtin_array_pop(const struct object* args, const uint32_t num_args) {
+    if (num_args != 1) {
+        return make_error_object("wrong number of arguments: expected 1, got %d", num_args);
     }
 
-    if (args->values[0].type != OBJ_ARRAY) {
-        return make_error_object("invalid argument: expected ARRAY, got %s", object_type_to_str(args->values[0].type));
+    if (obj_type(args[0]) != OBJ_ARRAY) {
+        return make_error_object("invalid argument: expected ARRAY, got %s", object_type_to_str(obj_type(args[0])));
     }
 
-	struct object array = args->values[0];
-	struct object_list* list = array.value.list;
+	struct object array = args[0];
+	struct object_list* list = obj_list(array);
     if (list->size == 0) {
-        return (struct object) {.type = OBJ_NULL};
+        return make_null_object();
     }
 
     return copy_object(&list->values[list->size-- - 1]);
 }
 
-static struct object builtin_array_push(const struct object_list *args) {
-    if (args->size != 2) {
-        return make_error_object("wrong number of arguments: expected 2, got %d", args->size);
+BUILTIN builtin_array_push(const struct object* args, const uint32_t num_args) {
+    if (num_args != 2) {
+        return make_error_object("wrong number of arguments: expected 2, got %d", num_args);
     }
 
-    if (args->values[0].type != OBJ_ARRAY) {
-        return make_error_object("invalid argument: expected ARRAY, got %s", object_type_to_str(args->values[0].type));
+    if (obj_type(args[0]) != OBJ_ARRAY) {
+        return make_error_object("invalid argument: expected ARRAY, got %s", object_type_to_str(obj_type(args[0])));
     }
    
-	struct object array = args->values[0];
-	struct object_list* list = array.value.list;
-    struct object *value = (struct object*) &args->values[1];
+	struct object array = args[0];
+	struct object_list* list = obj_list(array);
+    struct object *value = (struct object*) &args[1];
     append_to_object_list(list, copy_object(value)); 
     return make_integer_object(list->size);
 }
 
-static struct object builtin_file_get_contents(const struct object_list *args) {
-    if (args->size != 1) {
-        return make_error_object("wrong number of arguments: expected 1, got %d", args->size);
+BUILTIN builtin_file_get_contents(const struct object* args, const uint32_t num_args) {
+    if (num_args != 1) {
+        return make_error_object("wrong number of arguments: expected 1, got %d", num_args);
     }
 
-    if (args->values[0].type != OBJ_STRING) {
-        return make_error_object("invalid argument: expected %s, got %s", object_type_to_str(OBJ_STRING), object_type_to_str(args->values[0].type));
+    if (obj_type(args[0]) != OBJ_STRING) {
+        return make_error_object("invalid argument: expected %s, got %s", object_type_to_str(OBJ_STRING), object_type_to_str(obj_type(args[0])));
     }
 
-    const char *filename = args->values[0].value.string->value;
+    const char *filename = obj_string(args[0])->value;
     FILE *fd = fopen(filename, "rb");
     if (!fd) {
         return make_error_object("error opening file \"%s\"", filename);
@@ -184,30 +208,30 @@ static struct object builtin_file_get_contents(const struct object_list *args) {
     fseek(fd, 0, SEEK_SET); 
 
     struct object obj = make_string_object_with_length("", fsize);
-    size_t bytes_read = fread(obj.value.string->value, 1, fsize, fd);
+    size_t bytes_read = fread(obj_string(obj)->value, 1, fsize, fd);
     assert(bytes_read == fsize);
-    obj.value.string->value[fsize] = '\0';
+    obj_string(obj)->value[fsize] = '\0';
     fclose(fd);
     return obj;
 }
 
-static struct object str_split(const struct object_list *args) {
-  if (args->size != 2) {
+BUILTIN str_split(const struct object* args, const uint32_t num_args) {
+  if (num_args != 2) {
     return make_error_object("wrong number of arguments: expected 2, got %d",
-                             args->size);
+                             num_args);
   }
 
-  if (args->values[0].type != OBJ_STRING ||
-      args->values[1].type != OBJ_STRING) {
+  if (obj_type(args[0]) != OBJ_STRING ||
+      obj_type(args[1]) != OBJ_STRING) {
     return make_error_object("invalid argument: expected %s, got %s",
                              object_type_to_str(OBJ_STRING),
-                             object_type_to_str(args->values[0].type));
+                             object_type_to_str(obj_type(args[0])));
   }
 
 
 
-  const char *str = args->values[0].value.string->value;
-  struct string *delim = args->values[1].value.string;
+  const char *str = obj_string(args[0])->value;
+  struct string *delim = obj_string(args[1]);
   struct object_list *list = make_object_list(8);
 
   char *p;
@@ -216,8 +240,8 @@ static struct object str_split(const struct object_list *args) {
   while ((p = strstr(str, delim->value)) != NULL) {
     size_t len = p - str;
     obj = make_string_object_with_length("", len);
-    memcpy(obj.value.string->value, str, len);
-    obj.value.string->value[len] = '\0';
+    memcpy(obj_string(obj)->value, str, len);
+    obj_string(obj)->value[len] = '\0';
     append_to_object_list(list, obj);
     str = p + delim->length;
   }
@@ -230,17 +254,17 @@ static struct object str_split(const struct object_list *args) {
   return make_array_object(list);
 }
 
-static struct object str_contains(const struct object_list *args) {
-    if (args->size != 2) {
-        return make_error_object("wrong number of arguments: expected 2, got %d", args->size);
+BUILTIN str_contains(const struct object* args, const uint32_t num_args) {
+    if (num_args != 2) {
+        return make_error_object("wrong number of arguments: expected 2, got %d", num_args);
     }
 
-    if (args->values[0].type != OBJ_STRING || args->values[1].type != OBJ_STRING) {
-        return make_error_object("invalid argument: expected %s, got %s", object_type_to_str(OBJ_STRING), object_type_to_str(args->values[0].type));
+    if (obj_type(args[0]) != OBJ_STRING || obj_type(args[1]) != OBJ_STRING) {
+        return make_error_object("invalid argument: expected %s, got %s", object_type_to_str(OBJ_STRING), object_type_to_str(obj_type(args[0])));
     }
 
-    const char* subject = args->values[0].value.string->value;
-    const char* search = args->values[1].value.string->value;
+    const char* subject = obj_string(args[0])->value;
+    const char* search = obj_string(args[1])->value;
     char* ret;
 
     ret = strstr(subject, search);
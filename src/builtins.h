@@ -1,10 +1,18 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 #include "object.h"
+#include "opcode.h"
 #include "symbol_table.h"
 
 struct object get_builtin(const char *name);
 struct object get_builtin_by_index(const uint8_t index);
+bool builtin_is_pure(const uint8_t index);
+bool builtin_mutates_arguments(const uint8_t index);
+/* instruction a call of the built-in function with num_args arguments compiles to, or OPCODE_CALL */
+enum opcode builtin_intrinsic(const uint8_t index, const uint32_t num_args);
+/* the built-in function an intrinsic instruction falls back to for arguments it does not handle itself */
+builtin_function intrinsic_builtin(const enum opcode intrinsic);
 
 void define_builtins(struct symbol_table *t);
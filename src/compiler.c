@@ -9,6 +9,7 @@
 #include "parser.h"
 #include "symbol_table.h"
 #include "builtins.h"
+#include "ir.h"
 
 enum {
     COMPILE_SUCCESS = 0,
@@ -16,13 +17,28 @@ enum {
     COMPILE_ERR_UNKNOWN_EXPR_TYPE,
     COMPILE_ERR_UNKNOWN_IDENT,
     COMPILE_ERR_PREVIOUSLY_DECLARED,
+    COMPILE_ERR_TOO_MANY_REGISTERS,
 };
 
+/* registers are addressed by a single byte operand */
+#define MAX_REGISTERS 256u
+
 const uint16_t JUMP_PLACEHOLDER_BREAK = 9999;
 const uint16_t JUMP_PLACEHOLDER_CONTINUE = 9998;
 
+/* a list of jumps without any jump in it, see compiler_add_jump() */
+#define JUMP_LIST_EMPTY UINT32_MAX
+
 static int compile_statement(struct compiler *compiler, const struct statement *statement);
 static int compile_expression(struct compiler *compiler, const struct expression *expression);
+static int compile_expression_for_effect(struct compiler *compiler, const struct expression *expression);
+static int compile_block_statement(struct compiler *compiler, const struct block_statement *block, bool value);
+static uint32_t max_stack_depth(const struct instruction *ins);
+static int compile_register_program(struct compiler *c, const struct program *program);
+static int compile_register_statement(struct compiler *c, const struct statement *stmt);
+static int compile_register_expression(struct compiler *c, const struct expression *expr, uint32_t dest);
+static void constant_index_rebuild(struct compiler *c, uint32_t cap);
+static struct instruction *compiler_optimize(struct compiler *c, struct instruction *ins, const char *name, uint32_t *num_locals, uint32_t num_parameters);
 
 struct compiler *compiler_new(void) {
     struct compiler *c = malloc(sizeof *c);
@@ -34,7 +50,23 @@ struct compiler *compiler_new(void) {
     scope.instructions->bytes = calloc(scope.instructions->cap, sizeof *scope.instructions->bytes);
     assert(scope.instructions->bytes != NULL);
     scope.instructions->size = 0;
+    scope.last_jump_target = 0;
+    scope.last_instruction = scope.previous_instruction = (struct emitted_instruction) { .opcode = OPCODE_HALT, .position = 0 };
+    scope.first_temporary = scope.free_register = scope.num_registers = scope.loop_register = 0;
+    scope.loop_value = true;
+    scope.function = NULL;
     c->constants = make_object_list(64);
+    c->constant_index = NULL;
+    constant_index_rebuild(c, 128);
+    c->registers = false;
+    c->optimizer_stats = false;
+    c->optimize = false;
+    c->num_hoisted = 0;
+    c->num_bounded = 0;
+    c->inline_functions = true;
+    c->num_bound_functions = 0;
+    c->num_inline_candidates = 0;
+    c->num_inlined = 0;
 
     c->symbol_table = symbol_table_new();
     define_builtins(c->symbol_table);
@@ -55,11 +87,14 @@ struct compiler *compiler_new_with_state(struct symbol_table *t, struct object_l
 	define_builtins(c->symbol_table);
     free_object_list(c->constants);
     c->constants = constants;
+    constant_index_rebuild(c, c->constant_index_cap);
+    c->inline_functions = false;
     return c;
 }
 
 void compiler_free(struct compiler *c) {
     free_instruction(c->scopes[0].instructions);
+    free(c->constant_index);
     free_object_list(c->constants);
     symbol_table_free(c->symbol_table);
     free(c);
@@ -73,6 +108,7 @@ const char *compiler_error_str(int err) {
         "Unknown expression type",
         "Undefined variable",
         "Redeclaration of variable",
+        "Too many registers",
     };
     return error_messages[err];
 }
@@ -88,10 +124,122 @@ struct instruction *compiler_current_instructions(struct compiler *c) {
 
 static uint32_t
 add_constant(struct compiler *c, struct object obj) {
-    c->constants->values[c->constants->size++] = obj;
+    append_to_object_list(c->constants, obj);
     return c->constants->size - 1;
 }
 
+static uint64_t 
+constant_hash_integer(int64_t value) {
+    uint64_t h = (uint64_t) value * 0x9E3779B97F4A7C15u;
+    return h ^ (h >> 32);
+}
+
+/* FNV-1a */
+static uint64_t 
+constant_hash_string(const char *value) {
+    uint64_t h = 0xcbf29ce484222325u;
+    for (; *value != '\0'; value++) {
+        h = (h ^ (uint8_t) *value) * 0x100000001b3u;
+    }
+    return h;
+}
+
+static uint64_t 
+constant_hash(struct object obj) {
+    return obj_type(obj) == OBJ_INT ? constant_hash_integer(obj_int(obj)) : constant_hash_string(obj_string(obj)->value);
+}
+
+/* 
+ * Returns the index slot for the integer (if value is NULL) or string constant, 
+ * which is either empty or refers to a constant with that value 
+ */
+static uint32_t *
+constant_index_find(struct compiler *c, uint64_t hash, int64_t integer, const char *string) {
+    const uint32_t mask = c->constant_index_cap - 1;
+    for (uint32_t pos = hash & mask; ; pos = (pos + 1) & mask) {
+        uint32_t *slot = &c->constant_index[pos];
+        if (*slot == 0) {
+            return slot;
+        }
+
+        struct object obj = c->constants->values[*slot - 1];
+        if (string == NULL) {
+            if (obj_type(obj) == OBJ_INT && obj_int(obj) == integer) {
+                return slot;
+            }
+        } else if (obj_type(obj) == OBJ_STRING && strcmp(obj_string(obj)->value, string) == 0) {
+            return slot;
+        }
+    }
+}
+
+/* (re)creates the index with the given capacity, which must be a power of 2, from all integer and string constants */
+static void 
+constant_index_rebuild(struct compiler *c, uint32_t cap) {
+    free(c->constant_index);
+    c->constant_index = calloc(cap, sizeof *c->constant_index);
+    assert(c->constant_index != NULL);
+    c->constant_index_cap = cap;
+    c->constant_index_size = 0;
+
+    for (uint32_t i = 0; i < c->constants->size; i++) {
+        struct object obj = c->constants->values[i];
+        if (obj_type(obj) != OBJ_INT && obj_type(obj) != OBJ_STRING) {
+            continue;
+        }
+
+        // keep the index at most half full
+        if ((c->constant_index_size + 1) * 2 > c->constant_index_cap) {
+            constant_index_rebuild(c, cap * 2);
+            return;
+        }
+
+        uint32_t *slot = obj_type(obj) == OBJ_INT 
+            ? constant_index_find(c, constant_hash(obj), obj_int(obj), NULL)
+            : constant_index_find(c, constant_hash(obj), 0, obj_string(obj)->value);
+        if (*slot == 0) {
+            *slot = i + 1;
+            c->constant_index_size++;
+        }
+    }
+}
+
+/* adds a constant for an empty index slot, returned by constant_index_find */
+static uint32_t 
+add_indexed_constant(struct compiler *c, uint32_t *slot, struct object obj) {
+    uint32_t idx = add_constant(c, obj);
+    *slot = idx + 1;
+    if (++c->constant_index_size * 2 > c->constant_index_cap) {
+        constant_index_rebuild(c, c->constant_index_cap * 2);
+    }
+    return idx;
+}
+
+/* returns the index of the integer constant with the given value, adding it if it does not exist yet */
+static uint32_t
+add_integer_constant(struct compiler *c, int64_t value) {
+    uint32_t *slot = constant_index_find(c, constant_hash_integer(value), value, NULL);
+    if (*slot != 0) {
+        return *slot - 1;
+    }
+
+    return add_indexed_constant(c, slot, make_integer_object(value));
+}
+
+/* 
+ * Returns the index of the string constant with the given value, adding it if it does not exist yet.
+ * All identical string literals share this single string object.
+ */
+static uint32_t
+add_string_constant(struct compiler *c, const char *value) {
+    uint32_t *slot = constant_index_find(c, constant_hash_string(value), 0, value);
+    if (*slot != 0) {
+        return *slot - 1;
+    }
+
+    return add_indexed_constant(c, slot, make_string_object(value));
+}
+
 static void compiler_set_last_instruction(struct compiler *c, enum opcode opcode, uint32_t pos) {
     struct emitted_instruction previous = compiler_current_scope(c).last_instruction;
     struct emitted_instruction last = {
@@ -138,10 +286,197 @@ static void compiler_change_operand(struct compiler *c, uint32_t pos, uint16_t o
     }
 }
 
+/* 
+ * Turns the call instruction just emitted for a call expression in tail position into a tail call, 
+ * which reuses the frame of the current function. The main program has no frame to reuse.
+ */
+static bool compiler_emit_tail_call(struct compiler *c, const struct expression *expr) {
+    bool self = compiler_last_instruction_is(c, OPCODE_CALL_SELF);
+    if (c->scope_index == 0 || expr == NULL || expr->type != EXPR_CALL || (!compiler_last_instruction_is(c, OPCODE_CALL) && !self)) {
+        return false;
+    }
+
+    // the call may come from an inlined function body, where it does not need to be the last thing that runs
+    const struct compiler_scope *scope = &c->scopes[c->scope_index];
+    if (scope->last_jump_target > scope->last_instruction.position) {
+        return false;
+    }
+
+    uint8_t num_args = scope->instructions->bytes[scope->last_instruction.position + 1];
+    compiler_replace_last_instruction(c, make_instruction(self ? OPCODE_TAIL_CALL_SELF : OPCODE_TAIL_CALL, num_args));
+    return true;
+}
+
+/* returns the current position in the instruction stream and marks it as a jump target */
+static uint32_t compiler_jump_target(struct compiler *c) {
+    struct compiler_scope *scope = &c->scopes[c->scope_index];
+    scope->last_jump_target = scope->instructions->size;
+    return scope->last_jump_target;
+}
+
+#ifndef NO_SUPERINSTRUCTIONS
+static enum opcode superinstruction_for(enum opcode first, enum opcode second, enum opcode opcode) {
+    if (first != OPCODE_GET_LOCAL) {
+        return opcode;
+    }
+
+    // a fused instruction saves more dispatches than an unchecked integer instruction saves type checks
+    if (second == OPCODE_CONST || second == OPCODE_PUSH_INT8 || second == OPCODE_PUSH_INT16) {
+        switch (opcode) {
+            case OPCODE_ADD:
+            case OPCODE_INT_ADD:
+                return OPCODE_ADD_LOCAL_CONST;
+            case OPCODE_SUBTRACT:
+            case OPCODE_INT_SUBTRACT:
+                return OPCODE_SUBTRACT_LOCAL_CONST;
+            case OPCODE_LESS_THAN:
+            case OPCODE_INT_LESS_THAN:
+                return OPCODE_LESS_THAN_LOCAL_CONST;
+            case OPCODE_EQUAL:
+            case OPCODE_INT_EQUAL:
+                return OPCODE_EQUAL_LOCAL_CONST;
+            default: break;
+        }
+    } else if (second == OPCODE_GET_LOCAL) {
+        switch (opcode) {
+            case OPCODE_ADD:
+            case OPCODE_INT_ADD:
+                return OPCODE_ADD_LOCAL_LOCAL;
+            case OPCODE_LESS_THAN:
+            case OPCODE_INT_LESS_THAN:
+                return OPCODE_LESS_THAN_LOCAL_LOCAL;
+            case OPCODE_INDEX_GET: return OPCODE_INDEX_GET_LOCAL_LOCAL;
+            case OPCODE_INDEX_GET_IN_BOUNDS: return OPCODE_INDEX_GET_LOCAL_LOCAL_IN_BOUNDS;
+            default: break;
+        }
+    }
+
+    return opcode;
+}
+
+/* 
+ * Peephole stage: replaces <GET_LOCAL> <CONST|GET_LOCAL> <opcode> with a single superinstruction
+ * Returns the position of the fused instruction or -1 if the last two instructions could not be fused
+ */
+static int64_t compiler_emit_superinstruction(struct compiler *c, enum opcode opcode) {
+    struct compiler_scope *scope = &c->scopes[c->scope_index];
+    struct emitted_instruction first = scope->previous_instruction;
+    struct emitted_instruction second = scope->last_instruction;
+    enum opcode fused = superinstruction_for(first.opcode, second.opcode, opcode);
+    if (fused == opcode) {
+        return -1;
+    }
+
+    // both instructions should be directly adjacent and no jump may land in between
+    if (first.position + instruction_width(first.opcode) != second.position 
+        || second.position + instruction_width(second.opcode) != scope->instructions->size
+        || scope->last_jump_target > first.position) {
+        return -1;
+    }
+
+    uint8_t *bytes = scope->instructions->bytes;
+    uint32_t operand1 = read_uint8(&bytes[first.position + 1]);
+    uint32_t operand2;
+    switch (second.opcode) {
+        case OPCODE_CONST: 
+            operand2 = read_uint16(&bytes[second.position + 1]); 
+        break;
+        // superinstructions take their right operand from the constants
+        case OPCODE_PUSH_INT8: 
+            operand2 = add_integer_constant(c, (int8_t) read_uint8(&bytes[second.position + 1])); 
+        break;
+        case OPCODE_PUSH_INT16: 
+            operand2 = add_integer_constant(c, (int16_t) read_uint16(&bytes[second.position + 1])); 
+        break;
+        default: 
+            operand2 = read_uint8(&bytes[second.position + 1]); 
+        break;
+    }
+    scope->instructions->size = first.position;
+    return compiler_emit(c, fused, operand1, operand2);
+}
+
+static enum opcode compare_and_branch_for(enum opcode comparison) {
+    switch (comparison) {
+        case OPCODE_EQUAL:
+        case OPCODE_INT_EQUAL:
+        case OPCODE_BOOL_EQUAL:
+            return OPCODE_JUMP_IF_NOT_EQUAL;
+        case OPCODE_NOT_EQUAL:
+        case OPCODE_INT_NOT_EQUAL:
+        case OPCODE_BOOL_NOT_EQUAL:
+            return OPCODE_JUMP_IF_EQUAL;
+        case OPCODE_GREATER_THAN:
+        case OPCODE_INT_GREATER_THAN:
+            return OPCODE_JUMP_IF_NOT_GREATER_THAN;
+        case OPCODE_GREATER_THAN_OR_EQUALS:
+        case OPCODE_INT_GREATER_THAN_OR_EQUALS:
+            return OPCODE_JUMP_IF_NOT_GREATER_THAN_OR_EQUALS;
+        case OPCODE_LESS_THAN:
+        case OPCODE_INT_LESS_THAN:
+            return OPCODE_JUMP_IF_NOT_LESS_THAN;
+        case OPCODE_LESS_THAN_OR_EQUALS:
+        case OPCODE_INT_LESS_THAN_OR_EQUALS:
+            return OPCODE_JUMP_IF_NOT_LESS_THAN_OR_EQUALS;
+        case OPCODE_LESS_THAN_LOCAL_CONST: return OPCODE_JUMP_IF_NOT_LESS_THAN_LOCAL_CONST;
+        case OPCODE_LESS_THAN_LOCAL_LOCAL: return OPCODE_JUMP_IF_NOT_LESS_THAN_LOCAL_LOCAL;
+        case OPCODE_EQUAL_LOCAL_CONST: return OPCODE_JUMP_IF_NOT_EQUAL_LOCAL_CONST;
+        default: return OPCODE_JUMP_NOT_TRUE;
+    }
+}
+
+/*
+ * Peephole stage: replaces <comparison> <JUMP_NOT_TRUE target> with a single compare-and-branch instruction,
+ * so the boolean result is never pushed and tested again.
+ * Returns the position of the fused instruction or -1 if the last instruction is not a comparison that can be fused
+ */
+static int64_t compiler_emit_compare_and_branch(struct compiler *c, int64_t target) {
+    struct compiler_scope *scope = &c->scopes[c->scope_index];
+    struct emitted_instruction comparison = scope->last_instruction;
+    enum opcode fused = compare_and_branch_for(comparison.opcode);
+    if (fused == OPCODE_JUMP_NOT_TRUE
+        || comparison.position + instruction_width(comparison.opcode) != scope->instructions->size
+        || scope->last_jump_target > comparison.position) {
+        return -1;
+    }
+
+    const uint8_t *bytes = &scope->instructions->bytes[comparison.position];
+    uint32_t operand1 = 0;
+    uint32_t operand2 = 0;
+    if (comparison.opcode == OPCODE_LESS_THAN_LOCAL_LOCAL) {
+        operand1 = read_uint8(bytes + 1);
+        operand2 = read_uint8(bytes + 2);
+    } else if (comparison.opcode == OPCODE_LESS_THAN_LOCAL_CONST || comparison.opcode == OPCODE_EQUAL_LOCAL_CONST) {
+        operand1 = read_uint8(bytes + 1);
+        operand2 = read_uint16(bytes + 2);
+    }
+    scope->instructions->size = comparison.position;
+    return compiler_emit(c, fused, target, (int64_t) operand1, (int64_t) operand2);
+}
+#endif
+
 static uint32_t compiler_emit_va(struct compiler *c, enum opcode opcode, va_list operands) {
     struct definition def = lookup(opcode);  
     struct instruction *cins = compiler_current_instructions(c);
 
+    #ifndef NO_SUPERINSTRUCTIONS
+    if (def.operands == 0 && c->scopes[c->scope_index].instructions->size > 0) {
+        int64_t pos = compiler_emit_superinstruction(c, opcode);
+        if (pos >= 0) {
+            return (uint32_t) pos;
+        }
+    }
+    if (opcode == OPCODE_JUMP_NOT_TRUE && c->scopes[c->scope_index].instructions->size > 0) {
+        va_list target;
+        va_copy(target, operands);
+        int64_t pos = compiler_emit_compare_and_branch(c, va_arg(target, int64_t));
+        va_end(target);
+        if (pos >= 0) {
+            return (uint32_t) pos;
+        }
+    }
+    #endif
+
     if (cins->size + def.operands * 3 >= cins->cap) {
         cins->cap *= 2;
         cins->bytes = realloc(cins->bytes, cins->cap * sizeof(*cins->bytes));
@@ -165,42 +500,2738 @@ static uint32_t compiler_emit_va(struct compiler *c, enum opcode opcode, va_list
     return pos;
 }
 
-uint32_t compiler_emit(struct compiler *c, enum opcode opcode, ...) {
-    va_list args;
-    va_start(args, opcode);
-    uint32_t pos = compiler_emit_va(c, opcode, args);
-    va_end(args);
-    return pos;
+uint32_t compiler_emit(struct compiler *c, enum opcode opcode, ...) {
+    va_list args;
+    va_start(args, opcode);
+    uint32_t pos = compiler_emit_va(c, opcode, args);
+    va_end(args);
+    return pos;
+}
+
+/*
+ * Inlining
+ *
+ * With c->optimize, calls to small functions bound to a global that is never assigned again are replaced by the body
+ * of the function. The arguments are stored in anonymous variables of the caller standing in for the parameters,
+ * so the body runs in the frame of the caller. Names in the body that are not parameters or locals of the function
+ * are resolved in the global scope, like they would be when the function is called.
+ */
+
+#define INLINE_MAX_COST 24
+
+/* resolves a name in the scope being compiled, which is the body of the innermost inlined function if there is one */
+static struct symbol *
+compiler_resolve(struct compiler *c, const char *name) {
+    if (c->num_inlined == 0) {
+        return symbol_table_resolve(c->symbol_table, name);
+    }
+
+    struct inlined_call *call = &c->inlined[c->num_inlined - 1];
+    for (uint32_t i = 0; i < call->num_symbols; i++) {
+        if (strcmp(call->names[i], name) == 0) {
+            return &call->symbols[i];
+        }
+    }
+
+    struct symbol_table *globals = c->symbol_table;
+    while (globals->outer != NULL) {
+        globals = globals->outer;
+    }
+    return symbol_table_resolve(globals, name);
+}
+
+/* defines a name in the scope being compiled */
+static struct symbol *
+compiler_define(struct compiler *c, const char *name) {
+    if (c->num_inlined == 0) {
+        return symbol_table_define(c->symbol_table, name);
+    }
+
+    struct inlined_call *call = &c->inlined[c->num_inlined - 1];
+    for (uint32_t i = 0; i < call->num_symbols; i++) {
+        if (strcmp(call->names[i], name) == 0) {
+            return &call->symbols[i];
+        }
+    }
+
+    // inline_cost() made sure there is room for every name in the function
+    assert(call->num_symbols < sizeof call->names / sizeof call->names[0]);
+    call->names[call->num_symbols] = name;
+    call->symbols[call->num_symbols] = symbol_table_define_anonymous(c->symbol_table);
+    return &call->symbols[call->num_symbols++];
+}
+
+/* the size of a function body and the number of names it defines */
+struct inline_cost {
+    // the name the function is bound to, calling itself would never stop inlining
+    const char *name;
+    uint32_t nodes;
+    uint32_t names;
+    bool possible;
+};
+
+static void inline_cost_of_block(struct inline_cost *cost, const struct block_statement *block);
+
+static void
+inline_cost_of_expression(struct inline_cost *cost, const struct expression *expr) {
+    if (expr == NULL || !cost->possible) {
+        return;
+    }
+
+    cost->nodes++;
+    switch (expr->type) {
+        case EXPR_INT:
+        case EXPR_BOOL:
+        case EXPR_STRING:
+        break;
+
+        case EXPR_IDENT:
+            cost->possible = strcmp(expr->ident.value, cost->name) != 0;
+        break;
+
+        case EXPR_INFIX:
+            inline_cost_of_expression(cost, expr->infix.left);
+            inline_cost_of_expression(cost, expr->infix.right);
+        break;
+
+        case EXPR_PREFIX:
+            inline_cost_of_expression(cost, expr->prefix.right);
+        break;
+
+        case EXPR_POSTFIX:
+            inline_cost_of_expression(cost, expr->postfix.left);
+        break;
+
+        case EXPR_IF:
+            inline_cost_of_expression(cost, expr->ifelse.condition);
+            inline_cost_of_block(cost, expr->ifelse.consequence);
+            inline_cost_of_block(cost, expr->ifelse.alternative);
+        break;
+
+        case EXPR_CALL:
+            inline_cost_of_expression(cost, expr->call.function);
+            for (uint32_t i = 0; i < expr->call.arguments.size; i++) {
+                inline_cost_of_expression(cost, expr->call.arguments.values[i]);
+            }
+        break;
+
+        case EXPR_ARRAY:
+            for (uint32_t i = 0; i < expr->array.size; i++) {
+                inline_cost_of_expression(cost, expr->array.values[i]);
+            }
+        break;
+
+        case EXPR_INDEX:
+            inline_cost_of_expression(cost, expr->index.left);
+            inline_cost_of_expression(cost, expr->index.index);
+        break;
+
+        case EXPR_SLICE:
+            inline_cost_of_expression(cost, expr->slice.left);
+            inline_cost_of_expression(cost, expr->slice.start);
+            inline_cost_of_expression(cost, expr->slice.end);
+        break;
+
+        case EXPR_ASSIGN:
+            inline_cost_of_expression(cost, expr->assign.left);
+            inline_cost_of_expression(cost, expr->assign.value);
+        break;
+
+        // loops may contain break and continue, which would not find the loop they belong to
+        // function literals would resolve names in the frame of the caller
+        default:
+            cost->possible = false;
+        break;
+    }
+}
+
+static void
+inline_cost_of_block(struct inline_cost *cost, const struct block_statement *block) {
+    for (uint32_t i = 0; block != NULL && i < block->size; i++) {
+        const struct statement *stmt = &block->statements[i];
+        switch (stmt->type) {
+            case STMT_LET:
+                cost->names++;
+                cost->nodes++;
+                inline_cost_of_expression(cost, stmt->value);
+            break;
+
+            case STMT_EXPR:
+                inline_cost_of_expression(cost, stmt->value);
+            break;
+
+            // a return is only allowed as the last statement of the function, see inline_cost()
+            default:
+                cost->possible = false;
+            break;
+        }
+    }
+}
+
+/* returns the number of nodes in the body of a function literal bound to the given name, or UINT32_MAX if it can not be inlined */
+static uint32_t
+inline_cost(const struct expression *function, const char *name) {
+    struct inline_cost cost = { .name = name, .nodes = 0, .names = function->function.parameters.size, .possible = true };
+    struct block_statement body = *function->function.body;
+    if (body.size > 0 && body.statements[body.size - 1].type == STMT_RETURN) {
+        inline_cost_of_expression(&cost, body.statements[body.size - 1].value);
+        body.size--;
+    }
+    inline_cost_of_block(&cost, &body);
+
+    if (!cost.possible || cost.names > 16) {
+        return UINT32_MAX;
+    }
+    return cost.nodes;
+}
+
+static bool assigns_name(const struct expression *expr, const char *name);
+
+static bool
+block_assigns_name(const struct block_statement *block, const char *name) {
+    for (uint32_t i = 0; block != NULL && i < block->size; i++) {
+        const struct statement *stmt = &block->statements[i];
+        if ((stmt->type == STMT_LET && strcmp(stmt->name.value, name) == 0) || assigns_name(stmt->value, name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* whether an expression assigns or declares the given name anywhere, including the functions it defines */
+static bool
+assigns_name(const struct expression *expr, const char *name) {
+    if (expr == NULL) {
+        return false;
+    }
+
+    switch (expr->type) {
+        case EXPR_INFIX:
+            return assigns_name(expr->infix.left, name) || assigns_name(expr->infix.right, name);
+
+        case EXPR_PREFIX:
+            return assigns_name(expr->prefix.right, name);
+
+        case EXPR_POSTFIX:
+            return strcmp(expr->postfix.left->ident.value, name) == 0;
+
+        case EXPR_IF:
+            return assigns_name(expr->ifelse.condition, name) || block_assigns_name(expr->ifelse.consequence, name) || block_assigns_name(expr->ifelse.alternative, name);
+
+        case EXPR_FUNCTION:
+            for (uint32_t i = 0; i < expr->function.parameters.size; i++) {
+                if (strcmp(expr->function.parameters.values[i].value, name) == 0) {
+                    return true;
+                }
+            }
+            return block_assigns_name(expr->function.body, name);
+
+        case EXPR_CALL:
+            for (uint32_t i = 0; i < expr->call.arguments.size; i++) {
+                if (assigns_name(expr->call.arguments.values[i], name)) {
+                    return true;
+                }
+            }
+            return assigns_name(expr->call.function, name);
+
+        case EXPR_ARRAY:
+            for (uint32_t i = 0; i < expr->array.size; i++) {
+                if (assigns_name(expr->array.values[i], name)) {
+                    return true;
+                }
+            }
+            return false;
+
+        case EXPR_INDEX:
+            return assigns_name(expr->index.left, name) || assigns_name(expr->index.index, name);
+
+        case EXPR_SLICE:
+            return assigns_name(expr->slice.left, name) || assigns_name(expr->slice.start, name) || assigns_name(expr->slice.end, name);
+
+        case EXPR_WHILE:
+            return assigns_name(expr->while_loop.condition, name) || block_assigns_name(expr->while_loop.body, name);
+
+        case EXPR_FOR: {
+            const struct statement *init = &expr->for_loop.init;
+            return (init->type == STMT_LET && strcmp(init->name.value, name) == 0) || assigns_name(init->value, name)
+                || assigns_name(expr->for_loop.condition, name) || assigns_name(expr->for_loop.inc.value, name)
+                || block_assigns_name(expr->for_loop.body, name);
+        }
+
+        case EXPR_ASSIGN:
+            if (expr->assign.left->type == EXPR_IDENT && strcmp(expr->assign.left->ident.value, name) == 0) {
+                return true;
+            }
+            return assigns_name(expr->assign.left, name) || assigns_name(expr->assign.value, name);
+
+        default:
+            return false;
+    }
+}
+
+/* collects the functions bound by the let statements of a program whose name is never assigned again and the ones among them that can be inlined */
+static void
+find_bound_functions(struct compiler *c, const struct program *program) {
+    c->num_bound_functions = 0;
+    c->num_inline_candidates = 0;
+    for (uint32_t i = 0; i < program->size; i++) {
+        const struct statement *stmt = &program->statements[i];
+        if (stmt->type != STMT_LET || stmt->value == NULL || stmt->value->type != EXPR_FUNCTION) {
+            continue;
+        }
+
+        bool reassigned = assigns_name(stmt->value, stmt->name.value);
+        for (uint32_t j = 0; j < program->size && !reassigned; j++) {
+            const struct statement *other = &program->statements[j];
+            reassigned = other != stmt && ((other->type == STMT_LET && strcmp(other->name.value, stmt->name.value) == 0) || assigns_name(other->value, stmt->name.value));
+        }
+        if (reassigned) {
+            continue;
+        }
+
+        if (c->num_bound_functions < sizeof c->bound_functions / sizeof c->bound_functions[0]) {
+            c->bound_functions[c->num_bound_functions++] = stmt;
+        }
+        if (c->optimize && inline_cost(stmt->value, stmt->name.value) <= INLINE_MAX_COST
+            && c->num_inline_candidates < sizeof c->inline_candidates / sizeof c->inline_candidates[0]) {
+            c->inline_candidates[c->num_inline_candidates++] = stmt;
+        }
+    }
+}
+
+/* whether a call goes to the global the function being compiled is bound to, which is the function running in the frame */
+static bool
+is_self_call(struct compiler *c, const struct expression *expr) {
+    const struct expression *function = expr->call.function;
+    const struct expression *current = c->scopes[c->scope_index].function;
+    if (current == NULL || function->type != EXPR_IDENT) {
+        return false;
+    }
+
+    struct symbol *s = compiler_resolve(c, function->ident.value);
+    if (s == NULL || s->scope != SCOPE_GLOBAL) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < c->num_bound_functions; i++) {
+        const struct statement *stmt = c->bound_functions[i];
+        if (stmt->value == current && strcmp(stmt->name.value, function->ident.value) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* returns the function literal a call can be replaced with, or NULL */
+static const struct expression *
+inline_target(struct compiler *c, const struct expression *expr) {
+    const struct expression *function = expr->call.function;
+    if (c->num_inline_candidates == 0 || function->type != EXPR_IDENT || c->num_inlined == sizeof c->inlined / sizeof c->inlined[0]) {
+        return NULL;
+    }
+
+    // only a global that is already defined holds the function, a local of the same name shadows it
+    struct symbol *s = compiler_resolve(c, function->ident.value);
+    if (s == NULL || s->scope != SCOPE_GLOBAL) {
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < c->num_inline_candidates; i++) {
+        const struct statement *stmt = c->inline_candidates[i];
+        if (strcmp(stmt->name.value, function->ident.value) != 0 || stmt->value->function.parameters.size != expr->call.arguments.size) {
+            continue;
+        }
+
+        // functions calling each other
+        for (uint32_t j = 0; j < c->num_inlined; j++) {
+            if (c->inlined[j].function == stmt->value) {
+                return NULL;
+            }
+        }
+
+        // every parameter and local needs a slot in the frame of the caller
+        if (c->symbol_table->outer != NULL && c->symbol_table->size + 16 >= UINT8_MAX) {
+            return NULL;
+        }
+        return stmt->value;
+    }
+
+    return NULL;
+}
+
+/* compiles the body of a function in place of a call to it, leaving the value the call would return on the stack */
+static int
+compile_inlined_call(struct compiler *c, const struct expression *expr, const struct expression *function) {
+    int err;
+    for (uint32_t i = 0; i < expr->call.arguments.size; i++) {
+        err = compile_expression(c, expr->call.arguments.values[i]);
+        if (err) return err;
+    }
+
+    struct inlined_call *call = &c->inlined[c->num_inlined++];
+    call->function = function;
+    call->num_symbols = 0;
+    for (uint32_t i = function->function.parameters.size; i-- > 0; ) {
+        struct symbol *s = compiler_define(c, function->function.parameters.values[i].value);
+        compiler_emit(c, s->scope == SCOPE_GLOBAL ? OPCODE_SET_GLOBAL : OPCODE_SET_LOCAL, s->index);
+    }
+
+    const struct block_statement *body = function->function.body;
+    for (uint32_t i = 0; i + 1 < body->size; i++) {
+        err = compile_statement(c, &body->statements[i]);
+        if (err) return err;
+    }
+
+    // the value of a trailing expression or return statement is the value of the call, otherwise it is null
+    const struct statement *last = body->size > 0 ? &body->statements[body->size - 1] : NULL;
+    if (last != NULL && (last->type == STMT_EXPR || last->type == STMT_RETURN) && last->value != NULL) {
+        err = compile_expression(c, last->value);
+        if (err) return err;
+    } else {
+        if (last != NULL) {
+            err = compile_statement(c, last);
+            if (err) return err;
+        }
+        compiler_emit(c, OPCODE_NULL);
+    }
+
+    c->num_inlined--;
+    return 0;
+}
+
+/*
+ * Compiles the program to stack code, or to register code if compiler->registers is set.
+ * Programs that need more registers than a function can address, eg. for a large array literal or deeply nested calls,
+ * are compiled to stack code instead, which clears compiler->registers: check it to pick the machine to run the result on.
+ */
+int
+compile_program(struct compiler *compiler, const struct program *program) {
+    int err;
+    if (compiler->registers) {
+        err = compile_register_program(compiler, program);
+        if (err != COMPILE_ERR_TOO_MANY_REGISTERS) {
+            return err;
+        }
+
+        // globals that were defined keep their index, the constants that were added are left unused
+        while (compiler->scope_index > 0) {
+            free_instruction(compiler_leave_scope(compiler));
+        }
+        struct compiler_scope *scope = &compiler->scopes[0];
+        scope->instructions->size = 0;
+        scope->last_jump_target = 0;
+        scope->last_instruction = scope->previous_instruction = (struct emitted_instruction) { .opcode = OPCODE_HALT, .position = 0 };
+        scope->first_temporary = scope->free_register = scope->num_registers = scope->loop_register = 0;
+        compiler->registers = false;
+    }
+
+    compiler->num_hoisted = 0;
+    compiler->num_bounded = 0;
+    compiler->num_inlined = 0;
+    if (compiler->inline_functions) {
+        find_bound_functions(compiler, program);
+    }
+    // only the value of the last expression statement is observable, as the last popped value
+    uint32_t last_expression = UINT32_MAX;
+    for (uint32_t i=0; i < program->size; i++) {
+        if (program->statements[i].type == STMT_EXPR && program->statements[i].value != NULL) {
+            last_expression = i;
+        }
+    }
+    for (uint32_t i=0; i < program->size; i++) {
+        if (i == last_expression) {
+            err = compile_expression(compiler, program->statements[i].value);
+            if (err) return err;
+            compiler_emit(compiler, OPCODE_POP);
+            continue;
+        }
+
+        err = compile_statement(compiler, &program->statements[i]);
+        if (err) return err;
+    }
+
+    // end every program with OPCODE_HALT so we can include it in the lookup table
+    // vs. checking ip on every iteration
+    compiler_emit(compiler, OPCODE_HALT);
+    compiler->scopes[compiler->scope_index].instructions = compiler_optimize(compiler, compiler->scopes[compiler->scope_index].instructions, "<main>", NULL, 0);
+
+    return 0;
+}
+
+/* with value set, the value of a trailing expression statement is pushed and popped again, so the caller can take it by removing the pop */
+static int
+compile_block_statement(struct compiler *compiler, const struct block_statement *block, bool value) {
+    int err;
+    for (uint32_t i=0; i < block->size; i++) {
+        const struct statement *stmt = &block->statements[i];
+        if (value && i == block->size - 1 && stmt->type == STMT_EXPR && stmt->value != NULL) {
+            err = compile_expression(compiler, stmt->value);
+            if (err) return err;
+            compiler_emit(compiler, OPCODE_POP);
+            break;
+        }
+
+        err = compile_statement(compiler, stmt);
+        if (err) return err;
+    }
+
+    return 0;
+}
+
+static int
+compile_statement(struct compiler *c, const struct statement *stmt) {
+    int err;
+    switch (stmt->type) {
+        case STMT_EXPR: {
+            // empty expressions, eg in for loops
+            if (stmt->value == NULL) {
+                return 0;
+            }
+
+            err = compile_expression_for_effect(c, stmt->value);
+            if (err) return err;
+        }
+        break;
+
+        case STMT_LET: {
+            struct symbol *s = compiler_define(c, stmt->name.value);
+            if (s == NULL) {
+                return COMPILE_ERR_PREVIOUSLY_DECLARED;
+            }
+
+            if (stmt->value != NULL) {
+                err = compile_expression(c, stmt->value);
+                if (err) return err;
+            } else {
+                // declaration without value
+                // Eg: let foo;
+                compiler_emit(c, OPCODE_NULL);
+            }
+            compiler_emit(c, s->scope == SCOPE_GLOBAL ? OPCODE_SET_GLOBAL : OPCODE_SET_LOCAL, s->index);
+        }
+        break;
+
+        case STMT_RETURN: {
+            // return statements have an optional value expression
+            if (stmt->value == NULL) {
+                return 0;
+            }
+
+            err = compile_expression(c, stmt->value);
+            if (err) return err;
+            if (!compiler_emit_tail_call(c, stmt->value)) {
+                compiler_emit(c, OPCODE_RETURN_VALUE);
+            }
+        }
+        break;
+
+        case STMT_BREAK:
+            // TODO: Validate that we're inside a loop. Or is that the parser's job?
+            if (c->scopes[c->scope_index].loop_value) {
+                compiler_emit(c, OPCODE_NULL);
+            }
+            compiler_emit(c, OPCODE_JUMP, JUMP_PLACEHOLDER_BREAK);
+        break;
+
+        case STMT_CONTINUE:
+            if (c->scopes[c->scope_index].loop_value) {
+                compiler_emit(c, OPCODE_NULL);
+            }
+            compiler_emit(c, OPCODE_JUMP, JUMP_PLACEHOLDER_CONTINUE);
+        break;
+    }
+
+    return 0;
+}
+
+void compiler_change_jump_placeholders(struct compiler* c, uint32_t pos_start, uint32_t pos_end, int32_t placeholder_value, int32_t actual_value) {
+    for (uint32_t p=pos_start; p < pos_end; ) {
+        enum opcode op = c->scopes[c->scope_index].instructions->bytes[p];
+        if ((op == OPCODE_JUMP || op == OPCODE_R_JUMP) && read_uint16(&c->scopes[c->scope_index].instructions->bytes[p+1]) == placeholder_value) {
+            compiler_change_operand(c, p, actual_value);
+        }
+        p += instruction_width(op);
+    }
+}
+
+/* 
+ * Emits a forward jump whose target is not known yet and adds it to the list starting at *list.
+ * Until the list is patched, the operand of every jump in it holds the position of the jump added before it,
+ * or its own position for the first one.
+ */
+static void compiler_add_jump(struct compiler *c, uint32_t *list, enum opcode opcode) {
+    uint32_t pos = compiler_emit(c, opcode, 9999);
+    compiler_change_operand(c, pos, *list == JUMP_LIST_EMPTY ? pos : *list);
+    *list = pos;
+}
+
+/* points all jumps in list to target */
+static void compiler_patch_jumps(struct compiler *c, uint32_t list, uint32_t target) {
+    while (list != JUMP_LIST_EMPTY) {
+        uint32_t previous = read_uint16(&c->scopes[c->scope_index].instructions->bytes[list + 1]);
+        compiler_change_operand(c, list, target);
+        list = previous == list ? JUMP_LIST_EMPTY : previous;
+    }
+}
+
+/* 
+ * Constant folding: evaluates literals, operators applied to constants and calls to pure built-in functions 
+ * with constant arguments at compile time, following the semantics of the VM.
+ * Returns false if the expression has to be evaluated at runtime, which includes operations that result in an error.
+ * The caller owns the resulting object.
+ */
+static bool fold_constant(struct compiler *c, const struct expression *expr, struct object *result);
+
+static bool 
+fold_integer_operation(enum operator operator, int64_t a, int64_t b, struct object *result) {
+    switch (operator) {
+        // wrap around on overflow like the VM does
+        case OP_ADD: *result = make_integer_object((int64_t) ((uint64_t) a + (uint64_t) b)); return true;
+        case OP_SUBTRACT: *result = make_integer_object((int64_t) ((uint64_t) a - (uint64_t) b)); return true;
+        case OP_MULTIPLY: *result = make_integer_object((int64_t) ((uint64_t) a * (uint64_t) b)); return true;
+        case OP_DIVIDE: 
+        case OP_MODULO:
+            // division by zero is reported at runtime
+            if (b == 0 || (a == INT64_MIN && b == -1)) {
+                return false;
+            }
+            *result = make_integer_object(operator == OP_DIVIDE ? a / b : a % b); 
+            return true;
+        case OP_LT: *result = make_boolean_object(a < b); return true;
+        case OP_LTE: *result = make_boolean_object(a <= b); return true;
+        case OP_GT: *result = make_boolean_object(a > b); return true;
+        case OP_GTE: *result = make_boolean_object(a >= b); return true;
+        case OP_EQ: *result = make_boolean_object(a == b); return true;
+        case OP_NOT_EQ: *result = make_boolean_object(a != b); return true;
+        default: return false;
+    }
+}
+
+static bool 
+fold_binary_operation(enum operator operator, struct object left, struct object right, struct object *result) {
+    if (obj_type(left) != obj_type(right)) {
+        return false;
+    }
+
+    switch (obj_type(left)) {
+        case OBJ_INT:
+            return fold_integer_operation(operator, obj_int(left), obj_int(right), result);
+
+        case OBJ_BOOL:
+            switch (operator) {
+                case OP_EQ: *result = make_boolean_object(obj_bool(left) == obj_bool(right)); return true;
+                case OP_NOT_EQ: *result = make_boolean_object(obj_bool(left) != obj_bool(right)); return true;
+                case OP_AND: *result = make_boolean_object(obj_bool(left) && obj_bool(right)); return true;
+                case OP_OR: *result = make_boolean_object(obj_bool(left) || obj_bool(right)); return true;
+                default: return false;
+            }
+
+        case OBJ_STRING:
+            switch (operator) {
+                case OP_ADD: *result = concat_string_objects(obj_string(left), obj_string(right)); return true;
+                case OP_EQ: *result = make_boolean_object(strcmp(obj_string(left)->value, obj_string(right)->value) == 0); return true;
+                case OP_NOT_EQ: *result = make_boolean_object(strcmp(obj_string(left)->value, obj_string(right)->value) != 0); return true;
+                default: return false;
+            }
+
+        default: 
+            return false;
+    }
+}
+
+/* the instruction a call of a built-in function compiles to instead of pushing the function and calling it, or OPCODE_CALL */
+static enum opcode
+intrinsic_for(struct compiler *c, const struct expression *expr) {
+    const struct expression *function = expr->call.function;
+    if (function->type != EXPR_IDENT) {
+        return OPCODE_CALL;
+    }
+
+    struct symbol *s = compiler_resolve(c, function->ident.value);
+    if (s == NULL || s->scope != SCOPE_BUILTIN) {
+        return OPCODE_CALL;
+    }
+    return builtin_intrinsic(s->index, expr->call.arguments.size);
+}
+
+static bool 
+fold_builtin_call(struct compiler *c, const struct expression *expr, struct object *result) {
+    const struct expression *function = expr->call.function;
+    if (function->type != EXPR_IDENT) {
+        return false;
+    }
+
+    struct symbol *s = compiler_resolve(c, function->ident.value);
+    if (s == NULL || s->scope != SCOPE_BUILTIN || !builtin_is_pure(s->index)) {
+        return false;
+    }
+
+    struct object_list *args = make_object_list(expr->call.arguments.size + 1);
+    bool folded = true;
+    for (uint32_t i = 0; i < expr->call.arguments.size && folded; i++) {
+        struct object arg;
+        folded = fold_constant(c, expr->call.arguments.values[i], &arg);
+        if (folded) {
+            append_to_object_list(args, arg);
+        }
+    }
+
+    if (folded) {
+        struct object value = obj_builtin(get_builtin_by_index(s->index))(args->values, args->size);
+        switch (obj_type(value)) {
+            // the built-in may return its argument, which is freed below
+            case OBJ_INT: *result = make_integer_object(obj_int(value)); break;
+            case OBJ_BOOL: 
+            case OBJ_STRING: *result = value; break;
+            default: 
+                free_object(&value);
+                folded = false;
+            break;
+        }
+    }
+
+    free_object_list(args);
+    return folded;
+}
+
+static bool 
+fold_constant(struct compiler *c, const struct expression *expr, struct object *result) {
+    switch (expr->type) {
+        case EXPR_INT:
+            *result = make_integer_object(expr->integer);
+            return true;
+
+        case EXPR_BOOL:
+            *result = make_boolean_object(expr->boolean);
+            return true;
+
+        case EXPR_STRING:
+            *result = make_string_object(expr->string);
+            return true;
+
+        case EXPR_PREFIX: {
+            struct object right;
+            if (!fold_constant(c, expr->prefix.right, &right)) {
+                return false;
+            }
+
+            bool folded = true;
+            enum object_type type = obj_type(right);
+            if (expr->prefix.operator == OP_SUBTRACT && type == OBJ_INT) {
+                *result = make_integer_object((int64_t) -(uint64_t) obj_int(right));
+            } else if (expr->prefix.operator == OP_NEGATE) {
+                *result = make_boolean_object((type == OBJ_BOOL && !obj_bool(right)) || (type == OBJ_INT && obj_int(right) <= 0));
+            } else {
+                folded = false;
+            }
+            free_object(&right);
+            return folded;
+        }
+
+        case EXPR_INFIX: {
+            struct object left, right;
+            if (!fold_constant(c, expr->infix.left, &left)) {
+                return false;
+            }
+            if (!fold_constant(c, expr->infix.right, &right)) {
+                free_object(&left);
+                return false;
+            }
+
+            bool folded = fold_binary_operation(expr->infix.operator, left, right, result);
+            free_object(&left);
+            free_object(&right);
+            return folded;
+        }
+
+        case EXPR_CALL:
+            return fold_builtin_call(c, expr, result);
+
+        default:
+            return false;
+    }
+}
+
+static void 
+compiler_emit_integer(struct compiler *c, int64_t value) {
+    // small integers are stored in the instruction itself
+    if (value >= INT8_MIN && value <= INT8_MAX) {
+        compiler_emit(c, OPCODE_PUSH_INT8, value);
+    } else if (value >= INT16_MIN && value <= INT16_MAX) {
+        compiler_emit(c, OPCODE_PUSH_INT16, value);
+    } else {
+        compiler_emit(c, OPCODE_CONST, add_integer_constant(c, value));
+    }
+}
+
+/* emits the instruction pushing the value of a folded expression and frees it */
+static void 
+compiler_emit_folded(struct compiler *c, struct object value) {
+    switch (obj_type(value)) {
+        case OBJ_INT:
+            compiler_emit_integer(c, obj_int(value));
+        break;
+
+        case OBJ_BOOL:
+            compiler_emit(c, obj_bool(value) ? OPCODE_TRUE : OPCODE_FALSE);
+        break;
+
+        default:
+            compiler_emit(c, OPCODE_CONST, add_string_constant(c, obj_string(value)->value));
+        break;
+    }
+    free_object(&value);
+}
+
+/*
+ * Compiles expr for where it branches to: adds jumps that are taken if expr is jump_if to the list jumps,
+ * otherwise execution continues after the code with nothing left on the stack.
+ * The right operand of && and || only runs if the left operand does not decide the outcome,
+ * in which case it is left to decide on its own, without materialising the boolean in between.
+ * Operands are tested like the condition of an if, anything but false and null is true, so they need not be booleans.
+ */
+static int compile_condition(struct compiler *c, const struct expression *expr, bool jump_if, uint32_t *jumps) {
+    int err;
+    if (expr->type != EXPR_INFIX || (expr->infix.operator != OP_AND && expr->infix.operator != OP_OR)) {
+        err = compile_expression(c, expr);
+        if (err) return err;
+        compiler_add_jump(c, jumps, jump_if ? OPCODE_JUMP_TRUE : OPCODE_JUMP_NOT_TRUE);
+        return 0;
+    }
+
+    // false decides the outcome of &&, true that of ||
+    const bool decides = expr->infix.operator == OP_OR;
+    if (decides == jump_if) {
+        err = compile_condition(c, expr->infix.left, jump_if, jumps);
+        if (err) return err;
+        return compile_condition(c, expr->infix.right, jump_if, jumps);
+    }
+
+    // the left operand deciding means not jumping, so it skips over the right operand
+    uint32_t skip = JUMP_LIST_EMPTY;
+    err = compile_condition(c, expr->infix.left, decides, &skip);
+    if (err) return err;
+    err = compile_condition(c, expr->infix.right, jump_if, jumps);
+    if (err) return err;
+    compiler_patch_jumps(c, skip, compiler_jump_target(c));
+    return 0;
+}
+
+static int compile_infix_expression(struct compiler *c, const struct expression *expr) {
+    int err;
+    if (expr->infix.operator == OP_AND || expr->infix.operator == OP_OR) {
+        uint32_t false_jumps = JUMP_LIST_EMPTY;
+        err = compile_condition(c, expr, false, &false_jumps);
+        if (err) return err;
+
+        compiler_emit(c, OPCODE_TRUE);
+        uint32_t jump_pos = compiler_emit(c, OPCODE_JUMP, 9999);
+        compiler_patch_jumps(c, false_jumps, compiler_jump_target(c));
+        compiler_emit(c, OPCODE_FALSE);
+        compiler_change_operand(c, jump_pos, compiler_jump_target(c));
+        return 0;
+    }
+
+    err = compile_expression(c, expr->infix.left);
+    if (err) return err;
+
+    err = compile_expression(c, expr->infix.right);
+    if (err) return err;
+
+    switch (expr->infix.operator) {
+        case OP_ADD:
+            compiler_emit(c, OPCODE_ADD);
+        break;
+
+        case OP_SUBTRACT:
+            compiler_emit(c, OPCODE_SUBTRACT);
+        break;
+
+        case OP_MULTIPLY:
+            compiler_emit(c, OPCODE_MULTIPLY);
+        break;
+
+        case OP_DIVIDE:
+            compiler_emit(c, OPCODE_DIVIDE);
+        break;
+
+        case OP_MODULO:
+            compiler_emit(c, OPCODE_MODULO);
+        break;
+
+        case OP_GTE:
+            compiler_emit(c, OPCODE_GREATER_THAN_OR_EQUALS);
+        break;
+
+        case OP_GT:
+            compiler_emit(c, OPCODE_GREATER_THAN);
+        break;
+
+        case OP_EQ:
+            compiler_emit(c, OPCODE_EQUAL);
+        break;
+
+        case OP_NOT_EQ:
+            compiler_emit(c, OPCODE_NOT_EQUAL);
+        break;
+
+        case OP_LT:
+            compiler_emit(c, OPCODE_LESS_THAN);
+        break;
+
+        case OP_LTE:
+            compiler_emit(c, OPCODE_LESS_THAN_OR_EQUALS);
+        break;
+
+        default:
+            return COMPILE_ERR_UNKNOWN_OPERATOR;
+        break;
+    }
+
+    return 0;
+}
+
+/*
+ * Loop-invariant code motion
+ *
+ * Before a loop is compiled, expressions in it that compute the same value on every iteration are computed once
+ * and stored in an anonymous variable, which compile_expression() reads instead.
+ * The body may not run at all, so only expressions that can not abort the program are moved out of it:
+ * calls to pure built-ins, which report errors as values. The condition always runs, so unless it has
+ * side effects, operators on invariant operands are moved out of it as well.
+ */
+
+#define MAX_LOOP_ASSIGNMENTS 64
+
+/* what running a loop may change */
+struct loop_effects {
+    const char *assigned[MAX_LOOP_ASSIGNMENTS];
+    uint32_t num_assigned;
+    // assigns more names than fit, nothing is invariant
+    bool overflow;
+    // calls user functions, which may assign globals and change arrays
+    bool calls_functions;
+    // calls built-ins that change their arguments
+    bool mutates_arguments;
+    // assigns variables or calls anything but pure built-ins
+    bool side_effects;
+};
+
+static void loop_effects_of_expression(struct compiler *c, struct loop_effects *e, const struct expression *expr);
+
+static void
+loop_effects_add_assignment(struct loop_effects *e, const char *name) {
+    e->side_effects = true;
+    for (uint32_t i = 0; i < e->num_assigned; i++) {
+        if (strcmp(e->assigned[i], name) == 0) {
+            return;
+        }
+    }
+
+    if (e->num_assigned == MAX_LOOP_ASSIGNMENTS) {
+        e->overflow = true;
+    } else {
+        e->assigned[e->num_assigned++] = name;
+    }
+}
+
+static void
+loop_effects_of_statement(struct compiler *c, struct loop_effects *e, const struct statement *stmt) {
+    if (stmt->type == STMT_LET) {
+        loop_effects_add_assignment(e, stmt->name.value);
+    }
+    if (stmt->value != NULL) {
+        loop_effects_of_expression(c, e, stmt->value);
+    }
+}
+
+static void
+loop_effects_of_block(struct compiler *c, struct loop_effects *e, const struct block_statement *block) {
+    for (uint32_t i = 0; block != NULL && i < block->size; i++) {
+        loop_effects_of_statement(c, e, &block->statements[i]);
+    }
+}
+
+static void
+loop_effects_of_expression(struct compiler *c, struct loop_effects *e, const struct expression *expr) {
+    if (expr == NULL) {
+        return;
+    }
+
+    switch (expr->type) {
+        case EXPR_INFIX:
+            loop_effects_of_expression(c, e, expr->infix.left);
+            loop_effects_of_expression(c, e, expr->infix.right);
+        break;
+
+        case EXPR_PREFIX:
+            loop_effects_of_expression(c, e, expr->prefix.right);
+        break;
+
+        case EXPR_POSTFIX:
+            loop_effects_add_assignment(e, expr->postfix.left->ident.value);
+        break;
+
+        case EXPR_IF:
+            loop_effects_of_expression(c, e, expr->ifelse.condition);
+            loop_effects_of_block(c, e, expr->ifelse.consequence);
+            loop_effects_of_block(c, e, expr->ifelse.alternative);
+        break;
+
+        case EXPR_CALL: {
+            const struct expression *function = expr->call.function;
+            struct symbol *s = function->type == EXPR_IDENT ? compiler_resolve(c, function->ident.value) : NULL;
+            if (s != NULL && s->scope == SCOPE_BUILTIN) {
+                e->mutates_arguments |= builtin_mutates_arguments(s->index);
+                e->side_effects |= !builtin_is_pure(s->index);
+            } else {
+                e->calls_functions = e->side_effects = true;
+            }
+
+            loop_effects_of_expression(c, e, function);
+            for (uint32_t i = 0; i < expr->call.arguments.size; i++) {
+                loop_effects_of_expression(c, e, expr->call.arguments.values[i]);
+            }
+        }
+        break;
+
+        case EXPR_ARRAY:
+            for (uint32_t i = 0; i < expr->array.size; i++) {
+                loop_effects_of_expression(c, e, expr->array.values[i]);
+            }
+        break;
+
+        case EXPR_INDEX:
+            loop_effects_of_expression(c, e, expr->index.left);
+            loop_effects_of_expression(c, e, expr->index.index);
+        break;
+
+        case EXPR_SLICE:
+            loop_effects_of_expression(c, e, expr->slice.left);
+            loop_effects_of_expression(c, e, expr->slice.start);
+            loop_effects_of_expression(c, e, expr->slice.end);
+        break;
+
+        case EXPR_WHILE:
+            loop_effects_of_expression(c, e, expr->while_loop.condition);
+            loop_effects_of_block(c, e, expr->while_loop.body);
+        break;
+
+        case EXPR_FOR:
+            loop_effects_of_statement(c, e, &expr->for_loop.init);
+            loop_effects_of_expression(c, e, expr->for_loop.condition);
+            loop_effects_of_statement(c, e, &expr->for_loop.inc);
+            loop_effects_of_block(c, e, expr->for_loop.body);
+        break;
+
+        case EXPR_ASSIGN:
+            if (expr->assign.left->type == EXPR_IDENT) {
+                loop_effects_add_assignment(e, expr->assign.left->ident.value);
+            } else {
+                // changing an element leaves the length of the array alone
+                e->side_effects = true;
+                loop_effects_of_expression(c, e, expr->assign.left);
+            }
+            loop_effects_of_expression(c, e, expr->assign.value);
+        break;
+
+        // function bodies only run when called, which is accounted for by the call
+        default:
+        break;
+    }
+}
+
+static bool
+is_loop_invariant(struct compiler *c, const struct loop_effects *e, const struct expression *expr) {
+    switch (expr->type) {
+        case EXPR_INT:
+        case EXPR_BOOL:
+        case EXPR_STRING:
+            return true;
+
+        case EXPR_IDENT: {
+            struct symbol *s = compiler_resolve(c, expr->ident.value);
+            if (s == NULL || e->overflow || (s->scope == SCOPE_GLOBAL && e->calls_functions)) {
+                return false;
+            }
+            for (uint32_t i = 0; i < e->num_assigned; i++) {
+                if (strcmp(e->assigned[i], expr->ident.value) == 0) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        case EXPR_PREFIX:
+            return is_loop_invariant(c, e, expr->prefix.right);
+
+        case EXPR_INFIX:
+            return is_loop_invariant(c, e, expr->infix.left) && is_loop_invariant(c, e, expr->infix.right);
+
+        case EXPR_CALL: {
+            // the arguments may be arrays, which change if anything in the loop changes arrays
+            const struct expression *function = expr->call.function;
+            if (e->calls_functions || e->mutates_arguments || function->type != EXPR_IDENT || !is_loop_invariant(c, e, function)) {
+                return false;
+            }
+
+            struct symbol *s = compiler_resolve(c, function->ident.value);
+            if (s->scope != SCOPE_BUILTIN || !builtin_is_pure(s->index)) {
+                return false;
+            }
+            for (uint32_t i = 0; i < expr->call.arguments.size; i++) {
+                if (!is_loop_invariant(c, e, expr->call.arguments.values[i])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        default:
+            return false;
+    }
+}
+
+/* whether evaluating an invariant expression may abort the program, which only operators do */
+static bool
+may_abort(const struct expression *expr) {
+    switch (expr->type) {
+        case EXPR_PREFIX:
+        case EXPR_INFIX:
+            return true;
+
+        case EXPR_CALL:
+            for (uint32_t i = 0; i < expr->call.arguments.size; i++) {
+                if (may_abort(expr->call.arguments.values[i])) {
+                    return true;
+                }
+            }
+            return false;
+
+        default:
+            return false;
+    }
+}
+
+/* whether an invariant expression reads a variable, expressions on constants are folded instead */
+static bool
+reads_variable(const struct expression *expr) {
+    switch (expr->type) {
+        case EXPR_IDENT:
+            return true;
+
+        case EXPR_PREFIX:
+            return reads_variable(expr->prefix.right);
+
+        case EXPR_INFIX:
+            return reads_variable(expr->infix.left) || reads_variable(expr->infix.right);
+
+        case EXPR_CALL:
+            for (uint32_t i = 0; i < expr->call.arguments.size; i++) {
+                if (reads_variable(expr->call.arguments.values[i])) {
+                    return true;
+                }
+            }
+            return false;
+
+        default:
+            return false;
+    }
+}
+
+static int hoist_from_expression(struct compiler *c, const struct loop_effects *e, const struct expression *expr, bool may_abort_first);
+
+static int
+hoist_from_block(struct compiler *c, const struct loop_effects *e, const struct block_statement *block) {
+    for (uint32_t i = 0; block != NULL && i < block->size; i++) {
+        int err = hoist_from_expression(c, e, block->statements[i].value, false);
+        if (err) return err;
+    }
+    return 0;
+}
+
+/*
+ * moves the largest invariant parts of an expression in the loop in front of it
+ * may_abort_first is set if the expression runs before anything else with a visible effect
+ */
+static int
+hoist_from_expression(struct compiler *c, const struct loop_effects *e, const struct expression *expr, bool may_abort_first) {
+    if (expr == NULL || c->num_hoisted == sizeof c->hoisted / sizeof c->hoisted[0]) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < c->num_hoisted; i++) {
+        if (c->hoisted[i].expression == expr) {
+            return 0;
+        }
+    }
+
+    bool is_operation = expr->type == EXPR_INFIX || expr->type == EXPR_PREFIX || expr->type == EXPR_CALL;
+    bool has_room = c->symbol_table->outer == NULL || c->symbol_table->size < UINT8_MAX;
+    if (is_operation && has_room && reads_variable(expr) && (may_abort_first || !may_abort(expr)) && is_loop_invariant(c, e, expr)) {
+        int err = compile_expression(c, expr);
+        if (err) return err;
+
+        struct symbol s = symbol_table_define_anonymous(c->symbol_table);
+        compiler_emit(c, s.scope == SCOPE_GLOBAL ? OPCODE_SET_GLOBAL : OPCODE_SET_LOCAL, s.index);
+        c->hoisted[c->num_hoisted++] = (struct hoisted_expression) { .expression = expr, .symbol = s };
+        return 0;
+    }
+
+    int err = 0;
+    switch (expr->type) {
+        case EXPR_INFIX:
+            err = hoist_from_expression(c, e, expr->infix.left, may_abort_first);
+            if (err) return err;
+            // the right operand of a logical operator does not always run
+            err = hoist_from_expression(c, e, expr->infix.right, may_abort_first && expr->infix.operator != OP_AND && expr->infix.operator != OP_OR);
+        break;
+
+        case EXPR_PREFIX:
+            err = hoist_from_expression(c, e, expr->prefix.right, may_abort_first);
+        break;
+
+        case EXPR_IF:
+            err = hoist_from_expression(c, e, expr->ifelse.condition, false);
+            if (err) return err;
+            err = hoist_from_block(c, e, expr->ifelse.consequence);
+            if (err) return err;
+            err = hoist_from_block(c, e, expr->ifelse.alternative);
+        break;
+
+        case EXPR_CALL:
+            for (uint32_t i = 0; i < expr->call.arguments.size && !err; i++) {
+                err = hoist_from_expression(c, e, expr->call.arguments.values[i], false);
+            }
+        break;
+
+        case EXPR_ARRAY:
+            for (uint32_t i = 0; i < expr->array.size && !err; i++) {
+                err = hoist_from_expression(c, e, expr->array.values[i], false);
+            }
+        break;
+
+        case EXPR_INDEX:
+            err = hoist_from_expression(c, e, expr->index.left, false);
+            if (err) return err;
+            err = hoist_from_expression(c, e, expr->index.index, false);
+        break;
+
+        case EXPR_SLICE:
+            err = hoist_from_expression(c, e, expr->slice.left, false);
+            if (err) return err;
+            err = hoist_from_expression(c, e, expr->slice.start, false);
+            if (err) return err;
+            err = hoist_from_expression(c, e, expr->slice.end, false);
+        break;
+
+        case EXPR_WHILE:
+            err = hoist_from_expression(c, e, expr->while_loop.condition, false);
+            if (err) return err;
+            err = hoist_from_block(c, e, expr->while_loop.body);
+        break;
+
+        case EXPR_FOR:
+            err = hoist_from_expression(c, e, expr->for_loop.init.value, false);
+            if (err) return err;
+            err = hoist_from_expression(c, e, expr->for_loop.condition, false);
+            if (err) return err;
+            err = hoist_from_expression(c, e, expr->for_loop.inc.value, false);
+            if (err) return err;
+            err = hoist_from_block(c, e, expr->for_loop.body);
+        break;
+
+        case EXPR_ASSIGN:
+            if (expr->assign.left->type != EXPR_IDENT) {
+                err = hoist_from_expression(c, e, expr->assign.left, false);
+                if (err) return err;
+            }
+            err = hoist_from_expression(c, e, expr->assign.value, false);
+        break;
+
+        default:
+        break;
+    }
+
+    return err;
+}
+
+/* emits the invariant expressions of a loop, right before the code evaluating its condition for the first time */
+static int
+compile_loop_invariants(struct compiler *c, const struct expression *condition, const struct statement *inc, const struct block_statement *body) {
+    struct loop_effects e = { .num_assigned = 0 };
+    loop_effects_of_expression(c, &e, condition);
+    bool condition_has_side_effects = e.side_effects;
+    if (inc != NULL) {
+        loop_effects_of_statement(c, &e, inc);
+    }
+    loop_effects_of_block(c, &e, body);
+
+    int err = hoist_from_expression(c, &e, condition, !condition_has_side_effects);
+    if (err) return err;
+    if (inc != NULL) {
+        err = hoist_from_expression(c, &e, inc->value, false);
+        if (err) return err;
+    }
+    return hoist_from_block(c, &e, body);
+}
+
+/*
+ * Bounds-check elimination
+ *
+ * In `for (let i = 0; i < len(arr); i++) { ... arr[i] ... }` the condition proves that arr[i] is in bounds
+ * for the whole body, as long as the body changes neither i nor arr and can not make any array shorter.
+ * Such accesses are compiled to instructions that only check that they index an array.
+ * The length may also be read from a local that holds len(arr) throughout the function, see bounding_length().
+ */
+
+static bool
+same_symbol(const struct symbol *a, const struct symbol *b) {
+    return a->scope == b->scope && a->index == b->index;
+}
+
+/* the loop index that bounds indexing arr with index in the code being compiled, if any */
+static const struct bounded_index *
+bounded_index(struct compiler *c, const struct expression *arr, const struct expression *index) {
+    if (arr->type != EXPR_IDENT || index->type != EXPR_IDENT) {
+        return NULL;
+    }
+
+    struct symbol *a = compiler_resolve(c, arr->ident.value);
+    struct symbol *i = compiler_resolve(c, index->ident.value);
+    if (a == NULL || i == NULL) {
+        return NULL;
+    }
+    for (uint32_t b = c->num_bounded; b-- > 0; ) {
+        const struct bounded_index *bounded = &c->bounded[b];
+        if (bounded->scope_index == c->scope_index && same_symbol(&bounded->index, i) && same_symbol(&bounded->array, a)) {
+            return bounded;
+        }
+    }
+    return NULL;
+}
+
+/* whether expr is an integer that can not be negative: a literal, a bounded loop index or sums and products of these */
+static bool
+is_nonnegative_integer(struct compiler *c, const struct expression *expr) {
+    switch (expr->type) {
+        case EXPR_INT:
+            return expr->integer >= 0;
+
+        case EXPR_IDENT: {
+            struct symbol *s = compiler_resolve(c, expr->ident.value);
+            for (uint32_t b = 0; s != NULL && b < c->num_bounded; b++) {
+                if (c->bounded[b].scope_index == c->scope_index && same_symbol(&c->bounded[b].index, s)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        case EXPR_INFIX:
+            return (expr->infix.operator == OP_ADD || expr->infix.operator == OP_MULTIPLY)
+                && is_nonnegative_integer(c, expr->infix.left) && is_nonnegative_integer(c, expr->infix.right);
+
+        default:
+            return false;
+    }
+}
+
+/* the array in a call len(arr) to the built-in, or NULL */
+static const struct expression *
+length_argument(struct compiler *c, const struct expression *expr) {
+    if (expr->type != EXPR_CALL || expr->call.function->type != EXPR_IDENT || expr->call.arguments.size != 1
+        || expr->call.arguments.values[0]->type != EXPR_IDENT || strcmp(expr->call.function->ident.value, "len") != 0) {
+        return NULL;
+    }
+
+    struct symbol *s = compiler_resolve(c, "len");
+    return s != NULL && s->scope == SCOPE_BUILTIN ? expr->call.arguments.values[0] : NULL;
+}
+
+/* whether the function assigns name nowhere except in the statement at index except, which may be -1 */
+static bool
+assigns_name_only_at(const struct block_statement *body, const char *name, int64_t except) {
+    for (uint32_t i = 0; i < body->size; i++) {
+        const struct statement *stmt = &body->statements[i];
+        if ((int64_t) i != except && ((stmt->type == STMT_LET && strcmp(stmt->name.value, name) == 0) || assigns_name(stmt->value, name))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* whether name is a parameter or a local the function assigns once, in a let statement at index *at of its body */
+static bool
+is_assigned_once(const struct expression *function, const char *name, int64_t *at) {
+    const struct block_statement *body = function->function.body;
+    *at = -1;
+    for (uint32_t i = 0; i < body->size; i++) {
+        if (body->statements[i].type == STMT_LET && strcmp(body->statements[i].name.value, name) == 0) {
+            *at = i;
+            break;
+        }
+    }
+    if (*at < 0) {
+        bool is_parameter = false;
+        for (uint32_t i = 0; i < function->function.parameters.size; i++) {
+            is_parameter |= strcmp(function->function.parameters.values[i].value, name) == 0;
+        }
+        if (!is_parameter) {
+            return false;
+        }
+    }
+    return assigns_name_only_at(body, name, *at);
+}
+
+/*
+ * The array whose length the local bound always holds: the function sets it once in `let bound = len(arr)`,
+ * after arr got its only value, and the function calls nothing that could make arr shorter.
+ */
+static const struct expression *
+bounding_length(struct compiler *c, const struct expression *bound) {
+    const struct expression *function = c->scopes[c->scope_index].function;
+    struct symbol *s = compiler_resolve(c, bound->ident.value);
+    if (function == NULL || c->num_inlined > 0 || s == NULL || s->scope != SCOPE_LOCAL) {
+        return NULL;
+    }
+
+    int64_t bound_at, array_at;
+    if (!is_assigned_once(function, bound->ident.value, &bound_at) || bound_at < 0) {
+        return NULL;
+    }
+    const struct expression *arr = length_argument(c, function->function.body->statements[bound_at].value);
+    if (arr == NULL || !is_assigned_once(function, arr->ident.value, &array_at) || array_at >= bound_at) {
+        return NULL;
+    }
+
+    struct loop_effects e = { .num_assigned = 0 };
+    loop_effects_of_block(c, &e, function->function.body);
+    return e.calls_functions || e.mutates_arguments ? NULL : arr;
+}
+
+/*
+ * Marks the index of a for loop as bounded while its body is compiled, if the loop has the form
+ * for (i = <non-negative integer>; i < len(arr); i++) and the body leaves i and arr alone.
+ * The caller removes it again after the body.
+ */
+static void
+bound_loop_index(struct compiler *c, const struct expression *expr) {
+    const struct statement *init = &expr->for_loop.init;
+    const struct expression *condition = expr->for_loop.condition;
+    const struct expression *inc = expr->for_loop.inc.value;
+    if (c->num_bounded == sizeof c->bounded / sizeof c->bounded[0] || condition == NULL || inc == NULL || condition->type != EXPR_INFIX
+        || condition->infix.operator != OP_LT || condition->infix.left->type != EXPR_IDENT) {
+        return;
+    }
+
+    // the index starts at a non-negative integer and only ever goes up by one
+    const char *index = condition->infix.left->ident.value;
+    const struct expression *start = NULL;
+    if (init->type == STMT_LET && strcmp(init->name.value, index) == 0) {
+        start = init->value;
+    } else if (init->type == STMT_EXPR && init->value != NULL && init->value->type == EXPR_ASSIGN
+        && init->value->assign.left->type == EXPR_IDENT && strcmp(init->value->assign.left->ident.value, index) == 0) {
+        start = init->value->assign.value;
+    }
+    bool increments = inc->type == EXPR_POSTFIX && inc->postfix.operator == OP_ADD && strcmp(inc->postfix.left->ident.value, index) == 0;
+    if (start == NULL || !increments || !is_nonnegative_integer(c, start)) {
+        return;
+    }
+
+    const struct expression *bound = condition->infix.right;
+    const struct expression *arr = length_argument(c, bound);
+    if (arr == NULL && bound->type == EXPR_IDENT) {
+        arr = bounding_length(c, bound);
+    }
+    struct symbol *i = compiler_resolve(c, index);
+    struct symbol *a = arr != NULL ? compiler_resolve(c, arr->ident.value) : NULL;
+    if (i == NULL || a == NULL || i->scope == SCOPE_BUILTIN || a->scope == SCOPE_BUILTIN) {
+        return;
+    }
+
+    struct loop_effects e = { .num_assigned = 0 };
+    loop_effects_of_expression(c, &e, condition);
+    loop_effects_of_block(c, &e, expr->for_loop.body);
+    if (e.overflow || e.calls_functions || e.mutates_arguments) {
+        return;
+    }
+    for (uint32_t n = 0; n < e.num_assigned; n++) {
+        if (strcmp(e.assigned[n], index) == 0 || strcmp(e.assigned[n], arr->ident.value) == 0 || (bound->type == EXPR_IDENT && strcmp(e.assigned[n], bound->ident.value) == 0)) {
+            return;
+        }
+    }
+
+    c->bounded[c->num_bounded++] = (struct bounded_index) { .scope_index = c->scope_index, .index = *i, .array = *a };
+}
+
+/*
+ * Statement context
+ *
+ * An expression statement that is not the last statement of its block has a value nobody looks at.
+ * Such expressions are compiled for their effect only, which leaves nothing on the stack: 
+ * assignments and increments do not load the variable again, if expressions without an alternative
+ * do not push null and loops do not keep the value of their last iteration.
+ */
+/* compiles the body of a loop, leaving its value on the stack if the loop has one */
+static int compile_loop_body(struct compiler *c, const struct block_statement *body, bool value, uint32_t *loop_start_pos, uint32_t *loop_end_pos) {
+    struct compiler_scope *scope = &c->scopes[c->scope_index];
+    bool outer_loop_value = scope->loop_value;
+    scope->loop_value = value;
+    *loop_start_pos = scope->instructions->size;
+    int err = compile_block_statement(c, body, value);
+    if (err) return err;
+    *loop_end_pos = c->scopes[c->scope_index].instructions->size;
+    c->scopes[c->scope_index].loop_value = outer_loop_value;
+
+    // leave last item on the stack
+    if (!value) {
+        return 0;
+    }
+    if (compiler_last_instruction_is(c, OPCODE_POP)) {
+        compiler_remove_last_instruction(c);
+    } else {
+        compiler_emit(c, OPCODE_NULL);
+    }
+    return 0;
+}
+
+static int compile_if_expression(struct compiler *c, const struct expression *expr, bool value) {
+    /* we don't know where to jump yet, so the jumps are patched once we do */
+    uint32_t false_jumps = JUMP_LIST_EMPTY;
+    int err = compile_condition(c, expr->ifelse.condition, false, &false_jumps);
+    if (err) return err;
+
+    err = compile_block_statement(c, expr->ifelse.consequence, value);
+    if (err) return err;
+
+    if (value && compiler_last_instruction_is(c, OPCODE_POP)) {
+        compiler_remove_last_instruction(c);
+    }
+
+    if (!value && expr->ifelse.alternative == NULL) {
+        compiler_patch_jumps(c, false_jumps, compiler_jump_target(c));
+        return 0;
+    }
+    
+    uint32_t jump_pos = compiler_emit(c, OPCODE_JUMP, 9999);
+
+    /* now we know actual position to jump to, so change operand */
+    uint32_t after_conseq_pos = compiler_jump_target(c);
+    compiler_patch_jumps(c, false_jumps, after_conseq_pos);
+
+    if (expr->ifelse.alternative) {
+        err = compile_block_statement(c, expr->ifelse.alternative, value);
+        if (err) return err; 
+
+        if (value && compiler_last_instruction_is(c, OPCODE_POP)) {
+            compiler_remove_last_instruction(c);
+        }
+    } else {
+        compiler_emit(c, OPCODE_NULL);
+    }
+
+    /* same story here, replace placeholder position with actual jump to position */
+    uint32_t after_alternative_pos = compiler_jump_target(c);
+    compiler_change_operand(c, jump_pos, after_alternative_pos);
+    return 0;
+}
+
+/*
+ * A loop with a value keeps the value of the last iteration on the stack, starting with null. 
+ * Without one, nothing is left on the stack between iterations.
+ */
+static int compile_while_expression(struct compiler *c, const struct expression *expr, bool value) {
+    uint32_t num_hoisted = c->num_hoisted;
+    int err = compile_loop_invariants(c, expr->while_loop.condition, NULL, expr->while_loop.body);
+    if (err) return err;
+
+    if (value) {
+        compiler_emit(c, OPCODE_NULL);
+    }
+
+    uint32_t before_pos = compiler_jump_target(c);
+
+    /* we don't know where to jump yet, so the jumps are patched once we do */
+    uint32_t false_jumps = JUMP_LIST_EMPTY;
+    err = compile_condition(c, expr->while_loop.condition, false, &false_jumps);
+    if (err) return err;
+
+    // pop null or last value from previous iteration
+    if (value) {
+        compiler_emit(c, OPCODE_POP);
+    }
+
+    uint32_t loop_start_pos, loop_end_pos;
+    err = compile_loop_body(c, expr->while_loop.body, value, &loop_start_pos, &loop_end_pos);
+    if (err) return err;
+
+    /* jump back to beginning to re-evaluate condition */
+    compiler_emit(c, OPCODE_JUMP, before_pos);
+
+    /* now we know actual position to jump to, so change operand */
+    uint32_t after_conseq_pos = compiler_jump_target(c);
+    compiler_patch_jumps(c, false_jumps, after_conseq_pos);
+    compiler_change_jump_placeholders(c, loop_start_pos, loop_end_pos, JUMP_PLACEHOLDER_BREAK, after_conseq_pos);
+    compiler_change_jump_placeholders(c, loop_start_pos, loop_end_pos, JUMP_PLACEHOLDER_CONTINUE, before_pos);
+    c->num_hoisted = num_hoisted;
+    return 0;
+}
+
+static int compile_for_expression(struct compiler *c, const struct expression *expr, bool value) {
+    if (value) {
+        compiler_emit(c, OPCODE_NULL);
+    }
+
+    int err = compile_statement(c, &expr->for_loop.init);
+    if (err) return err;
+
+    uint32_t num_hoisted = c->num_hoisted;
+    err = compile_loop_invariants(c, expr->for_loop.condition, &expr->for_loop.inc, expr->for_loop.body);
+    if (err) return err;
+
+    uint32_t before_pos = compiler_jump_target(c);
+    uint32_t false_jumps = JUMP_LIST_EMPTY;
+
+    if (expr->for_loop.condition != NULL) {
+        /* we don't know where to jump yet, so the jumps are patched once we do */
+        err = compile_condition(c, expr->for_loop.condition, false, &false_jumps);
+        if (err) return err;
+    }
+
+    // pop null or last value from previous iteration
+    if (value) {
+        compiler_emit(c, OPCODE_POP);
+    }
+
+    uint32_t num_bounded = c->num_bounded;
+    bound_loop_index(c, expr);
+    uint32_t loop_start_pos, loop_end_pos;
+    err = compile_loop_body(c, expr->for_loop.body, value, &loop_start_pos, &loop_end_pos);
+    if (err) return err;
+    c->num_bounded = num_bounded;
+
+    // run increment step
+    uint32_t before_inc_pos = compiler_jump_target(c);
+    err = compile_statement(c, &expr->for_loop.inc);
+    if (err) return err;
+
+    /* jump back to beginning to re-evaluate condition */
+    compiler_emit(c, OPCODE_JUMP, before_pos);
+
+    /* now we know actual position to jump to, so change operand */
+    uint32_t after_conseq_pos = compiler_jump_target(c);
+    compiler_patch_jumps(c, false_jumps, after_conseq_pos);
+    compiler_change_jump_placeholders(c, loop_start_pos, loop_end_pos, JUMP_PLACEHOLDER_BREAK, after_conseq_pos);
+    compiler_change_jump_placeholders(c, loop_start_pos, loop_end_pos, JUMP_PLACEHOLDER_CONTINUE, before_inc_pos);
+    c->num_hoisted = num_hoisted;
+    return 0;
+}
+
+static int compile_expression_for_effect(struct compiler *c, const struct expression *expr) {
+    switch (expr->type) {
+        case EXPR_IF:
+            return compile_if_expression(c, expr, false);
+
+        case EXPR_WHILE:
+            return compile_while_expression(c, expr, false);
+
+        case EXPR_FOR:
+            return compile_for_expression(c, expr, false);
+
+        case EXPR_ASSIGN: {
+            struct symbol *s = expr->assign.left->type == EXPR_IDENT ? compiler_resolve(c, expr->assign.left->ident.value) : NULL;
+            if (s == NULL || (s->scope != SCOPE_GLOBAL && s->scope != SCOPE_LOCAL)) {
+                break;
+            }
+
+            int err = compile_expression(c, expr->assign.value);
+            if (err) return err;
+            compiler_emit(c, s->scope == SCOPE_GLOBAL ? OPCODE_SET_GLOBAL : OPCODE_SET_LOCAL, s->index);
+            return 0;
+        }
+
+        case EXPR_POSTFIX: {
+            struct symbol *s = compiler_resolve(c, expr->postfix.left->ident.value);
+            if (s == NULL || (s->scope != SCOPE_GLOBAL && s->scope != SCOPE_LOCAL) || (expr->postfix.operator != OP_ADD && expr->postfix.operator != OP_SUBTRACT)) {
+                break;
+            }
+
+            if (s->scope == SCOPE_LOCAL) {
+                compiler_emit(c, expr->postfix.operator == OP_ADD ? OPCODE_INC_LOCAL : OPCODE_DEC_LOCAL, s->index);
+                return 0;
+            } 
+            if (expr->postfix.operator == OP_ADD) {
+                compiler_emit(c, OPCODE_INC_GLOBAL, s->index);
+                return 0;
+            }
+
+            compiler_emit(c, OPCODE_GET_GLOBAL, s->index);
+            compiler_emit(c, OPCODE_PUSH_INT8, (int64_t) 1);
+            compiler_emit(c, OPCODE_SUBTRACT);
+            compiler_emit(c, OPCODE_SET_GLOBAL, s->index);
+            return 0;
+        }
+
+        default: 
+        break;
+    }
+
+    int err = compile_expression(c, expr);
+    if (err) return err;
+    compiler_emit(c, OPCODE_POP);
+    return 0;
+}
+
+static int
+compile_expression(struct compiler *c, const struct expression *expr) {
+    int err;
+    for (uint32_t i = c->num_hoisted; i-- > 0; ) {
+        if (c->hoisted[i].expression == expr) {
+            compiler_emit(c, c->hoisted[i].symbol.scope == SCOPE_GLOBAL ? OPCODE_GET_GLOBAL : OPCODE_GET_LOCAL, c->hoisted[i].symbol.index);
+            return 0;
+        }
+    }
+
+    struct object folded;
+    if ((expr->type == EXPR_INFIX || expr->type == EXPR_PREFIX || expr->type == EXPR_CALL) && fold_constant(c, expr, &folded)) {
+        compiler_emit_folded(c, folded);
+        return 0;
+    }
+
+    switch (expr->type) {
+        case EXPR_INFIX: {
+            return compile_infix_expression(c, expr);
+        }
+        break;   
+
+        case EXPR_PREFIX: {
+            err = compile_expression(c, expr->prefix.right);
+            if (err) return err;
+
+            switch (expr->prefix.operator) {
+                case OP_NEGATE: 
+                    compiler_emit(c, OPCODE_BANG);
+                break;
+
+                case OP_SUBTRACT: 
+                    compiler_emit(c, OPCODE_MINUS);
+                break;
+
+                default: 
+                    return COMPILE_ERR_UNKNOWN_OPERATOR;
+                break;
+            }   
+        }
+        break;
+
+        case EXPR_POSTFIX: {
+            if (expr->postfix.operator != OP_ADD && expr->postfix.operator != OP_SUBTRACT) {
+                return COMPILE_ERR_UNKNOWN_OPERATOR;
+            }
+
+            struct symbol *s = compiler_resolve(c, expr->postfix.left->ident.value);
+            if (s == NULL) {
+                return COMPILE_ERR_UNKNOWN_IDENT;
+            }
+
+            // load identifier on the stack, this is the value of the expression
+            err = compile_expression(c, expr->postfix.left);
+            if (err) return err;
+
+            // increment or decrement the variable in place
+            if (s->scope == SCOPE_LOCAL) {
+                compiler_emit(c, expr->postfix.operator == OP_ADD ? OPCODE_INC_LOCAL : OPCODE_DEC_LOCAL, s->index);
+                break;
+            } 
+            if (s->scope == SCOPE_GLOBAL && expr->postfix.operator == OP_ADD) {
+                compiler_emit(c, OPCODE_INC_GLOBAL, s->index);
+                break;
+            }
+
+            // load again on the stack, add or subtract 1 and store the result in identifier
+            err = compile_expression(c, expr->postfix.left);
+            if (err) return err;
+            compiler_emit(c, OPCODE_PUSH_INT8, (int64_t) 1);
+            compiler_emit(c, expr->postfix.operator == OP_ADD ? OPCODE_ADD : OPCODE_SUBTRACT);
+            compiler_emit(c, s->scope == SCOPE_GLOBAL ? OPCODE_SET_GLOBAL : OPCODE_SET_LOCAL, s->index);        
+        }
+        break;
+
+        case EXPR_IF:
+            return compile_if_expression(c, expr, true);
+
+        case EXPR_INT: 
+            compiler_emit_integer(c, expr->integer);
+        break;
+
+        case EXPR_BOOL: {
+            if (expr->boolean) {
+                compiler_emit(c, OPCODE_TRUE);
+            } else {
+                compiler_emit(c, OPCODE_FALSE);
+            }
+        }
+        break;
+
+        case EXPR_STRING: {
+            compiler_emit(c, OPCODE_CONST, add_string_constant(c, expr->string));
+        }
+        break;
+
+        case EXPR_IDENT: {
+            struct symbol *s = compiler_resolve(c, expr->ident.value);
+            if (s == NULL) {
+                return COMPILE_ERR_UNKNOWN_IDENT;
+            }
+
+            switch (s->scope) {
+                case SCOPE_GLOBAL:
+                    compiler_emit(c, OPCODE_GET_GLOBAL, s->index);
+                break;
+
+                case SCOPE_LOCAL:
+                    compiler_emit(c, OPCODE_GET_LOCAL, s->index);
+                break;
+
+                case SCOPE_BUILTIN:
+                    compiler_emit(c, OPCODE_GET_BUILTIN, s->index);
+                break;
+            }
+        }
+        break;
+
+        case EXPR_FUNCTION: {
+            compiler_enter_scope(c);
+            c->scopes[c->scope_index].function = expr;
+
+            for (uint32_t i=0; i < expr->function.parameters.size; i++) {
+                symbol_table_define(c->symbol_table, expr->function.parameters.values[i].value);
+            }
+
+            err = compile_block_statement(c, expr->function.body, true);
+            if (err) return err;
+
+            const struct block_statement *body = expr->function.body;
+            if (compiler_last_instruction_is(c, OPCODE_POP)) {
+                // the value of a trailing call expression is returned through a tail call
+                compiler_remove_last_instruction(c);
+                if (!compiler_emit_tail_call(c, body->statements[body->size - 1].value)) {
+                    compiler_emit(c, OPCODE_RETURN_VALUE);
+                }
+            } else if (!compiler_last_instruction_is(c, OPCODE_RETURN_VALUE) && !compiler_last_instruction_is(c, OPCODE_TAIL_CALL)
+                && !compiler_last_instruction_is(c, OPCODE_TAIL_CALL_SELF)) {
+                compiler_emit(c, OPCODE_RETURN);
+            }
+
+            uint32_t num_locals = c->symbol_table->size;
+            struct instruction *ins = compiler_leave_scope(c);
+            const char *name = expr->function.name[0] != '\0' ? expr->function.name : "<anonymous>";
+            ins = compiler_optimize(c, ins, name, &num_locals, expr->function.parameters.size);
+            struct object obj = make_compiled_function_object(ins, num_locals);
+            obj_fn(obj)->max_stack_depth = max_stack_depth(ins);
+            compiler_emit(c, OPCODE_CONST, add_constant(c, obj));
+            free_instruction(ins);
+        }
+        break;
+
+        case EXPR_CALL: {
+            const struct expression *inlined = inline_target(c, expr);
+            if (inlined != NULL) {
+                return compile_inlined_call(c, expr, inlined);
+            }
+
+            enum opcode intrinsic = intrinsic_for(c, expr);
+            if (intrinsic != OPCODE_CALL) {
+                for (uint32_t i = 0; i < expr->call.arguments.size; i++) {
+                    err = compile_expression(c, expr->call.arguments.values[i]);
+                    if (err) return err;
+                }
+                compiler_emit(c, intrinsic);
+                break;
+            }
+
+            // the function calling itself is already known, so it is not pushed
+            bool self = is_self_call(c, expr);
+            if (!self) {
+                err = compile_expression(c, expr->call.function);
+                if (err) return err;
+            }
+
+            uint32_t i = 0;
+            for (; i < expr->call.arguments.size; i++) {
+                err = compile_expression(c, expr->call.arguments.values[i]);
+                if (err) return err;
+            }
+
+            compiler_emit(c, self ? OPCODE_CALL_SELF : OPCODE_CALL, i);
+        }
+        break;
+
+        case EXPR_WHILE:
+            return compile_while_expression(c, expr, true);
+
+        case EXPR_FOR:
+            return compile_for_expression(c, expr, true);
+
+        case EXPR_ARRAY:
+            for (unsigned i=0; i < expr->array.size; i++) {
+                err = compile_expression(c, expr->array.values[i]);
+                if (err) return err;
+            }
+            compiler_emit(c, OPCODE_ARRAY, expr->array.size);
+        break;
+
+        case EXPR_SLICE: {
+            err = compile_expression(c, expr->slice.left); 
+            if (err) return err;
+            
+            if (expr->slice.start != NULL) {
+                err = compile_expression(c, expr->slice.start); 
+                if (err) return err;
+            } else {
+                compiler_emit(c, OPCODE_NULL);
+            }
+
+            if (expr->slice.end != NULL) {
+                err = compile_expression(c, expr->slice.end); 
+                if (err) return err;
+            } else {
+                compiler_emit(c, OPCODE_NULL);
+            }
+            
+            compiler_emit(c, OPCODE_SLICE);
+        }
+        break;
+
+        case EXPR_INDEX: {
+            err = compile_expression(c, expr->index.left);
+            if (err) return err;
+            err = compile_expression(c, expr->index.index);
+            if (err) return err;
+            compiler_emit(c, bounded_index(c, expr->index.left, expr->index.index) != NULL ? OPCODE_INDEX_GET_IN_BOUNDS : OPCODE_INDEX_GET);
+        break;
+        }
+
+        case EXPR_ASSIGN: {
+            if (expr->assign.left->type == EXPR_IDENT) {
+                struct symbol *s = compiler_resolve(c, expr->assign.left->ident.value);
+                if (s == NULL) {
+                    return COMPILE_ERR_UNKNOWN_IDENT;
+                }
+
+                err = compile_expression(c, expr->assign.value);
+                if (err) return err;
+
+                switch (s->scope) {
+                    case SCOPE_GLOBAL:
+                        compiler_emit(c, OPCODE_SET_GLOBAL, s->index);
+                        compiler_emit(c, OPCODE_GET_GLOBAL, s->index);
+                    break;
+
+                    case SCOPE_LOCAL:
+                        compiler_emit(c, OPCODE_SET_LOCAL, s->index);
+                        compiler_emit(c, OPCODE_GET_LOCAL, s->index);
+                    break;
+                    default:
+                        exit(1);
+                        // TODO: emit error, can not redefine built-ins
+                    break;
+                }
+            } else {
+                err = compile_expression(c, expr->assign.left->index.left);
+                if (err) return err;
+                err = compile_expression(c, expr->assign.left->index.index);
+                if (err) return err;
+                err = compile_expression(c, expr->assign.value);
+                if (err) return err;
+                const struct index_expression *index = &expr->assign.left->index;
+                compiler_emit(c, bounded_index(c, index->left, index->index) != NULL ? OPCODE_INDEX_SET_IN_BOUNDS : OPCODE_INDEX_SET);
+            }            
+        }
+        break;
+
+        default:
+            return COMPILE_ERR_UNKNOWN_EXPR_TYPE;
+        break;
+    }
+
+    return 0;
+}
+
+/* net number of objects the stack instruction at ip pushes onto the stack */
+static int32_t stack_effect(const uint8_t *ip) {
+    switch ((enum opcode) *ip) {
+        case OPCODE_CONST:
+        case OPCODE_PUSH_INT8:
+        case OPCODE_PUSH_INT16:
+        case OPCODE_TRUE:
+        case OPCODE_FALSE:
+        case OPCODE_NULL:
+        case OPCODE_GET_GLOBAL:
+        case OPCODE_GET_LOCAL:
+        case OPCODE_GET_BUILTIN:
+        case OPCODE_ADD_LOCAL_CONST:
+        case OPCODE_SUBTRACT_LOCAL_CONST:
+        case OPCODE_LESS_THAN_LOCAL_CONST:
+        case OPCODE_EQUAL_LOCAL_CONST:
+        case OPCODE_ADD_LOCAL_LOCAL:
+        case OPCODE_LESS_THAN_LOCAL_LOCAL:
+        case OPCODE_INDEX_GET_LOCAL_LOCAL:
+        case OPCODE_INDEX_GET_LOCAL_LOCAL_IN_BOUNDS:
+            return 1;
+
+        case OPCODE_INDEX_SET:
+        case OPCODE_INDEX_SET_IN_BOUNDS:
+        case OPCODE_SLICE:
+            return -2;
+
+        case OPCODE_CALL:
+        case OPCODE_CALL_FUNCTION:
+        case OPCODE_CALL_BUILTIN:
+        case OPCODE_TAIL_CALL_SELF:
+            return -(int32_t) read_uint8(ip + 1);
+
+        case OPCODE_TAIL_CALL:
+            return -(int32_t) read_uint8(ip + 1) - 1;
+
+        case OPCODE_CALL_SELF:
+            return 1 - (int32_t) read_uint8(ip + 1);
+
+        case OPCODE_ARRAY:
+            return 1 - (int32_t) read_uint16(ip + 1);
+
+        case OPCODE_JUMP_IF_NOT_EQUAL:
+        case OPCODE_JUMP_IF_EQUAL:
+        case OPCODE_JUMP_IF_NOT_GREATER_THAN:
+        case OPCODE_JUMP_IF_NOT_GREATER_THAN_OR_EQUALS:
+        case OPCODE_JUMP_IF_NOT_LESS_THAN:
+        case OPCODE_JUMP_IF_NOT_LESS_THAN_OR_EQUALS:
+            return -2;
+
+        case OPCODE_MINUS:
+        case OPCODE_BANG:
+        case OPCODE_BOOL_BANG:
+        case OPCODE_LEN:
+        case OPCODE_INT:
+        case OPCODE_ARRAY_POP:
+        case OPCODE_JUMP_IF_NOT_LESS_THAN_LOCAL_CONST:
+        case OPCODE_JUMP_IF_NOT_LESS_THAN_LOCAL_LOCAL:
+        case OPCODE_JUMP_IF_NOT_EQUAL_LOCAL_CONST:
+        case OPCODE_INC_LOCAL:
+        case OPCODE_DEC_LOCAL:
+        case OPCODE_INT_INC_LOCAL:
+        case OPCODE_INT_DEC_LOCAL:
+        case OPCODE_INC_GLOBAL:
+        case OPCODE_JUMP:
+        case OPCODE_RETURN:
+        case OPCODE_HALT:
+            return 0;
+
+        case OPCODE_POP:
+        case OPCODE_ADD:
+        case OPCODE_SUBTRACT:
+        case OPCODE_MULTIPLY:
+        case OPCODE_DIVIDE:
+        case OPCODE_MODULO:
+        case OPCODE_EQUAL:
+        case OPCODE_NOT_EQUAL:
+        case OPCODE_GREATER_THAN:
+        case OPCODE_GREATER_THAN_OR_EQUALS:
+        case OPCODE_LESS_THAN:
+        case OPCODE_LESS_THAN_OR_EQUALS:
+        case OPCODE_AND:
+        case OPCODE_OR:
+        case OPCODE_JUMP_NOT_TRUE:
+        case OPCODE_JUMP_TRUE:
+        case OPCODE_SET_GLOBAL:
+        case OPCODE_SET_LOCAL:
+        case OPCODE_RETURN_VALUE:
+        case OPCODE_INDEX_GET:
+        case OPCODE_INDEX_GET_ARRAY_INT:
+        case OPCODE_INDEX_GET_IN_BOUNDS:
+        case OPCODE_ARRAY_PUSH:
+        case OPCODE_ADD_INT:
+        case OPCODE_SUBTRACT_INT:
+        case OPCODE_MULTIPLY_INT:
+        case OPCODE_DIVIDE_INT:
+        case OPCODE_MODULO_INT:
+        case OPCODE_EQUAL_INT:
+        case OPCODE_NOT_EQUAL_INT:
+        case OPCODE_GREATER_THAN_INT:
+        case OPCODE_GREATER_THAN_OR_EQUALS_INT:
+        case OPCODE_LESS_THAN_INT:
+        case OPCODE_LESS_THAN_OR_EQUALS_INT:
+        case OPCODE_INT_ADD:
+        case OPCODE_INT_SUBTRACT:
+        case OPCODE_INT_MULTIPLY:
+        case OPCODE_INT_EQUAL:
+        case OPCODE_INT_NOT_EQUAL:
+        case OPCODE_INT_GREATER_THAN:
+        case OPCODE_INT_GREATER_THAN_OR_EQUALS:
+        case OPCODE_INT_LESS_THAN:
+        case OPCODE_INT_LESS_THAN_OR_EQUALS:
+        case OPCODE_BOOL_EQUAL:
+        case OPCODE_BOOL_NOT_EQUAL:
+            return -1;
+
+        default:
+            // register instructions do not use the stack, every stack instruction has to be listed above
+            assert(*ip >= OPCODE_R_MOVE);
+            return 0;
+    }
+}
+
+/* 
+ * Computes the maximum number of objects the given stack code keeps on the stack above its locals, 
+ * so that the VM only has to make room for a function once per call instead of checking every push
+ */
+static uint32_t max_stack_depth(const struct instruction *ins) {
+    // stack depth before every instruction, or -1 if not reached (yet)
+    // loops are entered from the top, so every reachable instruction is reached by falling through or a forward jump
+    int32_t *depths = malloc(ins->size * sizeof *depths);
+    assert(depths != NULL);
+    for (uint32_t pos = 0; pos < ins->size; pos++) {
+        depths[pos] = -1;
+    }
+    if (ins->size > 0) {
+        depths[0] = 0;
+    }
+
+    int32_t max = 0;
+    for (uint32_t pos = 0; pos < ins->size; pos += instruction_width(ins->bytes[pos])) {
+        if (depths[pos] < 0) {
+            continue;
+        }
+
+        const uint8_t *ip = &ins->bytes[pos];
+        int32_t depth = depths[pos] + stack_effect(ip);
+
+        // the slow paths of superinstructions push both operands before replacing them with the result
+        bool pushes_operands = (*ip >= OPCODE_ADD_LOCAL_CONST && *ip <= OPCODE_LESS_THAN_LOCAL_LOCAL)
+            || (*ip >= OPCODE_JUMP_IF_NOT_LESS_THAN_LOCAL_CONST && *ip <= OPCODE_JUMP_IF_NOT_EQUAL_LOCAL_CONST);
+        int32_t peak = pushes_operands ? depths[pos] + 2 : depth;
+        // a call of the function itself makes room for the callee below its arguments
+        if (*ip == OPCODE_CALL_SELF) {
+            peak = depths[pos] + 1;
+        }
+        if (peak > max) {
+            max = peak;
+        }
+
+        uint32_t targets[2] = { pos + instruction_width(*ip), UINT32_MAX };
+        switch ((enum opcode) *ip) {
+            case OPCODE_JUMP:
+                targets[0] = read_uint16(ip + 1);
+            break;
+            case OPCODE_JUMP_NOT_TRUE:
+            case OPCODE_JUMP_TRUE:
+                targets[1] = read_uint16(ip + 1);
+            break;
+            case OPCODE_RETURN_VALUE:
+            case OPCODE_RETURN:
+            case OPCODE_TAIL_CALL:
+            case OPCODE_TAIL_CALL_SELF:
+            case OPCODE_HALT:
+                targets[0] = UINT32_MAX;
+            break;
+            default: 
+                if (is_compare_and_branch(*ip)) {
+                    targets[1] = read_uint16(ip + 1);
+                }
+            break;
+        }
+
+        for (uint32_t i = 0; i < 2; i++) {
+            if (targets[i] > pos && targets[i] < ins->size && depths[targets[i]] < depth) {
+                depths[targets[i]] = depth;
+            }
+        }
+    }
+
+    free(depths);
+    return (uint32_t) max;
+}
+
+/*
+ * Peephole optimizer
+ *
+ * Cleans up the stack code of a function or the main program once it is complete: jumps to unconditional jumps
+ * go to their final target directly, branches on a constant condition are resolved, jumps to the next instruction,
+ * unreachable instructions and values that are popped right after being pushed are removed.
+ * The remaining instructions are moved together and all jump targets are remapped.
+ */
+
+struct peephole_instruction {
+    uint32_t position;
+    uint32_t new_position;
+    bool reachable;
+    bool jump_target;
+    bool removed;
+};
+
+/* instructions that push a value without any other effect */
+static bool is_pure_push(const enum opcode opcode) {
+    switch (opcode) {
+        case OPCODE_NULL:
+        case OPCODE_TRUE:
+        case OPCODE_FALSE:
+        case OPCODE_CONST:
+        case OPCODE_PUSH_INT8:
+        case OPCODE_PUSH_INT16:
+        case OPCODE_GET_LOCAL:
+        case OPCODE_GET_GLOBAL:
+        case OPCODE_GET_BUILTIN:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* instructions after which execution never falls through to the next instruction */
+static bool is_block_end(const enum opcode opcode) {
+    switch (opcode) {
+        case OPCODE_JUMP:
+        case OPCODE_RETURN_VALUE:
+        case OPCODE_RETURN:
+        case OPCODE_TAIL_CALL:
+        case OPCODE_TAIL_CALL_SELF:
+        case OPCODE_HALT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* instructions with the position to jump to as their (first) operand */
+static bool is_jump(const enum opcode opcode) {
+    return opcode == OPCODE_JUMP || opcode == OPCODE_JUMP_NOT_TRUE || opcode == OPCODE_JUMP_TRUE || is_compare_and_branch(opcode);
+}
+
+/* follows a chain of unconditional jumps to its final target, giving up on cycles */
+static uint32_t jump_destination(const struct instruction *ins, uint32_t target) {
+    for (uint32_t hops = 0; hops < 16 && target < ins->size && ins->bytes[target] == OPCODE_JUMP; hops++) {
+        target = read_uint16(&ins->bytes[target + 1]);
+    }
+    return target;
+}
+
+/* 
+ * Runs a single pass over the instructions and returns true if anything changed.
+ * Pops are kept if the popped value is observable, which is the case for the main program: 
+ * the REPL shows the last popped value.
+ */
+static bool peephole_pass(struct instruction *ins, const bool keep_pops) {
+    // index of the instruction starting at every position, the end of the code maps to one past the last instruction
+    uint32_t *index = malloc((ins->size + 1) * sizeof *index);
+    struct peephole_instruction *code = malloc((ins->size + 1) * sizeof *code);
+    uint32_t *worklist = malloc((ins->size + 1) * sizeof *worklist);
+    assert(index != NULL && code != NULL && worklist != NULL);
+    for (uint32_t pos = 0; pos <= ins->size; pos++) {
+        index[pos] = UINT32_MAX;
+    }
+
+    uint32_t n = 0;
+    for (uint32_t pos = 0; pos < ins->size; pos += instruction_width(ins->bytes[pos])) {
+        index[pos] = n;
+        code[n++] = (struct peephole_instruction) { .position = pos };
+    }
+    index[ins->size] = n;
+    code[n] = (struct peephole_instruction) { .position = ins->size };
+
+    // leave code with jumps to anything but an instruction (unresolved break or continue) alone
+    bool changed = false;
+    for (uint32_t i = 0; i < n; i++) {
+        uint8_t *ip = &ins->bytes[code[i].position];
+        if (!is_jump(*ip)) {
+            continue;
+        }
+
+        uint32_t target = read_uint16(ip + 1);
+        if (target > ins->size || index[target] == UINT32_MAX) {
+            goto done;
+        }
+
+        uint32_t destination = jump_destination(ins, target);
+        if (destination != target && destination <= ins->size && index[destination] != UINT32_MAX) {
+            ip[1] = (uint8_t) (destination >> 8);
+            ip[2] = (uint8_t) destination;
+            target = destination;
+            changed = true;
+        }
+        code[index[target]].jump_target = true;
+    }
+
+    // branches on a constant condition, unless the branch can be reached from elsewhere
+    for (uint32_t i = 0; i + 1 < n; i++) {
+        uint8_t *next = &ins->bytes[code[i + 1].position];
+        if ((*next != OPCODE_JUMP_NOT_TRUE && *next != OPCODE_JUMP_TRUE) || code[i].removed || code[i + 1].jump_target) {
+            continue;
+        }
+
+        const uint8_t condition = ins->bytes[code[i].position];
+        if (condition != OPCODE_TRUE && condition != OPCODE_FALSE) {
+            continue;
+        }
+        if ((condition == OPCODE_TRUE) == (*next == OPCODE_JUMP_TRUE)) {
+            code[i].removed = true;
+            *next = OPCODE_JUMP;
+        } else {
+            code[i].removed = code[i + 1].removed = true;
+        }
+    }
+
+    // instructions are reachable by falling through from the instruction before them or through a jump
+    uint32_t nworklist = 0;
+    if (n > 0) {
+        code[0].reachable = true;
+        worklist[nworklist++] = 0;
+    }
+    while (nworklist > 0) {
+        uint32_t i = worklist[--nworklist];
+        const uint8_t *ip = &ins->bytes[code[i].position];
+        uint32_t successors[2] = { is_block_end(*ip) ? n : i + 1, n };
+        if (is_jump(*ip)) {
+            successors[1] = index[read_uint16(ip + 1)];
+        }
+
+        for (uint32_t s = 0; s < 2; s++) {
+            if (successors[s] < n && !code[successors[s]].reachable) {
+                code[successors[s]].reachable = true;
+                worklist[nworklist++] = successors[s];
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint8_t *ip = &ins->bytes[code[i].position];
+        if (!code[i].reachable) {
+            code[i].removed = true;
+        }
+        if (code[i].removed) {
+            continue;
+        }
+
+        // a jump to the next instruction only has to pop the condition, if any
+        // compare-and-branch instructions are kept, the comparison can still fail on its operand types
+        if (is_jump(*ip) && !is_compare_and_branch(*ip) && (uint32_t) read_uint16(ip + 1) == code[i + 1].position) {
+            if (*ip == OPCODE_JUMP) {
+                code[i].removed = true;
+            } else {
+                *ip = OPCODE_POP;
+            }
+        }
+    }
+
+    // values that are discarded right away
+    for (uint32_t i = 0; !keep_pops && i + 1 < n; i++) {
+        if (!code[i].removed && !code[i + 1].removed && !code[i + 1].jump_target &&
+            is_pure_push(ins->bytes[code[i].position]) && ins->bytes[code[i + 1].position] == OPCODE_POP) {
+            code[i].removed = code[i + 1].removed = true;
+        }
+    }
+
+    // move the remaining instructions together, jumps to removed instructions go to the instruction after them
+    uint32_t size = 0;
+    for (uint32_t i = 0; i <= n; i++) {
+        code[i].new_position = size;
+        if (i < n && !code[i].removed) {
+            size += instruction_width(ins->bytes[code[i].position]);
+        }
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        if (code[i].removed) {
+            changed = true;
+            continue;
+        }
+
+        uint8_t *ip = &ins->bytes[code[i].position];
+        uint32_t target = UINT32_MAX;
+        if (is_jump(*ip)) {
+            target = code[index[read_uint16(ip + 1)]].new_position;
+        }
+
+        memmove(&ins->bytes[code[i].new_position], ip, instruction_width(*ip));
+        if (target != UINT32_MAX) {
+            ins->bytes[code[i].new_position + 1] = (uint8_t) (target >> 8);
+            ins->bytes[code[i].new_position + 2] = (uint8_t) target;
+        }
+    }
+    ins->size = size;
+
+done:
+    free(worklist);
+    free(code);
+    free(index);
+    return changed;
+}
+
+static uint32_t count_instructions(const struct instruction *ins) {
+    uint32_t n = 0;
+    for (uint32_t pos = 0; pos < ins->size; pos += instruction_width(ins->bytes[pos])) {
+        n++;
+    }
+    return n;
+}
+
+/*
+ * Bytecode generation from the IR
+ *
+ * Emits the nodes that are left after optimization in order, which keeps every object where the stack code expects it.
+ * Everything goes through compiler_emit(), so the result is fused into superinstructions again.
+ */
+static struct instruction *compile_ir(struct compiler *c, const struct ir_function *fn) {
+    uint32_t *block_positions = malloc(fn->num_blocks * sizeof *block_positions);
+    uint32_t *jump_positions = malloc(fn->num_blocks * sizeof *jump_positions);
+    uint32_t *jump_targets = malloc(fn->num_blocks * sizeof *jump_targets);
+    assert(block_positions != NULL && jump_positions != NULL && jump_targets != NULL);
+    uint32_t num_jumps = 0;
+
+    compiler_enter_scope(c);
+    for (uint32_t b = 0; b < fn->num_blocks; b++) {
+        const struct ir_block *block = &fn->blocks[b];
+        block_positions[b] = compiler_jump_target(c);
+
+        for (uint32_t n = block->first; n < block->first + block->count; n++) {
+            const struct ir_node *node = &fn->nodes[n];
+            if (node->removed || node->stack_entry) {
+                continue;
+            }
+
+            switch (node->op) {
+                case OPCODE_PUSH_INT8:
+                case OPCODE_PUSH_INT16:
+                    compiler_emit_integer(c, node->operand);
+                break;
+
+                // every block ends in at most one jump
+                case OPCODE_JUMP:
+                case OPCODE_JUMP_NOT_TRUE:
+                case OPCODE_JUMP_TRUE:
+                    jump_targets[num_jumps] = (uint32_t) node->operand;
+                    jump_positions[num_jumps++] = compiler_emit(c, node->op, (int64_t) 9999);
+                break;
+
+                default:
+                    compiler_emit(c, node->op, node->operand);
+                break;
+            }
+
+            if (node->spill != IR_NONE) {
+                compiler_emit(c, OPCODE_SET_LOCAL, (int64_t) node->spill);
+                compiler_emit(c, OPCODE_GET_LOCAL, (int64_t) node->spill);
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < num_jumps; i++) {
+        compiler_change_operand(c, jump_positions[i], block_positions[jump_targets[i]]);
+    }
+
+    free(jump_targets);
+    free(jump_positions);
+    free(block_positions);
+    return compiler_leave_scope(c);
+}
+
+/*
+ * Optimizes the finished stack code of a function, or of the main program if num_locals is NULL.
+ * With c->optimize set, functions go through the IR, which may also change their number of locals.
+ * Returns the optimized code, which is not necessarily the buffer that was passed in.
+ */
+static struct instruction *compiler_optimize(struct compiler *c, struct instruction *ins, const char *name, uint32_t *num_locals, uint32_t num_parameters) {
+    uint32_t before = count_instructions(ins);
+    uint32_t locals_before = num_locals != NULL ? *num_locals : 0;
+    while (peephole_pass(ins, num_locals == NULL));
+
+    if (c->optimize && num_locals != NULL) {
+        struct ir_function *fn = ir_build(ins, c->constants, *num_locals, num_parameters);
+        if (fn != NULL) {
+            ir_optimize(fn);
+            free_instruction(ins);
+            ins = compile_ir(c, fn);
+            *num_locals = fn->num_locals;
+            ir_free(fn);
+            while (peephole_pass(ins, false));
+        }
+    }
+
+    if (c->optimizer_stats && num_locals != NULL) {
+        fprintf(stderr, "%-24s %6u instructions before, %6u after optimization, %3u locals before, %3u after\n", name, before, count_instructions(ins), locals_before, *num_locals);
+    } else if (c->optimizer_stats) {
+        fprintf(stderr, "%-24s %6u instructions before, %6u after optimization\n", name, before, count_instructions(ins));
+    }
+    return ins;
+}
+
+/*
+ * Register code generator
+ *
+ * Compiles the AST to three-address instructions that read and write frame slots (registers) directly,
+ * so that eg. `a + 1` on a local is a single instruction instead of a push, a push and an add.
+ * Parameters and locals live in the registers below first_temporary, temporaries are allocated above
+ * them in stack order. A call uses the topmost registers, so the callee's frame starts right after them.
+ * The main program leaves the value of its last expression statement in register 0, see vm_run_registers().
+ */
+
+static uint32_t register_alloc(struct compiler *c) {
+    struct compiler_scope *scope = &c->scopes[c->scope_index];
+    uint32_t reg = scope->free_register++;
+    if (scope->free_register > scope->num_registers) {
+        scope->num_registers = scope->free_register;
+    }
+    return reg;
+}
+
+static uint32_t register_top(struct compiler *c) {
+    return c->scopes[c->scope_index].free_register;
+}
+
+/* releases all registers from reg upwards */
+static void register_free(struct compiler *c, uint32_t reg) {
+    c->scopes[c->scope_index].free_register = reg;
+}
+
+/* destination of an if expression or loop whose value is not used, so it only writes the locals it assigns */
+#define REGISTER_DISCARD UINT32_MAX
+
+/* patches the target of the (conditional) jump at pos, which is always its last operand */
+static void compiler_change_register_jump(struct compiler *c, uint32_t pos, uint16_t target) {
+    uint8_t *bytes = c->scopes[c->scope_index].instructions->bytes;
+    uint32_t end = pos + instruction_width(bytes[pos]);
+    bytes[end - 2] = (uint8_t) (target >> 8);
+    bytes[end - 1] = (uint8_t) target;
+}
+
+static uint32_t count_block_locals(const struct block_statement *block);
+
+/* number of let statements in an expression, excluding those in nested functions */
+static uint32_t count_expression_locals(const struct expression *expr) {
+    if (expr == NULL) {
+        return 0;
+    }
+
+    uint32_t n = 0;
+    switch (expr->type) {
+        case EXPR_INFIX:
+            return count_expression_locals(expr->infix.left) + count_expression_locals(expr->infix.right);
+        case EXPR_PREFIX:
+            return count_expression_locals(expr->prefix.right);
+        case EXPR_IF:
+            n = count_expression_locals(expr->ifelse.condition) + count_block_locals(expr->ifelse.consequence);
+            return expr->ifelse.alternative ? n + count_block_locals(expr->ifelse.alternative) : n;
+        case EXPR_CALL:
+            n = count_expression_locals(expr->call.function);
+            for (uint32_t i=0; i < expr->call.arguments.size; i++) {
+                n += count_expression_locals(expr->call.arguments.values[i]);
+            }
+            return n;
+        case EXPR_ARRAY:
+            for (uint32_t i=0; i < expr->array.size; i++) {
+                n += count_expression_locals(expr->array.values[i]);
+            }
+            return n;
+        case EXPR_INDEX:
+            return count_expression_locals(expr->index.left) + count_expression_locals(expr->index.index);
+        case EXPR_SLICE:
+            return count_expression_locals(expr->slice.left) + count_expression_locals(expr->slice.start) + count_expression_locals(expr->slice.end);
+        case EXPR_WHILE:
+            return count_expression_locals(expr->while_loop.condition) + count_block_locals(expr->while_loop.body);
+        case EXPR_FOR:
+            return (expr->for_loop.init.type == STMT_LET) + count_expression_locals(expr->for_loop.init.value) 
+                + count_expression_locals(expr->for_loop.condition) 
+                + (expr->for_loop.inc.type == STMT_LET) + count_expression_locals(expr->for_loop.inc.value) 
+                + count_block_locals(expr->for_loop.body);
+        case EXPR_ASSIGN:
+            return count_expression_locals(expr->assign.left) + count_expression_locals(expr->assign.value);
+        default:
+            return 0;
+    }
+}
+
+static uint32_t count_block_locals(const struct block_statement *block) {
+    uint32_t n = 0;
+    for (uint32_t i=0; i < block->size; i++) {
+        n += (block->statements[i].type == STMT_LET) + count_expression_locals(block->statements[i].value);
+    }
+    return n;
+}
+
+/* whether evaluating expr may assign to a local, so that operands evaluated before it can not stay in their register */
+static bool may_assign_locals(const struct expression *expr) {
+    if (expr == NULL) {
+        return false;
+    }
+
+    switch (expr->type) {
+        case EXPR_INFIX:
+            return may_assign_locals(expr->infix.left) || may_assign_locals(expr->infix.right);
+        case EXPR_PREFIX:
+            return may_assign_locals(expr->prefix.right);
+        case EXPR_CALL:
+            for (uint32_t i=0; i < expr->call.arguments.size; i++) {
+                if (may_assign_locals(expr->call.arguments.values[i])) {
+                    return true;
+                }
+            }
+            return may_assign_locals(expr->call.function);
+        case EXPR_ARRAY:
+            for (uint32_t i=0; i < expr->array.size; i++) {
+                if (may_assign_locals(expr->array.values[i])) {
+                    return true;
+                }
+            }
+            return false;
+        case EXPR_INDEX:
+            return may_assign_locals(expr->index.left) || may_assign_locals(expr->index.index);
+        case EXPR_SLICE:
+            return may_assign_locals(expr->slice.left) || may_assign_locals(expr->slice.start) || may_assign_locals(expr->slice.end);
+        case EXPR_POSTFIX:
+        case EXPR_ASSIGN:
+        case EXPR_IF:
+        case EXPR_WHILE:
+        case EXPR_FOR:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* 
+ * Returns the register holding the value of expr in reg: the register of a local, 
+ * or a newly allocated temporary that the expression is compiled into 
+ */
+static int compile_register_operand(struct compiler *c, const struct expression *expr, uint32_t *reg) {
+    if (expr->type == EXPR_IDENT) {
+        struct symbol *s = symbol_table_resolve(c->symbol_table, expr->ident.value);
+        if (s != NULL && s->scope == SCOPE_LOCAL) {
+            *reg = s->index;
+            return 0;
+        }
+    }
+
+    *reg = register_alloc(c);
+    return compile_register_expression(c, expr, *reg);
+}
+
+/* like compile_register_operand, but always copies the value if a later operand could assign to its local */
+static int compile_register_operand_before(struct compiler *c, const struct expression *expr, uint32_t *reg, bool copy) {
+    if (copy) {
+        *reg = register_alloc(c);
+        return compile_register_expression(c, expr, *reg);
+    }
+
+    return compile_register_operand(c, expr, reg);
+}
+
+/* compiles expr into the register of a local, going through a temporary for expressions that write their result early */
+static int compile_register_store(struct compiler *c, const struct expression *expr, uint32_t reg) {
+    switch (expr->type) {
+        case EXPR_POSTFIX:
+        case EXPR_WHILE:
+        case EXPR_FOR: {
+            uint32_t tmp = register_alloc(c);
+            int err = compile_register_expression(c, expr, tmp);
+            if (err) return err;
+            compiler_emit(c, OPCODE_R_MOVE, reg, tmp);
+            register_free(c, tmp);
+            return 0;
+        }
+
+        default:
+            return compile_register_expression(c, expr, reg);
+    }
+}
+
+/* compiles all statements in block, leaving the value of its last expression statement (or null) in dest */
+static int compile_register_block(struct compiler *c, const struct block_statement *block, uint32_t dest) {
+    int err;
+    if (dest == REGISTER_DISCARD) {
+        for (uint32_t i=0; i < block->size; i++) {
+            err = compile_register_statement(c, &block->statements[i]);
+            if (err) return err;
+        }
+        return 0;
+    }
+
+    for (uint32_t i=0; i + 1 < block->size; i++) {
+        err = compile_register_statement(c, &block->statements[i]);
+        if (err) return err;
+    }
+
+    if (block->size > 0) {
+        const struct statement *last = &block->statements[block->size - 1];
+        if (last->type == STMT_EXPR && last->value != NULL) {
+            return compile_register_expression(c, last->value, dest);
+        }
+
+        err = compile_register_statement(c, last);
+        if (err) return err;
+    }
+
+    compiler_emit(c, OPCODE_R_NULL, dest);
+    return 0;
+}
+
+/* returns the value of expr, through a tail call if it is a call expression (see compiler_emit_tail_call) */
+static int compile_register_return(struct compiler *c, const struct expression *expr) {
+    uint32_t reg;
+    int err = compile_register_operand(c, expr, &reg);
+    if (err) return err;
+
+    // the call was made in place, so its function register is the operand register
+    if (c->scope_index > 0 && expr->type == EXPR_CALL && compiler_last_instruction_is(c, OPCODE_R_CALL)) {
+        compiler_replace_last_instruction(c, make_instruction(OPCODE_R_TAIL_CALL, reg, expr->call.arguments.size));
+    } else {
+        compiler_emit(c, OPCODE_R_RETURN_VALUE, reg);
+    }
+    return 0;
 }
 
-int
-compile_program(struct compiler *compiler, const struct program *program) {
+static int compile_register_function_body(struct compiler *c, const struct block_statement *body) {
     int err;
-    for (uint32_t i=0; i < program->size; i++) {
-        err = compile_statement(compiler, &program->statements[i]);
+    for (uint32_t i=0; i + 1 < body->size; i++) {
+        err = compile_register_statement(c, &body->statements[i]);
         if (err) return err;
     }
 
-    // end every program with OPCODE_HALT so we can include it in the lookup table
-    // vs. checking ip on every iteration
-    compiler_emit(compiler, OPCODE_HALT);
+    if (body->size > 0) {
+        const struct statement *last = &body->statements[body->size - 1];
+
+        // implicit return of the last expression
+        if (last->type == STMT_EXPR && last->value != NULL) {
+            return compile_register_return(c, last->value);
+        }
+
+        err = compile_register_statement(c, last);
+        if (err) return err;
+        if (last->type == STMT_RETURN && last->value != NULL) {
+            return 0;
+        }
+    }
 
+    compiler_emit(c, OPCODE_R_RETURN);
     return 0;
 }
 
 static int
-compile_block_statement(struct compiler *compiler, const struct block_statement *block) {
+compile_register_program(struct compiler *c, const struct program *program) {
     int err;
-    for (uint32_t i=0; i < block->size; i++) {
-        err = compile_statement(compiler, &block->statements[i]);
+    for (uint32_t i=0; i < program->size; i++) {
+        err = compile_register_statement(c, &program->statements[i]);
         if (err) return err;
     }
+    compiler_emit(c, OPCODE_HALT);
 
-    return 0;
+    // register 0 holds the result of the program, even if it has no expression statements
+    struct compiler_scope *scope = &c->scopes[c->scope_index];
+    if (scope->num_registers == 0) {
+        scope->num_registers = 1;
+    }
+    return scope->num_registers > MAX_REGISTERS ? COMPILE_ERR_TOO_MANY_REGISTERS : 0;
 }
 
 static int
-compile_statement(struct compiler *c, const struct statement *stmt) {
+compile_register_statement(struct compiler *c, const struct statement *stmt) {
     int err;
     switch (stmt->type) {
         case STMT_EXPR: {
@@ -209,10 +3240,26 @@ compile_statement(struct compiler *c, const struct statement *stmt) {
                 return 0;
             }
 
-            err = compile_expression(c, stmt->value);
-            if (err) return err;
+            // the value is discarded, so assignments to a local only need to write the local itself
+            const struct expression *target = stmt->value->type == EXPR_ASSIGN ? stmt->value->assign.left 
+                : stmt->value->type == EXPR_POSTFIX ? stmt->value->postfix.left : NULL;
+            if (target != NULL && target->type == EXPR_IDENT) {
+                struct symbol *s = symbol_table_resolve(c->symbol_table, target->ident.value);
+                if (s != NULL && s->scope == SCOPE_LOCAL) {
+                    return compile_register_expression(c, stmt->value, s->index);
+                }
+            }
 
-            compiler_emit(c, OPCODE_POP);
+            // the main program keeps the value of every expression statement as its result
+            enum expression_type type = stmt->value->type;
+            if (c->scope_index > 0 && (type == EXPR_IF || type == EXPR_WHILE || type == EXPR_FOR)) {
+                return compile_register_expression(c, stmt->value, REGISTER_DISCARD);
+            }
+
+            uint32_t reg = register_alloc(c);
+            err = compile_register_expression(c, stmt->value, reg);
+            if (err) return err;
+            register_free(c, reg);
         }
         break;
 
@@ -222,15 +3269,19 @@ compile_statement(struct compiler *c, const struct statement *stmt) {
                 return COMPILE_ERR_PREVIOUSLY_DECLARED;
             }
 
+            // locals are assigned directly, globals go through a temporary
+            uint32_t reg = s->scope == SCOPE_GLOBAL ? register_alloc(c) : s->index;
             if (stmt->value != NULL) {
-                err = compile_expression(c, stmt->value);
+                err = compile_register_store(c, stmt->value, reg);
                 if (err) return err;
             } else {
-                // declaration without value
-                // Eg: let foo;
-                compiler_emit(c, OPCODE_NULL);
+                compiler_emit(c, OPCODE_R_NULL, reg);
+            }
+
+            if (s->scope == SCOPE_GLOBAL) {
+                compiler_emit(c, OPCODE_R_SET_GLOBAL, s->index, reg);
+                register_free(c, reg);
             }
-            compiler_emit(c, s->scope == SCOPE_GLOBAL ? OPCODE_SET_GLOBAL : OPCODE_SET_LOCAL, s->index);
         }
         break;
 
@@ -240,125 +3291,222 @@ compile_statement(struct compiler *c, const struct statement *stmt) {
                 return 0;
             }
 
-            err = compile_expression(c, stmt->value);
+            uint32_t top = register_top(c);
+            err = compile_register_return(c, stmt->value);
             if (err) return err;
-            compiler_emit(c, OPCODE_RETURN_VALUE);
+            register_free(c, top);
         }
         break;
 
         case STMT_BREAK:
-            // TODO: Validate that we're inside a loop. Or is that the parser's job?
-            compiler_emit(c, OPCODE_NULL);
-            compiler_emit(c, OPCODE_JUMP, JUMP_PLACEHOLDER_BREAK);
+            if (c->scopes[c->scope_index].loop_register != REGISTER_DISCARD) {
+                compiler_emit(c, OPCODE_R_NULL, c->scopes[c->scope_index].loop_register);
+            }
+            compiler_emit(c, OPCODE_R_JUMP, JUMP_PLACEHOLDER_BREAK);
         break;
 
         case STMT_CONTINUE:
-            compiler_emit(c, OPCODE_NULL);
-            compiler_emit(c, OPCODE_JUMP, JUMP_PLACEHOLDER_CONTINUE);
+            if (c->scopes[c->scope_index].loop_register != REGISTER_DISCARD) {
+                compiler_emit(c, OPCODE_R_NULL, c->scopes[c->scope_index].loop_register);
+            }
+            compiler_emit(c, OPCODE_R_JUMP, JUMP_PLACEHOLDER_CONTINUE);
         break;
     }
 
     return 0;
 }
 
-void compiler_change_jump_placeholders(struct compiler* c, uint32_t pos_start, uint32_t pos_end, int32_t placeholder_value, int32_t actual_value) {
-    for (uint32_t p=pos_start; p < pos_end; ) {
-        enum opcode op = c->scopes[c->scope_index].instructions->bytes[p];
-        if (op == OPCODE_JUMP && read_uint16(&c->scopes[c->scope_index].instructions->bytes[p+1]) == placeholder_value) {
-            compiler_change_operand(c, p, actual_value);
-        }
-        p += 1 + lookup(op).operand_widths[0];
+static enum opcode register_opcode_for(enum operator operator) {
+    switch (operator) {
+        case OP_ADD: return OPCODE_R_ADD;
+        case OP_SUBTRACT: return OPCODE_R_SUBTRACT;
+        case OP_MULTIPLY: return OPCODE_R_MULTIPLY;
+        case OP_DIVIDE: return OPCODE_R_DIVIDE;
+        case OP_MODULO: return OPCODE_R_MODULO;
+        case OP_GTE: return OPCODE_R_GREATER_THAN_OR_EQUALS;
+        case OP_GT: return OPCODE_R_GREATER_THAN;
+        case OP_EQ: return OPCODE_R_EQUAL;
+        case OP_NOT_EQ: return OPCODE_R_NOT_EQUAL;
+        case OP_LT: return OPCODE_R_LESS_THAN;
+        case OP_LTE: return OPCODE_R_LESS_THAN_OR_EQUALS;
+        default: return OPCODE_HALT;
     }
 }
 
-static int compile_infix_expression(struct compiler *c, const struct expression *expr) {
-    int err = compile_expression(c, expr->infix.left);
-    if (err) return err;
-
-    err = compile_expression(c, expr->infix.right);
-    if (err) return err;
+/* variant of a register instruction that takes its right operand from the constants, or the instruction itself */
+static enum opcode register_const_opcode_for(enum opcode opcode) {
+    switch (opcode) {
+        case OPCODE_R_ADD: return OPCODE_R_ADD_CONST;
+        case OPCODE_R_SUBTRACT: return OPCODE_R_SUBTRACT_CONST;
+        case OPCODE_R_LESS_THAN: return OPCODE_R_LESS_THAN_CONST;
+        case OPCODE_R_EQUAL: return OPCODE_R_EQUAL_CONST;
+        case OPCODE_R_JUMP_IF_NOT_LESS_THAN: return OPCODE_R_JUMP_IF_NOT_LESS_THAN_CONST;
+        case OPCODE_R_JUMP_IF_NOT_EQUAL: return OPCODE_R_JUMP_IF_NOT_EQUAL_CONST;
+        default: return opcode;
+    }
+}
 
-    switch (expr->infix.operator) {
-        case OP_ADD:
-            compiler_emit(c, OPCODE_ADD);
-        break;
+/* compare-and-branch instruction for a comparison, which jumps if the comparison is false, or OPCODE_HALT for other operators */
+static enum opcode register_branch_opcode_for(enum operator operator) {
+    switch (operator) {
+        case OP_EQ: return OPCODE_R_JUMP_IF_NOT_EQUAL;
+        case OP_NOT_EQ: return OPCODE_R_JUMP_IF_EQUAL;
+        case OP_GT: return OPCODE_R_JUMP_IF_NOT_GREATER_THAN;
+        case OP_GTE: return OPCODE_R_JUMP_IF_NOT_GREATER_THAN_OR_EQUALS;
+        case OP_LT: return OPCODE_R_JUMP_IF_NOT_LESS_THAN;
+        case OP_LTE: return OPCODE_R_JUMP_IF_NOT_LESS_THAN_OR_EQUALS;
+        default: return OPCODE_HALT;
+    }
+}
 
-        case OP_SUBTRACT:
-            compiler_emit(c, OPCODE_SUBTRACT);
-        break;
+/* 
+ * Compiles a condition followed by a jump that is taken if it is not true, returning the position of the jump in jump_pos
+ * Comparisons are fused with the jump, so loops and ifs do not store the result of their condition in a register
+ */
+static int compile_register_condition(struct compiler *c, const struct expression *expr, uint32_t *jump_pos) {
+    uint32_t top = register_top(c);
+    uint32_t b, rc;
+    int err;
+    enum opcode opcode = expr->type == EXPR_INFIX ? register_branch_opcode_for(expr->infix.operator) : OPCODE_HALT;
 
-        case OP_MULTIPLY:
-            compiler_emit(c, OPCODE_MULTIPLY);
-        break;
+    /* we don't know where to jump yet, so we use 9999 as placeholder */
+    if (opcode == OPCODE_HALT) {
+        err = compile_register_operand(c, expr, &b);
+        if (err) return err;
+        *jump_pos = compiler_emit(c, OPCODE_R_JUMP_NOT_TRUE, b, 9999);
+        register_free(c, top);
+        return 0;
+    }
 
-        case OP_DIVIDE:
-            compiler_emit(c, OPCODE_DIVIDE);
-        break;
+    const struct expression *right = expr->infix.right;
+    err = compile_register_operand_before(c, expr->infix.left, &b, may_assign_locals(right));
+    if (err) return err;
 
-        case OP_MODULO:
-            compiler_emit(c, OPCODE_MODULO);
-        break;
+    enum opcode const_opcode = register_const_opcode_for(opcode);
+    if (const_opcode != opcode && (right->type == EXPR_INT || right->type == EXPR_STRING)) {
+        uint32_t constant = right->type == EXPR_INT ? add_integer_constant(c, right->integer) : add_string_constant(c, right->string);
+        *jump_pos = compiler_emit(c, const_opcode, b, constant, 9999);
+    } else {
+        err = compile_register_operand(c, right, &rc);
+        if (err) return err;
+        *jump_pos = compiler_emit(c, opcode, b, rc, 9999);
+    }
 
-        case OP_GTE:
-            compiler_emit(c, OPCODE_GREATER_THAN_OR_EQUALS);
-        break;
+    register_free(c, top);
+    return 0;
+}
 
-        case OP_GT:
-            compiler_emit(c, OPCODE_GREATER_THAN);
-        break;
+/* && and ||, which only evaluate their right operand if the left operand does not decide the outcome */
+static int compile_register_logical_expression(struct compiler *c, const struct expression *expr, uint32_t dest) {
+    uint32_t top = register_top(c);
+    uint32_t left, right;
+    int err = compile_register_operand(c, expr->infix.left, &left);
+    if (err) return err;
+    register_free(c, top);
+
+    /* we don't know where to jump yet, so we use 9999 as placeholder */
+    uint32_t jump_left_pos = compiler_emit(c, OPCODE_R_JUMP_NOT_TRUE, left, 9999);
+    uint32_t jump_true_pos = 0;
+    if (expr->infix.operator == OP_OR) {
+        jump_true_pos = compiler_emit(c, OPCODE_R_JUMP, 9999);
+        compiler_change_register_jump(c, jump_left_pos, compiler_jump_target(c));
+    }
 
-        case OP_EQ:
-            compiler_emit(c, OPCODE_EQUAL);
-        break;
+    err = compile_register_operand(c, expr->infix.right, &right);
+    if (err) return err;
+    register_free(c, top);
+    uint32_t jump_right_pos = compiler_emit(c, OPCODE_R_JUMP_NOT_TRUE, right, 9999);
 
-        case OP_NOT_EQ:
-            compiler_emit(c, OPCODE_NOT_EQUAL);
-        break;
+    if (expr->infix.operator == OP_OR) {
+        compiler_change_register_jump(c, jump_true_pos, compiler_jump_target(c));
+    }
+    compiler_emit(c, OPCODE_R_TRUE, dest);
+    uint32_t jump_pos = compiler_emit(c, OPCODE_R_JUMP, 9999);
 
-        case OP_LT:
-            compiler_emit(c, OPCODE_LESS_THAN);
-        break;
+    uint32_t false_pos = compiler_jump_target(c);
+    if (expr->infix.operator == OP_AND) {
+        compiler_change_register_jump(c, jump_left_pos, false_pos);
+    }
+    compiler_change_register_jump(c, jump_right_pos, false_pos);
+    compiler_emit(c, OPCODE_R_FALSE, dest);
+    compiler_change_register_jump(c, jump_pos, compiler_jump_target(c));
+    return 0;
+}
 
-        case OP_LTE:
-            compiler_emit(c, OPCODE_LESS_THAN_OR_EQUALS);
-        break;
+static int compile_register_infix_expression(struct compiler *c, const struct expression *expr, uint32_t dest) {
+    if (expr->infix.operator == OP_AND || expr->infix.operator == OP_OR) {
+        return compile_register_logical_expression(c, expr, dest);
+    }
 
-        case OP_AND:
-            compiler_emit(c, OPCODE_AND);
-        break;
+    enum opcode opcode = register_opcode_for(expr->infix.operator);
+    if (opcode == OPCODE_HALT) {
+        return COMPILE_ERR_UNKNOWN_OPERATOR;
+    }
 
-        case OP_OR:
-            compiler_emit(c, OPCODE_OR);
-        break;
+    const struct expression *right = expr->infix.right;
+    uint32_t top = register_top(c);
+    uint32_t b, rc;
+    int err = compile_register_operand_before(c, expr->infix.left, &b, may_assign_locals(right));
+    if (err) return err;
 
-        default:
-            return COMPILE_ERR_UNKNOWN_OPERATOR;
-        break;
+    enum opcode const_opcode = register_const_opcode_for(opcode);
+    if (const_opcode != opcode && (right->type == EXPR_INT || right->type == EXPR_STRING)) {
+        uint32_t constant = right->type == EXPR_INT ? add_integer_constant(c, right->integer) : add_string_constant(c, right->string);
+        compiler_emit(c, const_opcode, dest, b, constant);
+    } else {
+        err = compile_register_operand(c, right, &rc);
+        if (err) return err;
+        compiler_emit(c, opcode, dest, b, rc);
     }
 
+    register_free(c, top);
+    return 0;
+}
+
+static int compile_register_loop_body(struct compiler *c, const struct block_statement *body, uint32_t dest, uint32_t *loop_start_pos, uint32_t *loop_end_pos) {
+    struct compiler_scope *scope = &c->scopes[c->scope_index];
+    uint32_t outer_loop_register = scope->loop_register;
+    scope->loop_register = dest;
+    *loop_start_pos = scope->instructions->size;
+    int err = compile_register_block(c, body, dest);
+    if (err) return err;
+    *loop_end_pos = c->scopes[c->scope_index].instructions->size;
+    c->scopes[c->scope_index].loop_register = outer_loop_register;
     return 0;
 }
 
 static int
-compile_expression(struct compiler *c, const struct expression *expr) {
+compile_register_expression(struct compiler *c, const struct expression *expr, uint32_t dest) {
     int err;
-    switch (expr->type) {
-        case EXPR_INFIX: {
-            return compile_infix_expression(c, expr);
+    uint32_t top = register_top(c);
+    struct object folded;
+    if ((expr->type == EXPR_INFIX || expr->type == EXPR_PREFIX || expr->type == EXPR_CALL) && fold_constant(c, expr, &folded)) {
+        switch (obj_type(folded)) {
+            case OBJ_INT: compiler_emit(c, OPCODE_R_CONST, dest, add_integer_constant(c, obj_int(folded))); break;
+            case OBJ_BOOL: compiler_emit(c, obj_bool(folded) ? OPCODE_R_TRUE : OPCODE_R_FALSE, dest); break;
+            default: compiler_emit(c, OPCODE_R_CONST, dest, add_string_constant(c, obj_string(folded)->value)); break;
         }
-        break;   
+        free_object(&folded);
+        return 0;
+    }
+
+    switch (expr->type) {
+        case EXPR_INFIX: 
+            return compile_register_infix_expression(c, expr, dest);
+        break;
 
         case EXPR_PREFIX: {
-            err = compile_expression(c, expr->prefix.right);
+            uint32_t b;
+            err = compile_register_operand(c, expr->prefix.right, &b);
             if (err) return err;
 
             switch (expr->prefix.operator) {
                 case OP_NEGATE: 
-                    compiler_emit(c, OPCODE_BANG);
+                    compiler_emit(c, OPCODE_R_BANG, dest, b);
                 break;
 
                 case OP_SUBTRACT: 
-                    compiler_emit(c, OPCODE_MINUS);
+                    compiler_emit(c, OPCODE_R_MINUS, dest, b);
                 break;
 
                 default: 
@@ -369,96 +3517,80 @@ compile_expression(struct compiler *c, const struct expression *expr) {
         break;
 
         case EXPR_POSTFIX: {
-            // load identifier on the stack
-            err = compile_expression(c, expr->postfix.left);
-            if (err) return err;
-
-            // load again on the stack
-            err = compile_expression(c, expr->postfix.left);
-            if (err) return err;
-
-            // load 1 on the stack
-            compiler_emit(c, OPCODE_CONST, add_constant(c, make_integer_object(1)));
+            struct symbol *s = symbol_table_resolve(c->symbol_table, expr->postfix.left->ident.value);
+            if (s == NULL || s->scope == SCOPE_BUILTIN) {
+                return COMPILE_ERR_UNKNOWN_IDENT;
+            }
 
+            enum opcode opcode;
             switch (expr->postfix.operator) {
                 case OP_ADD: 
-                    compiler_emit(c, OPCODE_ADD);
+                    opcode = OPCODE_R_ADD_CONST;
                 break;
 
                 case OP_SUBTRACT: 
-                    compiler_emit(c, OPCODE_SUBTRACT);
+                    opcode = OPCODE_R_SUBTRACT_CONST;
                 break;
 
                 default: 
                     return COMPILE_ERR_UNKNOWN_OPERATOR;
                 break;
-            }   
+            }
 
-            // store result in identifier
-            struct symbol *s = symbol_table_resolve(c->symbol_table, expr->postfix.left->ident.value);
-            if (s == NULL) {
-                return COMPILE_ERR_UNKNOWN_IDENT;
+            // the expression evaluates to the value before incrementing or decrementing
+            uint32_t one = add_integer_constant(c, 1);
+            if (s->scope == SCOPE_LOCAL) {
+                if (s->index != dest) {
+                    compiler_emit(c, OPCODE_R_MOVE, dest, s->index);
+                }
+                compiler_emit(c, opcode, s->index, s->index, one);
+            } else {
+                uint32_t tmp = register_alloc(c);
+                compiler_emit(c, OPCODE_R_GET_GLOBAL, dest, s->index);
+                compiler_emit(c, opcode, tmp, dest, one);
+                compiler_emit(c, OPCODE_R_SET_GLOBAL, s->index, tmp);
             }
-            compiler_emit(c, s->scope == SCOPE_GLOBAL ? OPCODE_SET_GLOBAL : OPCODE_SET_LOCAL, s->index);        
         }
         break;
 
         case EXPR_IF: {
-            err = compile_expression(c, expr->ifelse.condition);
+            uint32_t jump_if_not_true_pos;
+            err = compile_register_condition(c, expr->ifelse.condition, &jump_if_not_true_pos);
             if (err) return err;
 
-            /* we don't know where to jump yet, so we use 9999 as placeholder */
-            uint32_t jump_if_not_true_pos = compiler_emit(c, OPCODE_JUMP_NOT_TRUE, 9999);
-
-            err = compile_block_statement(c, expr->ifelse.consequence);
-            if (err) { return err; }
+            err = compile_register_block(c, expr->ifelse.consequence, dest);
+            if (err) return err;
 
-            if (compiler_last_instruction_is(c, OPCODE_POP)) {
-                compiler_remove_last_instruction(c);
+            // without an alternative there is nothing to jump over if the value is not used
+            if (dest == REGISTER_DISCARD && !expr->ifelse.alternative) {
+                compiler_change_register_jump(c, jump_if_not_true_pos, compiler_jump_target(c));
+                break;
             }
-            
-            uint32_t jump_pos = compiler_emit(c, OPCODE_JUMP, 9999);
 
-            /* now we know actual position to jump to, so change operand */
-            uint32_t after_conseq_pos = c->scopes[c->scope_index].instructions->size;
-            compiler_change_operand(c, jump_if_not_true_pos, after_conseq_pos);
+            uint32_t jump_pos = compiler_emit(c, OPCODE_R_JUMP, 9999);
+            compiler_change_register_jump(c, jump_if_not_true_pos, compiler_jump_target(c));
 
             if (expr->ifelse.alternative) {
-                err = compile_block_statement(c, expr->ifelse.alternative);
+                err = compile_register_block(c, expr->ifelse.alternative, dest);
                 if (err) return err; 
-
-                if (compiler_last_instruction_is(c, OPCODE_POP)) {
-                    compiler_remove_last_instruction(c);
-                }
             } else {
-                compiler_emit(c, OPCODE_NULL);
+                compiler_emit(c, OPCODE_R_NULL, dest);
             }
 
-            /* same story here, replace placeholder position with actual jump to position */
-            uint32_t after_alternative_pos = c->scopes[c->scope_index].instructions->size;
-            compiler_change_operand(c, jump_pos, after_alternative_pos);
+            compiler_change_register_jump(c, jump_pos, compiler_jump_target(c));
         }
         break;
 
-        case EXPR_INT: {
-            struct object obj = make_integer_object(expr->integer);
-            compiler_emit(c,  OPCODE_CONST, add_constant(c, obj));
-            break;
-        }
+        case EXPR_INT: 
+            compiler_emit(c, OPCODE_R_CONST, dest, add_integer_constant(c, expr->integer));
+        break;
 
-        case EXPR_BOOL: {
-            if (expr->boolean) {
-                compiler_emit(c, OPCODE_TRUE);
-            } else {
-                compiler_emit(c, OPCODE_FALSE);
-            }
-        }
+        case EXPR_BOOL: 
+            compiler_emit(c, expr->boolean ? OPCODE_R_TRUE : OPCODE_R_FALSE, dest);
         break;
 
-        case EXPR_STRING: {
-            struct object obj = make_string_object(expr->string);
-            compiler_emit(c, OPCODE_CONST, add_constant(c, obj));
-        }
+        case EXPR_STRING: 
+            compiler_emit(c, OPCODE_R_CONST, dest, add_string_constant(c, expr->string));
         break;
 
         case EXPR_IDENT: {
@@ -469,15 +3601,17 @@ compile_expression(struct compiler *c, const struct expression *expr) {
 
             switch (s->scope) {
                 case SCOPE_GLOBAL:
-                    compiler_emit(c, OPCODE_GET_GLOBAL, s->index);
+                    compiler_emit(c, OPCODE_R_GET_GLOBAL, dest, s->index);
                 break;
 
                 case SCOPE_LOCAL:
-                    compiler_emit(c, OPCODE_GET_LOCAL, s->index);
+                    if (s->index != dest) {
+                        compiler_emit(c, OPCODE_R_MOVE, dest, s->index);
+                    }
                 break;
 
                 case SCOPE_BUILTIN:
-                    compiler_emit(c, OPCODE_GET_BUILTIN, s->index);
+                    compiler_emit(c, OPCODE_R_GET_BUILTIN, dest, s->index);
                 break;
             }
         }
@@ -486,200 +3620,172 @@ compile_expression(struct compiler *c, const struct expression *expr) {
         case EXPR_FUNCTION: {
             compiler_enter_scope(c);
 
+            // reserve a register for every parameter and local before allocating any temporaries
+            struct compiler_scope *scope = &c->scopes[c->scope_index];
+            scope->first_temporary = scope->free_register = scope->num_registers = expr->function.parameters.size + count_block_locals(expr->function.body);
+
             for (uint32_t i=0; i < expr->function.parameters.size; i++) {
                 symbol_table_define(c->symbol_table, expr->function.parameters.values[i].value);
             }
 
-            err = compile_block_statement(c, expr->function.body);
+            err = compile_register_function_body(c, expr->function.body);
             if (err) return err;
 
-            if (compiler_last_instruction_is(c, OPCODE_POP)) {
-                compiler_replace_last_instruction(c, make_instruction(OPCODE_RETURN_VALUE));
-            } else if (!compiler_last_instruction_is(c, OPCODE_RETURN_VALUE)) {
-                compiler_emit(c, OPCODE_RETURN);
-            }
-
-            uint32_t num_locals = c->symbol_table->size;
+            uint32_t num_registers = c->scopes[c->scope_index].num_registers;
             struct instruction *ins = compiler_leave_scope(c);
-            struct object obj = make_compiled_function_object(ins, num_locals);
-            compiler_emit(c, OPCODE_CONST, add_constant(c, obj));
+            struct object obj = make_compiled_function_object(ins, num_registers);
+            compiler_emit(c, OPCODE_R_CONST, dest, add_constant(c, obj));
             free_instruction(ins);
+            if (num_registers > MAX_REGISTERS) {
+                return COMPILE_ERR_TOO_MANY_REGISTERS;
+            }
         }
         break;
 
         case EXPR_CALL: {
-            err = compile_expression(c, expr->call.function);
+            // the function goes into the topmost register, followed by its arguments which become the callee's first registers
+            const struct compiler_scope *scope = &c->scopes[c->scope_index];
+            uint32_t base = dest + 1 == top && dest >= scope->first_temporary ? dest : register_alloc(c);
+            err = compile_register_expression(c, expr->call.function, base);
             if (err) return err;
 
             uint32_t i = 0;
             for (; i < expr->call.arguments.size; i++) {
-                err = compile_expression(c, expr->call.arguments.values[i]);
+                err = compile_register_expression(c, expr->call.arguments.values[i], register_alloc(c));
                 if (err) return err;
             }
 
-            compiler_emit(c, OPCODE_CALL, i);
+            compiler_emit(c, OPCODE_R_CALL, base, i);
+            if (base != dest) {
+                compiler_emit(c, OPCODE_R_MOVE, dest, base);
+            }
         }
         break;
 
         case EXPR_WHILE: {
-            compiler_emit(c, OPCODE_NULL);
-
-            uint32_t before_pos = c->scopes[c->scope_index].instructions->size;
+            if (dest != REGISTER_DISCARD) {
+                compiler_emit(c, OPCODE_R_NULL, dest);
+            }
+            uint32_t before_pos = compiler_jump_target(c);
 
-            err = compile_expression(c, expr->while_loop.condition);
+            uint32_t jump_if_not_true_pos;
+            err = compile_register_condition(c, expr->while_loop.condition, &jump_if_not_true_pos);
             if (err) return err;
 
-            /* we don't know where to jump yet, so we use 9999 as placeholder */
-            uint32_t jump_if_not_true_pos = compiler_emit(c, OPCODE_JUMP_NOT_TRUE, 9999);
-
-            // pop null or last value from previous iteration
-            compiler_emit(c, OPCODE_POP);
-
-            uint32_t loop_start_pos = c->scopes[c->scope_index].instructions->size;
-            err = compile_block_statement(c, expr->while_loop.body);
-            if (err) { return err; }
-            uint32_t loop_end_pos = c->scopes[c->scope_index].instructions->size;
-
-            // leave last item on the stack
-            if (compiler_last_instruction_is(c, OPCODE_POP)) {
-                compiler_remove_last_instruction(c);
-            } else {
-                compiler_emit(c, OPCODE_NULL);
-            }
+            uint32_t loop_start_pos, loop_end_pos;
+            err = compile_register_loop_body(c, expr->while_loop.body, dest, &loop_start_pos, &loop_end_pos);
+            if (err) return err;
 
             /* jump back to beginning to re-evaluate condition */
-            compiler_emit(c, OPCODE_JUMP, before_pos);
+            compiler_emit(c, OPCODE_R_JUMP, before_pos);
 
-            /* now we know actual position to jump to, so change operand */
-            uint32_t after_conseq_pos = c->scopes[c->scope_index].instructions->size;
-            compiler_change_operand(c, jump_if_not_true_pos, after_conseq_pos);
+            uint32_t after_conseq_pos = compiler_jump_target(c);
+            compiler_change_register_jump(c, jump_if_not_true_pos, after_conseq_pos);
             compiler_change_jump_placeholders(c, loop_start_pos, loop_end_pos, JUMP_PLACEHOLDER_BREAK, after_conseq_pos);
             compiler_change_jump_placeholders(c, loop_start_pos, loop_end_pos, JUMP_PLACEHOLDER_CONTINUE, before_pos);
         }
         break;
 
-         case EXPR_FOR: {
-            compiler_emit(c, OPCODE_NULL);
+        case EXPR_FOR: {
+            if (dest != REGISTER_DISCARD) {
+                compiler_emit(c, OPCODE_R_NULL, dest);
+            }
 
-            err = compile_statement(c, &expr->for_loop.init);
+            err = compile_register_statement(c, &expr->for_loop.init);
             if (err) return err;
 
-            uint32_t before_pos = c->scopes[c->scope_index].instructions->size;
+            uint32_t before_pos = compiler_jump_target(c);
             uint32_t jump_if_not_true_pos = 0;
-
             if (expr->for_loop.condition != NULL) {
-                err = compile_expression(c, expr->for_loop.condition);
+                err = compile_register_condition(c, expr->for_loop.condition, &jump_if_not_true_pos);
                 if (err) return err;
-           
-                /* we don't know where to jump yet, so we use 9999 as placeholder */
-                jump_if_not_true_pos = compiler_emit(c, OPCODE_JUMP_NOT_TRUE, 9999);
-             }
-
-            // pop null or last value from previous iteration
-            compiler_emit(c, OPCODE_POP);
-
-            uint32_t loop_start_pos = c->scopes[c->scope_index].instructions->size;
-            err = compile_block_statement(c, expr->for_loop.body);
-            if (err) { return err; }
-            uint32_t loop_end_pos = c->scopes[c->scope_index].instructions->size;
-
-            // leave last item on the stack
-            if (compiler_last_instruction_is(c, OPCODE_POP)) {
-                compiler_remove_last_instruction(c);
-            } else {
-                compiler_emit(c, OPCODE_NULL);
             }
 
+            uint32_t loop_start_pos, loop_end_pos;
+            err = compile_register_loop_body(c, expr->for_loop.body, dest, &loop_start_pos, &loop_end_pos);
+            if (err) return err;
+
             // run increment step
-            uint32_t before_inc_pos = c->scopes[c->scope_index].instructions->size;
-            err = compile_statement(c, &expr->for_loop.inc);
+            uint32_t before_inc_pos = compiler_jump_target(c);
+            err = compile_register_statement(c, &expr->for_loop.inc);
             if (err) return err;
 
             /* jump back to beginning to re-evaluate condition */
-            compiler_emit(c, OPCODE_JUMP, before_pos);
+            compiler_emit(c, OPCODE_R_JUMP, before_pos);
 
-            /* now we know actual position to jump to, so change operand */
-            uint32_t after_conseq_pos = c->scopes[c->scope_index].instructions->size;
+            uint32_t after_conseq_pos = compiler_jump_target(c);
             if (expr->for_loop.condition != NULL) {
-                compiler_change_operand(c, jump_if_not_true_pos, after_conseq_pos);
+                compiler_change_register_jump(c, jump_if_not_true_pos, after_conseq_pos);
             }
             compiler_change_jump_placeholders(c, loop_start_pos, loop_end_pos, JUMP_PLACEHOLDER_BREAK, after_conseq_pos);
             compiler_change_jump_placeholders(c, loop_start_pos, loop_end_pos, JUMP_PLACEHOLDER_CONTINUE, before_inc_pos);
         }
         break;
 
-        case EXPR_ARRAY:
-            for (unsigned i=0; i < expr->array.size; i++) {
-                err = compile_expression(c, expr->array.values[i]);
+        case EXPR_ARRAY: 
+            for (uint32_t i=0; i < expr->array.size; i++) {
+                err = compile_register_expression(c, expr->array.values[i], register_alloc(c));
                 if (err) return err;
             }
-            compiler_emit(c, OPCODE_ARRAY, expr->array.size);
+            compiler_emit(c, OPCODE_R_ARRAY, dest, top, expr->array.size);
         break;
 
         case EXPR_SLICE: {
-            err = compile_expression(c, expr->slice.left); 
-            if (err) return err;
-            
-            if (expr->slice.start != NULL) {
-                err = compile_expression(c, expr->slice.start); 
-                if (err) return err;
-            } else {
-                compiler_emit(c, OPCODE_NULL);
-            }
+            // left, start and end go into consecutive registers
+            const struct expression *operands[] = { expr->slice.left, expr->slice.start, expr->slice.end };
+            for (uint32_t i=0; i < 3; i++) {
+                uint32_t reg = register_alloc(c);
+                if (operands[i] == NULL) {
+                    compiler_emit(c, OPCODE_R_NULL, reg);
+                    continue;
+                }
 
-            if (expr->slice.end != NULL) {
-                err = compile_expression(c, expr->slice.end); 
+                err = compile_register_expression(c, operands[i], reg);
                 if (err) return err;
-            } else {
-                compiler_emit(c, OPCODE_NULL);
             }
-            
-            compiler_emit(c, OPCODE_SLICE);
+            compiler_emit(c, OPCODE_R_SLICE, dest, top);
         }
         break;
 
         case EXPR_INDEX: {
-            err = compile_expression(c, expr->index.left);
+            uint32_t left, index;
+            err = compile_register_operand_before(c, expr->index.left, &left, may_assign_locals(expr->index.index));
             if (err) return err;
-            err = compile_expression(c, expr->index.index);
+            err = compile_register_operand(c, expr->index.index, &index);
             if (err) return err;
-            compiler_emit(c, OPCODE_INDEX_GET);
-        break;
+            compiler_emit(c, OPCODE_R_INDEX_GET, dest, left, index);
         }
+        break;
 
         case EXPR_ASSIGN: {
             if (expr->assign.left->type == EXPR_IDENT) {
                 struct symbol *s = symbol_table_resolve(c->symbol_table, expr->assign.left->ident.value);
-                if (s == NULL) {
+                if (s == NULL || s->scope == SCOPE_BUILTIN) {
                     return COMPILE_ERR_UNKNOWN_IDENT;
                 }
 
-                err = compile_expression(c, expr->assign.value);
-                if (err) return err;
-
-                switch (s->scope) {
-                    case SCOPE_GLOBAL:
-                        compiler_emit(c, OPCODE_SET_GLOBAL, s->index);
-                        compiler_emit(c, OPCODE_GET_GLOBAL, s->index);
-                    break;
-
-                    case SCOPE_LOCAL:
-                        compiler_emit(c, OPCODE_SET_LOCAL, s->index);
-                        compiler_emit(c, OPCODE_GET_LOCAL, s->index);
-                    break;
-                    default:
-                        exit(1);
-                        // TODO: emit error, can not redefine built-ins
-                    break;
+                if (s->scope == SCOPE_GLOBAL) {
+                    err = compile_register_expression(c, expr->assign.value, dest);
+                    if (err) return err;
+                    compiler_emit(c, OPCODE_R_SET_GLOBAL, s->index, dest);
+                } else {
+                    err = compile_register_store(c, expr->assign.value, s->index);
+                    if (err) return err;
+                    if (s->index != dest) {
+                        compiler_emit(c, OPCODE_R_MOVE, dest, s->index);
+                    }
                 }
             } else {
-                err = compile_expression(c, expr->assign.left->index.left);
+                const struct expression *index = expr->assign.left->index.index;
+                const struct expression *value = expr->assign.value;
+                uint32_t left, key, reg;
+                err = compile_register_operand_before(c, expr->assign.left->index.left, &left, may_assign_locals(index) || may_assign_locals(value));
                 if (err) return err;
-                err = compile_expression(c, expr->assign.left->index.index);
+                err = compile_register_operand_before(c, index, &key, may_assign_locals(value));
                 if (err) return err;
-                err = compile_expression(c, expr->assign.value);
+                err = compile_register_operand(c, value, &reg);
                 if (err) return err;
-                compiler_emit(c, OPCODE_INDEX_SET);    
+                compiler_emit(c, OPCODE_R_INDEX_SET, dest, left, key, reg);
             }            
         }
         break;
@@ -689,6 +3795,7 @@ compile_expression(struct compiler *c, const struct expression *expr) {
         break;
     }
 
+    register_free(c, top);
     return 0;
 }
 
@@ -699,6 +3806,9 @@ get_bytecode(struct compiler *c) {
     assert(b != NULL);
     b->instructions = compiler_current_instructions(c);
     b->constants = c->constants; // pointer, no copy
+    b->num_registers = c->registers ? c->scopes[0].num_registers : 0;
+    b->max_stack_depth = c->registers ? 0 : max_stack_depth(b->instructions);
+    b->num_globals = c->symbol_table->size;
     return b;
 }
 
@@ -710,6 +3820,11 @@ void compiler_enter_scope(struct compiler *c) {
     scope.instructions->bytes = calloc(scope.instructions->cap, sizeof *scope.instructions->bytes);
     assert(scope.instructions->bytes != NULL);
     scope.instructions->size = 0;
+    scope.last_jump_target = 0;
+    scope.last_instruction = scope.previous_instruction = (struct emitted_instruction) { .opcode = OPCODE_HALT, .position = 0 };
+    scope.first_temporary = scope.free_register = scope.num_registers = scope.loop_register = 0;
+    scope.loop_value = true;
+    scope.function = NULL;
     c->scopes[++c->scope_index] = scope;
     c->symbol_table = symbol_table_new_enclosed(c->symbol_table);
 }
@@ -13,13 +13,89 @@ struct compiler_scope {
     struct instruction *instructions;
     struct emitted_instruction last_instruction;
     struct emitted_instruction previous_instruction;
+
+    // position of the last instruction that is the target of a jump
+    // instructions before this position can not be fused with the instructions after it
+    uint32_t last_jump_target;
+
+    // register allocation for register code: parameters and locals occupy the registers below first_temporary,
+    // temporaries are allocated above them in stack order
+    uint32_t first_temporary;
+    uint32_t free_register;
+    uint32_t num_registers;
+
+    // register receiving the value of the innermost loop, cleared by break and continue
+    uint32_t loop_register;
+
+    // whether the innermost loop keeps a value on the stack, which break and continue set to null
+    bool loop_value;
+
+    // function literal this scope compiles, NULL for the main program
+    const struct expression *function;
+};
+
+// an expression moved out of the loop being compiled, its value is read from an anonymous variable instead
+struct hoisted_expression {
+    const struct expression *expression;
+    struct symbol symbol;
+};
+
+// an index variable that stays within the bounds of an array while the body of the loop it counts runs
+struct bounded_index {
+    uint32_t scope_index;
+    struct symbol index;
+    struct symbol array;
+};
+
+// a call to a small global function that is compiled by compiling the body of the function in its place
+struct inlined_call {
+    const struct expression *function;
+    // the parameters and locals of the function, which are anonymous variables of the caller
+    const char *names[16];
+    struct symbol symbols[16];
+    uint32_t num_symbols;
 };
 
 struct compiler {
     struct object_list *constants;
+
+    // open addressing hash index over the integer and string constants, so that every distinct value is only stored once
+    // slots hold the index of a constant plus one, 0 marks an empty slot
+    uint32_t *constant_index;
+    uint32_t constant_index_cap;
+    uint32_t constant_index_size;
+
     struct symbol_table *symbol_table;
     uint32_t scope_index;
     struct compiler_scope scopes[64];
+
+    // loop-invariant expressions of the loops that are being compiled
+    struct hoisted_expression hoisted[64];
+    uint32_t num_hoisted;
+
+    // index variables of the loops that are being compiled, accessing their array with them needs no bounds check
+    struct bounded_index bounded[16];
+    uint32_t num_bounded;
+
+    // functions bound by let statements of the program whose name is never assigned again, see compile_program()
+    // only known if the whole program is compiled at once, later programs in the REPL could assign a new function
+    // small ones are inlined, calls to the name from within the function itself call the function running in the frame
+    bool inline_functions;
+    const struct statement *bound_functions[64];
+    uint32_t num_bound_functions;
+    const struct statement *inline_candidates[32];
+    uint32_t num_inline_candidates;
+    struct inlined_call inlined[4];
+    uint32_t num_inlined;
+
+    // emit register code for vm_run_registers() instead of stack code for vm_run()
+    bool registers;
+
+    // inline small functions and optimize functions through the SSA intermediate representation, see ir.c
+    bool optimize;
+
+    // print the number of instructions and locals of every function before and after optimization to stderr
+    bool optimizer_stats;
 };
 
 struct compiler *compiler_new(void);
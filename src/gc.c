@@ -5,7 +5,7 @@
 
 void 
 gc_add(struct vm* restrict vm, struct object obj) {
-    if (obj.type <= OBJ_BUILTIN) {
+    if (!obj_is_heap_allocated(obj)) {
         return;
     }
 
@@ -15,19 +15,27 @@ gc_add(struct vm* restrict vm, struct object obj) {
 
 void 
 gc_mark(struct object* obj, bool marked) {
-    switch (obj->type) {
+    switch (obj_type(*obj)) {
         case OBJ_STRING:
-            obj->value.string->gc_meta.marked = marked;
+            obj_string(*obj)->gc_meta.marked = marked;
         break;
 
         case OBJ_COMPILED_FUNCTION:
-            obj->value.fn_compiled->gc_meta.marked = marked;
+            obj_fn(*obj)->gc_meta.marked = marked;
         break;
 
         case OBJ_ARRAY:
-            obj->value.list->gc_meta.marked = marked;
+            obj_list(*obj)->gc_meta.marked = marked;
         break;
 
+        #ifdef TAGGED_OBJECTS
+        case OBJ_INT:
+            if (obj_is_boxed_integer(*obj)) {
+                ((struct boxed_integer*) object_payload(*obj))->gc_meta.marked = marked;
+            }
+        break;
+        #endif
+
         default: break;
     }
 }
@@ -38,18 +46,27 @@ gc_sweep(struct object_list* heap) {
     for (int32_t i = heap->size - 1; i >= 0; i--) {
         bool marked = false;
         struct object* obj = &heap->values[i];
-        switch (obj->type) {
+        switch (obj_type(*obj)) {
             case OBJ_STRING:
-                marked = obj->value.string->gc_meta.marked;
+                marked = obj_string(*obj)->gc_meta.marked;
             break;
 
             case OBJ_COMPILED_FUNCTION:
-                marked = obj->value.fn_compiled->gc_meta.marked;
+                marked = obj_fn(*obj)->gc_meta.marked;
             break;
 
             case OBJ_ARRAY:
-                marked = obj->value.list->gc_meta.marked;
+                marked = obj_list(*obj)->gc_meta.marked;
+            break;
+
+            #ifdef TAGGED_OBJECTS
+            case OBJ_INT:
+                if (!obj_is_boxed_integer(*obj)) {
+                    continue;
+                }
+                marked = ((struct boxed_integer*) object_payload(*obj))->gc_meta.marked;
             break;
+            #endif
 
             default: 
                 // skip stack allocated objects and built-in functions
@@ -89,7 +106,7 @@ gc(struct vm* restrict vm)
     for (uint32_t i=0; i < vm->nconstants; i++) {
         gc_mark(&vm->constants[i], true);
     }
-    for (uint32_t i=0; i < GLOBALS_SIZE && vm->globals[i].type != OBJ_NULL; i++) {
+    for (uint32_t i=0; i < vm->nglobals; i++) {
         gc_mark(&vm->globals[i], true);
     }
 
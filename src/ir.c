@@ -0,0 +1,1138 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ir.h"
+
+/*
+ * Optimizing middle-end: lifts the stack code of a function into SSA form, then
+ * - propagates constants and copies: reading a local that holds a constant pushes the constant,
+ *   reading a copy of another local reads the original
+ * - eliminates common subexpressions within a basic block, keeping the first result in a local if needed
+ * - removes stores to locals that are never read afterwards and values that are discarded without side effects
+ * - fuses increments of locals
+ * - renumbers the locals that are still used, so functions need fewer slots
+ * - infers which values are integers or booleans and uses instructions without type checks for them
+ * The compiler turns the result back into bytecode, see compile_ir().
+ */
+
+struct ir_locals {
+    uint64_t bits[IR_MAX_LOCALS / 64];
+};
+
+static inline bool ir_locals_has(const struct ir_locals *set, uint32_t local) {
+    return (set->bits[local / 64] >> (local % 64)) & 1u;
+}
+
+static inline void ir_locals_add(struct ir_locals *set, uint32_t local) {
+    set->bits[local / 64] |= (uint64_t) 1u << (local % 64);
+}
+
+static inline void ir_locals_remove(struct ir_locals *set, uint32_t local) {
+    set->bits[local / 64] &= ~((uint64_t) 1u << (local % 64));
+}
+
+static inline uint32_t ir_arg(const struct ir_function *fn, const struct ir_node *node, uint32_t i) {
+    return fn->args[node->args + i];
+}
+
+static bool ir_is_constant(enum opcode op) {
+    switch (op) {
+        case OPCODE_CONST:
+        case OPCODE_PUSH_INT8:
+        case OPCODE_PUSH_INT16:
+        case OPCODE_TRUE:
+        case OPCODE_FALSE:
+        case OPCODE_NULL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool ir_is_binary(enum opcode op) {
+    return op >= OPCODE_ADD && op <= OPCODE_OR && op != OPCODE_TRUE && op != OPCODE_FALSE;
+}
+
+/* instructions that may change arrays or globals */
+static bool ir_writes_memory(enum opcode op) {
+    return op == OPCODE_INDEX_SET || op == OPCODE_INDEX_SET_IN_BOUNDS || op == OPCODE_SET_GLOBAL || op == OPCODE_INC_GLOBAL || op == OPCODE_CALL || op == OPCODE_TAIL_CALL
+        || op == OPCODE_CALL_SELF || op == OPCODE_TAIL_CALL_SELF || op == OPCODE_ARRAY_PUSH || op == OPCODE_ARRAY_POP;
+}
+
+/* instructions whose result only depends on their operands and, for the ones reading memory, on arrays and globals */
+static bool ir_is_value_numbered(enum opcode op) {
+    return ir_is_constant(op) || ir_is_binary(op) || op == OPCODE_MINUS || op == OPCODE_BANG || op == OPCODE_INT
+        || op == OPCODE_INDEX_GET || op == OPCODE_INDEX_GET_IN_BOUNDS || op == OPCODE_GET_GLOBAL || op == OPCODE_GET_BUILTIN || op == OPCODE_LEN;
+}
+
+/*
+ * Number of objects the generic instruction pops and whether it pushes a result.
+ * Returns false for instructions the IR does not handle.
+ */
+static bool ir_stack_effect(enum opcode op, int64_t operand, uint32_t *pops, bool *pushes) {
+    *pushes = true;
+    switch (op) {
+        case OPCODE_CONST:
+        case OPCODE_PUSH_INT8:
+        case OPCODE_PUSH_INT16:
+        case OPCODE_TRUE:
+        case OPCODE_FALSE:
+        case OPCODE_NULL:
+        case OPCODE_GET_GLOBAL:
+        case OPCODE_GET_LOCAL:
+        case OPCODE_GET_BUILTIN:
+            *pops = 0;
+        break;
+        case OPCODE_MINUS:
+        case OPCODE_BANG:
+        case OPCODE_LEN:
+        case OPCODE_INT:
+        case OPCODE_ARRAY_POP:
+            *pops = 1;
+        break;
+        case OPCODE_INDEX_GET:
+        case OPCODE_INDEX_GET_IN_BOUNDS:
+        case OPCODE_ARRAY_PUSH:
+            *pops = 2;
+        break;
+        case OPCODE_INDEX_SET:
+        case OPCODE_INDEX_SET_IN_BOUNDS:
+        case OPCODE_SLICE:
+            *pops = 3;
+        break;
+        case OPCODE_ARRAY:
+            *pops = (uint32_t) operand;
+        break;
+        case OPCODE_CALL:
+            *pops = (uint32_t) operand + 1;
+        break;
+        case OPCODE_TAIL_CALL:
+            *pops = (uint32_t) operand + 1;
+            *pushes = false;
+        break;
+        case OPCODE_CALL_SELF:
+            *pops = (uint32_t) operand;
+        break;
+        case OPCODE_TAIL_CALL_SELF:
+            *pops = (uint32_t) operand;
+            *pushes = false;
+        break;
+        case OPCODE_SET_LOCAL:
+        case OPCODE_SET_GLOBAL:
+        case OPCODE_POP:
+        case OPCODE_RETURN_VALUE:
+        case OPCODE_JUMP_NOT_TRUE:
+        case OPCODE_JUMP_TRUE:
+            *pops = 1;
+            *pushes = false;
+        break;
+        case OPCODE_INC_GLOBAL:
+        case OPCODE_RETURN:
+        case OPCODE_JUMP:
+            *pops = 0;
+            *pushes = false;
+        break;
+        default:
+            if (!ir_is_binary(op)) {
+                return false;
+            }
+            *pops = 2;
+        break;
+    }
+    return true;
+}
+
+static uint32_t
+ir_add_node(struct ir_function *fn, enum opcode op, int64_t operand, const uint32_t *args, uint32_t nargs) {
+    if (fn->num_nodes == fn->cap_nodes) {
+        fn->cap_nodes *= 2;
+        fn->nodes = realloc(fn->nodes, fn->cap_nodes * sizeof *fn->nodes);
+        assert(fn->nodes != NULL);
+    }
+    if (fn->num_args + nargs > fn->cap_args) {
+        while (fn->num_args + nargs > fn->cap_args) {
+            fn->cap_args *= 2;
+        }
+        fn->args = realloc(fn->args, fn->cap_args * sizeof *fn->args);
+        assert(fn->args != NULL);
+    }
+
+    if (nargs > 0) {
+        memcpy(&fn->args[fn->num_args], args, nargs * sizeof *args);
+    }
+    fn->nodes[fn->num_nodes] = (struct ir_node) {
+        .op = op,
+        .operand = operand,
+        .args = fn->num_args,
+        .nargs = nargs,
+        .value = fn->num_nodes,
+        .spill = IR_NONE,
+    };
+    fn->num_args += nargs;
+    return fn->num_nodes++;
+}
+
+/* adds a node for a generic instruction, taking its arguments from the simulated stack */
+static bool
+ir_lift(struct ir_function *fn, uint32_t *stack, uint32_t *depth, enum opcode op, int64_t operand) {
+    uint32_t pops;
+    bool pushes;
+    if (!ir_stack_effect(op, operand, &pops, &pushes) || pops > *depth) {
+        return false;
+    }
+    if ((op == OPCODE_GET_LOCAL || op == OPCODE_SET_LOCAL) && (uint64_t) operand >= fn->num_locals) {
+        return false;
+    }
+
+    *depth -= pops;
+    uint32_t node = ir_add_node(fn, op, operand, &stack[*depth], pops);
+    if (pushes) {
+        stack[(*depth)++] = node;
+    }
+    return true;
+}
+
+/* small integer constants become immediates, so equal integers get the same value number */
+static bool
+ir_lift_constant(struct ir_function *fn, uint32_t *stack, uint32_t *depth, const struct object_list *constants, uint32_t index) {
+    if (index >= constants->size) {
+        return false;
+    }
+
+    struct object obj = constants->values[index];
+    if (obj_type(obj) == OBJ_INT && obj_int(obj) >= INT16_MIN && obj_int(obj) <= INT16_MAX) {
+        enum opcode op = obj_int(obj) >= INT8_MIN && obj_int(obj) <= INT8_MAX ? OPCODE_PUSH_INT8 : OPCODE_PUSH_INT16;
+        return ir_lift(fn, stack, depth, op, obj_int(obj));
+    }
+    return ir_lift(fn, stack, depth, OPCODE_CONST, index);
+}
+
+/* adds the nodes for a single bytecode instruction, splitting up fused instructions */
+static bool
+ir_lift_instruction(struct ir_function *fn, uint32_t *stack, uint32_t *depth, const uint8_t *ip, const struct object_list *constants, const uint32_t *block_at) {
+    enum opcode op = *ip;
+    switch (op) {
+        case OPCODE_CONST:
+            return ir_lift_constant(fn, stack, depth, constants, read_uint16(ip + 1));
+        case OPCODE_PUSH_INT8:
+            return ir_lift(fn, stack, depth, op, (int8_t) read_uint8(ip + 1));
+        case OPCODE_PUSH_INT16:
+            return ir_lift(fn, stack, depth, op, (int16_t) read_uint16(ip + 1));
+
+        case OPCODE_JUMP:
+        case OPCODE_JUMP_NOT_TRUE:
+        case OPCODE_JUMP_TRUE:
+            return ir_lift(fn, stack, depth, op, block_at[read_uint16(ip + 1)]);
+
+        case OPCODE_GET_LOCAL:
+        case OPCODE_SET_LOCAL:
+        case OPCODE_GET_BUILTIN:
+        case OPCODE_CALL:
+        case OPCODE_TAIL_CALL:
+        case OPCODE_CALL_SELF:
+        case OPCODE_TAIL_CALL_SELF:
+            return ir_lift(fn, stack, depth, op, read_uint8(ip + 1));
+        case OPCODE_GET_GLOBAL:
+        case OPCODE_SET_GLOBAL:
+        case OPCODE_INC_GLOBAL:
+        case OPCODE_ARRAY:
+            return ir_lift(fn, stack, depth, op, read_uint16(ip + 1));
+
+        case OPCODE_INC_LOCAL:
+        case OPCODE_DEC_LOCAL:
+            return ir_lift(fn, stack, depth, OPCODE_GET_LOCAL, read_uint8(ip + 1))
+                && ir_lift(fn, stack, depth, OPCODE_PUSH_INT8, 1)
+                && ir_lift(fn, stack, depth, op == OPCODE_INC_LOCAL ? OPCODE_ADD : OPCODE_SUBTRACT, 0)
+                && ir_lift(fn, stack, depth, OPCODE_SET_LOCAL, read_uint8(ip + 1));
+
+        case OPCODE_ADD_LOCAL_CONST:
+        case OPCODE_SUBTRACT_LOCAL_CONST:
+        case OPCODE_LESS_THAN_LOCAL_CONST:
+        case OPCODE_EQUAL_LOCAL_CONST: {
+            static const enum opcode generic[] = { OPCODE_ADD, OPCODE_SUBTRACT, OPCODE_LESS_THAN, OPCODE_EQUAL };
+            return ir_lift(fn, stack, depth, OPCODE_GET_LOCAL, read_uint8(ip + 1))
+                && ir_lift_constant(fn, stack, depth, constants, read_uint16(ip + 2))
+                && ir_lift(fn, stack, depth, generic[op - OPCODE_ADD_LOCAL_CONST], 0);
+        }
+
+        case OPCODE_ADD_LOCAL_LOCAL:
+        case OPCODE_LESS_THAN_LOCAL_LOCAL:
+        case OPCODE_INDEX_GET_LOCAL_LOCAL: {
+            static const enum opcode generic[] = { OPCODE_ADD, OPCODE_LESS_THAN, OPCODE_INDEX_GET };
+            return ir_lift(fn, stack, depth, OPCODE_GET_LOCAL, read_uint8(ip + 1))
+                && ir_lift(fn, stack, depth, OPCODE_GET_LOCAL, read_uint8(ip + 2))
+                && ir_lift(fn, stack, depth, generic[op - OPCODE_ADD_LOCAL_LOCAL], 0);
+        }
+
+        case OPCODE_INDEX_GET_LOCAL_LOCAL_IN_BOUNDS:
+            return ir_lift(fn, stack, depth, OPCODE_GET_LOCAL, read_uint8(ip + 1))
+                && ir_lift(fn, stack, depth, OPCODE_GET_LOCAL, read_uint8(ip + 2))
+                && ir_lift(fn, stack, depth, OPCODE_INDEX_GET_IN_BOUNDS, 0);
+
+        case OPCODE_JUMP_IF_NOT_LESS_THAN_LOCAL_CONST:
+        case OPCODE_JUMP_IF_NOT_EQUAL_LOCAL_CONST:
+            return ir_lift(fn, stack, depth, OPCODE_GET_LOCAL, read_uint8(ip + 3))
+                && ir_lift_constant(fn, stack, depth, constants, read_uint16(ip + 4))
+                && ir_lift(fn, stack, depth, op == OPCODE_JUMP_IF_NOT_EQUAL_LOCAL_CONST ? OPCODE_EQUAL : OPCODE_LESS_THAN, 0)
+                && ir_lift(fn, stack, depth, OPCODE_JUMP_NOT_TRUE, block_at[read_uint16(ip + 1)]);
+
+        case OPCODE_JUMP_IF_NOT_LESS_THAN_LOCAL_LOCAL:
+            return ir_lift(fn, stack, depth, OPCODE_GET_LOCAL, read_uint8(ip + 3))
+                && ir_lift(fn, stack, depth, OPCODE_GET_LOCAL, read_uint8(ip + 4))
+                && ir_lift(fn, stack, depth, OPCODE_LESS_THAN, 0)
+                && ir_lift(fn, stack, depth, OPCODE_JUMP_NOT_TRUE, block_at[read_uint16(ip + 1)]);
+
+        case OPCODE_JUMP_IF_NOT_EQUAL:
+        case OPCODE_JUMP_IF_EQUAL:
+        case OPCODE_JUMP_IF_NOT_GREATER_THAN:
+        case OPCODE_JUMP_IF_NOT_GREATER_THAN_OR_EQUALS:
+        case OPCODE_JUMP_IF_NOT_LESS_THAN:
+        case OPCODE_JUMP_IF_NOT_LESS_THAN_OR_EQUALS:
+            return ir_lift(fn, stack, depth, branch_comparison(op), 0)
+                && ir_lift(fn, stack, depth, OPCODE_JUMP_NOT_TRUE, block_at[read_uint16(ip + 1)]);
+
+        default:
+            return ir_lift(fn, stack, depth, op, 0);
+    }
+}
+
+/*
+ * Lifts the stack code of a function with the given number of locals, the first num_parameters of which are its parameters.
+ * Returns NULL if the code can not be represented, in which case it should be left as is.
+ */
+struct ir_function *
+ir_build(const struct instruction *ins, const struct object_list *constants, uint32_t num_locals, uint32_t num_parameters) {
+    if (ins->size == 0 || num_locals > IR_MAX_LOCALS) {
+        return NULL;
+    }
+
+    // find the instructions starting a basic block
+    bool *is_start = calloc(ins->size + 1, sizeof *is_start);
+    bool *is_leader = calloc(ins->size + 1, sizeof *is_leader);
+    uint32_t *block_at = malloc((ins->size + 1) * sizeof *block_at);
+    uint32_t *stack = malloc((2 * ins->size + 2) * sizeof *stack);
+    assert(is_start != NULL && is_leader != NULL && block_at != NULL && stack != NULL);
+
+    struct ir_function *fn = NULL;
+    bool ok = true;
+    is_leader[0] = true;
+    for (uint32_t pos = 0; pos < ins->size; pos += instruction_width(ins->bytes[pos])) {
+        const uint8_t *ip = &ins->bytes[pos];
+        uint32_t next = pos + instruction_width(*ip);
+        is_start[pos] = true;
+        switch ((enum opcode) *ip) {
+            case OPCODE_RETURN_VALUE:
+            case OPCODE_RETURN:
+            case OPCODE_TAIL_CALL:
+            case OPCODE_TAIL_CALL_SELF:
+                is_leader[next] = true;
+            break;
+            default:
+                if (*ip != OPCODE_JUMP && *ip != OPCODE_JUMP_NOT_TRUE && *ip != OPCODE_JUMP_TRUE && !is_compare_and_branch(*ip)) {
+                    break;
+                }
+                if ((uint32_t) read_uint16(ip + 1) >= ins->size) {
+                    ok = false;
+                } else {
+                    is_leader[read_uint16(ip + 1)] = true;
+                }
+                is_leader[next] = true;
+            break;
+        }
+    }
+
+    uint32_t num_blocks = 0;
+    for (uint32_t pos = 0; pos < ins->size; pos++) {
+        if (is_leader[pos] && !is_start[pos]) {
+            ok = false;
+        }
+        block_at[pos] = is_leader[pos] && is_start[pos] ? num_blocks++ : IR_NONE;
+    }
+    block_at[ins->size] = IR_NONE;
+    if (!ok) {
+        goto done;
+    }
+
+    fn = malloc(sizeof *fn);
+    assert(fn != NULL);
+    fn->cap_nodes = fn->cap_args = ins->size + 16;
+    fn->nodes = malloc(fn->cap_nodes * sizeof *fn->nodes);
+    fn->args = malloc(fn->cap_args * sizeof *fn->args);
+    fn->blocks = malloc(num_blocks * sizeof *fn->blocks);
+    assert(fn->nodes != NULL && fn->args != NULL && fn->blocks != NULL);
+    fn->num_nodes = fn->num_args = 0;
+    fn->num_blocks = num_blocks;
+    fn->num_locals = num_locals;
+    fn->num_parameters = num_parameters < num_locals ? num_parameters : num_locals;
+    fn->constants = constants;
+    for (uint32_t b = 0; b < num_blocks; b++) {
+        fn->blocks[b] = (struct ir_block) { .entry_depth = UINT32_MAX, .successors = { IR_NONE, IR_NONE } };
+    }
+    fn->blocks[0].entry_depth = 0;
+
+    // lift the blocks in order, loops are entered from the top so the stack depth at the start of every block is known
+    uint32_t pos = 0;
+    for (uint32_t b = 0; b < num_blocks && ok; b++) {
+        struct ir_block *block = &fn->blocks[b];
+        if (block->entry_depth == UINT32_MAX) {
+            ok = false;
+            break;
+        }
+
+        block->first = fn->num_nodes;
+        uint32_t depth = 0;
+        for (; depth < block->entry_depth; depth++) {
+            stack[depth] = ir_add_node(fn, OPCODE_NULL, 0, NULL, 0);
+            fn->nodes[stack[depth]].stack_entry = true;
+        }
+
+        uint32_t last = pos;
+        do {
+            last = pos;
+            ok = ir_lift_instruction(fn, stack, &depth, &ins->bytes[pos], constants, block_at);
+            pos += instruction_width(ins->bytes[pos]);
+        } while (ok && pos < ins->size && block_at[pos] == IR_NONE);
+        block->count = fn->num_nodes - block->first;
+
+        // jumps, including compare-and-branch instructions, take their target from the first operand
+        const uint8_t *ip = &ins->bytes[last];
+        switch ((enum opcode) *ip) {
+            case OPCODE_JUMP:
+                block->successors[0] = block_at[read_uint16(ip + 1)];
+            break;
+            case OPCODE_JUMP_NOT_TRUE:
+            case OPCODE_JUMP_TRUE:
+                block->successors[0] = b + 1;
+                block->successors[1] = block_at[read_uint16(ip + 1)];
+            break;
+            case OPCODE_RETURN_VALUE:
+            case OPCODE_RETURN:
+            case OPCODE_TAIL_CALL:
+            case OPCODE_TAIL_CALL_SELF:
+            break;
+            default:
+                block->successors[0] = b + 1;
+                if (is_compare_and_branch(*ip)) {
+                    block->successors[1] = block_at[read_uint16(ip + 1)];
+                }
+            break;
+        }
+
+        for (uint32_t s = 0; s < 2 && ok; s++) {
+            uint32_t successor = block->successors[s];
+            if (successor == IR_NONE) {
+                continue;
+            }
+            if (successor >= num_blocks) {
+                ok = false;
+            } else if (fn->blocks[successor].entry_depth == UINT32_MAX) {
+                fn->blocks[successor].entry_depth = depth;
+            } else if (fn->blocks[successor].entry_depth != depth) {
+                ok = false;
+            }
+        }
+    }
+
+    if (!ok) {
+        ir_free(fn);
+        fn = NULL;
+    }
+
+done:
+    free(stack);
+    free(block_at);
+    free(is_leader);
+    free(is_start);
+    return fn;
+}
+
+void
+ir_free(struct ir_function *fn) {
+    free(fn->nodes);
+    free(fn->args);
+    free(fn->blocks);
+    free(fn);
+}
+
+/* values without side effects that can not fail, which can be dropped if nothing uses them */
+static bool ir_is_removable(const struct ir_function *fn, uint32_t n) {
+    const struct ir_node *node = &fn->nodes[n];
+    if (node->stack_entry || node->spill != IR_NONE) {
+        return false;
+    }
+
+    switch (node->op) {
+        case OPCODE_GET_LOCAL:
+        case OPCODE_GET_GLOBAL:
+        case OPCODE_GET_BUILTIN:
+            return true;
+        case OPCODE_ARRAY:
+            for (uint32_t i = 0; i < node->nargs; i++) {
+                if (!ir_is_removable(fn, ir_arg(fn, node, i))) {
+                    return false;
+                }
+            }
+            return true;
+        default:
+            return ir_is_constant(node->op);
+    }
+}
+
+static void ir_remove_tree(struct ir_function *fn, uint32_t n) {
+    struct ir_node *node = &fn->nodes[n];
+    node->removed = true;
+    for (uint32_t i = 0; i < node->nargs; i++) {
+        ir_remove_tree(fn, ir_arg(fn, node, i));
+    }
+}
+
+/* number of nodes computing something in the tree of n */
+static uint32_t ir_count_operations(const struct ir_function *fn, uint32_t n) {
+    const struct ir_node *node = &fn->nodes[n];
+    uint32_t count = node->nargs > 0;
+    for (uint32_t i = 0; i < node->nargs; i++) {
+        count += ir_count_operations(fn, ir_arg(fn, node, i));
+    }
+    return count;
+}
+
+/* whether a node in the tree of n keeps its value for later nodes */
+static bool ir_has_spill(const struct ir_function *fn, uint32_t n) {
+    const struct ir_node *node = &fn->nodes[n];
+    if (node->spill != IR_NONE) {
+        return true;
+    }
+    for (uint32_t i = 0; i < node->nargs; i++) {
+        if (ir_has_spill(fn, ir_arg(fn, node, i))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* drops the store or pop n, along with the value it consumes if that has no side effects */
+static void ir_discard(struct ir_function *fn, uint32_t n) {
+    struct ir_node *node = &fn->nodes[n];
+    uint32_t value = ir_arg(fn, node, 0);
+    if (ir_is_removable(fn, value)) {
+        ir_remove_tree(fn, value);
+        node->removed = true;
+    } else {
+        node->op = OPCODE_POP;
+        node->operand = 0;
+    }
+}
+
+/* makes n push the object in the given local instead of computing it */
+static void ir_replace_with_local(struct ir_function *fn, uint32_t n, uint32_t local) {
+    struct ir_node *node = &fn->nodes[n];
+    for (uint32_t i = 0; i < node->nargs; i++) {
+        ir_remove_tree(fn, ir_arg(fn, node, i));
+    }
+    node->op = OPCODE_GET_LOCAL;
+    node->operand = local;
+    node->nargs = 0;
+}
+
+/* open addressing table of the value numbered nodes in a block */
+struct ir_value_table {
+    uint32_t *slots;
+    uint32_t mask;
+    /* state of arrays and globals every node saw, incremented by every instruction that may change them */
+    uint32_t *epochs;
+};
+
+static uint64_t ir_key_hash(const struct ir_function *fn, const struct ir_value_table *t, uint32_t n) {
+    const struct ir_node *node = &fn->nodes[n];
+    uint64_t h = ((uint64_t) node->op * 0x9E3779B97F4A7C15u) ^ (uint64_t) node->operand;
+    for (uint32_t i = 0; i < node->nargs; i++) {
+        h = (h ^ fn->nodes[ir_arg(fn, node, i)].value) * 0x100000001b3u;
+    }
+    h = (h ^ t->epochs[n]) * 0x100000001b3u;
+    return h ^ (h >> 32);
+}
+
+static bool ir_key_equals(const struct ir_function *fn, const struct ir_value_table *t, uint32_t a, uint32_t b) {
+    const struct ir_node *x = &fn->nodes[a];
+    const struct ir_node *y = &fn->nodes[b];
+    if (x->op != y->op || x->operand != y->operand || x->nargs != y->nargs || t->epochs[a] != t->epochs[b]) {
+        return false;
+    }
+    for (uint32_t i = 0; i < x->nargs; i++) {
+        if (fn->nodes[ir_arg(fn, x, i)].value != fn->nodes[ir_arg(fn, y, i)].value) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* returns an earlier node with the same key as n, or adds n to the table and returns IR_NONE */
+static uint32_t ir_value_table_find(const struct ir_function *fn, struct ir_value_table *t, uint32_t n) {
+    for (uint32_t pos = ir_key_hash(fn, t, n) & t->mask; ; pos = (pos + 1) & t->mask) {
+        if (t->slots[pos] == IR_NONE) {
+            t->slots[pos] = n;
+            return IR_NONE;
+        }
+        if (ir_key_equals(fn, t, t->slots[pos], n)) {
+            return t->slots[pos];
+        }
+    }
+}
+
+/*
+ * Assigns value numbers to the nodes of a block, following the values through the locals.
+ * Reads of locals holding a constant or a copy are replaced, and so are repeated computations.
+ */
+static void ir_number_values(struct ir_function *fn, const struct ir_block *block, uint32_t *home) {
+    // value each local holds in the code as written, IR_NONE until it is read or written in this block
+    uint32_t local_value[IR_MAX_LOCALS];
+    for (uint32_t i = 0; i < IR_MAX_LOCALS; i++) {
+        local_value[i] = IR_NONE;
+    }
+
+    struct ir_value_table t;
+    uint32_t cap = 16;
+    while (cap < block->count * 2) {
+        cap *= 2;
+    }
+    t.mask = cap - 1;
+    t.slots = malloc(cap * sizeof *t.slots);
+    t.epochs = malloc(block->count * sizeof *t.epochs);
+    assert(t.slots != NULL && t.epochs != NULL);
+    memset(t.slots, 0xff, cap * sizeof *t.slots);
+    t.epochs -= block->first;
+    uint32_t epoch = 0;
+
+    for (uint32_t n = block->first; n < block->first + block->count; n++) {
+        struct ir_node *node = &fn->nodes[n];
+        t.epochs[n] = 0;
+        home[n] = IR_NONE;
+        if (node->stack_entry || node->removed) {
+            continue;
+        }
+
+        switch (node->op) {
+            case OPCODE_GET_LOCAL: {
+                uint32_t local = (uint32_t) node->operand;
+                if (local_value[local] == IR_NONE) {
+                    local_value[local] = n;
+                    home[n] = local;
+                }
+
+                uint32_t value = local_value[local];
+                const struct ir_node *source = &fn->nodes[value];
+                node->value = value;
+                if (ir_is_constant(source->op) && !source->stack_entry) {
+                    node->op = source->op;
+                    node->operand = source->operand;
+                } else if (home[value] != IR_NONE && local_value[home[value]] == value) {
+                    node->operand = home[value];
+                }
+            }
+            break;
+
+            case OPCODE_SET_LOCAL: {
+                uint32_t local = (uint32_t) node->operand;
+                uint32_t value = fn->nodes[ir_arg(fn, node, 0)].value;
+                if (local_value[local] == value) {
+                    // the local already holds this value
+                    ir_discard(fn, n);
+                    break;
+                }
+
+                local_value[local] = value;
+                if (home[value] == IR_NONE || local_value[home[value]] != value) {
+                    home[value] = local;
+                }
+            }
+            break;
+
+            case OPCODE_POP:
+                if (ir_is_removable(fn, ir_arg(fn, node, 0))) {
+                    ir_discard(fn, n);
+                }
+            break;
+
+            default: {
+                if (ir_writes_memory(node->op)) {
+                    epoch++;
+                }
+                if (!ir_is_value_numbered(node->op)) {
+                    break;
+                }
+
+                if (node->op == OPCODE_INDEX_GET || node->op == OPCODE_INDEX_GET_IN_BOUNDS || node->op == OPCODE_GET_GLOBAL || node->op == OPCODE_LEN) {
+                    t.epochs[n] = epoch;
+                }
+                uint32_t earlier = ir_value_table_find(fn, &t, n);
+                if (earlier == IR_NONE) {
+                    break;
+                }
+
+                uint32_t value = fn->nodes[earlier].value;
+                node->value = value;
+                if (ir_is_constant(node->op)) {
+                    break;
+                }
+
+                // reuse the earlier result if it is still in a local, or keep it in a new one if that saves enough work
+                uint32_t operations = ir_count_operations(fn, n);
+                if (ir_has_spill(fn, n)) {
+                    break;
+                }
+                if (home[value] != IR_NONE && local_value[home[value]] == value && operations >= 1) {
+                    ir_replace_with_local(fn, n, home[value]);
+                } else if (operations >= 2 && fn->num_locals < IR_MAX_LOCALS && fn->nodes[value].spill == IR_NONE && !fn->nodes[value].removed) {
+                    uint32_t local = fn->num_locals++;
+                    fn->nodes[value].spill = local;
+                    local_value[local] = value;
+                    home[value] = local;
+                    ir_replace_with_local(fn, n, local);
+                }
+            }
+            break;
+        }
+    }
+
+    free(t.epochs + block->first);
+    free(t.slots);
+}
+
+/* locals read before they are written and locals written in a block */
+static void ir_block_uses(const struct ir_function *fn, const struct ir_block *block, struct ir_locals *use, struct ir_locals *def) {
+    memset(use, 0, sizeof *use);
+    memset(def, 0, sizeof *def);
+    for (uint32_t n = block->first; n < block->first + block->count; n++) {
+        const struct ir_node *node = &fn->nodes[n];
+        if (node->removed || node->stack_entry) {
+            continue;
+        }
+        if (node->op == OPCODE_GET_LOCAL && !ir_locals_has(def, (uint32_t) node->operand)) {
+            ir_locals_add(use, (uint32_t) node->operand);
+        } else if (node->op == OPCODE_SET_LOCAL) {
+            ir_locals_add(def, (uint32_t) node->operand);
+        }
+        if (node->spill != IR_NONE) {
+            ir_locals_add(def, node->spill);
+        }
+    }
+}
+
+/*
+ * A local that is read right after it is stored and never again does not need to be stored at all:
+ * the value stays on the stack and whatever used the read uses the stored value instead.
+ * Values carried across a join are left alone, they are only placeholders for whatever the predecessors left on the stack.
+ */
+static bool ir_forward_store(struct ir_function *fn, const struct ir_block *block, uint32_t get) {
+    uint32_t set = get;
+    while (set-- > block->first && fn->nodes[set].removed);
+    if (set < block->first || set >= get || fn->nodes[set].stack_entry || fn->nodes[set].op != OPCODE_SET_LOCAL || fn->nodes[set].operand != fn->nodes[get].operand) {
+        return false;
+    }
+
+    uint32_t value = ir_arg(fn, &fn->nodes[set], 0);
+    if (fn->nodes[value].stack_entry) {
+        return false;
+    }
+    for (uint32_t n = get + 1; n < block->first + block->count; n++) {
+        const struct ir_node *node = &fn->nodes[n];
+        for (uint32_t a = 0; a < node->nargs; a++) {
+            if (fn->args[node->args + a] == get) {
+                fn->args[node->args + a] = value;
+            }
+        }
+    }
+    fn->nodes[set].removed = true;
+    fn->nodes[get].removed = true;
+    return true;
+}
+
+/* removes stores to locals that are not read before being overwritten or leaving the function, returns true if any were removed */
+static bool ir_eliminate_dead_stores(struct ir_function *fn) {
+    struct ir_locals *use = malloc(fn->num_blocks * sizeof *use);
+    struct ir_locals *def = malloc(fn->num_blocks * sizeof *def);
+    struct ir_locals *live_in = calloc(fn->num_blocks, sizeof *live_in);
+    assert(use != NULL && def != NULL && live_in != NULL);
+    for (uint32_t b = 0; b < fn->num_blocks; b++) {
+        ir_block_uses(fn, &fn->blocks[b], &use[b], &def[b]);
+    }
+
+    // backwards data flow until nothing changes
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (uint32_t b = fn->num_blocks; b-- > 0; ) {
+            struct ir_locals in = { 0 };
+            for (uint32_t s = 0; s < 2; s++) {
+                if (fn->blocks[b].successors[s] != IR_NONE) {
+                    const struct ir_locals *succ = &live_in[fn->blocks[b].successors[s]];
+                    for (uint32_t w = 0; w < IR_MAX_LOCALS / 64; w++) {
+                        in.bits[w] |= succ->bits[w];
+                    }
+                }
+            }
+            for (uint32_t w = 0; w < IR_MAX_LOCALS / 64; w++) {
+                in.bits[w] = use[b].bits[w] | (in.bits[w] & ~def[b].bits[w]);
+                if (in.bits[w] != live_in[b].bits[w]) {
+                    live_in[b].bits[w] = in.bits[w];
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    bool removed = false;
+    for (uint32_t b = 0; b < fn->num_blocks; b++) {
+        const struct ir_block *block = &fn->blocks[b];
+        struct ir_locals live = { 0 };
+        for (uint32_t s = 0; s < 2; s++) {
+            if (block->successors[s] != IR_NONE) {
+                for (uint32_t w = 0; w < IR_MAX_LOCALS / 64; w++) {
+                    live.bits[w] |= live_in[block->successors[s]].bits[w];
+                }
+            }
+        }
+
+        for (uint32_t n = block->first + block->count; n-- > block->first; ) {
+            struct ir_node *node = &fn->nodes[n];
+            if (node->removed || node->stack_entry) {
+                continue;
+            }
+
+            if (node->spill != IR_NONE) {
+                ir_locals_remove(&live, node->spill);
+            }
+            if (node->op == OPCODE_SET_LOCAL) {
+                if (!ir_locals_has(&live, (uint32_t) node->operand)) {
+                    ir_discard(fn, n);
+                    removed = true;
+                } else {
+                    ir_locals_remove(&live, (uint32_t) node->operand);
+                }
+            } else if (node->op == OPCODE_GET_LOCAL) {
+                if (!ir_locals_has(&live, (uint32_t) node->operand) && ir_forward_store(fn, block, n)) {
+                    removed = true;
+                    continue;
+                }
+                ir_locals_add(&live, (uint32_t) node->operand);
+            }
+        }
+    }
+
+    free(live_in);
+    free(def);
+    free(use);
+    return removed;
+}
+
+/* turns local = local + 1 and local = local - 1 into a single increment or decrement */
+static void ir_fuse_increments(struct ir_function *fn) {
+    for (uint32_t n = 0; n < fn->num_nodes; n++) {
+        struct ir_node *store = &fn->nodes[n];
+        if (store->removed || store->op != OPCODE_SET_LOCAL) {
+            continue;
+        }
+
+        uint32_t op = ir_arg(fn, store, 0);
+        struct ir_node *operation = &fn->nodes[op];
+        if ((operation->op != OPCODE_ADD && operation->op != OPCODE_SUBTRACT) || operation->spill != IR_NONE) {
+            continue;
+        }
+
+        uint32_t load = ir_arg(fn, operation, 0);
+        uint32_t one = ir_arg(fn, operation, 1);
+        if (fn->nodes[load].op != OPCODE_GET_LOCAL || fn->nodes[load].operand != store->operand || fn->nodes[load].spill != IR_NONE
+            || fn->nodes[one].op != OPCODE_PUSH_INT8 || fn->nodes[one].operand != 1) {
+            continue;
+        }
+
+        // the local may not change between reading and writing it
+        bool written = false;
+        for (uint32_t i = load + 1; i < n && !written; i++) {
+            const struct ir_node *node = &fn->nodes[i];
+            bool writes = node->op == OPCODE_SET_LOCAL || node->op == OPCODE_INC_LOCAL || node->op == OPCODE_DEC_LOCAL;
+            written = !node->removed && !node->stack_entry && ((writes && node->operand == store->operand) || node->spill == (uint32_t) store->operand);
+        }
+        if (written) {
+            continue;
+        }
+
+        fn->nodes[load].removed = fn->nodes[one].removed = operation->removed = true;
+        store->op = operation->op == OPCODE_ADD ? OPCODE_INC_LOCAL : OPCODE_DEC_LOCAL;
+        store->nargs = 0;
+    }
+}
+
+/* drops unused locals and gives the remaining ones consecutive slots after the parameters */
+static void ir_renumber_locals(struct ir_function *fn) {
+    bool used[IR_MAX_LOCALS] = { false };
+    bool read[IR_MAX_LOCALS] = { false };
+    for (uint32_t n = 0; n < fn->num_nodes; n++) {
+        const struct ir_node *node = &fn->nodes[n];
+        if (node->removed || node->stack_entry) {
+            continue;
+        }
+        switch (node->op) {
+            case OPCODE_GET_LOCAL:
+                read[node->operand] = true;
+                used[node->operand] = true;
+            break;
+            case OPCODE_SET_LOCAL:
+            case OPCODE_INC_LOCAL:
+            case OPCODE_DEC_LOCAL:
+                used[node->operand] = true;
+            break;
+            default: break;
+        }
+    }
+
+    // a value kept for reuse whose copies were all removed
+    for (uint32_t n = 0; n < fn->num_nodes; n++) {
+        struct ir_node *node = &fn->nodes[n];
+        if (node->spill != IR_NONE && !read[node->spill]) {
+            node->spill = IR_NONE;
+        } else if (node->spill != IR_NONE && !node->removed) {
+            used[node->spill] = true;
+        }
+    }
+
+    uint32_t map[IR_MAX_LOCALS];
+    uint32_t num_locals = 0;
+    for (uint32_t local = 0; local < fn->num_locals; local++) {
+        map[local] = local < fn->num_parameters || used[local] ? num_locals++ : IR_NONE;
+    }
+
+    for (uint32_t n = 0; n < fn->num_nodes; n++) {
+        struct ir_node *node = &fn->nodes[n];
+        switch (node->op) {
+            case OPCODE_GET_LOCAL:
+            case OPCODE_SET_LOCAL:
+            case OPCODE_INC_LOCAL:
+            case OPCODE_DEC_LOCAL:
+                if (!node->removed && !node->stack_entry) {
+                    node->operand = map[node->operand];
+                }
+            break;
+            default: break;
+        }
+        if (node->spill != IR_NONE) {
+            node->spill = map[node->spill];
+        }
+    }
+    fn->num_locals = num_locals;
+}
+
+/* 
+ * What is known about the type of a value. Joining the types of a local from two predecessors
+ * keeps the type if it is the same on both paths.
+ */
+enum ir_type {
+    IR_TYPE_UNREACHED = 0,
+    IR_TYPE_INT,
+    IR_TYPE_BOOL,
+    IR_TYPE_ANY,
+};
+
+static enum ir_type ir_type_join(enum ir_type a, enum ir_type b) {
+    if (a == IR_TYPE_UNREACHED || a == b) {
+        return b;
+    }
+    return b == IR_TYPE_UNREACHED ? a : IR_TYPE_ANY;
+}
+
+static enum opcode ir_unchecked_opcode(enum opcode op, enum ir_type left, enum ir_type right) {
+    if (left == IR_TYPE_INT && right == IR_TYPE_INT) {
+        switch (op) {
+            case OPCODE_ADD: return OPCODE_INT_ADD;
+            case OPCODE_SUBTRACT: return OPCODE_INT_SUBTRACT;
+            case OPCODE_MULTIPLY: return OPCODE_INT_MULTIPLY;
+            case OPCODE_EQUAL: return OPCODE_INT_EQUAL;
+            case OPCODE_NOT_EQUAL: return OPCODE_INT_NOT_EQUAL;
+            case OPCODE_GREATER_THAN: return OPCODE_INT_GREATER_THAN;
+            case OPCODE_GREATER_THAN_OR_EQUALS: return OPCODE_INT_GREATER_THAN_OR_EQUALS;
+            case OPCODE_LESS_THAN: return OPCODE_INT_LESS_THAN;
+            case OPCODE_LESS_THAN_OR_EQUALS: return OPCODE_INT_LESS_THAN_OR_EQUALS;
+            default: break;
+        }
+    } else if (left == IR_TYPE_BOOL && right == IR_TYPE_BOOL) {
+        switch (op) {
+            case OPCODE_EQUAL: return OPCODE_BOOL_EQUAL;
+            case OPCODE_NOT_EQUAL: return OPCODE_BOOL_NOT_EQUAL;
+            default: break;
+        }
+    }
+    return op;
+}
+
+/* type of the object node n pushes, given the types of its arguments */
+static enum ir_type ir_node_type(const struct ir_function *fn, const struct ir_node *node, const uint8_t *types) {
+    enum ir_type left = node->nargs > 0 ? types[ir_arg(fn, node, 0)] : IR_TYPE_ANY;
+    enum ir_type right = node->nargs > 1 ? types[ir_arg(fn, node, 1)] : IR_TYPE_ANY;
+    switch (node->op) {
+        case OPCODE_PUSH_INT8:
+        case OPCODE_PUSH_INT16:
+            return IR_TYPE_INT;
+        case OPCODE_CONST: {
+            enum object_type type = obj_type(fn->constants->values[node->operand]);
+            return type == OBJ_INT ? IR_TYPE_INT : type == OBJ_BOOL ? IR_TYPE_BOOL : IR_TYPE_ANY;
+        }
+        case OPCODE_TRUE:
+        case OPCODE_FALSE:
+            return IR_TYPE_BOOL;
+
+        case OPCODE_ADD:
+        case OPCODE_SUBTRACT:
+        case OPCODE_MULTIPLY:
+            return left == IR_TYPE_INT && right == IR_TYPE_INT ? IR_TYPE_INT : IR_TYPE_ANY;
+
+        // dividing by zero results in an error object
+        case OPCODE_DIVIDE:
+        case OPCODE_MODULO: {
+            const struct ir_node *divisor = &fn->nodes[ir_arg(fn, node, 1)];
+            bool nonzero = (divisor->op == OPCODE_PUSH_INT8 || divisor->op == OPCODE_PUSH_INT16) && divisor->operand != 0;
+            return left == IR_TYPE_INT && right == IR_TYPE_INT && nonzero ? IR_TYPE_INT : IR_TYPE_ANY;
+        }
+
+        // comparing anything else aborts the program
+        case OPCODE_EQUAL:
+        case OPCODE_NOT_EQUAL:
+        case OPCODE_GREATER_THAN:
+        case OPCODE_GREATER_THAN_OR_EQUALS:
+        case OPCODE_LESS_THAN:
+        case OPCODE_LESS_THAN_OR_EQUALS:
+        case OPCODE_BANG:
+            return IR_TYPE_BOOL;
+
+        case OPCODE_AND:
+        case OPCODE_OR:
+            return left == IR_TYPE_BOOL && right == IR_TYPE_BOOL ? IR_TYPE_BOOL : IR_TYPE_ANY;
+
+        case OPCODE_MINUS:
+            return left == IR_TYPE_INT ? IR_TYPE_INT : IR_TYPE_ANY;
+
+        default:
+            return IR_TYPE_ANY;
+    }
+}
+
+/*
+ * Follows the types of the values and locals through a block, starting from the types of the locals on entry.
+ * With rewrite set, operations on proven integers or booleans are replaced with their unchecked variants.
+ */
+static void ir_type_block(struct ir_function *fn, const struct ir_block *block, uint8_t *locals, uint8_t *types, bool rewrite) {
+    for (uint32_t n = block->first; n < block->first + block->count; n++) {
+        struct ir_node *node = &fn->nodes[n];
+        types[n] = IR_TYPE_ANY;
+        if (node->removed || node->stack_entry) {
+            continue;
+        }
+
+        switch (node->op) {
+            case OPCODE_GET_LOCAL:
+                types[n] = locals[node->operand];
+            break;
+
+            case OPCODE_SET_LOCAL:
+                locals[node->operand] = types[ir_arg(fn, node, 0)];
+            break;
+
+            case OPCODE_INC_LOCAL:
+            case OPCODE_DEC_LOCAL:
+                if (locals[node->operand] != IR_TYPE_INT) {
+                    locals[node->operand] = IR_TYPE_ANY;
+                } else if (rewrite) {
+                    node->op = node->op == OPCODE_INC_LOCAL ? OPCODE_INT_INC_LOCAL : OPCODE_INT_DEC_LOCAL;
+                }
+            break;
+
+            default:
+                types[n] = ir_node_type(fn, node, types);
+                if (rewrite && node->op == OPCODE_BANG && types[ir_arg(fn, node, 0)] == IR_TYPE_BOOL) {
+                    node->op = OPCODE_BOOL_BANG;
+                } else if (rewrite && ir_is_binary(node->op)) {
+                    node->op = ir_unchecked_opcode(node->op, types[ir_arg(fn, node, 0)], types[ir_arg(fn, node, 1)]);
+                }
+            break;
+        }
+
+        if (node->spill != IR_NONE) {
+            locals[node->spill] = types[n];
+        }
+    }
+}
+
+/*
+ * Flow-sensitive type inference: forward data flow over the blocks computes the types the locals have on entry to
+ * every block, which are the same on all paths leading there, or IR_TYPE_ANY. Parameters and values that are on
+ * the stack when entering a block can be anything, as can the results of calls, indexing and globals.
+ * Locals are only changed by the function itself, so calls do not invalidate what is known about them.
+ */
+static void ir_infer_types(struct ir_function *fn) {
+    uint32_t num_locals = fn->num_locals > 0 ? fn->num_locals : 1;
+    uint8_t *entry = calloc(fn->num_blocks * num_locals, sizeof *entry);
+    uint8_t *types = malloc(fn->num_nodes * sizeof *types);
+    uint8_t *locals = malloc(num_locals * sizeof *locals);
+    bool *reached = calloc(fn->num_blocks, sizeof *reached);
+    assert(entry != NULL && types != NULL && locals != NULL && reached != NULL);
+    memset(entry, IR_TYPE_ANY, num_locals);
+    reached[0] = true;
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (uint32_t b = 0; b < fn->num_blocks; b++) {
+            if (!reached[b]) {
+                continue;
+            }
+
+            memcpy(locals, &entry[b * num_locals], num_locals);
+            ir_type_block(fn, &fn->blocks[b], locals, types, false);
+            for (uint32_t s = 0; s < 2; s++) {
+                uint32_t successor = fn->blocks[b].successors[s];
+                if (successor == IR_NONE) {
+                    continue;
+                }
+
+                uint8_t *in = &entry[successor * num_locals];
+                for (uint32_t local = 0; local < fn->num_locals; local++) {
+                    enum ir_type joined = ir_type_join(in[local], locals[local]);
+                    if (joined != in[local]) {
+                        in[local] = (uint8_t) joined;
+                        changed = true;
+                    }
+                }
+                if (!reached[successor]) {
+                    reached[successor] = changed = true;
+                }
+            }
+        }
+    }
+
+    for (uint32_t b = 0; b < fn->num_blocks; b++) {
+        if (reached[b]) {
+            memcpy(locals, &entry[b * num_locals], num_locals);
+            ir_type_block(fn, &fn->blocks[b], locals, types, true);
+        }
+    }
+
+    free(reached);
+    free(locals);
+    free(types);
+    free(entry);
+}
+
+void
+ir_optimize(struct ir_function *fn) {
+    uint32_t *home = malloc(fn->num_nodes * sizeof *home);
+    assert(home != NULL);
+    for (uint32_t b = 0; b < fn->num_blocks; b++) {
+        ir_number_values(fn, &fn->blocks[b], home);
+    }
+    free(home);
+
+    while (ir_eliminate_dead_stores(fn));
+    ir_fuse_increments(fn);
+    ir_renumber_locals(fn);
+    ir_infer_types(fn);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "opcode.h"
+#include "object.h"
+
+/* locals are addressed by a single byte operand */
+#define IR_MAX_LOCALS 256u
+#define IR_NONE UINT32_MAX
+
+/*
+ * A single generic stack instruction. Superinstructions and increments are split up into the instructions they fuse.
+ * A node that pushes an object is that value, its arguments are the nodes that pushed the objects it pops.
+ */
+struct ir_node {
+    enum opcode op;
+    /* constant, local, global or builtin index, number of arguments or elements, integer value or target block */
+    int64_t operand;
+    /* index of the first argument in ir_function.args */
+    uint32_t args;
+    uint32_t nargs;
+    /* value number: the index of the first node in the block known to produce the same object */
+    uint32_t value;
+    /* local that also receives the value right after it is computed, so later nodes can reuse it, or IR_NONE */
+    uint32_t spill;
+    /* an object that was on the stack when entering the block, which is not emitted */
+    bool stack_entry;
+    bool removed;
+};
+
+struct ir_block {
+    uint32_t first;
+    uint32_t count;
+    uint32_t entry_depth;
+    /* blocks control continues in, IR_NONE if unused */
+    uint32_t successors[2];
+};
+
+/*
+ * SSA form of a function's stack code. Within a basic block every value is assigned once and reading a local
+ * yields the value last stored in it. Between blocks values live in their frame slots and on the stack,
+ * the same way the bytecode keeps them, so going back to stack code does not need phi nodes.
+ */
+struct ir_function {
+    struct ir_node *nodes;
+    uint32_t num_nodes;
+    uint32_t cap_nodes;
+    uint32_t *args;
+    uint32_t num_args;
+    uint32_t cap_args;
+    struct ir_block *blocks;
+    uint32_t num_blocks;
+    uint32_t num_locals;
+    uint32_t num_parameters;
+    const struct object_list *constants;
+};
+
+struct ir_function *ir_build(const struct instruction *ins, const struct object_list *constants, uint32_t num_locals, uint32_t num_parameters);
+void ir_optimize(struct ir_function *fn);
+void ir_free(struct ir_function *fn);
@@ -0,0 +1,1007 @@
+/*
+ * Baseline JIT compiler translating the bytecode of a compiled function into x86-64 machine code.
+ *
+ * Every instruction is translated in isolation using the same stack, frame and globals layout as the interpreter,
+ * so that native code and interpreter can hand a frame over to each other at any instruction boundary.
+ * Integer arithmetic, comparisons, array indexing, jumps and returns are inlined behind type guards,
+ * everything else (and the slow path of every guard) calls back into the interpreter's implementation.
+ *
+ * While native code runs the following callee-saved registers hold the VM state:
+ *   rbx: struct vm*
+ *   r12: struct frame* for the current frame
+ *   r13: &vm->stack[frame->base_pointer], ie. the locals of the current frame
+ *   r14: &vm->stack[vm->stack_pointer], ie. the next free stack slot
+ *   r15: vm->constants
+ * vm->stack_pointer is only synchronised with r14 before calling into C.
+ * Calls may grow (and thereby move) the stack and frames, so r12-r14 are reloaded after calling into C.
+ */
+#define _DEFAULT_SOURCE
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "opcode.h"
+#include "object.h"
+#include "vm.h"
+#include "jit.h"
+
+// native code is generated for the 16-byte object layout only
+#if defined(__x86_64__) && !defined(TAGGED_OBJECTS)
+
+_Static_assert(sizeof(struct object) == 16, "native code assumes 16-byte objects");
+
+enum reg {
+    RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+#define REG_VM RBX
+#define REG_FRAME R12
+#define REG_LOCALS R13
+#define REG_SP R14
+#define REG_CONSTANTS R15
+
+enum condition {
+    CC_B = 0x2,
+    CC_AE = 0x3,
+    CC_E = 0x4,
+    CC_NE = 0x5,
+    CC_A = 0x7,
+    CC_L = 0xC,
+    CC_GE = 0xD,
+    CC_LE = 0xE,
+    CC_G = 0xF,
+};
+
+#define OBJECT_SIZE ((int32_t) sizeof(struct object))
+#define TYPE_OFFSET ((int32_t) offsetof(struct object, type))
+#define VALUE_OFFSET ((int32_t) offsetof(struct object, value))
+#define VM_OFFSET(field) ((int32_t) offsetof(struct vm, field))
+#define FRAME_OFFSET(field) ((int32_t) offsetof(struct frame, field))
+#define LIST_OFFSET(field) ((int32_t) offsetof(struct object_list, field))
+
+/* a rel32 operand at code offset `at` that should point to the code for bytecode position `target` */
+struct fixup {
+    uint32_t at;
+    uint32_t target;
+};
+
+struct assembler {
+    /* the function being compiled */
+    const struct compiled_function* fn;
+
+    uint8_t* code;
+    uint32_t size;
+    uint32_t cap;
+
+    struct fixup* fixups;
+    uint32_t nfixups;
+    uint32_t fixups_cap;
+
+    uint32_t epilogue;
+};
+
+static void
+emit8(struct assembler* a, uint8_t byte) {
+    if (a->size == a->cap) {
+        a->cap *= 2;
+        a->code = realloc(a->code, a->cap);
+        assert(a->code != NULL);
+    }
+    a->code[a->size++] = byte;
+}
+
+static void
+emit32(struct assembler* a, uint32_t value) {
+    for (unsigned i = 0; i < 4; i++) {
+        emit8(a, (uint8_t) (value >> (i * 8)));
+    }
+}
+
+static void
+emit64(struct assembler* a, uint64_t value) {
+    emit32(a, (uint32_t) value);
+    emit32(a, (uint32_t) (value >> 32));
+}
+
+static void
+emit_opcode(struct assembler* a, bool wide, const char* opcode, unsigned reg, unsigned rm) {
+    emit8(a, 0x40 | (wide << 3) | ((reg >> 3) << 2) | (rm >> 3));
+    while (*opcode != '\0') {
+        emit8(a, (uint8_t) *opcode++);
+    }
+}
+
+/* instruction with a register (or opcode extension) and a [base + disp32] memory operand */
+static void
+emit_mem(struct assembler* a, bool wide, const char* opcode, unsigned reg, unsigned base, int32_t disp) {
+    emit_opcode(a, wide, opcode, reg, base);
+    emit8(a, 0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP) {
+        emit8(a, 0x24);
+    }
+    emit32(a, (uint32_t) disp);
+}
+
+/* instruction with two register operands */
+static void
+emit_reg(struct assembler* a, bool wide, const char* opcode, unsigned reg, unsigned rm) {
+    emit_opcode(a, wide, opcode, reg, rm);
+    emit8(a, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+static void
+emit_push(struct assembler* a, enum reg reg) {
+    if (reg >= R8) {
+        emit8(a, 0x41);
+    }
+    emit8(a, 0x50 + (reg & 7));
+}
+
+static void
+emit_pop(struct assembler* a, enum reg reg) {
+    if (reg >= R8) {
+        emit8(a, 0x41);
+    }
+    emit8(a, 0x58 + (reg & 7));
+}
+
+static void
+emit_mov_imm64(struct assembler* a, enum reg reg, uint64_t value) {
+    emit8(a, 0x48 | (reg >> 3));
+    emit8(a, 0xB8 + (reg & 7));
+    emit64(a, value);
+}
+
+static void
+emit_mov_imm32(struct assembler* a, enum reg reg, uint32_t value) {
+    emit_opcode(a, false, "\xB8", 0, reg);
+    a->code[a->size - 1] += reg & 7;
+    emit32(a, value);
+}
+
+static void
+emit_load(struct assembler* a, enum reg dst, enum reg base, int32_t disp) {
+    emit_mem(a, true, "\x8B", dst, base, disp);
+}
+
+static void
+emit_load32(struct assembler* a, enum reg dst, enum reg base, int32_t disp) {
+    emit_mem(a, false, "\x8B", dst, base, disp);
+}
+
+static void
+emit_store(struct assembler* a, enum reg base, int32_t disp, enum reg src) {
+    emit_mem(a, true, "\x89", src, base, disp);
+}
+
+static void
+emit_store32(struct assembler* a, enum reg base, int32_t disp, enum reg src) {
+    emit_mem(a, false, "\x89", src, base, disp);
+}
+
+static void
+emit_store_imm32(struct assembler* a, bool wide, enum reg base, int32_t disp, uint32_t value) {
+    emit_mem(a, wide, "\xC7", 0, base, disp);
+    emit32(a, value);
+}
+
+static void
+emit_mov(struct assembler* a, enum reg dst, enum reg src) {
+    emit_reg(a, true, "\x89", src, dst);
+}
+
+static void
+emit_add(struct assembler* a, enum reg dst, enum reg src) {
+    emit_reg(a, true, "\x01", src, dst);
+}
+
+static void
+emit_sub(struct assembler* a, enum reg dst, enum reg src) {
+    emit_reg(a, true, "\x29", src, dst);
+}
+
+static void
+emit_add_imm(struct assembler* a, enum reg reg, int32_t value) {
+    if (value < 0) {
+        emit_reg(a, true, "\x81", 5, reg);
+        emit32(a, (uint32_t) -value);
+    } else {
+        emit_reg(a, true, "\x81", 0, reg);
+        emit32(a, (uint32_t) value);
+    }
+}
+
+static void
+emit_shift(struct assembler* a, unsigned extension, enum reg reg, uint8_t count) {
+    emit_reg(a, true, "\xC1", extension, reg);
+    emit8(a, count);
+}
+#define emit_shl(a, reg, count) emit_shift(a, 4, reg, count)
+#define emit_shr(a, reg, count) emit_shift(a, 5, reg, count)
+
+/* cmp dword [base + disp], value */
+static void
+emit_cmp_mem_imm32(struct assembler* a, enum reg base, int32_t disp, uint32_t value) {
+    emit_mem(a, false, "\x81", 7, base, disp);
+    emit32(a, value);
+}
+
+static void
+emit_call(struct assembler* a, const void* fn) {
+    emit_mov_imm64(a, RAX, (uint64_t) (uintptr_t) fn);
+    emit_reg(a, false, "\xFF", 2, RAX);
+}
+
+/* emits a jump with a zero rel32 operand and returns the offset of that operand */
+static uint32_t
+emit_jump(struct assembler* a) {
+    emit8(a, 0xE9);
+    emit32(a, 0);
+    return a->size - 4;
+}
+
+static uint32_t
+emit_jcc(struct assembler* a, enum condition cc) {
+    emit8(a, 0x0F);
+    emit8(a, 0x80 | cc);
+    emit32(a, 0);
+    return a->size - 4;
+}
+
+static void
+patch(struct assembler* a, uint32_t at, uint32_t target) {
+    int32_t rel = (int32_t) (target - (at + 4));
+    memcpy(&a->code[at], &rel, sizeof rel);
+}
+
+static void
+patch_here(struct assembler* a, uint32_t at) {
+    patch(a, at, a->size);
+}
+
+/* call to code offset target within the function itself */
+static void
+emit_call_local(struct assembler* a, uint32_t target) {
+    emit8(a, 0xE8);
+    emit32(a, 0);
+    patch(a, a->size - 4, target);
+}
+
+/* lea reg, [rip + rel32], returns the offset of the rel32 operand */
+static uint32_t
+emit_lea_local(struct assembler* a, enum reg reg) {
+    emit_opcode(a, true, "\x8D", reg, 0);
+    emit8(a, 0x05 | ((reg & 7) << 3));
+    emit32(a, 0);
+    return a->size - 4;
+}
+
+static void
+add_fixup(struct assembler* a, uint32_t at, uint32_t target) {
+    if (a->nfixups == a->fixups_cap) {
+        a->fixups_cap = a->fixups_cap ? a->fixups_cap * 2 : 16;
+        a->fixups = realloc(a->fixups, a->fixups_cap * sizeof *a->fixups);
+        assert(a->fixups != NULL);
+    }
+    a->fixups[a->nfixups++] = (struct fixup) { at, target };
+}
+
+/* loads the frame, locals and stack pointer registers from the VM */
+static void
+emit_load_state(struct assembler* a) {
+    emit_load32(a, RAX, REG_VM, VM_OFFSET(frame_index));
+    emit_reg(a, false, "\x69", RAX, RAX);
+    emit32(a, sizeof(struct frame));
+    emit_load(a, REG_FRAME, REG_VM, VM_OFFSET(frames));
+    emit_add(a, REG_FRAME, RAX);
+
+    emit_load32(a, RAX, REG_FRAME, FRAME_OFFSET(base_pointer));
+    emit_shl(a, RAX, 4);
+    emit_load(a, REG_LOCALS, REG_VM, VM_OFFSET(stack));
+    emit_add(a, REG_LOCALS, RAX);
+
+    emit_load32(a, RAX, REG_VM, VM_OFFSET(stack_pointer));
+    emit_shl(a, RAX, 4);
+    emit_load(a, REG_SP, REG_VM, VM_OFFSET(stack));
+    emit_add(a, REG_SP, RAX);
+}
+
+/* writes the stack pointer register back to vm->stack_pointer */
+static void
+emit_store_stack_pointer(struct assembler* a) {
+    emit_load(a, RAX, REG_VM, VM_OFFSET(stack));
+    emit_mov(a, RCX, REG_SP);
+    emit_sub(a, RCX, RAX);
+    emit_shr(a, RCX, 4);
+    emit_store32(a, REG_VM, VM_OFFSET(stack_pointer), RCX);
+}
+
+/*
+ * Copies the type and the value of an object, leaving out the padding after the type.
+ * Pushes only write the four bytes of the type, so loading eight bytes there would wait for the store to finish.
+ */
+static void
+emit_copy_object(struct assembler* a, enum reg dst, int32_t dst_disp, enum reg src, int32_t src_disp) {
+    emit_load32(a, RCX, src, src_disp + TYPE_OFFSET);
+    emit_load(a, RDX, src, src_disp + VALUE_OFFSET);
+    emit_store32(a, dst, dst_disp + TYPE_OFFSET, RCX);
+    emit_store(a, dst, dst_disp + VALUE_OFFSET, RDX);
+}
+
+static void
+emit_push_object(struct assembler* a, enum reg src, int32_t src_disp) {
+    emit_copy_object(a, REG_SP, 0, src, src_disp);
+    emit_add_imm(a, REG_SP, OBJECT_SIZE);
+}
+
+static void
+emit_push_immediate(struct assembler* a, enum object_type type, int32_t value) {
+    emit_store_imm32(a, false, REG_SP, TYPE_OFFSET, type);
+    emit_store_imm32(a, true, REG_SP, VALUE_OFFSET, (uint32_t) value);
+    emit_add_imm(a, REG_SP, OBJECT_SIZE);
+}
+
+/* executes the instruction at ip through the interpreter's implementation */
+static void
+emit_execute_instruction(struct assembler* a, const uint8_t* ip) {
+    emit_store_stack_pointer(a);
+    emit_mov(a, RDI, REG_VM);
+    emit_mov_imm64(a, RSI, (uint64_t) (uintptr_t) ip);
+    emit_call(a, (const void*) vm_jit_execute_instruction);
+    emit_load_state(a);
+}
+
+/* hands the frame back to the interpreter at ip */
+static void
+emit_deoptimize(struct assembler* a, const uint8_t* ip) {
+    emit_store_stack_pointer(a);
+    emit_mov_imm64(a, RAX, (uint64_t) (uintptr_t) ip);
+    emit_store(a, REG_FRAME, FRAME_OFFSET(ip), RAX);
+    emit_mov_imm32(a, RAX, JIT_DEOPTIMIZED);
+    patch(a, emit_jump(a), a->epilogue);
+}
+
+/* pops the frame, pushes the object in the return slot (the callee's slot) and returns to the caller */
+static void
+emit_return(struct assembler* a) {
+    emit_load32(a, RAX, REG_FRAME, FRAME_OFFSET(base_pointer));
+    emit_store32(a, REG_VM, VM_OFFSET(stack_pointer), RAX);
+    emit_mem(a, false, "\xFF", 1, REG_VM, VM_OFFSET(frame_index));
+
+    // advance the caller's instruction pointer past the operand of its call instruction
+    emit_mem(a, true, "\x83", 0, REG_FRAME, FRAME_OFFSET(ip) - (int32_t) sizeof(struct frame));
+    emit8(a, 1);
+
+    emit_mov_imm32(a, RAX, JIT_RETURNED);
+    patch(a, emit_jump(a), a->epilogue);
+}
+
+enum integer_operation {
+    INT_ADD,
+    INT_SUBTRACT,
+    INT_MULTIPLY,
+    INT_DIVIDE,
+    INT_MODULO,
+    INT_COMPARE,
+};
+
+/*
+ * Inline integer operation on the objects at [left_base + left_disp] and [right_base + right_disp].
+ * The result is written to [REG_SP + result_disp] after which the stack pointer is adjusted by sp_delta.
+ * Falls back to the interpreter if either operand is not an integer or when dividing by zero.
+ */
+static void
+emit_integer_operation(struct assembler* a, const uint8_t* ip, enum integer_operation op, enum condition cc,
+                       enum reg left_base, int32_t left_disp, enum reg right_base, int32_t right_disp,
+                       int32_t result_disp, int32_t sp_delta) {
+    uint32_t slow[3];
+    unsigned nslow = 0;
+
+    emit_cmp_mem_imm32(a, left_base, left_disp + TYPE_OFFSET, OBJ_INT);
+    slow[nslow++] = emit_jcc(a, CC_NE);
+    emit_cmp_mem_imm32(a, right_base, right_disp + TYPE_OFFSET, OBJ_INT);
+    slow[nslow++] = emit_jcc(a, CC_NE);
+
+    emit_load(a, RAX, left_base, left_disp + VALUE_OFFSET);
+    switch (op) {
+        case INT_ADD:
+            emit_mem(a, true, "\x03", RAX, right_base, right_disp + VALUE_OFFSET);
+        break;
+        case INT_SUBTRACT:
+            emit_mem(a, true, "\x2B", RAX, right_base, right_disp + VALUE_OFFSET);
+        break;
+        case INT_MULTIPLY:
+            emit_mem(a, true, "\x0F\xAF", RAX, right_base, right_disp + VALUE_OFFSET);
+        break;
+        case INT_DIVIDE:
+        case INT_MODULO:
+            emit_load(a, RCX, right_base, right_disp + VALUE_OFFSET);
+            emit_reg(a, true, "\x85", RCX, RCX);
+            slow[nslow++] = emit_jcc(a, CC_E);
+            emit8(a, 0x48);
+            emit8(a, 0x99);
+            emit_reg(a, true, "\xF7", 7, RCX);
+            if (op == INT_MODULO) {
+                emit_mov(a, RAX, RDX);
+            }
+        break;
+        case INT_COMPARE:
+            emit_mem(a, true, "\x3B", RAX, right_base, right_disp + VALUE_OFFSET);
+            emit_reg(a, false, (const char[]) { 0x0F, (char) (0x90 | cc), 0 }, 0, RAX);
+            emit_reg(a, false, "\x0F\xB6", RAX, RAX);
+        break;
+    }
+
+    emit_store_imm32(a, false, REG_SP, result_disp + TYPE_OFFSET, op == INT_COMPARE ? OBJ_BOOL : OBJ_INT);
+    emit_store(a, REG_SP, result_disp + VALUE_OFFSET, RAX);
+    emit_add_imm(a, REG_SP, sp_delta);
+    uint32_t done = emit_jump(a);
+
+    for (unsigned i = 0; i < nslow; i++) {
+        patch_here(a, slow[i]);
+    }
+    emit_execute_instruction(a, ip);
+    patch_here(a, done);
+}
+
+/* inline array[int] with the same operand and result conventions as emit_integer_operation */
+static void
+emit_index_get(struct assembler* a, const uint8_t* ip, enum reg left_base, int32_t left_disp,
+               enum reg index_base, int32_t index_disp, int32_t result_disp, int32_t sp_delta) {
+    uint32_t slow[3];
+    emit_cmp_mem_imm32(a, left_base, left_disp + TYPE_OFFSET, OBJ_ARRAY);
+    slow[0] = emit_jcc(a, CC_NE);
+    emit_cmp_mem_imm32(a, index_base, index_disp + TYPE_OFFSET, OBJ_INT);
+    slow[1] = emit_jcc(a, CC_NE);
+
+    // negative indices are handled by the interpreter as they wrap around
+    emit_load(a, RAX, left_base, left_disp + VALUE_OFFSET);
+    emit_load(a, RCX, index_base, index_disp + VALUE_OFFSET);
+    emit_load32(a, RDX, RAX, LIST_OFFSET(size));
+    emit_reg(a, true, "\x39", RDX, RCX);
+    slow[2] = emit_jcc(a, CC_AE);
+
+    emit_load(a, RAX, RAX, LIST_OFFSET(values));
+    emit_shl(a, RCX, 4);
+    emit_add(a, RAX, RCX);
+    emit_copy_object(a, REG_SP, result_disp, RAX, 0);
+    emit_add_imm(a, REG_SP, sp_delta);
+    uint32_t done = emit_jump(a);
+
+    for (unsigned i = 0; i < 3; i++) {
+        patch_here(a, slow[i]);
+    }
+    emit_execute_instruction(a, ip);
+    patch_here(a, done);
+}
+
+static void
+emit_jump_not_true(struct assembler* a, uint32_t target) {
+    emit_add_imm(a, REG_SP, -OBJECT_SIZE);
+    emit_load32(a, RAX, REG_SP, TYPE_OFFSET);
+    emit_reg(a, false, "\x85", RAX, RAX);
+    add_fixup(a, emit_jcc(a, CC_E), target);
+    emit_reg(a, false, "\x81", 7, RAX);
+    emit32(a, OBJ_BOOL);
+    uint32_t not_bool = emit_jcc(a, CC_NE);
+    emit_mem(a, false, "\x80", 7, REG_SP, VALUE_OFFSET);
+    emit8(a, 0);
+    add_fixup(a, emit_jcc(a, CC_E), target);
+    patch_here(a, not_bool);
+}
+
+static void
+emit_jump_true(struct assembler* a, uint32_t target) {
+    emit_add_imm(a, REG_SP, -OBJECT_SIZE);
+    emit_load32(a, RAX, REG_SP, TYPE_OFFSET);
+    emit_reg(a, false, "\x85", RAX, RAX);
+    uint32_t is_null = emit_jcc(a, CC_E);
+    emit_reg(a, false, "\x81", 7, RAX);
+    emit32(a, OBJ_BOOL);
+    add_fixup(a, emit_jcc(a, CC_NE), target);
+    emit_mem(a, false, "\x80", 7, REG_SP, VALUE_OFFSET);
+    emit8(a, 0);
+    add_fixup(a, emit_jcc(a, CC_NE), target);
+    patch_here(a, is_null);
+}
+
+static void
+emit_prologue(struct assembler* a) {
+    // five pushes keep the stack 16-byte aligned for calls into C
+    emit_push(a, RBX);
+    emit_push(a, R12);
+    emit_push(a, R13);
+    emit_push(a, R14);
+    emit_push(a, R15);
+    emit_mov(a, REG_VM, RDI);
+    emit_load(a, REG_CONSTANTS, REG_VM, VM_OFFSET(constants));
+    emit_load_state(a);
+    emit_reg(a, false, "\xFF", 4, RSI);
+
+    a->epilogue = a->size;
+    emit_pop(a, R15);
+    emit_pop(a, R14);
+    emit_pop(a, R13);
+    emit_pop(a, R12);
+    emit_pop(a, RBX);
+    emit8(a, 0xC3);
+}
+
+/* adds delta to the integer object at [base + disp] in place, other types go through the interpreter */
+static void
+emit_increment(struct assembler* a, const uint8_t* ip, enum reg base, int32_t disp, int8_t delta) {
+    emit_cmp_mem_imm32(a, base, disp + TYPE_OFFSET, OBJ_INT);
+    uint32_t not_int = emit_jcc(a, CC_NE);
+    // add or sub qword [base + disp], 1
+    emit_mem(a, true, "\x83", delta > 0 ? 0 : 5, base, disp + VALUE_OFFSET);
+    emit8(a, 1);
+    uint32_t done = emit_jump(a);
+    patch_here(a, not_int);
+    emit_execute_instruction(a, ip);
+    patch_here(a, done);
+}
+
+/*
+ * Calls the function being compiled from its own native code, without going through the interpreter.
+ * The arguments move up to make room for the function, then a frame is pushed and the native code entered again
+ * through its prologue. If the frames or the stack have to grow, or native code is nested too deep,
+ * the call goes through vm_jit_call() instead.
+ */
+static void
+emit_call_self(struct assembler* a, uint8_t num_args) {
+    for (int32_t i = num_args; i > 0; i--) {
+        emit_copy_object(a, REG_SP, (1 - i) * OBJECT_SIZE, REG_SP, -i * OBJECT_SIZE);
+    }
+    emit_store_imm32(a, false, REG_SP, -num_args * OBJECT_SIZE + TYPE_OFFSET, OBJ_COMPILED_FUNCTION);
+    emit_mov_imm64(a, RAX, (uint64_t) (uintptr_t) a->fn);
+    emit_store(a, REG_SP, -num_args * OBJECT_SIZE + VALUE_OFFSET, RAX);
+    emit_add_imm(a, REG_SP, OBJECT_SIZE);
+
+    uint32_t slow[3];
+    emit_cmp_mem_imm32(a, REG_VM, VM_OFFSET(jit_depth), JIT_MAX_DEPTH);
+    slow[0] = emit_jcc(a, CC_AE);
+
+    // rcx = index of the new frame
+    emit_load32(a, RCX, REG_VM, VM_OFFSET(frame_index));
+    emit_add_imm(a, RCX, 1);
+    emit_mem(a, false, "\x3B", RCX, REG_VM, VM_OFFSET(frames_cap));
+    slow[1] = emit_jcc(a, CC_AE);
+
+    // rax = base pointer of the new frame, rdx = stack slots it needs
+    emit_load(a, RDX, REG_VM, VM_OFFSET(stack));
+    emit_mov(a, RAX, REG_SP);
+    emit_sub(a, RAX, RDX);
+    emit_shr(a, RAX, 4);
+    emit_add_imm(a, RAX, -(int32_t) num_args);
+    emit_mov(a, RDX, RAX);
+    emit_add_imm(a, RDX, (int32_t) (a->fn->num_locals + a->fn->max_stack_depth));
+    emit_mem(a, false, "\x3B", RDX, REG_VM, VM_OFFSET(stack_cap));
+    slow[2] = emit_jcc(a, CC_A);
+
+    emit_store32(a, REG_VM, VM_OFFSET(frame_index), RCX);
+    emit_reg(a, false, "\x69", RCX, RCX);
+    emit32(a, sizeof(struct frame));
+    emit_load(a, RDX, REG_VM, VM_OFFSET(frames));
+    emit_add(a, RDX, RCX);
+    emit_mov_imm64(a, RCX, (uint64_t) (uintptr_t) a->fn->instructions.bytes);
+    emit_store(a, RDX, FRAME_OFFSET(ip), RCX);
+    emit_mov_imm64(a, RCX, (uint64_t) (uintptr_t) a->fn);
+    emit_store(a, RDX, FRAME_OFFSET(fn), RCX);
+    emit_store32(a, RDX, FRAME_OFFSET(base_pointer), RAX);
+    emit_add_imm(a, RAX, (int32_t) a->fn->num_locals);
+    emit_store32(a, REG_VM, VM_OFFSET(stack_pointer), RAX);
+
+    // enter through the prologue with the code of the first instruction as entry point, counting the activation like vm_jit_run()
+    emit_mem(a, false, "\xFF", 0, REG_VM, VM_OFFSET(jit_depth));
+    emit_mov(a, RDI, REG_VM);
+    add_fixup(a, emit_lea_local(a, RSI), 0);
+    emit_call_local(a, 0);
+    emit_mem(a, false, "\xFF", 1, REG_VM, VM_OFFSET(jit_depth));
+
+    // test eax, eax: a callee that fell back to the interpreter still has its frame
+    emit_reg(a, false, "\x85", RAX, RAX);
+    uint32_t returned = emit_jcc(a, CC_E);
+    emit_mov(a, RDI, REG_VM);
+    emit_call(a, (const void*) vm_jit_finish_call);
+    uint32_t done = emit_jump(a);
+
+    for (unsigned i = 0; i < 3; i++) {
+        patch_here(a, slow[i]);
+    }
+    emit_store_stack_pointer(a);
+    emit_mov(a, RDI, REG_VM);
+    emit_mov_imm32(a, RSI, num_args);
+    emit_call(a, (const void*) vm_jit_call);
+
+    patch_here(a, returned);
+    patch_here(a, done);
+    emit_load_state(a);
+}
+
+/* calls the function being compiled in tail position: the arguments replace the locals and its native code starts over */
+static void
+emit_tail_call_self(struct assembler* a, uint8_t num_args) {
+    for (int32_t i = 0; i < num_args; i++) {
+        emit_copy_object(a, REG_LOCALS, i * OBJECT_SIZE, REG_SP, (i - num_args) * OBJECT_SIZE);
+    }
+    emit_mov(a, REG_SP, REG_LOCALS);
+    emit_add_imm(a, REG_SP, (int32_t) (a->fn->num_locals * OBJECT_SIZE));
+    add_fixup(a, emit_jump(a), 0);
+}
+
+static void
+emit_instruction(struct assembler* a, uint8_t* ip) {
+    #define STACK(n) REG_SP, (n) * OBJECT_SIZE
+    #define LOCAL(n) REG_LOCALS, (n) * OBJECT_SIZE
+    #define CONSTANT(n) REG_CONSTANTS, (n) * OBJECT_SIZE
+    // globals are addressed through rax, which has to be loaded with vm->globals first
+    #define GLOBAL(n) RAX, (n) * OBJECT_SIZE
+
+    switch ((enum opcode) *ip) {
+        case OPCODE_CONST:
+            emit_push_object(a, CONSTANT(read_uint16(ip + 1)));
+        break;
+
+        case OPCODE_PUSH_INT8:
+            emit_push_immediate(a, OBJ_INT, (int8_t) read_uint8(ip + 1));
+        break;
+
+        case OPCODE_PUSH_INT16:
+            emit_push_immediate(a, OBJ_INT, (int16_t) read_uint16(ip + 1));
+        break;
+
+        case OPCODE_POP:
+            emit_add_imm(a, REG_SP, -OBJECT_SIZE);
+        break;
+
+        case OPCODE_TRUE:
+            emit_push_immediate(a, OBJ_BOOL, 1);
+        break;
+
+        case OPCODE_FALSE:
+            emit_push_immediate(a, OBJ_BOOL, 0);
+        break;
+
+        case OPCODE_NULL:
+            emit_push_immediate(a, OBJ_NULL, 0);
+        break;
+
+        case OPCODE_GET_LOCAL:
+            emit_push_object(a, LOCAL(read_uint8(ip + 1)));
+        break;
+
+        case OPCODE_SET_LOCAL:
+            emit_add_imm(a, REG_SP, -OBJECT_SIZE);
+            emit_copy_object(a, LOCAL(read_uint8(ip + 1)), STACK(0));
+        break;
+
+        case OPCODE_GET_GLOBAL:
+            emit_load(a, RAX, REG_VM, VM_OFFSET(globals));
+            emit_push_object(a, GLOBAL(read_uint16(ip + 1)));
+        break;
+
+        case OPCODE_SET_GLOBAL:
+            emit_add_imm(a, REG_SP, -OBJECT_SIZE);
+            emit_load(a, RAX, REG_VM, VM_OFFSET(globals));
+            emit_copy_object(a, GLOBAL(read_uint16(ip + 1)), STACK(0));
+        break;
+
+        case OPCODE_INC_LOCAL:
+        case OPCODE_INT_INC_LOCAL:
+            emit_increment(a, ip, LOCAL(read_uint8(ip + 1)), 1);
+        break;
+
+        case OPCODE_DEC_LOCAL:
+        case OPCODE_INT_DEC_LOCAL:
+            emit_increment(a, ip, LOCAL(read_uint8(ip + 1)), -1);
+        break;
+
+        case OPCODE_INC_GLOBAL:
+            emit_load(a, RAX, REG_VM, VM_OFFSET(globals));
+            emit_increment(a, ip, GLOBAL(read_uint16(ip + 1)), 1);
+        break;
+
+        case OPCODE_JUMP:
+            add_fixup(a, emit_jump(a), read_uint16(ip + 1));
+        break;
+
+        case OPCODE_JUMP_NOT_TRUE:
+            emit_jump_not_true(a, read_uint16(ip + 1));
+        break;
+
+        case OPCODE_JUMP_TRUE:
+            emit_jump_true(a, read_uint16(ip + 1));
+        break;
+
+        // compare-and-branch instructions push their result like the comparison they fuse and jump on it
+        case OPCODE_JUMP_IF_NOT_EQUAL:
+            emit_integer_operation(a, ip, INT_COMPARE, CC_E, STACK(-2), STACK(-1), -2 * OBJECT_SIZE, -OBJECT_SIZE);
+            emit_jump_not_true(a, read_uint16(ip + 1));
+        break;
+
+        case OPCODE_JUMP_IF_EQUAL:
+            emit_integer_operation(a, ip, INT_COMPARE, CC_NE, STACK(-2), STACK(-1), -2 * OBJECT_SIZE, -OBJECT_SIZE);
+            emit_jump_not_true(a, read_uint16(ip + 1));
+        break;
+
+        case OPCODE_JUMP_IF_NOT_GREATER_THAN:
+            emit_integer_operation(a, ip, INT_COMPARE, CC_G, STACK(-2), STACK(-1), -2 * OBJECT_SIZE, -OBJECT_SIZE);
+            emit_jump_not_true(a, read_uint16(ip + 1));
+        break;
+
+        case OPCODE_JUMP_IF_NOT_GREATER_THAN_OR_EQUALS:
+            emit_integer_operation(a, ip, INT_COMPARE, CC_GE, STACK(-2), STACK(-1), -2 * OBJECT_SIZE, -OBJECT_SIZE);
+            emit_jump_not_true(a, read_uint16(ip + 1));
+        break;
+
+        case OPCODE_JUMP_IF_NOT_LESS_THAN:
+            emit_integer_operation(a, ip, INT_COMPARE, CC_L, STACK(-2), STACK(-1), -2 * OBJECT_SIZE, -OBJECT_SIZE);
+            emit_jump_not_true(a, read_uint16(ip + 1));
+        break;
+
+        case OPCODE_JUMP_IF_NOT_LESS_THAN_OR_EQUALS:
+            emit_integer_operation(a, ip, INT_COMPARE, CC_LE, STACK(-2), STACK(-1), -2 * OBJECT_SIZE, -OBJECT_SIZE);
+            emit_jump_not_true(a, read_uint16(ip + 1));
+        break;
+
+        case OPCODE_JUMP_IF_NOT_LESS_THAN_LOCAL_CONST:
+            emit_integer_operation(a, ip, INT_COMPARE, CC_L, LOCAL(read_uint8(ip + 3)), CONSTANT(read_uint16(ip + 4)), 0, OBJECT_SIZE);
+            emit_jump_not_true(a, read_uint16(ip + 1));
+        break;
+
+        case OPCODE_JUMP_IF_NOT_LESS_THAN_LOCAL_LOCAL:
+            emit_integer_operation(a, ip, INT_COMPARE, CC_L, LOCAL(read_uint8(ip + 3)), LOCAL(read_uint8(ip + 4)), 0, OBJECT_SIZE);
+            emit_jump_not_true(a, read_uint16(ip + 1));
+        break;
+
+        case OPCODE_JUMP_IF_NOT_EQUAL_LOCAL_CONST:
+            emit_integer_operation(a, ip, INT_COMPARE, CC_E, LOCAL(read_uint8(ip + 3)), CONSTANT(read_uint16(ip + 4)), 0, OBJECT_SIZE);
+            emit_jump_not_true(a, read_uint16(ip + 1));
+        break;
+
+        case OPCODE_CALL:
+        case OPCODE_CALL_FUNCTION:
+        case OPCODE_CALL_BUILTIN:
+            emit_store_stack_pointer(a);
+            emit_mov(a, RDI, REG_VM);
+            emit_mov_imm32(a, RSI, read_uint8(ip + 1));
+            emit_call(a, (const void*) vm_jit_call);
+            emit_load_state(a);
+        break;
+
+        case OPCODE_CALL_SELF:
+            emit_call_self(a, read_uint8(ip + 1));
+        break;
+
+        case OPCODE_TAIL_CALL_SELF:
+            emit_tail_call_self(a, read_uint8(ip + 1));
+        break;
+
+        case OPCODE_RETURN_VALUE:
+            emit_copy_object(a, LOCAL(-1), STACK(-1));
+            emit_return(a);
+        break;
+
+        case OPCODE_RETURN:
+            emit_store_imm32(a, false, LOCAL(-1), OBJ_NULL);
+            emit_return(a);
+        break;
+
+        case OPCODE_ADD:
+        case OPCODE_ADD_INT:
+        case OPCODE_INT_ADD:
+            emit_integer_operation(a, ip, INT_ADD, 0, STACK(-2), STACK(-1), -2 * OBJECT_SIZE, -OBJECT_SIZE);
+        break;
+
+        case OPCODE_SUBTRACT:
+        case OPCODE_SUBTRACT_INT:
+        case OPCODE_INT_SUBTRACT:
+            emit_integer_operation(a, ip, INT_SUBTRACT, 0, STACK(-2), STACK(-1), -2 * OBJECT_SIZE, -OBJECT_SIZE);
+        break;
+
+        case OPCODE_MULTIPLY:
+        case OPCODE_MULTIPLY_INT:
+        case OPCODE_INT_MULTIPLY:
+            emit_integer_operation(a, ip, INT_MULTIPLY, 0, STACK(-2), STACK(-1), -2 * OBJECT_SIZE, -OBJECT_SIZE);
+        break;
+
+        case OPCODE_DIVIDE:
+        case OPCODE_DIVIDE_INT:
+            emit_integer_operation(a, ip, INT_DIVIDE, 0, STACK(-2), STACK(-1), -2 * OBJECT_SIZE, -OBJECT_SIZE);
+        break;
+
+        case OPCODE_MODULO:
+        case OPCODE_MODULO_INT:
+            emit_integer_operation(a, ip, INT_MODULO, 0, STACK(-2), STACK(-1), -2 * OBJECT_SIZE, -OBJECT_SIZE);
+        break;
+
+        case OPCODE_EQUAL:
+        case OPCODE_EQUAL_INT:
+        case OPCODE_INT_EQUAL:
+            emit_integer_operation(a, ip, INT_COMPARE, CC_E, STACK(-2), STACK(-1), -2 * OBJECT_SIZE, -OBJECT_SIZE);
+        break;
+
+        case OPCODE_NOT_EQUAL:
+        case OPCODE_NOT_EQUAL_INT:
+        case OPCODE_INT_NOT_EQUAL:
+            emit_integer_operation(a, ip, INT_COMPARE, CC_NE, STACK(-2), STACK(-1), -2 * OBJECT_SIZE, -OBJECT_SIZE);
+        break;
+
+        case OPCODE_GREATER_THAN:
+        case OPCODE_GREATER_THAN_INT:
+        case OPCODE_INT_GREATER_THAN:
+            emit_integer_operation(a, ip, INT_COMPARE, CC_G, STACK(-2), STACK(-1), -2 * OBJECT_SIZE, -OBJECT_SIZE);
+        break;
+
+        case OPCODE_GREATER_THAN_OR_EQUALS:
+        case OPCODE_GREATER_THAN_OR_EQUALS_INT:
+        case OPCODE_INT_GREATER_THAN_OR_EQUALS:
+            emit_integer_operation(a, ip, INT_COMPARE, CC_GE, STACK(-2), STACK(-1), -2 * OBJECT_SIZE, -OBJECT_SIZE);
+        break;
+
+        case OPCODE_LESS_THAN:
+        case OPCODE_LESS_THAN_INT:
+        case OPCODE_INT_LESS_THAN:
+            emit_integer_operation(a, ip, INT_COMPARE, CC_L, STACK(-2), STACK(-1), -2 * OBJECT_SIZE, -OBJECT_SIZE);
+        break;
+
+        case OPCODE_LESS_THAN_OR_EQUALS:
+        case OPCODE_LESS_THAN_OR_EQUALS_INT:
+        case OPCODE_INT_LESS_THAN_OR_EQUALS:
+            emit_integer_operation(a, ip, INT_COMPARE, CC_LE, STACK(-2), STACK(-1), -2 * OBJECT_SIZE, -OBJECT_SIZE);
+        break;
+
+        case OPCODE_ADD_LOCAL_CONST:
+            emit_integer_operation(a, ip, INT_ADD, 0, LOCAL(read_uint8(ip + 1)), CONSTANT(read_uint16(ip + 2)), 0, OBJECT_SIZE);
+        break;
+
+        case OPCODE_SUBTRACT_LOCAL_CONST:
+            emit_integer_operation(a, ip, INT_SUBTRACT, 0, LOCAL(read_uint8(ip + 1)), CONSTANT(read_uint16(ip + 2)), 0, OBJECT_SIZE);
+        break;
+
+        case OPCODE_LESS_THAN_LOCAL_CONST:
+            emit_integer_operation(a, ip, INT_COMPARE, CC_L, LOCAL(read_uint8(ip + 1)), CONSTANT(read_uint16(ip + 2)), 0, OBJECT_SIZE);
+        break;
+
+        case OPCODE_EQUAL_LOCAL_CONST:
+            emit_integer_operation(a, ip, INT_COMPARE, CC_E, LOCAL(read_uint8(ip + 1)), CONSTANT(read_uint16(ip + 2)), 0, OBJECT_SIZE);
+        break;
+
+        case OPCODE_ADD_LOCAL_LOCAL:
+            emit_integer_operation(a, ip, INT_ADD, 0, LOCAL(read_uint8(ip + 1)), LOCAL(read_uint8(ip + 2)), 0, OBJECT_SIZE);
+        break;
+
+        case OPCODE_LESS_THAN_LOCAL_LOCAL:
+            emit_integer_operation(a, ip, INT_COMPARE, CC_L, LOCAL(read_uint8(ip + 1)), LOCAL(read_uint8(ip + 2)), 0, OBJECT_SIZE);
+        break;
+
+        case OPCODE_INDEX_GET:
+        case OPCODE_INDEX_GET_ARRAY_INT:
+        case OPCODE_INDEX_GET_IN_BOUNDS:
+            emit_index_get(a, ip, STACK(-2), STACK(-1), -2 * OBJECT_SIZE, -OBJECT_SIZE);
+        break;
+
+        case OPCODE_INDEX_GET_LOCAL_LOCAL:
+        case OPCODE_INDEX_GET_LOCAL_LOCAL_IN_BOUNDS:
+            emit_index_get(a, ip, LOCAL(read_uint8(ip + 1)), LOCAL(read_uint8(ip + 2)), 0, OBJECT_SIZE);
+        break;
+
+        case OPCODE_AND:
+        case OPCODE_OR:
+        case OPCODE_MINUS:
+        case OPCODE_BANG:
+        case OPCODE_BOOL_EQUAL:
+        case OPCODE_BOOL_NOT_EQUAL:
+        case OPCODE_BOOL_BANG:
+        case OPCODE_GET_BUILTIN:
+        case OPCODE_ARRAY:
+        case OPCODE_INDEX_SET:
+        case OPCODE_INDEX_SET_IN_BOUNDS:
+        case OPCODE_SLICE:
+        case OPCODE_LEN:
+        case OPCODE_INT:
+        case OPCODE_ARRAY_PUSH:
+        case OPCODE_ARRAY_POP:
+            emit_execute_instruction(a, ip);
+        break;
+
+        // the interpreter replaces the frame's function, which then continues in its own native code
+        case OPCODE_TAIL_CALL:
+        case OPCODE_HALT:
+        default:
+            emit_deoptimize(a, ip);
+        break;
+    }
+
+    #undef STACK
+    #undef LOCAL
+    #undef CONSTANT
+    #undef GLOBAL
+}
+
+static void
+jit_release(struct jit_function* jit) {
+    munmap(jit, jit->mapping_size);
+}
+
+bool
+jit_compile(struct compiled_function* fn) {
+    const uint32_t ninstructions = fn->instructions.size;
+    uint32_t* offsets = malloc(ninstructions * sizeof *offsets);
+    assert(offsets != NULL);
+    for (uint32_t i = 0; i < ninstructions; i++) {
+        offsets[i] = UINT32_MAX;
+    }
+
+    struct assembler a = {
+        .fn = fn,
+        .code = malloc(1024),
+        .cap = 1024,
+    };
+    assert(a.code != NULL);
+    emit_prologue(&a);
+    for (uint32_t pos = 0; pos < ninstructions; pos += instruction_width(fn->instructions.bytes[pos])) {
+        offsets[pos] = a.size;
+        emit_instruction(&a, &fn->instructions.bytes[pos]);
+    }
+    for (uint32_t i = 0; i < a.nfixups; i++) {
+        assert(a.fixups[i].target < ninstructions && offsets[a.fixups[i].target] != UINT32_MAX);
+        patch(&a, a.fixups[i].at, offsets[a.fixups[i].target]);
+    }
+
+    // the header and offset table share a mapping with the code
+    size_t header_size = sizeof(struct jit_function) + ninstructions * sizeof *offsets;
+    header_size = (header_size + 15) & ~(size_t) 15;
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    size_t mapping_size = (header_size + a.size + page_size - 1) & ~(page_size - 1);
+    struct jit_function* jit = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    bool ok = jit != MAP_FAILED;
+    if (ok) {
+        uint8_t* code = (uint8_t*) jit + header_size;
+        memcpy(code, a.code, a.size);
+        memcpy(jit->offsets, offsets, ninstructions * sizeof *offsets);
+        jit->code = (enum jit_status (*)(struct vm*, const void*)) (void*) code;
+        jit->release = jit_release;
+        jit->mapping_size = mapping_size;
+        jit->ninstructions = ninstructions;
+        ok = mprotect(jit, mapping_size, PROT_READ | PROT_EXEC) == 0;
+        if (ok) {
+            fn->jit = jit;
+        } else {
+            munmap(jit, mapping_size);
+        }
+    }
+
+    free(a.code);
+    free(a.fixups);
+    free(offsets);
+    return ok;
+}
+
+enum jit_status
+jit_run(struct vm* vm, struct frame* frame) {
+    struct jit_function* jit = frame->fn->jit;
+    uint32_t pos = (uint32_t) (frame->ip - frame->fn->instructions.bytes);
+    assert(pos < jit->ninstructions && jit->offsets[pos] != UINT32_MAX);
+    const uint8_t* code = (const uint8_t*) (void*) jit->code;
+    return jit->code(vm, code + jit->offsets[pos]);
+}
+
+#else
+
+bool
+jit_compile(__attribute__((unused)) struct compiled_function* fn) {
+    return false;
+}
+
+enum jit_status
+jit_run(__attribute__((unused)) struct vm* vm, __attribute__((unused)) struct frame* frame) {
+    return JIT_DEOPTIMIZED;
+}
+
+#endif
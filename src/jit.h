@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "object.h"
+
+struct vm;
+struct frame;
+
+/* number of calls or loop iterations after which a function is compiled to native code */
+#define JIT_THRESHOLD 1000u
+
+/* 
+ * every call made from native code nests on the C stack until the callee returns,
+ * calls nested deeper than this stay in the interpreter, which keeps its frames on the heap
+ */
+#define JIT_MAX_DEPTH 256u
+
+enum jit_status {
+    /* the function returned: its frame was popped and the return value pushed onto the caller's stack */
+    JIT_RETURNED = 0,
+    /* native code stopped at an instruction it does not handle, the interpreter continues at frame->ip */
+    JIT_DEOPTIMIZED,
+};
+
+/*
+ * Native code for a compiled function, living in its own executable mapping.
+ * The code operates directly on the VM stack, frames and globals so that execution
+ * can move between the interpreter and native code at any instruction boundary.
+ */
+struct jit_function {
+    enum jit_status (*code)(struct vm* vm, const void* entry);
+    /* unmaps this function, called when the owning compiled_function is freed */
+    void (*release)(struct jit_function* jit);
+    size_t mapping_size;
+    uint32_t ninstructions;
+    /* offset into the native code for every bytecode position, or UINT32_MAX if no instruction starts there */
+    uint32_t offsets[];
+};
+
+bool jit_compile(struct compiled_function* fn);
+enum jit_status jit_run(struct vm* vm, struct frame* frame);
+
+/* runtime helpers called from native code, implemented in vm.c */
+void vm_jit_call(struct vm* vm, uint8_t num_args);
+void vm_jit_finish_call(struct vm* vm);
+void vm_jit_execute_instruction(struct vm* vm, const uint8_t* ip);
@@ -8,6 +8,7 @@
 #include "util.h"
 #include "opcode.h"
 #include "object.h"
+#include "jit.h"
 
 const char *object_type_to_str(enum object_type t) 
 {
@@ -24,42 +25,32 @@ const char *object_type_to_str(enum object_type t)
     return object_names[t];
 }
   
-struct object make_integer_object(int64_t value) 
+#ifdef TAGGED_OBJECTS
+struct object make_boxed_integer_object(int64_t value)
 {
-    return (struct object) {
-        .type = OBJ_INT,
-        .value.integer = value,
-    };
-}
-
-struct object make_boolean_object(bool value)
-{
-    return (struct object) {
-        .type = OBJ_BOOL,
-        .value.boolean = value
-    };
+    struct boxed_integer* boxed = malloc(sizeof *boxed);
+    assert(boxed != NULL);
+    boxed->value = value;
+    boxed->gc_meta.marked = false;
+    return make_pointer_object(OBJ_INT, boxed);
 }
+#endif 
 
 struct object make_array_object(struct object_list *elements) 
 {
-    struct object obj;
-    obj.type = OBJ_ARRAY;
-    obj.value.list = elements;
     elements->gc_meta.marked = false;
-    return obj;
+    return make_pointer_object(OBJ_ARRAY, elements);
 }
 
 struct object make_string_object_with_length(const char *str, size_t length)
 {
-    struct object obj;
-    obj.type = OBJ_STRING;
-    obj.value.string = malloc(sizeof(*obj.value.string) + length + 1);
-    assert(obj.value.string != NULL);
-    obj.value.string->gc_meta.marked = false;
-    obj.value.string->value = (char*) (obj.value.string + 1);
-    strcpy(obj.value.string->value, str);
-    obj.value.string->length = length;
-    return obj;
+    struct string* string = malloc(sizeof(*string) + length + 1);
+    assert(string != NULL);
+    string->gc_meta.marked = false;
+    string->value = (char*) (string + 1);
+    strcpy(string->value, str);
+    string->length = length;
+    return make_pointer_object(OBJ_STRING, string);
 }
 
 struct object make_string_object(const char *str)
@@ -70,71 +61,77 @@ struct object make_string_object(const char *str)
 struct object concat_string_objects(struct string* left, struct string* right)
 {
     struct object obj = make_string_object_with_length(left->value, left->length + right->length); 
-    strcpy(obj.value.string->value + left->length, right->value);
+    strcpy(obj_string(obj)->value + left->length, right->value);
     return obj;
 }
 
 struct object make_error_object(const char *format, ...) 
 {
     va_list args;
-    struct object obj;
-    obj.type = OBJ_ERROR;
 
     // assume all expansions in the format string take up at most 64 bytes
     uint32_t len = strlen(format) + 64;
-    obj.value.error = malloc(sizeof(*obj.value.error) + len);
-    assert(obj.value.error != NULL);
-    obj.value.error->gc_meta.marked = false;
-    obj.value.error->value = (char*) (obj.value.error + 1);
+    struct error* error = malloc(sizeof(*error) + len);
+    assert(error != NULL);
+    error->gc_meta.marked = false;
+    error->value = (char*) (error + 1);
     va_start(args, format);  
-    vsnprintf(obj.value.error->value, len + 64, format, args);
+    vsnprintf(error->value, len + 64, format, args);
     va_end(args);
-    return obj;
+    return make_pointer_object(OBJ_ERROR, error);
 }
 
 struct object make_compiled_function_object(const struct instruction *ins, uint32_t num_locals) {
-    struct object obj;
-    obj.type = OBJ_COMPILED_FUNCTION;
     struct compiled_function *f = malloc(sizeof (struct compiled_function) + ins->size);
     assert(f != NULL);
     f->num_locals = num_locals;
+    f->max_stack_depth = 0;
+    f->hotness = 0;
+    f->jit = NULL;
     f->instructions.cap = ins->size;
     f->instructions.size = ins->size;
     f->instructions.bytes = (uint8_t *) (f + 1);
     memcpy(f->instructions.bytes, ins->bytes, ins->size);
-    obj.value.fn_compiled = f;
     f->gc_meta.marked = false;
-    return obj;
+    return make_pointer_object(OBJ_COMPILED_FUNCTION, f);
 }   
  
  // deep copy, incl. all children and values pointed to
 struct object copy_object(const struct object* restrict obj) {
-    switch (obj->type) {
+    switch (obj_type(*obj)) {
+        case OBJ_INT:
+            #ifdef TAGGED_OBJECTS
+            if (obj_is_boxed_integer(*obj)) {
+                return make_boxed_integer_object(obj_int(*obj));
+            }
+            #endif
+            // fallthrough
         case OBJ_BOOL:
         case OBJ_NULL:
         case OBJ_BUILTIN:
-        case OBJ_INT:
             // these values contain no pointers, so we can just dereference them
             return *obj;
             break;
 
         case OBJ_ERROR: 
-            return make_error_object(obj->value.error->value);
+            return make_error_object(obj_error(*obj)->value);
             break;
         
         case OBJ_STRING:
-            return make_string_object(obj->value.string->value);
+            return make_string_object(obj_string(*obj)->value);
             break;
 
         case OBJ_ARRAY: {
-            struct object_list* list = obj->value.list;
+            struct object_list* list = obj_list(*obj);
             return make_array_object(copy_object_list(list));
             break;    
         }
 
         case OBJ_COMPILED_FUNCTION: {
-            struct compiled_function* f = obj->value.fn_compiled;
-            return make_compiled_function_object(&f->instructions, f->num_locals);
+            struct compiled_function* f = obj_fn(*obj);
+            struct object copy = make_compiled_function_object(&f->instructions, f->num_locals);
+            obj_fn(copy)->max_stack_depth = f->max_stack_depth;
+            return copy;
         }
         break;  
 
@@ -146,32 +143,44 @@ struct object copy_object(const struct object* restrict obj) {
 
 void free_object(struct object* restrict obj)
 {   
-    switch (obj->type) {
+    switch (obj_type(*obj)) {
+        case OBJ_INT:
+            #ifdef TAGGED_OBJECTS
+            if (obj_is_boxed_integer(*obj)) {
+                free((void*) object_payload(*obj));
+            }
+            #endif
+            return;
+            break;
+
         case OBJ_NULL: 
         case OBJ_BOOL: 
-        case OBJ_INT:
         case OBJ_BUILTIN:
             return;
             break;
 
         case OBJ_COMPILED_FUNCTION: {
-            free(obj->value.fn_compiled);
+            struct jit_function* jit = obj_fn(*obj)->jit;
+            if (jit != NULL) {
+                jit->release(jit);
+            }
+            free(obj_fn(*obj));
             break;
         }
         case OBJ_ARRAY: {
             // Note that we do not free the values in the list here
             // As these are also handled by the GC
-            struct object_list* list = obj->value.list;
+            struct object_list* list = obj_list(*obj);
             free_object_list(list);
             break;
         }
 
         case OBJ_STRING:
-            free(obj->value.string);
+            free(obj_string(*obj));
         break;
 
         case OBJ_ERROR:
-            free(obj->value.error);
+            free(obj_error(*obj));
         break;
 
         default: 
@@ -224,29 +233,29 @@ struct object_list *copy_object_list(const struct object_list *original) {
 
 void print_object(struct object obj) 
 {
-    switch (obj.type)
+    switch (obj_type(obj))
     {
         case OBJ_NULL:
             printf("null");
             break;
             
         case OBJ_INT:
-            printf("%ld", obj.value.integer);
+            printf("%ld", obj_int(obj));
             break;
             
         case OBJ_BOOL:
-            printf("%s", obj.value.boolean ? "true" : "false");
+            printf("%s", obj_bool(obj) ? "true" : "false");
             break;
             
         case OBJ_ERROR: 
-            printf("%s", obj.value.error->value);
+            printf("%s", obj_error(obj)->value);
             break;  
 
         case OBJ_STRING: 
             #ifdef DEBUG
-                printf("\"%s\"", (const char *) obj.value.ptr->string.value);
+                printf("\"%s\"", (const char *) obj_string(obj)->value);
             #else
-                printf("%s", (const char *) obj.value.string->value);  
+                printf("%s", (const char *) obj_string(obj)->value);  
             #endif
             break;
 
@@ -256,7 +265,7 @@ void print_object(struct object obj)
 
         case OBJ_ARRAY: {
             printf("[");
-            struct object_list* list = obj.value.list;
+            struct object_list* list = obj_list(obj);
             for (uint32_t i=0; i < list->size; i++) {
                 if (i > 0) {
                     printf(", ");
@@ -268,7 +277,7 @@ void print_object(struct object obj)
         }
 
         case OBJ_COMPILED_FUNCTION: {
-            struct compiled_function* f = obj.value.fn_compiled;
+            struct compiled_function* f = obj_fn(obj);
             char *instruction_str = instruction_to_str(&f->instructions);
             printf("%s", instruction_str);
             free(instruction_str);
@@ -282,30 +291,30 @@ void object_to_str(char *str, struct object obj)
 {
     char tmp[BUFSIZ] = { '\0' };
 
-    switch (obj.type)
+    switch (obj_type(obj))
     {
         case OBJ_NULL:
             strcat(str, "NULL");
             break;
             
         case OBJ_INT:
-            sprintf(tmp, "%ld", obj.value.integer);
+            sprintf(tmp, "%ld", obj_int(obj));
             strcat(str, tmp);
             break;
             
         case OBJ_BOOL:
-            strcat(str, obj.value.boolean ? "true" : "false");
+            strcat(str, obj_bool(obj) ? "true" : "false");
             break;
             
         case OBJ_ERROR: 
-            strcat(str, obj.value.error->value);
+            strcat(str, obj_error(obj)->value);
             break;  
 
         case OBJ_STRING: 
             #ifdef DEBUG 
             strcat(str, "\"");
             #endif
-            strcat(str, obj.value.string->value);
+            strcat(str, obj_string(obj)->value);
             #ifdef DEBUG 
             strcat(str, "\"");
             #endif
@@ -317,7 +326,7 @@ void object_to_str(char *str, struct object obj)
 
         case OBJ_ARRAY: {
             strcat(str, "[");
-            struct object_list* list = obj.value.list;
+            struct object_list* list = obj_list(obj);
             for (uint32_t i=0; i < list->size; i++) {
                 object_to_str(str, list->values[i]);
                 if (i < (list->size - 1)) {
@@ -329,7 +338,7 @@ void object_to_str(char *str, struct object obj)
         }
 
         case OBJ_COMPILED_FUNCTION: {
-            struct compiled_function* f = obj.value.fn_compiled;
+            struct compiled_function* f = obj_fn(obj);
             char *instruction_str = instruction_to_str(&f->instructions);
             strcat(str, instruction_str);
             free(instruction_str);
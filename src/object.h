@@ -30,9 +30,16 @@ struct gc_meta {
     bool marked;
 };
 
+struct jit_function;
+
 struct compiled_function {
     struct instruction instructions;
     uint32_t num_locals;
+    /* maximum number of objects on the stack above the locals, the VM makes room for these when calling the function */
+    uint32_t max_stack_depth;
+    /* number of calls and loop iterations so far, used to decide when to compile to native code */
+    uint32_t hotness;
+    struct jit_function* jit;
     struct gc_meta gc_meta;
 };
 
@@ -52,7 +59,7 @@ struct error {
 union object_value {
     bool boolean;
     int64_t integer;
-	struct object (*fn_builtin)(const struct object_list* args);
+	struct object (*fn_builtin)(const struct object* args, uint32_t num_args);
     /* TODO: Remove void pointer */
     void *value;
     struct error *error;
@@ -61,11 +68,36 @@ union object_value {
     struct string* string;
 };
 
+#ifdef TAGGED_OBJECTS
+/*
+ * An object packed into a single 64-bit word:
+ *   ...iiiii1  63-bit integer
+ *   ...pttt0   16-byte aligned pointer, or an immediate shifted left by 4, tagged with its type
+ * Integers outside of the 63-bit range are boxed on the heap.
+ */
+struct object 
+{
+    uint64_t bits;
+};
+
+struct boxed_integer {
+    int64_t value;
+    struct gc_meta gc_meta;
+};
+
+#define OBJECT_INTEGER_TAG 1u
+#define OBJECT_TAG_MASK 15u
+#define object_tag(type) ((uint64_t) (type) << 1)
+#define object_payload(obj) ((obj).bits & ~(uint64_t) OBJECT_TAG_MASK)
+
+struct object make_boxed_integer_object(const int64_t value);
+#else 
 struct object
 {
     enum object_type type;
     union object_value value;
 };
+#endif
 
 struct object_list {
     struct object* values;
@@ -75,8 +107,6 @@ struct object_list {
 };
 
 const char *object_type_to_str(const enum object_type t);
-struct object make_integer_object(const int64_t value);
-struct object make_boolean_object(const bool value);
 struct object make_string_object(const char *str1);
 struct object make_string_object_with_length(const char *str, size_t length);
 struct object make_error_object(const char *format, ...);
@@ -91,3 +121,89 @@ struct object_list *make_object_list(uint32_t cap);
 void append_to_object_list(struct object_list* list, struct object obj);
 struct object_list *copy_object_list(const struct object_list *original);
 void free_object_list(struct object_list *list);
+
+/* built-in functions read their arguments in place, e.g. straight from the VM stack */
+typedef struct object (*builtin_function)(const struct object* args, uint32_t num_args);
+
+#ifdef TAGGED_OBJECTS
+static inline enum object_type obj_type(struct object obj) {
+    return (obj.bits & OBJECT_INTEGER_TAG) ? OBJ_INT : (enum object_type) ((obj.bits & OBJECT_TAG_MASK) >> 1);
+}
+
+static inline bool obj_is_boxed_integer(struct object obj) {
+    return (obj.bits & OBJECT_TAG_MASK) == object_tag(OBJ_INT);
+}
+
+static inline int64_t obj_int(struct object obj) {
+    if (obj_is_boxed_integer(obj)) {
+        return ((struct boxed_integer*) object_payload(obj))->value;
+    }
+    return (int64_t) obj.bits >> 1;
+}
+
+static inline bool obj_bool(struct object obj) { return (obj.bits >> 4) != 0; }
+static inline struct string* obj_string(struct object obj) { return (struct string*) object_payload(obj); }
+static inline struct error* obj_error(struct object obj) { return (struct error*) object_payload(obj); }
+static inline struct object_list* obj_list(struct object obj) { return (struct object_list*) object_payload(obj); }
+static inline struct compiled_function* obj_fn(struct object obj) { return (struct compiled_function*) object_payload(obj); }
+static inline builtin_function obj_builtin(struct object obj) { return (builtin_function) object_payload(obj); }
+
+/* whether the object points to memory owned by the garbage collector */
+static inline bool obj_is_heap_allocated(struct object obj) {
+    return obj_is_boxed_integer(obj) || (!(obj.bits & OBJECT_INTEGER_TAG) && obj_type(obj) > OBJ_BUILTIN);
+}
+
+static inline struct object make_pointer_object(enum object_type type, const void* ptr) {
+    return (struct object) { (uint64_t) (uintptr_t) ptr | object_tag(type) };
+}
+
+static inline struct object make_null_object(void) {
+    return (struct object) { object_tag(OBJ_NULL) };
+}
+
+static inline struct object make_boolean_object(const bool value) {
+    return (struct object) { ((uint64_t) value << 4) | object_tag(OBJ_BOOL) };
+}
+
+static inline struct object make_integer_object(const int64_t value) {
+    uint64_t bits = ((uint64_t) value << 1) | OBJECT_INTEGER_TAG;
+    if (__builtin_expect(((int64_t) bits >> 1) != value, 0)) {
+        return make_boxed_integer_object(value);
+    }
+    return (struct object) { bits };
+}
+#else
+static inline enum object_type obj_type(struct object obj) { return obj.type; }
+static inline int64_t obj_int(struct object obj) { return obj.value.integer; }
+static inline bool obj_bool(struct object obj) { return obj.value.boolean; }
+static inline struct string* obj_string(struct object obj) { return obj.value.string; }
+static inline struct error* obj_error(struct object obj) { return obj.value.error; }
+static inline struct object_list* obj_list(struct object obj) { return obj.value.list; }
+static inline struct compiled_function* obj_fn(struct object obj) { return obj.value.fn_compiled; }
+static inline builtin_function obj_builtin(struct object obj) { return obj.value.fn_builtin; }
+
+/* whether the object points to memory owned by the garbage collector */
+static inline bool obj_is_heap_allocated(struct object obj) {
+    return obj.type > OBJ_BUILTIN;
+}
+
+static inline struct object make_pointer_object(enum object_type type, const void* ptr) {
+    return (struct object) { .type = type, .value.value = (void*) ptr };
+}
+
+static inline struct object make_null_object(void) {
+    return (struct object) { .type = OBJ_NULL };
+}
+
+static inline struct object make_boolean_object(const bool value) {
+    return (struct object) { .type = OBJ_BOOL, .value.boolean = value };
+}
+
+static inline struct object make_integer_object(const int64_t value) {
+    return (struct object) { .type = OBJ_INT, .value.integer = value };
+}
+#endif
+
+static inline struct object make_builtin_object(builtin_function fn) {
+    return make_pointer_object(OBJ_BUILTIN, (const void*) fn);
+}
@@ -42,6 +42,111 @@ static const struct definition definitions[] = {
     { "OpIndexSet", 0, {0} },
     { "OpSlice", 0, {0} },
     { "OpHalt", 0, {0}, },
+    { "OpTailCall", 1, {1} },
+    { "OpPushInt8", 1, {1} },
+    { "OpPushInt16", 1, {2} },
+    { "OpIncLocal", 1, {1} },
+    { "OpDecLocal", 1, {1} },
+    { "OpIncGlobal", 1, {2} },
+    { "OpAddLocalConstant", 2, {1, 2} },
+    { "OpSubtractLocalConstant", 2, {1, 2} },
+    { "OpLessThanLocalConstant", 2, {1, 2} },
+    { "OpEqualLocalConstant", 2, {1, 2} },
+    { "OpAddLocalLocal", 2, {1, 1} },
+    { "OpLessThanLocalLocal", 2, {1, 1} },
+    { "OpIndexGetLocalLocal", 2, {1, 1} },
+    { "OpAddInt", 0, {0} },
+    { "OpSubtractInt", 0, {0} },
+    { "OpMultiplyInt", 0, {0} },
+    { "OpDivideInt", 0, {0} },
+    { "OpModuloInt", 0, {0} },
+    { "OpEqualInt", 0, {0} },
+    { "OpNotEqualInt", 0, {0} },
+    { "OpGreaterThanInt", 0, {0} },
+    { "OpGreaterThanOrEqualsInt", 0, {0} },
+    { "OpLessThanInt", 0, {0} },
+    { "OpLessThanOrEqualsInt", 0, {0} },
+    { "OpIndexGetArrayInt", 0, {0} },
+    { "OpIntAdd", 0, {0} },
+    { "OpIntSubtract", 0, {0} },
+    { "OpIntMultiply", 0, {0} },
+    { "OpIntEqual", 0, {0} },
+    { "OpIntNotEqual", 0, {0} },
+    { "OpIntGreaterThan", 0, {0} },
+    { "OpIntGreaterThanOrEquals", 0, {0} },
+    { "OpIntLessThan", 0, {0} },
+    { "OpIntLessThanOrEquals", 0, {0} },
+    { "OpIntIncLocal", 1, {1} },
+    { "OpIntDecLocal", 1, {1} },
+    { "OpBoolEqual", 0, {0} },
+    { "OpBoolNotEqual", 0, {0} },
+    { "OpBoolBang", 0, {0} },
+    { "OpIndexGetInBounds", 0, {0} },
+    { "OpIndexSetInBounds", 0, {0} },
+    { "OpIndexGetLocalLocalInBounds", 2, {1, 1} },
+    { "OpJumpTrue", 1, {2} },
+    { "OpJumpIfNotEqual", 1, {2} },
+    { "OpJumpIfEqual", 1, {2} },
+    { "OpJumpIfNotGreaterThan", 1, {2} },
+    { "OpJumpIfNotGreaterThanOrEquals", 1, {2} },
+    { "OpJumpIfNotLessThan", 1, {2} },
+    { "OpJumpIfNotLessThanOrEquals", 1, {2} },
+    { "OpJumpIfNotLessThanLocalConstant", 3, {2, 1, 2} },
+    { "OpJumpIfNotLessThanLocalLocal", 3, {2, 1, 1} },
+    { "OpJumpIfNotEqualLocalConstant", 3, {2, 1, 2} },
+    { "OpCallSelf", 1, {1} },
+    { "OpTailCallSelf", 1, {1} },
+    { "OpCallFunction", 1, {1} },
+    { "OpCallBuiltin", 1, {1} },
+    { "OpLen", 0, {0} },
+    { "OpInt", 0, {0} },
+    { "OpArrayPush", 0, {0} },
+    { "OpArrayPop", 0, {0} },
+    { "OpRMove", 2, {1, 1} },
+    { "OpRConstant", 2, {1, 2} },
+    { "OpRTrue", 1, {1} },
+    { "OpRFalse", 1, {1} },
+    { "OpRNull", 1, {1} },
+    { "OpRGetGlobal", 2, {1, 2} },
+    { "OpRSetGlobal", 2, {2, 1} },
+    { "OpRGetBuiltin", 2, {1, 1} },
+    { "OpRAdd", 3, {1, 1, 1} },
+    { "OpRSubtract", 3, {1, 1, 1} },
+    { "OpRMultiply", 3, {1, 1, 1} },
+    { "OpRDivide", 3, {1, 1, 1} },
+    { "OpRModulo", 3, {1, 1, 1} },
+    { "OpREqual", 3, {1, 1, 1} },
+    { "OpRNotEqual", 3, {1, 1, 1} },
+    { "OpRGreaterThan", 3, {1, 1, 1} },
+    { "OpRGreaterThanOrEquals", 3, {1, 1, 1} },
+    { "OpRLessThan", 3, {1, 1, 1} },
+    { "OpRLessThanOrEquals", 3, {1, 1, 1} },
+    { "OpRAnd", 3, {1, 1, 1} },
+    { "OpROr", 3, {1, 1, 1} },
+    { "OpRAddConstant", 3, {1, 1, 2} },
+    { "OpRSubtractConstant", 3, {1, 1, 2} },
+    { "OpRLessThanConstant", 3, {1, 1, 2} },
+    { "OpREqualConstant", 3, {1, 1, 2} },
+    { "OpRMinus", 2, {1, 1} },
+    { "OpRBang", 2, {1, 1} },
+    { "OpRJump", 1, {2} },
+    { "OpRJumpNotTrue", 2, {1, 2} },
+    { "OpRCall", 2, {1, 1} },
+    { "OpRTailCall", 2, {1, 1} },
+    { "OpRReturnValue", 1, {1} },
+    { "OpRReturn", 0, {0} },
+    { "OpRArray", 3, {1, 1, 2} },
+    { "OpRIndexGet", 3, {1, 1, 1} },
+    { "OpRIndexSet", 4, {1, 1, 1, 1} },
+    { "OpRSlice", 2, {1, 1} },
+    { "OpRJumpIfNotEqual", 3, {1, 1, 2} },
+    { "OpRJumpIfEqual", 3, {1, 1, 2} },
+    { "OpRJumpIfNotGreaterThan", 3, {1, 1, 2} },
+    { "OpRJumpIfNotGreaterThanOrEquals", 3, {1, 1, 2} },
+    { "OpRJumpIfNotLessThan", 3, {1, 1, 2} },
+    { "OpRJumpIfNotLessThanOrEquals", 3, {1, 1, 2} },
+    { "OpRJumpIfNotLessThanConstant", 3, {1, 2, 2} },
+    { "OpRJumpIfNotEqualConstant", 3, {1, 2, 2} },
 };
 
 inline const char *opcode_to_str(enum opcode opcode) {
@@ -52,6 +157,37 @@ inline struct definition lookup(enum opcode opcode) {
     return definitions[opcode];
 }
 
+/* total size of an instruction in bytes, including its operands */
+unsigned instruction_width(enum opcode opcode) {
+    struct definition def = lookup(opcode);
+    unsigned width = 1;
+    for (uint8_t i=0; i < def.operands; i++) {
+        width += def.operand_widths[i];
+    }
+    return width;
+}
+
+/* whether the instruction compares and then jumps to its first operand when the comparison is false */
+bool is_compare_and_branch(enum opcode opcode) {
+    return opcode >= OPCODE_JUMP_IF_NOT_EQUAL && opcode <= OPCODE_JUMP_IF_NOT_EQUAL_LOCAL_CONST;
+}
+
+/* the comparison a compare-and-branch instruction was fused from */
+enum opcode branch_comparison(enum opcode opcode) {
+    switch (opcode) {
+        case OPCODE_JUMP_IF_NOT_EQUAL: return OPCODE_EQUAL;
+        case OPCODE_JUMP_IF_EQUAL: return OPCODE_NOT_EQUAL;
+        case OPCODE_JUMP_IF_NOT_GREATER_THAN: return OPCODE_GREATER_THAN;
+        case OPCODE_JUMP_IF_NOT_GREATER_THAN_OR_EQUALS: return OPCODE_GREATER_THAN_OR_EQUALS;
+        case OPCODE_JUMP_IF_NOT_LESS_THAN: return OPCODE_LESS_THAN;
+        case OPCODE_JUMP_IF_NOT_LESS_THAN_OR_EQUALS: return OPCODE_LESS_THAN_OR_EQUALS;
+        case OPCODE_JUMP_IF_NOT_LESS_THAN_LOCAL_CONST: return OPCODE_LESS_THAN_LOCAL_CONST;
+        case OPCODE_JUMP_IF_NOT_LESS_THAN_LOCAL_LOCAL: return OPCODE_LESS_THAN_LOCAL_LOCAL;
+        case OPCODE_JUMP_IF_NOT_EQUAL_LOCAL_CONST: return OPCODE_EQUAL_LOCAL_CONST;
+        default: return opcode;
+    }
+}
+
 struct instruction *make_instruction_va(enum opcode opcode, va_list operands) {
     struct definition def = lookup(opcode);
     struct instruction *ins = malloc(sizeof *ins);
@@ -145,6 +281,12 @@ char *instruction_to_str(struct instruction *ins) {
             case 2:
                 sprintf(str, "%04d %s %d %d", i, def.name, operands[0], operands[1]);
             break;
+            case 3:
+                sprintf(str, "%04d %s %d %d %d", i, def.name, operands[0], operands[1], operands[2]);
+            break;
+            case 4:
+                sprintf(str, "%04d %s %d %d %d %d", i, def.name, operands[0], operands[1], operands[2], operands[3]);
+            break;
         }
         strcat(buffer, str);
         i += bytes_read;
@@ -169,6 +311,7 @@ unsigned read_operands(unsigned dest[], struct definition def, const struct inst
                 dest[i] = read_uint16((ins->bytes + offset));
             break;
         }
+        offset += def.operand_widths[i];
         bytes_read += def.operand_widths[i];
     }
 
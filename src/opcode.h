@@ -1,5 +1,6 @@
 #pragma once 
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdint.h>
@@ -44,6 +45,139 @@ enum opcode {
     OPCODE_INDEX_SET,
     OPCODE_SLICE,
     OPCODE_HALT,
+
+    // calls a function in tail position, reusing the calling frame
+    OPCODE_TAIL_CALL,
+
+    // small integers and increments with immediate operands, without going through the constants
+    OPCODE_PUSH_INT8,
+    OPCODE_PUSH_INT16,
+    OPCODE_INC_LOCAL,
+    OPCODE_DEC_LOCAL,
+    OPCODE_INC_GLOBAL,
+
+    // superinstructions, fused from common opcode sequences by the compiler
+    OPCODE_ADD_LOCAL_CONST,
+    OPCODE_SUBTRACT_LOCAL_CONST,
+    OPCODE_LESS_THAN_LOCAL_CONST,
+    OPCODE_EQUAL_LOCAL_CONST,
+    OPCODE_ADD_LOCAL_LOCAL,
+    OPCODE_LESS_THAN_LOCAL_LOCAL,
+    OPCODE_INDEX_GET_LOCAL_LOCAL,
+
+    // type-specialised opcodes, rewritten in place by the VM once it has seen the operand types
+    OPCODE_ADD_INT,
+    OPCODE_SUBTRACT_INT,
+    OPCODE_MULTIPLY_INT,
+    OPCODE_DIVIDE_INT,
+    OPCODE_MODULO_INT,
+    OPCODE_EQUAL_INT,
+    OPCODE_NOT_EQUAL_INT,
+    OPCODE_GREATER_THAN_INT,
+    OPCODE_GREATER_THAN_OR_EQUALS_INT,
+    OPCODE_LESS_THAN_INT,
+    OPCODE_LESS_THAN_OR_EQUALS_INT,
+    OPCODE_INDEX_GET_ARRAY_INT,
+
+    // integer and boolean opcodes without type checks, emitted by the optimizer where it proved the operand types
+    OPCODE_INT_ADD,
+    OPCODE_INT_SUBTRACT,
+    OPCODE_INT_MULTIPLY,
+    OPCODE_INT_EQUAL,
+    OPCODE_INT_NOT_EQUAL,
+    OPCODE_INT_GREATER_THAN,
+    OPCODE_INT_GREATER_THAN_OR_EQUALS,
+    OPCODE_INT_LESS_THAN,
+    OPCODE_INT_LESS_THAN_OR_EQUALS,
+    OPCODE_INT_INC_LOCAL,
+    OPCODE_INT_DEC_LOCAL,
+    OPCODE_BOOL_EQUAL,
+    OPCODE_BOOL_NOT_EQUAL,
+    OPCODE_BOOL_BANG,
+
+    // indexing with an index the compiler proved to be an integer within bounds, only the type of the indexed object is checked
+    OPCODE_INDEX_GET_IN_BOUNDS,
+    OPCODE_INDEX_SET_IN_BOUNDS,
+    OPCODE_INDEX_GET_LOCAL_LOCAL_IN_BOUNDS,
+
+    // jumps if the popped condition is true, for the short-circuit evaluation of && and ||
+    OPCODE_JUMP_TRUE,
+
+    // compare-and-branch: compares like the instruction they are fused from and jump to their first operand if the result is false
+    OPCODE_JUMP_IF_NOT_EQUAL,
+    OPCODE_JUMP_IF_EQUAL,
+    OPCODE_JUMP_IF_NOT_GREATER_THAN,
+    OPCODE_JUMP_IF_NOT_GREATER_THAN_OR_EQUALS,
+    OPCODE_JUMP_IF_NOT_LESS_THAN,
+    OPCODE_JUMP_IF_NOT_LESS_THAN_OR_EQUALS,
+    OPCODE_JUMP_IF_NOT_LESS_THAN_LOCAL_CONST,
+    OPCODE_JUMP_IF_NOT_LESS_THAN_LOCAL_LOCAL,
+    OPCODE_JUMP_IF_NOT_EQUAL_LOCAL_CONST,
+
+    // calls of the function running in the current frame, for a function calling the global it is bound to
+    // the callee is not pushed, its slot is made when the call is made
+    OPCODE_CALL_SELF,
+    OPCODE_TAIL_CALL_SELF,
+
+    // call sites quickened for the type of callee they called last
+    OPCODE_CALL_FUNCTION,
+    OPCODE_CALL_BUILTIN,
+
+    // calls of built-in functions compiled to an instruction on their arguments, see builtin_intrinsic()
+    OPCODE_LEN,
+    OPCODE_INT,
+    OPCODE_ARRAY_PUSH,
+    OPCODE_ARRAY_POP,
+
+    // register machine instructions, see vm_run_registers()
+    // operands A, B, C and D name registers: slots in the current frame, relative to its base pointer
+    OPCODE_R_MOVE,
+    OPCODE_R_CONST,
+    OPCODE_R_TRUE,
+    OPCODE_R_FALSE,
+    OPCODE_R_NULL,
+    OPCODE_R_GET_GLOBAL,
+    OPCODE_R_SET_GLOBAL,
+    OPCODE_R_GET_BUILTIN,
+    OPCODE_R_ADD,
+    OPCODE_R_SUBTRACT,
+    OPCODE_R_MULTIPLY,
+    OPCODE_R_DIVIDE,
+    OPCODE_R_MODULO,
+    OPCODE_R_EQUAL,
+    OPCODE_R_NOT_EQUAL,
+    OPCODE_R_GREATER_THAN,
+    OPCODE_R_GREATER_THAN_OR_EQUALS,
+    OPCODE_R_LESS_THAN,
+    OPCODE_R_LESS_THAN_OR_EQUALS,
+    OPCODE_R_AND,
+    OPCODE_R_OR,
+    OPCODE_R_ADD_CONST,
+    OPCODE_R_SUBTRACT_CONST,
+    OPCODE_R_LESS_THAN_CONST,
+    OPCODE_R_EQUAL_CONST,
+    OPCODE_R_MINUS,
+    OPCODE_R_BANG,
+    OPCODE_R_JUMP,
+    OPCODE_R_JUMP_NOT_TRUE,
+    OPCODE_R_CALL,
+    OPCODE_R_TAIL_CALL,
+    OPCODE_R_RETURN_VALUE,
+    OPCODE_R_RETURN,
+    OPCODE_R_ARRAY,
+    OPCODE_R_INDEX_GET,
+    OPCODE_R_INDEX_SET,
+    OPCODE_R_SLICE,
+
+    // register compare-and-branch: compares B and C like the instruction they are fused from and jump to their last operand if the result is false
+    OPCODE_R_JUMP_IF_NOT_EQUAL,
+    OPCODE_R_JUMP_IF_EQUAL,
+    OPCODE_R_JUMP_IF_NOT_GREATER_THAN,
+    OPCODE_R_JUMP_IF_NOT_GREATER_THAN_OR_EQUALS,
+    OPCODE_R_JUMP_IF_NOT_LESS_THAN,
+    OPCODE_R_JUMP_IF_NOT_LESS_THAN_OR_EQUALS,
+    OPCODE_R_JUMP_IF_NOT_LESS_THAN_CONST,
+    OPCODE_R_JUMP_IF_NOT_EQUAL_CONST,
 };
 
 struct definition {
@@ -61,10 +195,22 @@ struct instruction {
 struct bytecode {
     struct instruction *instructions;
     struct object_list *constants;
+
+    // number of registers used by the main program, 0 for stack code
+    unsigned num_registers;
+
+    // maximum number of objects the main program keeps on the stack, 0 for register code
+    unsigned max_stack_depth;
+
+    // number of globals defined in the symbol table
+    unsigned num_globals;
 };
 
 const char *opcode_to_str(enum opcode opcode);
 struct definition lookup(enum opcode opcode);
+unsigned instruction_width(enum opcode opcode);
+bool is_compare_and_branch(enum opcode opcode);
+enum opcode branch_comparison(enum opcode opcode);
 struct instruction *make_instruction(enum opcode opcode, ...);
 struct instruction *make_instruction_va(enum opcode opcode, va_list operands);
 struct instruction *copy_instructions(const struct instruction *a);
@@ -23,6 +23,7 @@ SOFTWARE.
 */
 
 #include <assert.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -36,6 +37,13 @@ SOFTWARE.
 #define VERSION_MINOR 0
 #define VERSION_PATCH 1
 
+struct options {
+	bool jit;
+	bool registers;
+	bool optimize;
+	bool optimizer_stats;
+};
+
 static 
 char *read_file(const char *filename);
 
@@ -45,15 +53,17 @@ void print_version(void) {
 }
 
 static 
-int repl(void) {
+int repl(const struct options *options) {
 	print_version();
 	printf("Press CTRL+c to exit\n\n");
 
 	struct program *program;
 	struct symbol_table *symbol_table = symbol_table_new();
 	struct object_list *constants = make_object_list(64);
-	struct object globals[GLOBALS_SIZE];
+	struct object_list *globals = make_object_list(64);
 	char input[BUFSIZ] = { '\0' };
+	// once a line falls back to stack code, its functions live on in the globals, so later lines have to be stack code too
+	bool registers = options->registers;
 	while (1)
 	{
 		printf(">> ");
@@ -75,31 +85,31 @@ int repl(void) {
 		}
 
 		struct compiler *compiler = compiler_new_with_state(symbol_table, constants);
+		compiler->registers = registers;
+		compiler->optimize = options->optimize;
+		compiler->optimizer_stats = options->optimizer_stats;
 		int err = compile_program(compiler, program);
 		if (err) {
 			puts(compiler_error_str(err));
 			continue;
 		}
+		registers = compiler->registers;
 
 		struct bytecode *code = get_bytecode(compiler);
 		struct vm *machine = vm_new_with_globals(code, globals);
-		err = vm_run(machine);
+		machine->jit = options->jit;
+		err = compiler->registers ? vm_run_registers(machine) : vm_run(machine);
 		if (err) {
 			printf("Error executing bytecode: %d\n", err);
 			continue;
 		}
 
 		struct object obj = vm_stack_last_popped(machine);
-		if (obj.type != OBJ_COMPILED_FUNCTION && obj.type != OBJ_BUILTIN) {
+		if (obj_type(obj) != OBJ_COMPILED_FUNCTION && obj_type(obj) != OBJ_BUILTIN) {
 			print_object(obj);
 			puts("");
 		}
 
-		// copy globals out of VM so we can re-use them in next iteration
-		for (unsigned i=0; i < GLOBALS_SIZE; i++) {
-			globals[i] = machine->globals[i];
-		}
-
 		//free_parser(&parser);
 		//free_program(program);
 		//compiler_free(compiler);
@@ -111,7 +121,7 @@ int repl(void) {
 }
 
 static 
-int run_script(const char *filename) {
+int run_script(const char *filename, const struct options *options) {
 	char *input = read_file(filename);
 	struct lexer lexer = new_lexer(input);
 	struct parser parser = new_parser(&lexer);
@@ -126,6 +136,9 @@ int run_script(const char *filename) {
 	}
 
 	struct compiler *compiler = compiler_new();
+	compiler->registers = options->registers;
+	compiler->optimize = options->optimize;
+	compiler->optimizer_stats = options->optimizer_stats;
 	int err = compile_program(compiler, program);
 	if (err) {
 		printf("SyntaxError: %s\n", compiler_error_str(err));
@@ -134,7 +147,8 @@ int run_script(const char *filename) {
 
 	struct bytecode *code = get_bytecode(compiler);
 	struct vm *machine = vm_new(code);
-	err = vm_run(machine);
+	machine->jit = options->jit;
+	err = compiler->registers ? vm_run_registers(machine) : vm_run(machine);
 	if (err) {
 		printf("Error executing bytecode: %d\n", err);
 		return EXIT_FAILURE;
@@ -149,16 +163,35 @@ int run_script(const char *filename) {
 }
 
 int main(int argc, char *argv[]) {
-	if (argc < 2) {
-		return repl();
+	struct options options = { .jit = false, .registers = false, .optimize = false, .optimizer_stats = false };
+	const char *filename = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--version") == 0) {
+			print_version();
+			return 0;
+		} else if (strcmp(argv[i], "--jit") == 0) {
+			// compile hot functions to native code
+			options.jit = true;
+		} else if (strcmp(argv[i], "--registers") == 0) {
+			// run on the register machine instead of the stack machine
+			options.registers = true;
+		} else if (strcmp(argv[i], "-O") == 0) {
+			// inline small functions and optimize functions through the SSA intermediate representation
+			options.optimize = true;
+		} else if (strcmp(argv[i], "--optimizer-stats") == 0) {
+			// report the number of instructions and locals per function before and after optimization
+			options.optimizer_stats = true;
+		} else {
+			filename = argv[i];
+		}
 	}
 
-	if (strcmp(argv[1], "--version") == 0) {
-		print_version();
-		return 0;
+	if (filename == NULL) {
+		return repl(&options);
 	}
 
-	return run_script(argv[1]);
+	return run_script(filename, &options);
 }
 
 char *read_file(const char *filename) {
@@ -118,6 +118,15 @@ struct symbol *symbol_table_define(struct symbol_table *t, const char *name) {
     return s;
 }
 
+// reserves a slot that can not be resolved by name, for values the compiler keeps around itself
+struct symbol symbol_table_define_anonymous(struct symbol_table *t) {
+    return (struct symbol) {
+        .name = NULL,
+        .index = t->size++,
+        .scope = t->outer ? SCOPE_LOCAL : SCOPE_GLOBAL,
+    };
+}
+
 struct symbol *symbol_table_define_builtin_function(struct symbol_table *t, uint32_t index, const char *name) {
     struct symbol *s = malloc(sizeof *s);
     if (!s) err(EXIT_FAILURE, "out of memory");
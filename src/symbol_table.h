@@ -39,6 +39,7 @@ struct symbol_table {
 struct symbol_table *symbol_table_new();
 struct symbol_table *symbol_table_new_enclosed(struct symbol_table *outer);
 struct symbol *symbol_table_define(struct symbol_table *t, const char *name);
+struct symbol symbol_table_define_anonymous(struct symbol_table *t);
 struct symbol *symbol_table_define_builtin_function(struct symbol_table *t, uint32_t index, const char *name);
 struct symbol *symbol_table_resolve(struct symbol_table *t, const char *name);
 void symbol_table_free(struct symbol_table *t);
@@ -10,6 +10,7 @@
 #include "vm.h"
 #include "builtins.h"
 #include "gc.h"
+#include "jit.h"
 
 #define vm_current_frame(vm) (vm->frames[vm->frame_index])
 #define vm_stack_pop_ignore(vm) (vm->stack_pointer--)
@@ -17,12 +18,156 @@
 #define vm_stack_cur(vm) (vm->stack[vm->stack_pointer - 1])
 #define vm_stack_push(vm, obj) (vm->stack[vm->stack_pointer++] = obj)
 
+/*
+ * vm_run keeps the instruction pointer, the stack pointer and the locals of the running frame in local variables,
+ * so that the C compiler can keep them in registers instead of going through the frame and the VM on every instruction.
+ * They are written back before calling anything that reads them from there: calls, the garbage collector, built-in
+ * functions, native code and the helpers shared with it. Afterwards they are read again, since calls switch frames
+ * and may move the stack when growing it.
+ * The object on top of the stack stays in memory: caching it in a local as well made every benchmark slower.
+ */
+#define SAVE_STATE()                                                    \
+    do {                                                                \
+        frame->ip = ip;                                                 \
+        vm->stack_pointer = (uint32_t) (sp - vm->stack);                \
+    } while (0)
+
+#define LOAD_STATE()                                                    \
+    do {                                                                \
+        frame = &vm_current_frame(vm);                                  \
+        ip = frame->ip;                                                 \
+        sp = &vm->stack[vm->stack_pointer];                             \
+        locals = &vm->stack[frame->base_pointer];                       \
+    } while (0)
+
+/* integers too large for a tagged object are allocated and may start a collection, which needs the stack pointer */
+#define MAKE_INTEGER(value) vm_make_integer_at(vm, sp, (value))
+
+/* 
+ * Handler for a type-specialised integer opcode
+ * Rewrites the instruction back to its generic opcode if the operands are not both integers
+ */
+#define QUICKENED_INT_OPERATION(generic, guard, result)                 \
+    {                                                                   \
+        struct object* right = &sp[-1];                                 \
+        struct object* left = right - 1;                                \
+        if (obj_type(*left) != OBJ_INT || obj_type(*right) != OBJ_INT || !(guard)) { \
+            *ip = generic;                                              \
+            DISPATCH();                                                 \
+        }                                                               \
+        *left = result;                                                 \
+        sp--;                                                           \
+        ip++;                                                           \
+        DISPATCH();                                                     \
+    }
+
+/* 
+ * Handler for an integer or boolean opcode whose operand types the compiler proved, see ir_infer_types()
+ */
+#define UNCHECKED_BINARY_OPERATION(result)                              \
+    {                                                                   \
+        struct object* right = &sp[-1];                                 \
+        struct object* left = right - 1;                                \
+        *left = result;                                                 \
+        sp--;                                                           \
+        ip++;                                                           \
+        DISPATCH();                                                     \
+    }
+
+/*
+ * Handler for a compare-and-branch opcode: compares left and right without pushing the result
+ * and jumps to the first operand if the comparison is false
+ */
+#define COMPARE_AND_BRANCH(generic, operator, left_value, right_value, width) \
+    {                                                                   \
+        const struct object left = left_value;                          \
+        const struct object right = right_value;                        \
+        bool result = obj_type(left) == OBJ_INT && obj_type(right) == OBJ_INT \
+            ? obj_int(left) operator obj_int(right)                     \
+            : vm_compare(vm, generic, left, right);                     \
+        if (result) {                                                   \
+            ip += width;                                                \
+        } else {                                                        \
+            ip = frame->fn->instructions.bytes + read_uint16((ip + 1)); \
+        }                                                               \
+        DISPATCH();                                                     \
+    }
+
+/* 
+ * Handler for a generic operator, which quickens the instruction for the types of its operands
+ * and leaves everything else to operation
+ */
+#define GENERIC_OPERATION(opcode, operation)                            \
+    {                                                                   \
+        vm_quicken_binary_operation(ip++, &sp[-1]);                     \
+        SAVE_STATE();                                                   \
+        operation(vm, opcode);                                          \
+        LOAD_STATE();                                                   \
+        DISPATCH();                                                     \
+    }
+
+/* the opcodes vm_run has a handler for in vm_handlers.h */
+#define VM_OPCODES(X) \
+    X(CONST) X(POP) X(ADD) X(SUBTRACT) X(MULTIPLY) X(DIVIDE) X(MODULO) X(TRUE) X(FALSE) X(EQUAL) X(NOT_EQUAL) \
+    X(GREATER_THAN) X(GREATER_THAN_OR_EQUALS) X(LESS_THAN) X(LESS_THAN_OR_EQUALS) X(AND) X(OR) X(MINUS) X(BANG) \
+    X(JUMP) X(JUMP_NOT_TRUE) X(NULL) X(GET_GLOBAL) X(SET_GLOBAL) X(CALL) X(RETURN_VALUE) X(RETURN) X(GET_LOCAL) \
+    X(SET_LOCAL) X(GET_BUILTIN) X(ARRAY) X(INDEX_GET) X(INDEX_SET) X(SLICE) X(HALT) X(TAIL_CALL) X(PUSH_INT8) \
+    X(PUSH_INT16) X(INC_LOCAL) X(DEC_LOCAL) X(INC_GLOBAL) X(ADD_LOCAL_CONST) X(SUBTRACT_LOCAL_CONST) \
+    X(LESS_THAN_LOCAL_CONST) X(EQUAL_LOCAL_CONST) X(ADD_LOCAL_LOCAL) X(LESS_THAN_LOCAL_LOCAL) \
+    X(INDEX_GET_LOCAL_LOCAL) X(ADD_INT) X(SUBTRACT_INT) X(MULTIPLY_INT) X(DIVIDE_INT) X(MODULO_INT) X(EQUAL_INT) \
+    X(NOT_EQUAL_INT) X(GREATER_THAN_INT) X(GREATER_THAN_OR_EQUALS_INT) X(LESS_THAN_INT) X(LESS_THAN_OR_EQUALS_INT) \
+    X(INDEX_GET_ARRAY_INT) X(INT_ADD) X(INT_SUBTRACT) X(INT_MULTIPLY) X(INT_EQUAL) X(INT_NOT_EQUAL) \
+    X(INT_GREATER_THAN) X(INT_GREATER_THAN_OR_EQUALS) X(INT_LESS_THAN) X(INT_LESS_THAN_OR_EQUALS) X(INT_INC_LOCAL) \
+    X(INT_DEC_LOCAL) X(BOOL_EQUAL) X(BOOL_NOT_EQUAL) X(BOOL_BANG) X(INDEX_GET_IN_BOUNDS) X(INDEX_SET_IN_BOUNDS) \
+    X(INDEX_GET_LOCAL_LOCAL_IN_BOUNDS) X(JUMP_TRUE) X(JUMP_IF_NOT_EQUAL) X(JUMP_IF_EQUAL) \
+    X(JUMP_IF_NOT_GREATER_THAN) X(JUMP_IF_NOT_GREATER_THAN_OR_EQUALS) X(JUMP_IF_NOT_LESS_THAN) \
+    X(JUMP_IF_NOT_LESS_THAN_OR_EQUALS) X(JUMP_IF_NOT_LESS_THAN_LOCAL_CONST) X(JUMP_IF_NOT_LESS_THAN_LOCAL_LOCAL) \
+    X(JUMP_IF_NOT_EQUAL_LOCAL_CONST) X(CALL_SELF) X(TAIL_CALL_SELF) X(CALL_FUNCTION) X(CALL_BUILTIN) X(LEN) X(INT) \
+    X(ARRAY_PUSH) X(ARRAY_POP)
+
+/* the dispatch tables are indexed by opcode, so every stack opcode needs a handler */
+#define COUNT_OPCODE(name) + 1
+_Static_assert(0 VM_OPCODES(COUNT_OPCODE) == OPCODE_R_MOVE, "VM_OPCODES has to list every stack opcode");
+
+/*
+ * Build with TAIL_CALL_DISPATCH to give every handler a function of its own, which passes the VM state on in its
+ * arguments and dispatches by tail calling the handler of the next instruction. Without it, handlers are labels
+ * in vm_run and dispatch with computed gotos.
+ * Compilers supporting musttail guarantee the tail calls, others need optimization (-foptimize-sibling-calls)
+ * so that dispatching does not grow the C stack.
+ */
+#ifdef TAIL_CALL_DISPATCH
+    #if defined(__has_attribute)
+        #if __has_attribute(musttail)
+            #define MUSTTAIL __attribute__((musttail))
+        #endif
+    #endif
+    #ifndef MUSTTAIL
+        #define MUSTTAIL
+    #endif
+    #define HANDLER_PARAMETERS struct vm* restrict vm, struct frame* frame, uint8_t* ip, struct object* sp, struct object* locals
+    #define TARGET(name) static enum result HANDLE_OPCODE_##name(HANDLER_PARAMETERS)
+    #define JUMP_TO(name) MUSTTAIL return HANDLE_OPCODE_##name(vm, frame, ip, sp, locals)
+    #define NEXT_HANDLER() MUSTTAIL return handlers[*ip](vm, frame, ip, sp, locals)
+#else 
+    #define TARGET(name) GOTO_OPCODE_##name:
+    #define JUMP_TO(name) goto GOTO_OPCODE_##name
+    #define NEXT_HANDLER() goto *dispatch_table[*ip]
+    #define LABEL_ADDRESS(name) [OPCODE_##name] = &&GOTO_OPCODE_##name,
+#endif
+
 #ifndef DEBUG 
-    #define DISPATCH() goto *dispatch_table[*frame->ip];        
+    #define DISPATCH() NEXT_HANDLER();        
+    #define DISPATCH_REGISTERS() goto *dispatch_table[*ip];        
 #else 
     #define DISPATCH()                      \
+        SAVE_STATE();                       \
         print_debug_info(vm);               \
-        goto *dispatch_table[*frame->ip];      
+        NEXT_HANDLER();      
+    #define DISPATCH_REGISTERS()            \
+        frame->ip = ip;                     \
+        print_debug_info(vm);               \
+        goto *dispatch_table[*ip];      
 
 static void 
 print_debug_info(struct vm *vm) {
@@ -48,113 +193,193 @@ print_debug_info(struct vm *vm) {
     for (unsigned i = 0; i < vm->nconstants; i++) {
         str[0] = '\0';
         object_to_str(str, vm->constants[i]);
-        printf("  %3d: %s = %s\n", i, object_type_to_str(vm->constants[i].type), str);
+        printf("  %3d: %s = %s\n", i, object_type_to_str(obj_type(vm->constants[i])), str);
     }
 
     printf("Globals: \n");
-    for (unsigned i = 0; i < GLOBALS_SIZE; i++) {
-        if (vm->globals[i].type == OBJ_NULL) {
-            break;
-        }
+    for (unsigned i = 0; i < vm->nglobals; i++) {
         str[0] = '\0';
         object_to_str(str, vm->globals[i]);
-        printf("  %3d: %s = %s\n", i, object_type_to_str(vm->globals[i].type), str);
+        printf("  %3d: %s = %s\n", i, object_type_to_str(obj_type(vm->globals[i])), str);
     }
 
     printf("Stack: \n");
     for (unsigned i=0; i < vm->stack_pointer; i++) {
         str[0] = '\0';
         object_to_str(str, vm->stack[i]);
-        printf("  %3d: %s = %s\n", i, object_type_to_str(vm->stack[i].type), str);
+        printf("  %3d: %s = %s\n", i, object_type_to_str(obj_type(vm->stack[i])), str);
+    }
+}
+#endif
+
+/* grows the stack to hold at least size objects, new slots start out as null for the garbage collector */
+static void
+vm_grow_stack(struct vm* restrict vm, unsigned size) {
+    if (size > MAX_STACK_SIZE) {
+        err(VM_ERR_STACK_OVERFLOW, "Stack overflow.");
+    }
+
+    unsigned cap = vm->stack_cap > 0 ? vm->stack_cap : STACK_SIZE;
+    while (cap < size) {
+        cap *= 2;
+    }
+    vm->stack = realloc(vm->stack, cap * sizeof *vm->stack);
+    assert(vm->stack != NULL);
+    for (unsigned i = vm->stack_cap; i < cap; i++) {
+        vm->stack[i] = make_null_object();
     }
+    vm->stack_cap = cap;
 }
-#endif 
 
-static struct object_list *_builtin_args_list;
+/* makes sure the stack can hold size objects, called once per call with the callee's locals and maximum stack depth */
+static inline void
+vm_reserve_stack(struct vm* restrict vm, unsigned size) {
+    if (size > vm->stack_cap) {
+        vm_grow_stack(vm, size);
+    }
+}
+
+static void
+vm_grow_frames(struct vm* restrict vm) {
+    if (vm->frames_cap >= MAX_FRAMES_SIZE) {
+        err(VM_ERR_STACK_OVERFLOW, "Maximum call depth exceeded.");
+    }
+
+    vm->frames_cap *= 2;
+    vm->frames = realloc(vm->frames, vm->frames_cap * sizeof *vm->frames);
+    assert(vm->frames != NULL);
+}
+
+/* returns the next frame, making it the current one */
+static inline struct frame*
+vm_push_frame(struct vm* restrict vm) {
+    if (vm->frame_index + 1 == vm->frames_cap) {
+        vm_grow_frames(vm);
+    }
+    return &vm->frames[++vm->frame_index];
+}
 
 struct vm *vm_new(struct bytecode *bc) {
+    struct object_list *globals = make_object_list(bc->num_globals);
+    struct vm *vm = vm_new_with_globals(bc, globals);
+    vm->owned_globals = globals;
+    return vm;
+}
+
+/* creates a VM that reads and writes the given globals directly, growing them to the globals known to the compiler */
+struct vm *vm_new_with_globals(struct bytecode *bc, struct object_list *globals) {
     struct vm *vm = malloc(sizeof *vm);
     assert(vm != NULL);
     vm->stack_pointer = 0;
     vm->frame_index = 0;
-
-    // initialize globals as null objects for print_debug_info()
-    for (unsigned i=0; i < GLOBALS_SIZE; i++) {
-        vm->globals[i].type = OBJ_NULL;
+    vm->stack = NULL;
+    vm->stack_cap = 0;
+    vm->frames = malloc(FRAMES_SIZE * sizeof *vm->frames);
+    assert(vm->frames != NULL);
+    vm->frames_cap = FRAMES_SIZE;
+    vm->jit = false;
+    vm->jit_threshold = JIT_THRESHOLD;
+    vm->jit_depth = 0;
+
+    // globals defined since the list was last used start out as null
+    while (globals->size < bc->num_globals) {
+        append_to_object_list(globals, make_null_object());
     }
+    vm->globals = globals->values;
+    vm->nglobals = globals->size;
+    vm->owned_globals = NULL;
 
-    // copy over constants from compiled bytecode
-    vm->nconstants = 0;
-    for (unsigned i=0; i < bc->constants->size; i++) {
-       vm->constants[vm->nconstants++] = bc->constants->values[i];
-    }    
-
-    _builtin_args_list = make_object_list(32);
+    // constants are not copied, the bytecode owns them
+    vm->constants = bc->constants->values;
+    vm->nconstants = bc->constants->size;
 
     // initialize heap
     vm->heap = make_object_list(256);
 
-    struct object fn_obj = make_compiled_function_object(bc->instructions, 0);
-    struct compiled_function* fn = fn_obj.value.fn_compiled;
+    struct object fn_obj = make_compiled_function_object(bc->instructions, bc->num_registers);
+    struct compiled_function* fn = obj_fn(fn_obj);
+    fn->max_stack_depth = bc->max_stack_depth;
+    vm_grow_stack(vm, fn->num_locals + fn->max_stack_depth);
     vm->frames[0].ip = fn->instructions.bytes;
     vm->frames[0].fn = fn;
     vm->frames[0].base_pointer = 0;
     return vm;
 }
 
-struct vm *vm_new_with_globals(struct bytecode *bc, struct object globals[GLOBALS_SIZE]) {
-    struct vm *vm = vm_new(bc);
-
-    for (unsigned i=0; i < GLOBALS_SIZE; i++) {
-        vm->globals[i] = globals[i];
-    }
-    return vm;
-}
-
 void vm_free(struct vm *vm) {
     /* free initial compiled function since it's not on the constants list */
-    free(vm->frames[0].fn);
-
-    // free args list for builtin functions
-    free_object_list(_builtin_args_list);
+    struct object fn_obj = make_pointer_object(OBJ_COMPILED_FUNCTION, vm->frames[0].fn);
+    free_object(&fn_obj);
 
     // free all objects on heap
     free_object_list(vm->heap);
 
+    free(vm->stack);
+    free(vm->frames);
+
+    // the objects in the globals live on the heap
+    if (vm->owned_globals != NULL) {
+        free(vm->owned_globals->values);
+        free(vm->owned_globals);
+    }
+
     /* free vm itself */
     free(vm);
 }
 
 
+/* makes an integer object, registering it with the garbage collector if it had to be boxed */
+static inline struct object 
+vm_make_integer(struct vm* restrict vm, const int64_t value) {
+    struct object obj = make_integer_object(value);
+    if (obj_is_heap_allocated(obj)) {
+        gc_add(vm, obj);
+    }
+    return obj;
+}
+
+/* vm_make_integer() for vm_run, which only writes its stack pointer sp back when the integer goes on the heap */
+static inline struct object
+vm_make_integer_at(struct vm* restrict vm, const struct object* sp, const int64_t value) {
+    struct object obj = make_integer_object(value);
+    if (obj_is_heap_allocated(obj)) {
+        vm->stack_pointer = (uint32_t) (sp - vm->stack);
+        gc_add(vm, obj);
+    }
+    return obj;
+}
+
 static void 
 vm_do_binary_integer_operation(struct vm* restrict vm, const enum opcode opcode, struct object* restrict left, const struct object* restrict right) {    
+    const int64_t a = obj_int(*left);
+    const int64_t b = obj_int(*right);
     switch (opcode) {
         case OPCODE_ADD: 
-            left->value.integer += right->value.integer;
+            *left = vm_make_integer(vm, a + b);
         break;
         case OPCODE_SUBTRACT: 
-            left->value.integer -= right->value.integer;
+            *left = vm_make_integer(vm, a - b);
         break;
         case OPCODE_MULTIPLY: 
-            left->value.integer *= right->value.integer;
+            *left = vm_make_integer(vm, a * b);
         break;
         case OPCODE_DIVIDE: 
-            if (right->value.integer == 0) {
-                vm_stack_cur(vm) = make_error_object("Division by zero");
-                gc_add(vm, vm_stack_cur(vm));
+            if (b == 0) {
+                *left = make_error_object("Division by zero");
+                gc_add(vm, *left);
                 return;
             }
 
-            left->value.integer /= right->value.integer;
+            *left = vm_make_integer(vm, a / b);
         break;
         case OPCODE_MODULO:
-            if (right->value.integer == 0) {
-                vm_stack_cur(vm) = make_error_object("Division by zero");
-                gc_add(vm, vm_stack_cur(vm));
+            if (b == 0) {
+                *left = make_error_object("Division by zero");
+                gc_add(vm, *left);
                 return;
             }
 
-            left->value.integer %= right->value.integer;
+            *left = vm_make_integer(vm, a % b);
         break;
         default:
             err(VM_ERR_INVALID_OPERATOR, "Invalid operator %s for integer operation.", opcode_to_str(opcode));
@@ -166,8 +391,8 @@ static void
 vm_do_binary_string_operation(struct vm* restrict vm, enum opcode opcode, struct object* restrict left, const struct object* restrict right) {
     switch (opcode) {
         case OPCODE_ADD: {            
-            struct object o = concat_string_objects(left->value.string, right->value.string);
-            vm_stack_cur(vm) = o;
+            struct object o = concat_string_objects(obj_string(*left), obj_string(*right));
+            *left = o;
             gc_add(vm, o);   
         }
         break;
@@ -182,10 +407,10 @@ static void
 vm_do_binary_boolean_operation(__attribute__((unused)) struct vm* restrict vm, const enum opcode opcode, struct object* restrict left, const struct object* restrict right) {
     switch (opcode) {
         case OPCODE_AND: 
-            left->value.boolean = left->value.boolean && right->value.boolean;
+            *left = make_boolean_object(obj_bool(*left) && obj_bool(*right));
         break;
         case OPCODE_OR: 
-            left->value.boolean = left->value.boolean || right->value.boolean;
+            *left = make_boolean_object(obj_bool(*left) || obj_bool(*right));
         break;
         default:
             err(VM_ERR_INVALID_OPERATOR, "Invalid operator for boolean operation.");
@@ -193,13 +418,12 @@ vm_do_binary_boolean_operation(__attribute__((unused)) struct vm* restrict vm, c
     }
 }
 
+/* applies opcode to left and right, storing the result in left */
 static void 
-vm_do_binary_operation(struct vm* restrict vm, const enum opcode opcode) {
-    const struct object* right = &vm_stack_pop(vm);
-    struct object* left = &vm_stack_cur(vm);
-    assert(left->type == right->type);
+vm_binary_operation(struct vm* restrict vm, const enum opcode opcode, struct object* restrict left, const struct object* restrict right) {
+    assert(obj_type(*left) == obj_type(*right));
 
-    switch (left->type) {
+    switch (obj_type(*left)) {
         case OBJ_INT: 
             vm_do_binary_integer_operation(vm, opcode, left, right); 
         break;
@@ -210,55 +434,74 @@ vm_do_binary_operation(struct vm* restrict vm, const enum opcode opcode) {
             vm_do_binary_boolean_operation(vm, opcode, left, right);
         break;
         default: 
-            err(VM_ERR_INVALID_OP_TYPE, "Invalid type %s for binary operation.", object_type_to_str(left->type));
+            err(VM_ERR_INVALID_OP_TYPE, "Invalid type %s for binary operation.", object_type_to_str(obj_type(*left)));
         break;
     }
 }
 
+/* 
+ * adds delta (1 or -1) to the object in slot, for the increment and decrement instructions
+ * The handlers inline the integer case, this is kept out of line so the address of one does not keep them from tail
+ * calling the next handler, see TAIL_CALL_DISPATCH
+ */
+static __attribute__((noinline)) void
+vm_increment(struct vm* restrict vm, struct object* restrict slot, const int64_t delta) {
+    if (obj_type(*slot) == OBJ_INT) {
+        *slot = vm_make_integer(vm, obj_int(*slot) + delta);
+    } else {
+        const struct object one = make_integer_object(1);
+        vm_binary_operation(vm, delta > 0 ? OPCODE_ADD : OPCODE_SUBTRACT, slot, &one);
+    }
+}
+
+static void 
+vm_do_binary_operation(struct vm* restrict vm, const enum opcode opcode) {
+    const struct object* right = &vm_stack_pop(vm);
+    vm_binary_operation(vm, opcode, &vm_stack_cur(vm), right);
+}
+
 static void 
 vm_do_integer_comparison(__attribute__((unused)) struct vm* restrict vm, const enum opcode opcode, struct object* restrict left, const struct object* restrict right) {
     switch (opcode) {
          case OPCODE_EQUAL: 
-            left->value.boolean = left->value.integer == right->value.integer;
+            *left = make_boolean_object(obj_int(*left) == obj_int(*right));
             break;
 
         case OPCODE_NOT_EQUAL: 
-            left->value.boolean = left->value.integer != right->value.integer;
+            *left = make_boolean_object(obj_int(*left) != obj_int(*right));
             break;
 
         case OPCODE_GREATER_THAN: 
-            left->value.boolean = left->value.integer > right->value.integer;
+            *left = make_boolean_object(obj_int(*left) > obj_int(*right));
             break;
 
         case OPCODE_GREATER_THAN_OR_EQUALS: 
-            left->value.boolean = left->value.integer >= right->value.integer;
+            *left = make_boolean_object(obj_int(*left) >= obj_int(*right));
             break;
 
         case OPCODE_LESS_THAN:
-            left->value.boolean = left->value.integer < right->value.integer;
+            *left = make_boolean_object(obj_int(*left) < obj_int(*right));
             break;
 
         case OPCODE_LESS_THAN_OR_EQUALS:
-            left->value.boolean = left->value.integer <= right->value.integer;
+            *left = make_boolean_object(obj_int(*left) <= obj_int(*right));
             break;
 
         default: 
             err(VM_ERR_INVALID_OP_TYPE, "Invalid operator for integer comparison");
         break;
     }
-
-    left->type = OBJ_BOOL;
 }
 
 static void
 vm_do_bool_comparison(__attribute__((unused)) struct vm* restrict vm, const enum opcode opcode, struct object* restrict left, const struct object* restrict right) {
     switch (opcode) {
         case OPCODE_EQUAL: 
-            left->value.boolean = left->value.boolean == right->value.boolean;
+            *left = make_boolean_object(obj_bool(*left) == obj_bool(*right));
         break;
 
         case OPCODE_NOT_EQUAL: 
-            left->value.boolean = left->value.boolean != right->value.boolean;
+            *left = make_boolean_object(obj_bool(*left) != obj_bool(*right));
         break;
 
         default: 
@@ -269,14 +512,13 @@ vm_do_bool_comparison(__attribute__((unused)) struct vm* restrict vm, const enum
 
 static void
 vm_do_string_comparison(__attribute__((unused)) struct vm* restrict vm, const enum opcode opcode, struct object* restrict left, const struct object* restrict right) {
-    left->type = OBJ_BOOL;
     switch (opcode) {
         case OPCODE_EQUAL: 
-            left->value.boolean = strcmp(left->value.string->value, right->value.string->value) == 0;
+            *left = make_boolean_object(strcmp(obj_string(*left)->value, obj_string(*right)->value) == 0);
         break;
 
         case OPCODE_NOT_EQUAL: 
-            left->value.boolean = strcmp(left->value.string->value, right->value.string->value) != 0;
+            *left = make_boolean_object(strcmp(obj_string(*left)->value, obj_string(*right)->value) != 0);
         break;
 
         default: 
@@ -285,13 +527,12 @@ vm_do_string_comparison(__attribute__((unused)) struct vm* restrict vm, const en
     }    
 }
 
+/* compares left and right, storing the resulting boolean in left */
 static void 
-vm_do_comparision(struct vm* restrict vm, const enum opcode opcode) {
-    const struct object* right = &vm_stack_pop(vm);
-    struct object* left = &vm_stack_cur(vm);
-    assert(left->type == right->type);
+vm_comparison(struct vm* restrict vm, const enum opcode opcode, struct object* restrict left, const struct object* restrict right) {
+    assert(obj_type(*left) == obj_type(*right));
 
-    switch (left->type) {
+    switch (obj_type(*left)) {
         case OBJ_INT:
             vm_do_integer_comparison(vm, opcode, left, right);
         break;
@@ -310,61 +551,209 @@ vm_do_comparision(struct vm* restrict vm, const enum opcode opcode) {
     }   
 }
 
+/* compares two objects that are not on the stack, returning the result, out of line for the same reason as vm_increment() */
+static __attribute__((noinline)) bool
+vm_compare(struct vm* restrict vm, const enum opcode opcode, struct object left, const struct object right) {
+    vm_comparison(vm, opcode, &left, &right);
+    return obj_bool(left);
+}
+
+static void 
+vm_do_comparision(struct vm* restrict vm, const enum opcode opcode) {
+    const struct object* right = &vm_stack_pop(vm);
+    vm_comparison(vm, opcode, &vm_stack_cur(vm), right);
+}
+
+static inline struct object
+vm_bang(const struct object obj) {
+    enum object_type type = obj_type(obj);
+    return make_boolean_object(type == OBJ_NULL || (type == OBJ_BOOL && obj_bool(obj) == false) || (type == OBJ_INT && obj_int(obj) <= 0));
+}
+
 static void
 vm_do_bang_operation(struct vm * restrict vm) {
     // modify item in place by leaving it on the stack
-    struct object* obj = &vm_stack_cur(vm);
-    obj->value.boolean = obj->type == OBJ_NULL || (obj->type == OBJ_BOOL && obj->value.boolean == false) || (obj->type == OBJ_INT && obj->value.integer <= 0);
-    obj->type = OBJ_BOOL;
+    vm_stack_cur(vm) = vm_bang(vm_stack_cur(vm));
 }
 
 static void  
 vm_do_minus_operation(struct vm* restrict vm) {
     // modify item in place by leaving it on the stack
-    vm_stack_cur(vm).value.integer *= -1;
+    struct object result = vm_make_integer(vm, -obj_int(vm_stack_cur(vm)));
+    vm_stack_cur(vm) = result;
+}
+
+/* calls a built-in function with the num_args objects starting at argv, which it reads in place */
+static struct object
+vm_call_builtin(struct vm* restrict vm, builtin_function builtin, const struct object* argv, const uint8_t num_args) {
+    struct object obj = builtin(argv, num_args);
+
+    // register result object in heap for GC
+    gc_add(vm, obj);
+    return obj;
 }
 
 /* handle call to built-in function */
 static void 
-vm_do_call_builtin(struct vm* restrict vm, struct object (*builtin)(const struct object_list *), const uint8_t num_args) {
-    struct object_list *args = _builtin_args_list;
-    
-    for (uint32_t i = vm->stack_pointer - num_args; i < vm->stack_pointer; i++) {
-        args->values[args->size++] = vm->stack[i];
-    }  
-
-    struct object obj = builtin(args);
+vm_do_call_builtin(struct vm* restrict vm, builtin_function builtin, const uint8_t num_args) {
+    struct object obj = vm_call_builtin(vm, builtin, &vm->stack[vm->stack_pointer - num_args], num_args);
     vm->stack_pointer = vm->stack_pointer - num_args - 1;
     vm_stack_push(vm, obj);
     vm_current_frame(vm).ip++;
-    
-    // reset args for next use
-    args->size = 0;
+}
 
-    // register result object in heap for GC
-    gc_add(vm, obj);
+/* 
+ * Executes an intrinsic on the arguments below the stack pointer sp, replacing them with the result, and returns the new stack pointer.
+ * Arrays, strings and integers are handled in place, anything else goes through the built-in function.
+ */
+static inline struct object*
+vm_intrinsic(struct vm* restrict vm, const enum opcode opcode, struct object* sp) {
+    struct object* arg = &sp[-1];
+    switch (opcode) {
+        case OPCODE_LEN:
+            if (obj_type(*arg) == OBJ_ARRAY) {
+                *arg = vm_make_integer_at(vm, sp, obj_list(*arg)->size);
+                return sp;
+            }
+            if (obj_type(*arg) == OBJ_STRING) {
+                *arg = vm_make_integer_at(vm, sp, obj_string(*arg)->length);
+                return sp;
+            }
+        break;
+
+        case OPCODE_INT:
+            if (obj_type(*arg) == OBJ_INT) {
+                return sp;
+            }
+        break;
+
+        case OPCODE_ARRAY_PUSH: {
+            struct object* array = arg - 1;
+            if (obj_type(*array) == OBJ_ARRAY) {
+                struct object_list* list = obj_list(*array);
+                append_to_object_list(list, copy_object(arg));
+                *array = vm_make_integer_at(vm, sp, list->size);
+                return sp - 1;
+            }
+            arg = array;
+        }
+        break;
+
+        case OPCODE_ARRAY_POP:
+            if (obj_type(*arg) == OBJ_ARRAY && obj_list(*arg)->size > 0) {
+                struct object_list* list = obj_list(*arg);
+                struct object obj = copy_object(&list->values[list->size - 1]);
+                list->size--;
+                vm->stack_pointer = (uint32_t) (sp - vm->stack);
+                gc_add(vm, obj);
+                *arg = obj;
+                return sp;
+            }
+        break;
+
+        default:
+        break;
+    }
+
+    // arg points to the first argument
+    uint8_t num_args = (uint8_t) (sp - arg);
+    vm->stack_pointer = (uint32_t) (sp - vm->stack);
+    *arg = vm_call_builtin(vm, intrinsic_builtin(opcode), arg, num_args);
+    return arg + 1;
+}
+
+/* 
+ * counts an execution of fn and compiles it to native code once it gets hot
+ * Returns whether fn can run as native code, which it can not while native code is nested JIT_MAX_DEPTH deep
+ */
+static inline bool
+vm_jit_compiled(struct vm* restrict vm, struct compiled_function* restrict fn) {
+    if (vm->jit_depth >= JIT_MAX_DEPTH) {
+        return false;
+    }
+    if (fn->jit != NULL) {
+        return true;
+    }
+    if (++fn->hotness < vm->jit_threshold) {
+        return false;
+    }
+    fn->hotness = 0;
+    return jit_compile(fn);
+}
+
+/* runs the frame as native code from its instruction pointer */
+static inline void
+vm_jit_run(struct vm* restrict vm, struct frame* frame) {
+    vm->jit_depth++;
+    jit_run(vm, frame);
+    vm->jit_depth--;
 }
 
 /* handle call to user-defined function */
 static void 
 vm_do_call_function(struct vm* restrict vm, struct compiled_function* restrict fn, uint8_t num_args) {
-    struct frame* frame = &vm->frames[++vm->frame_index];
+    struct frame* frame = vm_push_frame(vm);
     frame->ip = fn->instructions.bytes;
     frame->fn = fn;
     frame->base_pointer = vm->stack_pointer - num_args;
+    vm_reserve_stack(vm, frame->base_pointer + fn->num_locals + fn->max_stack_depth);
+    vm->stack_pointer = frame->base_pointer + fn->num_locals; 
+
+    if (vm->jit && vm_jit_compiled(vm, fn)) {
+        vm_jit_run(vm, frame);
+    }
+}
+
+/* handle call to user-defined function in tail position: the callee and its arguments replace the current frame's function and locals */
+static void 
+vm_do_tail_call_function(struct vm* restrict vm, struct compiled_function* restrict fn, uint8_t num_args) {
+    struct frame* frame = &vm_current_frame(vm);
+    vm_reserve_stack(vm, frame->base_pointer + fn->num_locals + fn->max_stack_depth);
+    memmove(&vm->stack[frame->base_pointer - 1], &vm->stack[vm->stack_pointer - 1 - num_args], (num_args + 1u) * sizeof(struct object));
+    frame->ip = fn->instructions.bytes;
+    frame->fn = fn;
     vm->stack_pointer = frame->base_pointer + fn->num_locals; 
+
+    if (vm->jit && vm_jit_compiled(vm, fn)) {
+        vm_jit_run(vm, frame);
+    }
+}
+
+/* handle call to the function of the current frame: the arguments move up to make room for the callee, which was not pushed */
+static void
+vm_do_call_self(struct vm* restrict vm, uint8_t num_args) {
+    struct compiled_function* fn = vm_current_frame(vm).fn;
+    struct object* args = &vm->stack[vm->stack_pointer - num_args];
+    memmove(args + 1, args, num_args * sizeof(struct object));
+    *args = make_pointer_object(OBJ_COMPILED_FUNCTION, fn);
+    vm->stack_pointer++;
+    vm_do_call_function(vm, fn, num_args);
+}
+
+/* handle call to the function of the current frame in tail position: the arguments replace its locals and it starts over */
+static void
+vm_do_tail_call_self(struct vm* restrict vm, uint8_t num_args) {
+    struct frame* frame = &vm_current_frame(vm);
+    struct compiled_function* fn = frame->fn;
+    memmove(&vm->stack[frame->base_pointer], &vm->stack[vm->stack_pointer - num_args], num_args * sizeof(struct object));
+    frame->ip = fn->instructions.bytes;
+    vm->stack_pointer = frame->base_pointer + fn->num_locals;
+
+    if (vm->jit && vm_jit_compiled(vm, fn)) {
+        vm_jit_run(vm, frame);
+    }
 }
 
 static void
 vm_do_call(struct vm* restrict vm, uint8_t num_args) {
     const struct object callee = vm->stack[vm->stack_pointer - 1 - num_args];
-    switch (callee.type) {
+    switch (obj_type(callee)) {
         case OBJ_COMPILED_FUNCTION:
-            vm_do_call_function(vm, callee.value.fn_compiled, num_args);
+            vm_do_call_function(vm, obj_fn(callee), num_args);
         break;
 
         case OBJ_BUILTIN:
-            vm_do_call_builtin(vm, callee.value.fn_builtin, num_args);
+            vm_do_call_builtin(vm, obj_builtin(callee), num_args);
         break;
 
         default:
@@ -382,6 +771,14 @@ vm_build_array(struct vm* restrict vm, uint16_t start_index, uint16_t end_index)
     return make_array_object(list);
 }
 
+static void 
+vm_do_array(struct vm* restrict vm, uint16_t num_elements) {
+    struct object array = vm_build_array(vm, vm->stack_pointer - num_elements, vm->stack_pointer);
+    vm->stack_pointer -= num_elements;
+    vm_stack_push(vm, array);
+    gc_add(vm, array);
+}
+
 static struct object build_slice_from_array(struct object_list* source, int32_t start, int32_t end)
 {
 
@@ -413,7 +810,7 @@ static struct object build_slice_from_string(struct string* source, int32_t star
         end = start;
     }
     struct object obj = make_string_object_with_length("", end - start);
-    struct string* str = obj.value.string;
+    struct string* str = obj_string(obj);
     str->length = 0;
     for (int i=start; i < end && i < (int) source->length; i++) {
         str->value[str->length++] = source->value[i];
@@ -425,19 +822,19 @@ static struct object build_slice_from_string(struct string* source, int32_t star
 static struct object 
 build_slice(struct object left, struct object obj_start, struct object obj_end) 
 {
-    if ((obj_end.type != OBJ_NULL && obj_end.type != OBJ_INT) || (obj_start.type != OBJ_NULL && obj_start.type != OBJ_INT)) {
+    if ((obj_type(obj_end) != OBJ_NULL && obj_type(obj_end) != OBJ_INT) || (obj_type(obj_start) != OBJ_NULL && obj_type(obj_start) != OBJ_INT)) {
         return make_error_object("Slice indices must be integers.");
     }
-    int32_t start = obj_start.type == OBJ_NULL ? 0 : obj_start.value.integer;
-    int32_t end = obj_end.type == OBJ_NULL ? 0 : obj_end.value.integer;
+    int32_t start = obj_type(obj_start) == OBJ_NULL ? 0 : obj_int(obj_start);
+    int32_t end = obj_type(obj_end) == OBJ_NULL ? 0 : obj_int(obj_end);
 
-    switch (left.type) {
+    switch (obj_type(left)) {
         case OBJ_ARRAY:
-            return build_slice_from_array(left.value.list, start, end);
+            return build_slice_from_array(obj_list(left), start, end);
         break;
 
         case OBJ_STRING:
-            return build_slice_from_string(left.value.string, start, end);
+            return build_slice_from_string(obj_string(left), start, end);
         break;
 
         default:
@@ -446,8 +843,336 @@ build_slice(struct object left, struct object obj_start, struct object obj_end)
     } 
 }
 
+static void 
+vm_do_slice(struct vm* restrict vm) {
+    struct object end = vm_stack_pop(vm);
+    struct object start = vm_stack_pop(vm);
+    struct object left = vm_stack_pop(vm);
+    struct object obj = build_slice(left, start, end);
+    gc_add(vm, obj);
+    vm_stack_push(vm, obj);
+}
+
+static enum opcode 
+quickened_int_opcode(enum opcode opcode) {
+    switch (opcode) {
+        case OPCODE_ADD: return OPCODE_ADD_INT;
+        case OPCODE_SUBTRACT: return OPCODE_SUBTRACT_INT;
+        case OPCODE_MULTIPLY: return OPCODE_MULTIPLY_INT;
+        case OPCODE_DIVIDE: return OPCODE_DIVIDE_INT;
+        case OPCODE_MODULO: return OPCODE_MODULO_INT;
+        case OPCODE_EQUAL: return OPCODE_EQUAL_INT;
+        case OPCODE_NOT_EQUAL: return OPCODE_NOT_EQUAL_INT;
+        case OPCODE_GREATER_THAN: return OPCODE_GREATER_THAN_INT;
+        case OPCODE_GREATER_THAN_OR_EQUALS: return OPCODE_GREATER_THAN_OR_EQUALS_INT;
+        case OPCODE_LESS_THAN: return OPCODE_LESS_THAN_INT;
+        case OPCODE_LESS_THAN_OR_EQUALS: return OPCODE_LESS_THAN_OR_EQUALS_INT;
+        default: return opcode;
+    }
+}
+
+static enum opcode 
+generic_opcode(enum opcode opcode) {
+    switch (opcode) {
+        case OPCODE_ADD_INT: return OPCODE_ADD;
+        case OPCODE_SUBTRACT_INT: return OPCODE_SUBTRACT;
+        case OPCODE_MULTIPLY_INT: return OPCODE_MULTIPLY;
+        case OPCODE_DIVIDE_INT: return OPCODE_DIVIDE;
+        case OPCODE_MODULO_INT: return OPCODE_MODULO;
+        case OPCODE_EQUAL_INT: return OPCODE_EQUAL;
+        case OPCODE_NOT_EQUAL_INT: return OPCODE_NOT_EQUAL;
+        case OPCODE_GREATER_THAN_INT: return OPCODE_GREATER_THAN;
+        case OPCODE_GREATER_THAN_OR_EQUALS_INT: return OPCODE_GREATER_THAN_OR_EQUALS;
+        case OPCODE_LESS_THAN_INT: return OPCODE_LESS_THAN;
+        case OPCODE_LESS_THAN_OR_EQUALS_INT: return OPCODE_LESS_THAN_OR_EQUALS;
+        case OPCODE_INDEX_GET_ARRAY_INT: return OPCODE_INDEX_GET;
+        case OPCODE_INT_ADD: return OPCODE_ADD;
+        case OPCODE_INT_SUBTRACT: return OPCODE_SUBTRACT;
+        case OPCODE_INT_MULTIPLY: return OPCODE_MULTIPLY;
+        case OPCODE_INT_EQUAL: return OPCODE_EQUAL;
+        case OPCODE_INT_NOT_EQUAL: return OPCODE_NOT_EQUAL;
+        case OPCODE_INT_GREATER_THAN: return OPCODE_GREATER_THAN;
+        case OPCODE_INT_GREATER_THAN_OR_EQUALS: return OPCODE_GREATER_THAN_OR_EQUALS;
+        case OPCODE_INT_LESS_THAN: return OPCODE_LESS_THAN;
+        case OPCODE_INT_LESS_THAN_OR_EQUALS: return OPCODE_LESS_THAN_OR_EQUALS;
+        case OPCODE_INT_INC_LOCAL: return OPCODE_INC_LOCAL;
+        case OPCODE_INT_DEC_LOCAL: return OPCODE_DEC_LOCAL;
+        case OPCODE_BOOL_EQUAL: return OPCODE_EQUAL;
+        case OPCODE_BOOL_NOT_EQUAL: return OPCODE_NOT_EQUAL;
+        case OPCODE_BOOL_BANG: return OPCODE_BANG;
+        case OPCODE_INDEX_GET_IN_BOUNDS: return OPCODE_INDEX_GET;
+        case OPCODE_INDEX_SET_IN_BOUNDS: return OPCODE_INDEX_SET;
+        case OPCODE_INDEX_GET_LOCAL_LOCAL_IN_BOUNDS: return OPCODE_INDEX_GET_LOCAL_LOCAL;
+        default: return opcode;
+    }
+}
+
+/* rewrites the binary instruction at ip into its integer variant if both operands, right and the object below it, are integers */
+static inline void 
+vm_quicken_binary_operation(uint8_t* ip, const struct object* right) {
+    const struct object* left = right - 1;
+    if (obj_type(*left) == OBJ_INT && obj_type(*right) == OBJ_INT) {
+        *ip = quickened_int_opcode(*ip);
+    }
+}
+
+static struct object
+vm_index_get(struct vm* restrict vm, struct object left, struct object index) {
+    if (obj_type(index) != OBJ_INT) {
+        struct object obj = make_error_object("Array index must be integer or slice");
+        gc_add(vm, obj);
+        return obj;
+    }
+
+    const int64_t i = obj_int(index);
+    switch (obj_type(left)) {
+        case OBJ_ARRAY: {
+            struct object_list* list = obj_list(left);
+            unsigned idx = (unsigned) (i < 0 ? list->size + i : i);
+            if (idx >= list->size) {
+                struct object obj = make_error_object("Array index out of bounds");
+                gc_add(vm, obj);
+                return obj;
+            } 
+            
+            return list->values[idx];
+        }
+        break;
+
+        case OBJ_STRING: {
+            const char *str = obj_string(left)->value;
+            unsigned idx = (unsigned) (i < 0 ? (int) obj_string(left)->length + i : i);
+            if (idx >= obj_string(left)->length) {
+                struct object obj = make_error_object("String index out of bounds");
+                gc_add(vm, obj);
+                return obj;
+            } 
+            
+            /* TODO: Create char object? Bit wasteful here for a single byte */
+            char buf[2];
+            buf[0] = (char) str[idx];
+            buf[1] = '\0';
+            struct object obj = make_string_object(buf);
+            gc_add(vm, obj);
+            return obj;
+        }
+        break;
+
+        default: {
+            struct object obj = make_error_object("Invalid left-hand side for indexing operation");
+            gc_add(vm, obj);
+            return obj;
+        }
+        break;
+    }
+}
+
+static void
+vm_do_index_get(struct vm* restrict vm, struct object left, struct object index) {
+    struct object obj = vm_index_get(vm, left, index);
+    vm_stack_push(vm, obj);
+}
+
+/* assigns value to array[index], returning the value or an error */
+static struct object
+vm_index_set(struct vm* restrict vm, struct object array, struct object index, struct object value) {
+    assert(obj_type(index) == OBJ_INT);
+    assert(obj_type(array) == OBJ_ARRAY);
+    struct object_list* list = obj_list(array);
+    const int64_t i = obj_int(index);
+    if (i < 0 || i >= list->size) {
+        struct object obj = make_error_object("Array assignment index out of bounds");
+        gc_add(vm, obj);
+        return obj;
+    } 
+
+    list->values[i] = copy_object(&value);
+    return value;
+}
+
+static void 
+vm_do_index_set(struct vm* restrict vm) {
+    struct object value = vm_stack_pop(vm);
+    struct object index = vm_stack_pop(vm);
+    struct object array = vm_stack_pop(vm);
+
+    // Push value on stack ???
+    struct object obj = vm_index_set(vm, array, index, value);
+    vm_stack_push(vm, obj);
+}
+
+/* 
+ * Executes a single instruction that does not transfer control, for native code that does not inline it.
+ * Fused instructions push their operands and execute the generic instruction instead.
+ */
+void 
+vm_jit_execute_instruction(struct vm* restrict vm, const uint8_t* ip) {
+    const struct frame* frame = &vm_current_frame(vm);
+    enum opcode opcode = generic_opcode(*ip);
+    switch (opcode) {
+        case OPCODE_AND:
+        case OPCODE_OR:
+        case OPCODE_ADD:
+        case OPCODE_SUBTRACT:
+        case OPCODE_MULTIPLY:
+        case OPCODE_DIVIDE:
+        case OPCODE_MODULO:
+            vm_do_binary_operation(vm, opcode);
+        break;
+
+        case OPCODE_EQUAL:
+        case OPCODE_NOT_EQUAL: 
+        case OPCODE_GREATER_THAN: 
+        case OPCODE_GREATER_THAN_OR_EQUALS:
+        case OPCODE_LESS_THAN: 
+        case OPCODE_LESS_THAN_OR_EQUALS:
+            vm_do_comparision(vm, opcode);
+        break;
+
+        case OPCODE_BANG:
+            vm_do_bang_operation(vm);
+        break;
+
+        case OPCODE_MINUS:
+            vm_do_minus_operation(vm);
+        break;
+
+        case OPCODE_GET_BUILTIN:
+            vm_stack_push(vm, get_builtin_by_index(read_uint8((ip + 1))));
+        break;
+
+        case OPCODE_ARRAY:
+            vm_do_array(vm, read_uint16((ip + 1)));
+        break;
+
+        case OPCODE_SLICE:
+            vm_do_slice(vm);
+        break;
+
+        case OPCODE_LEN:
+        case OPCODE_INT:
+        case OPCODE_ARRAY_PUSH:
+        case OPCODE_ARRAY_POP:
+            vm->stack_pointer = (uint32_t) (vm_intrinsic(vm, opcode, &vm->stack[vm->stack_pointer]) - vm->stack);
+        break;
+
+        case OPCODE_INDEX_GET: {
+            struct object index = vm_stack_pop(vm);
+            struct object left = vm_stack_pop(vm);
+            vm_do_index_get(vm, left, index);
+        }
+        break;
+
+        case OPCODE_INDEX_SET:
+            vm_do_index_set(vm);
+        break;
+
+        case OPCODE_ADD_LOCAL_CONST:
+        case OPCODE_SUBTRACT_LOCAL_CONST:
+            vm_stack_push(vm, vm->stack[frame->base_pointer + read_uint8((ip + 1))]);
+            vm_stack_push(vm, vm->constants[read_uint16((ip + 2))]);
+            vm_do_binary_operation(vm, opcode == OPCODE_ADD_LOCAL_CONST ? OPCODE_ADD : OPCODE_SUBTRACT);
+        break;
+
+        case OPCODE_LESS_THAN_LOCAL_CONST:
+        case OPCODE_EQUAL_LOCAL_CONST:
+            vm_stack_push(vm, vm->stack[frame->base_pointer + read_uint8((ip + 1))]);
+            vm_stack_push(vm, vm->constants[read_uint16((ip + 2))]);
+            vm_do_comparision(vm, opcode == OPCODE_LESS_THAN_LOCAL_CONST ? OPCODE_LESS_THAN : OPCODE_EQUAL);
+        break;
+
+        case OPCODE_ADD_LOCAL_LOCAL:
+            vm_stack_push(vm, vm->stack[frame->base_pointer + read_uint8((ip + 1))]);
+            vm_stack_push(vm, vm->stack[frame->base_pointer + read_uint8((ip + 2))]);
+            vm_do_binary_operation(vm, OPCODE_ADD);
+        break;
+
+        case OPCODE_LESS_THAN_LOCAL_LOCAL:
+            vm_stack_push(vm, vm->stack[frame->base_pointer + read_uint8((ip + 1))]);
+            vm_stack_push(vm, vm->stack[frame->base_pointer + read_uint8((ip + 2))]);
+            vm_do_comparision(vm, OPCODE_LESS_THAN);
+        break;
+
+        case OPCODE_INDEX_GET_LOCAL_LOCAL:
+            vm_do_index_get(vm, vm->stack[frame->base_pointer + read_uint8((ip + 1))], vm->stack[frame->base_pointer + read_uint8((ip + 2))]);
+        break;
+
+        // native code jumps on the pushed result of a compare-and-branch instruction itself
+        case OPCODE_JUMP_IF_NOT_EQUAL:
+        case OPCODE_JUMP_IF_EQUAL:
+        case OPCODE_JUMP_IF_NOT_GREATER_THAN:
+        case OPCODE_JUMP_IF_NOT_GREATER_THAN_OR_EQUALS:
+        case OPCODE_JUMP_IF_NOT_LESS_THAN:
+        case OPCODE_JUMP_IF_NOT_LESS_THAN_OR_EQUALS:
+            vm_do_comparision(vm, branch_comparison(opcode));
+        break;
+
+        case OPCODE_JUMP_IF_NOT_LESS_THAN_LOCAL_CONST:
+        case OPCODE_JUMP_IF_NOT_EQUAL_LOCAL_CONST:
+            vm_stack_push(vm, vm->stack[frame->base_pointer + read_uint8((ip + 3))]);
+            vm_stack_push(vm, vm->constants[read_uint16((ip + 4))]);
+            vm_do_comparision(vm, opcode == OPCODE_JUMP_IF_NOT_LESS_THAN_LOCAL_CONST ? OPCODE_LESS_THAN : OPCODE_EQUAL);
+        break;
+
+        case OPCODE_JUMP_IF_NOT_LESS_THAN_LOCAL_LOCAL:
+            vm_stack_push(vm, vm->stack[frame->base_pointer + read_uint8((ip + 3))]);
+            vm_stack_push(vm, vm->stack[frame->base_pointer + read_uint8((ip + 4))]);
+            vm_do_comparision(vm, OPCODE_LESS_THAN);
+        break;
+
+        case OPCODE_INC_LOCAL:
+        case OPCODE_DEC_LOCAL:
+            vm_increment(vm, &vm->stack[frame->base_pointer + read_uint8((ip + 1))], opcode == OPCODE_INC_LOCAL ? 1 : -1);
+        break;
+
+        case OPCODE_INC_GLOBAL:
+            vm_increment(vm, &vm->globals[read_uint16((ip + 1))], 1);
+        break;
+
+        default:
+            err(VM_ERR_INVALID_OPERATOR, "Invalid opcode %s for native code.", opcode_to_str(opcode));
+        break;
+    }
+}
+
+/* 
+ * Returning from an interpreted function into native code goes through this HALT instruction,
+ * so that vm_run returns control to the native caller
+ */
+static uint8_t vm_jit_return_trampoline[] = { OPCODE_CALL, OPCODE_HALT };
+
+/* runs the frame of a function called from native code in the interpreter until it returns */
+void
+vm_jit_finish_call(struct vm* restrict vm) {
+    vm->frames[vm->frame_index - 1].ip = vm_jit_return_trampoline;
+    vm_run(vm);
+}
+
+/* calls a function from native code, running it in the interpreter if it is (or fell back to) interpreted */
+void 
+vm_jit_call(struct vm* restrict vm, uint8_t num_args) {
+    unsigned frame_index = vm->frame_index;
+    vm_do_call(vm, num_args);
+    if (vm->frame_index > frame_index) {
+        vm_jit_finish_call(vm);
+    }
+}
+
+#ifdef TAIL_CALL_DISPATCH
+typedef enum result (*vm_handler)(HANDLER_PARAMETERS);
+
+#define DECLARE_HANDLER(name) static enum result HANDLE_OPCODE_##name(HANDLER_PARAMETERS);
+#define HANDLER_ADDRESS(name) [OPCODE_##name] = HANDLE_OPCODE_##name,
+VM_OPCODES(DECLARE_HANDLER)
+
+static const vm_handler handlers[] = { VM_OPCODES(HANDLER_ADDRESS) };
+
+#include "vm_handlers.h"
+#endif
+
 enum result 
 vm_run(struct vm* restrict vm) {
+#ifndef TAIL_CALL_DISPATCH
     /* 
     The following comment is taken from CPython's source: https://github.com/python/cpython/blob/master/Python/ceval.c#L775
 
@@ -488,44 +1213,13 @@ vm_run(struct vm* restrict vm) {
    can be disabled on gcc by using the -fno-gcse flag (or possibly
    -fno-crossjumping).
 */
-    const void *dispatch_table[] = {
-        &&GOTO_OPCODE_CONST,
-        &&GOTO_OPCODE_POP,
-        &&GOTO_OPCODE_ADD,
-        &&GOTO_OPCODE_SUBTRACT,
-        &&GOTO_OPCODE_MULTIPLY,
-        &&GOTO_OPCODE_DIVIDE,
-        &&GOTO_OPCODE_MODULO,
-        &&GOTO_OPCODE_TRUE,
-        &&GOTO_OPCODE_FALSE,
-        &&GOTO_OPCODE_EQUAL,
-        &&GOTO_OPCODE_NOT_EQUAL,
-        &&GOTO_OPCODE_GREATER_THAN,
-        &&GOTO_OPCODE_GREATER_THAN_OR_EQUALS,
-        &&GOTO_OPCODE_LESS_THAN,
-        &&GOTO_OPCODE_LESS_THAN_OR_EQUALS,
-        &&GOTO_OPCODE_AND,
-        &&GOTO_OPCODE_OR,
-        &&GOTO_OPCODE_MINUS,
-        &&GOTO_OPCODE_BANG,
-        &&GOTO_OPCODE_JUMP,
-        &&GOTO_OPCODE_JUMP_NOT_TRUE,
-        &&GOTO_OPCODE_NULL,
-        &&GOTO_OPCODE_GET_GLOBAL,
-        &&GOTO_OPCODE_SET_GLOBAL,
-        &&GOTO_OPCODE_CALL,
-        &&GOTO_OPCODE_RETURN_VALUE,
-        &&GOTO_OPCODE_RETURN,
-        &&GOTO_OPCODE_GET_LOCAL,
-        &&GOTO_OPCODE_SET_LOCAL,
-        &&GOTO_OPCODE_GET_BUILTIN,
-        &&GOTO_OPCODE_ARRAY,
-        &&GOTO_OPCODE_INDEX_GET,
-        &&GOTO_OPCODE_INDEX_SET,
-        &&GOTO_OPCODE_SLICE,
-        &&GOTO_OPCODE_HALT,
-    };
-    struct frame *frame = &vm_current_frame(vm);
+    const void *dispatch_table[] = { VM_OPCODES(LABEL_ADDRESS) };
+#endif
+    struct frame *frame;
+    uint8_t *ip;
+    struct object *sp;
+    struct object *locals;
+    LOAD_STATE();
 
     #ifdef DEBUG
     char *instruction_str = instruction_to_str(&frame->fn->instructions);
@@ -533,254 +1227,429 @@ vm_run(struct vm* restrict vm) {
     free(instruction_str);
     #endif 
 
+    // run the main program as native code once it gets hot
+    if (vm->jit && vm->frame_index == 0 && ip == frame->fn->instructions.bytes && vm_jit_compiled(vm, frame->fn)) {
+        SAVE_STATE();
+        vm_jit_run(vm, frame);
+        LOAD_STATE();
+    }
+
     // intitial dispatch
+#ifdef TAIL_CALL_DISPATCH
+    return handlers[*ip](vm, frame, ip, sp, locals);
+#else
     DISPATCH();
 
-    // pushes a constant on the stack
-    GOTO_OPCODE_CONST: {
-        uint16_t idx = read_uint16((frame->ip + 1));
-        frame->ip += 3;
-        vm_stack_push(vm, vm->constants[idx]); 
-        DISPATCH();
-    }
+    #include "vm_handlers.h"
+#endif
+}
 
-    // pop last value off the stack and discard it
-    GOTO_OPCODE_POP: {
-        vm_stack_pop_ignore(vm);
-        frame->ip++;
-        DISPATCH();
+/* 
+ * Handler for a three-address register instruction: A = B op C, where C is a register or a constant
+ * Integers are handled inline, everything else goes through the generic (stack machine) implementation
+ */
+#define REGISTER_OPERATION(generic, operation, right_operand, width, guard, result)       \
+    {                                                                   \
+        struct object* dest = &regs[read_uint8((ip + 1))];       \
+        struct object left = regs[read_uint8((ip + 2))];         \
+        struct object right = right_operand;                            \
+        ip += width;                                             \
+        if (obj_type(left) == OBJ_INT && obj_type(right) == OBJ_INT && (guard)) { \
+            *dest = result;                                             \
+        } else {                                                        \
+            operation(vm, generic, &left, &right);                      \
+            *dest = left;                                               \
+        }                                                               \
+        DISPATCH_REGISTERS();                                                     \
     }
 
-    // call a (user-defined or built-in) function
-    GOTO_OPCODE_CALL: {
-        uint8_t num_args = read_uint8((++frame->ip));
-        vm_do_call(vm, num_args);
-        frame = &vm->frames[vm->frame_index];
-        DISPATCH();
+#define REGISTER_BINARY_OPERATION(generic, guard, result) \
+    REGISTER_OPERATION(generic, vm_binary_operation, regs[read_uint8((ip + 3))], 4, guard, result)
+#define REGISTER_COMPARISON(generic, result) \
+    REGISTER_OPERATION(generic, vm_comparison, regs[read_uint8((ip + 3))], 4, true, result)
+#define REGISTER_CONST_BINARY_OPERATION(generic, result) \
+    REGISTER_OPERATION(generic, vm_binary_operation, vm->constants[read_uint16((ip + 3))], 5, true, result)
+#define REGISTER_CONST_COMPARISON(generic, result) \
+    REGISTER_OPERATION(generic, vm_comparison, vm->constants[read_uint16((ip + 3))], 5, true, result)
+
+/*
+ * Handler for a register compare-and-branch instruction: compares B and C without storing the result
+ * and jumps to its last operand if the comparison is false
+ */
+#define REGISTER_COMPARE_AND_BRANCH(generic, operator, right_operand, width) \
+    {                                                                   \
+        const struct object left = regs[read_uint8((ip + 1))];          \
+        const struct object right = right_operand;                      \
+        bool result = obj_type(left) == OBJ_INT && obj_type(right) == OBJ_INT \
+            ? obj_int(left) operator obj_int(right)                     \
+            : vm_compare(vm, generic, left, right);                     \
+        if (result) {                                                   \
+            ip += width;                                                \
+        } else {                                                        \
+            ip = frame->fn->instructions.bytes + read_uint16((ip + width - 2)); \
+        }                                                               \
+        DISPATCH_REGISTERS();                                           \
     }
 
-    GOTO_OPCODE_JUMP: {
-        uint16_t pos = read_uint16((frame->ip + 1));
-        frame->ip = frame->fn->instructions.bytes + pos;
-        DISPATCH();
-    }
+/* 
+ * Runs register code, as compiled by the compiler's register code generator
+ * Every frame owns the registers [base_pointer, base_pointer + fn->num_locals) of the stack, 
+ * so the stack pointer always covers every live register for the garbage collector.
+ */
+enum result 
+vm_run_registers(struct vm* restrict vm) {
+    const void *dispatch_table[] = {
+        [OPCODE_HALT] = &&GOTO_OPCODE_HALT,
+        [OPCODE_R_MOVE] = &&GOTO_OPCODE_R_MOVE,
+        [OPCODE_R_CONST] = &&GOTO_OPCODE_R_CONST,
+        [OPCODE_R_TRUE] = &&GOTO_OPCODE_R_TRUE,
+        [OPCODE_R_FALSE] = &&GOTO_OPCODE_R_FALSE,
+        [OPCODE_R_NULL] = &&GOTO_OPCODE_R_NULL,
+        [OPCODE_R_GET_GLOBAL] = &&GOTO_OPCODE_R_GET_GLOBAL,
+        [OPCODE_R_SET_GLOBAL] = &&GOTO_OPCODE_R_SET_GLOBAL,
+        [OPCODE_R_GET_BUILTIN] = &&GOTO_OPCODE_R_GET_BUILTIN,
+        [OPCODE_R_ADD] = &&GOTO_OPCODE_R_ADD,
+        [OPCODE_R_SUBTRACT] = &&GOTO_OPCODE_R_SUBTRACT,
+        [OPCODE_R_MULTIPLY] = &&GOTO_OPCODE_R_MULTIPLY,
+        [OPCODE_R_DIVIDE] = &&GOTO_OPCODE_R_DIVIDE,
+        [OPCODE_R_MODULO] = &&GOTO_OPCODE_R_MODULO,
+        [OPCODE_R_EQUAL] = &&GOTO_OPCODE_R_EQUAL,
+        [OPCODE_R_NOT_EQUAL] = &&GOTO_OPCODE_R_NOT_EQUAL,
+        [OPCODE_R_GREATER_THAN] = &&GOTO_OPCODE_R_GREATER_THAN,
+        [OPCODE_R_GREATER_THAN_OR_EQUALS] = &&GOTO_OPCODE_R_GREATER_THAN_OR_EQUALS,
+        [OPCODE_R_LESS_THAN] = &&GOTO_OPCODE_R_LESS_THAN,
+        [OPCODE_R_LESS_THAN_OR_EQUALS] = &&GOTO_OPCODE_R_LESS_THAN_OR_EQUALS,
+        [OPCODE_R_AND] = &&GOTO_OPCODE_R_AND,
+        [OPCODE_R_OR] = &&GOTO_OPCODE_R_OR,
+        [OPCODE_R_ADD_CONST] = &&GOTO_OPCODE_R_ADD_CONST,
+        [OPCODE_R_SUBTRACT_CONST] = &&GOTO_OPCODE_R_SUBTRACT_CONST,
+        [OPCODE_R_LESS_THAN_CONST] = &&GOTO_OPCODE_R_LESS_THAN_CONST,
+        [OPCODE_R_EQUAL_CONST] = &&GOTO_OPCODE_R_EQUAL_CONST,
+        [OPCODE_R_MINUS] = &&GOTO_OPCODE_R_MINUS,
+        [OPCODE_R_BANG] = &&GOTO_OPCODE_R_BANG,
+        [OPCODE_R_JUMP] = &&GOTO_OPCODE_R_JUMP,
+        [OPCODE_R_JUMP_NOT_TRUE] = &&GOTO_OPCODE_R_JUMP_NOT_TRUE,
+        [OPCODE_R_CALL] = &&GOTO_OPCODE_R_CALL,
+        [OPCODE_R_TAIL_CALL] = &&GOTO_OPCODE_R_TAIL_CALL,
+        [OPCODE_R_RETURN_VALUE] = &&GOTO_OPCODE_R_RETURN_VALUE,
+        [OPCODE_R_RETURN] = &&GOTO_OPCODE_R_RETURN,
+        [OPCODE_R_ARRAY] = &&GOTO_OPCODE_R_ARRAY,
+        [OPCODE_R_INDEX_GET] = &&GOTO_OPCODE_R_INDEX_GET,
+        [OPCODE_R_INDEX_SET] = &&GOTO_OPCODE_R_INDEX_SET,
+        [OPCODE_R_SLICE] = &&GOTO_OPCODE_R_SLICE,
+        [OPCODE_R_JUMP_IF_NOT_EQUAL] = &&GOTO_OPCODE_R_JUMP_IF_NOT_EQUAL,
+        [OPCODE_R_JUMP_IF_EQUAL] = &&GOTO_OPCODE_R_JUMP_IF_EQUAL,
+        [OPCODE_R_JUMP_IF_NOT_GREATER_THAN] = &&GOTO_OPCODE_R_JUMP_IF_NOT_GREATER_THAN,
+        [OPCODE_R_JUMP_IF_NOT_GREATER_THAN_OR_EQUALS] = &&GOTO_OPCODE_R_JUMP_IF_NOT_GREATER_THAN_OR_EQUALS,
+        [OPCODE_R_JUMP_IF_NOT_LESS_THAN] = &&GOTO_OPCODE_R_JUMP_IF_NOT_LESS_THAN,
+        [OPCODE_R_JUMP_IF_NOT_LESS_THAN_OR_EQUALS] = &&GOTO_OPCODE_R_JUMP_IF_NOT_LESS_THAN_OR_EQUALS,
+        [OPCODE_R_JUMP_IF_NOT_LESS_THAN_CONST] = &&GOTO_OPCODE_R_JUMP_IF_NOT_LESS_THAN_CONST,
+        [OPCODE_R_JUMP_IF_NOT_EQUAL_CONST] = &&GOTO_OPCODE_R_JUMP_IF_NOT_EQUAL_CONST,
+    };
+    struct frame *frame = &vm_current_frame(vm);
+    struct object *regs = &vm->stack[frame->base_pointer];
 
-    GOTO_OPCODE_JUMP_NOT_TRUE: {
-        struct object condition = vm_stack_pop(vm);
-        if (condition.type == OBJ_NULL || (condition.type == OBJ_BOOL && condition.value.boolean == false)) {
-            uint16_t pos = read_uint16((frame->ip + 1));
-            frame->ip = frame->fn->instructions.bytes + pos;
-        } else {
-            frame->ip += 3;
-        }
-        DISPATCH();
-    }
+    // the instruction pointer lives in a local and is only written back to the frame on calls
+    uint8_t *ip = frame->ip;
 
-    GOTO_OPCODE_SET_GLOBAL: {
-        uint16_t idx = read_uint16((frame->ip + 1));
-        frame->ip += 3;
-        vm->globals[idx] = vm_stack_pop(vm);
-        DISPATCH();
-    }
+    #ifdef DEBUG
+    char *instruction_str = instruction_to_str(&frame->fn->instructions);
+    printf("Executing VM!\nInstructions: %s\n", instruction_str);
+    free(instruction_str);
+    #endif 
 
-    GOTO_OPCODE_GET_GLOBAL: {
-        uint16_t idx = read_uint16((frame->ip + 1));
-        frame->ip += 3;
-        vm_stack_push(vm, vm->globals[idx]);
-        DISPATCH();
+    vm->stack_pointer = frame->base_pointer + frame->fn->num_locals;
+    for (unsigned i = 0; i < frame->fn->num_locals; i++) {
+        regs[i] = make_null_object();
     }
 
-    GOTO_OPCODE_RETURN_VALUE: {
-        struct object obj = vm_stack_pop(vm); 
-        vm->stack_pointer = frame->base_pointer - 1;
-        frame = &vm->frames[--vm->frame_index];
-        vm_stack_push(vm, obj);
-        frame->ip++;
-        DISPATCH();
-    }
+    // intitial dispatch
+    DISPATCH_REGISTERS();
 
-    GOTO_OPCODE_RETURN: {
-        vm->stack_pointer = frame->base_pointer - 1;
-        frame = &vm->frames[--vm->frame_index];
-        vm->stack[vm->stack_pointer++].type = OBJ_NULL;
-        frame->ip++; 
-        DISPATCH();
+    GOTO_OPCODE_R_MOVE: {
+        regs[read_uint8((ip + 1))] = regs[read_uint8((ip + 2))];
+        ip += 3;
+        DISPATCH_REGISTERS();
     }
 
-    GOTO_OPCODE_SET_LOCAL: {
-        uint8_t idx = read_uint8((frame->ip + 1));
-        frame->ip += 2;
-        vm->stack[frame->base_pointer + idx] = vm_stack_pop(vm);
-        DISPATCH();
+    GOTO_OPCODE_R_CONST: {
+        regs[read_uint8((ip + 1))] = vm->constants[read_uint16((ip + 2))];
+        ip += 4;
+        DISPATCH_REGISTERS();
     }
 
-    GOTO_OPCODE_GET_LOCAL: {
-        uint8_t idx = read_uint8((frame->ip + 1));
-        frame->ip += 2;
-        vm_stack_push(vm, vm->stack[frame->base_pointer + idx]);
-        DISPATCH();
+    GOTO_OPCODE_R_TRUE: {
+        regs[read_uint8((ip + 1))] = make_boolean_object(true);
+        ip += 2;
+        DISPATCH_REGISTERS();
     }
 
-    GOTO_OPCODE_AND:
-    GOTO_OPCODE_OR:
-    GOTO_OPCODE_ADD:
-    GOTO_OPCODE_SUBTRACT:
-    GOTO_OPCODE_MULTIPLY:
-    GOTO_OPCODE_DIVIDE:
-    GOTO_OPCODE_MODULO: {
-        vm_do_binary_operation(vm, *frame->ip++);
-        DISPATCH();
+    GOTO_OPCODE_R_FALSE: {
+        regs[read_uint8((ip + 1))] = make_boolean_object(false);
+        ip += 2;
+        DISPATCH_REGISTERS();
     }
 
-    GOTO_OPCODE_BANG: {
-        vm_do_bang_operation(vm);
-        frame->ip++;
-        DISPATCH();
+    GOTO_OPCODE_R_NULL: {
+        regs[read_uint8((ip + 1))] = make_null_object();
+        ip += 2;
+        DISPATCH_REGISTERS();
     }
 
-    GOTO_OPCODE_MINUS: {
-        vm_do_minus_operation(vm);
-        frame->ip++;
-        DISPATCH();
+    GOTO_OPCODE_R_GET_GLOBAL: {
+        regs[read_uint8((ip + 1))] = vm->globals[read_uint16((ip + 2))];
+        ip += 4;
+        DISPATCH_REGISTERS();
     }
 
-    GOTO_OPCODE_EQUAL:
-    GOTO_OPCODE_NOT_EQUAL: 
-    GOTO_OPCODE_GREATER_THAN: 
-    GOTO_OPCODE_GREATER_THAN_OR_EQUALS:
-    GOTO_OPCODE_LESS_THAN: 
-    GOTO_OPCODE_LESS_THAN_OR_EQUALS: {
-        vm_do_comparision(vm, *frame->ip++);
-        DISPATCH();
+    GOTO_OPCODE_R_SET_GLOBAL: {
+        vm->globals[read_uint16((ip + 1))] = regs[read_uint8((ip + 3))];
+        ip += 4;
+        DISPATCH_REGISTERS();
     }
 
-    GOTO_OPCODE_TRUE: {
-        vm->stack[vm->stack_pointer].type = OBJ_BOOL;
-        vm->stack[vm->stack_pointer].value.boolean = true;
-        vm->stack_pointer++;
-        frame->ip++;
-        DISPATCH();
+    GOTO_OPCODE_R_GET_BUILTIN: {
+        regs[read_uint8((ip + 1))] = get_builtin_by_index(read_uint8((ip + 2)));
+        ip += 3;
+        DISPATCH_REGISTERS();
     }
 
-    GOTO_OPCODE_FALSE: {
-        vm->stack[vm->stack_pointer].type = OBJ_BOOL;
-        vm->stack[vm->stack_pointer].value.boolean = false;
-        vm->stack_pointer++;
-        frame->ip++;
-        DISPATCH();
-    }
+    GOTO_OPCODE_R_ADD: 
+        REGISTER_BINARY_OPERATION(OPCODE_ADD, true, vm_make_integer(vm, obj_int(left) + obj_int(right)));
 
-    GOTO_OPCODE_NULL: {
-        vm->stack[vm->stack_pointer++].type = OBJ_NULL;
-        frame->ip++;
-        DISPATCH();
-    }
+    GOTO_OPCODE_R_SUBTRACT: 
+        REGISTER_BINARY_OPERATION(OPCODE_SUBTRACT, true, vm_make_integer(vm, obj_int(left) - obj_int(right)));
+
+    GOTO_OPCODE_R_MULTIPLY: 
+        REGISTER_BINARY_OPERATION(OPCODE_MULTIPLY, true, vm_make_integer(vm, obj_int(left) * obj_int(right)));
+
+    GOTO_OPCODE_R_DIVIDE: 
+        REGISTER_BINARY_OPERATION(OPCODE_DIVIDE, obj_int(right) != 0, vm_make_integer(vm, obj_int(left) / obj_int(right)));
 
-    GOTO_OPCODE_GET_BUILTIN: {
-        uint8_t idx = read_uint8((frame->ip + 1));
-        frame->ip += 2;
-        vm_stack_push(vm, get_builtin_by_index(idx));
-        DISPATCH();
+    GOTO_OPCODE_R_MODULO: 
+        REGISTER_BINARY_OPERATION(OPCODE_MODULO, obj_int(right) != 0, vm_make_integer(vm, obj_int(left) % obj_int(right)));
+
+    GOTO_OPCODE_R_AND: 
+    GOTO_OPCODE_R_OR: {
+        struct object left = regs[read_uint8((ip + 2))];
+        struct object right = regs[read_uint8((ip + 3))];
+        vm_binary_operation(vm, *ip == OPCODE_R_AND ? OPCODE_AND : OPCODE_OR, &left, &right);
+        regs[read_uint8((ip + 1))] = left;
+        ip += 4;
+        DISPATCH_REGISTERS();
     }
 
-    GOTO_OPCODE_ARRAY: {
-        uint16_t num_elements = read_uint16((frame->ip + 1));
-        frame->ip += 3;
-        struct object array = vm_build_array(vm, vm->stack_pointer - num_elements, vm->stack_pointer);
-        vm->stack_pointer -= num_elements;
-        vm_stack_push(vm, array);
-        gc_add(vm, array);
-        DISPATCH();
+    GOTO_OPCODE_R_EQUAL: 
+        REGISTER_COMPARISON(OPCODE_EQUAL, make_boolean_object(obj_int(left) == obj_int(right)));
+
+    GOTO_OPCODE_R_NOT_EQUAL: 
+        REGISTER_COMPARISON(OPCODE_NOT_EQUAL, make_boolean_object(obj_int(left) != obj_int(right)));
+
+    GOTO_OPCODE_R_GREATER_THAN: 
+        REGISTER_COMPARISON(OPCODE_GREATER_THAN, make_boolean_object(obj_int(left) > obj_int(right)));
+
+    GOTO_OPCODE_R_GREATER_THAN_OR_EQUALS: 
+        REGISTER_COMPARISON(OPCODE_GREATER_THAN_OR_EQUALS, make_boolean_object(obj_int(left) >= obj_int(right)));
+
+    GOTO_OPCODE_R_LESS_THAN: 
+        REGISTER_COMPARISON(OPCODE_LESS_THAN, make_boolean_object(obj_int(left) < obj_int(right)));
+
+    GOTO_OPCODE_R_LESS_THAN_OR_EQUALS: 
+        REGISTER_COMPARISON(OPCODE_LESS_THAN_OR_EQUALS, make_boolean_object(obj_int(left) <= obj_int(right)));
+
+    GOTO_OPCODE_R_ADD_CONST: 
+        REGISTER_CONST_BINARY_OPERATION(OPCODE_ADD, vm_make_integer(vm, obj_int(left) + obj_int(right)));
+
+    GOTO_OPCODE_R_SUBTRACT_CONST: 
+        REGISTER_CONST_BINARY_OPERATION(OPCODE_SUBTRACT, vm_make_integer(vm, obj_int(left) - obj_int(right)));
+
+    GOTO_OPCODE_R_LESS_THAN_CONST: 
+        REGISTER_CONST_COMPARISON(OPCODE_LESS_THAN, make_boolean_object(obj_int(left) < obj_int(right)));
+
+    GOTO_OPCODE_R_EQUAL_CONST: 
+        REGISTER_CONST_COMPARISON(OPCODE_EQUAL, make_boolean_object(obj_int(left) == obj_int(right)));
+
+    GOTO_OPCODE_R_MINUS: {
+        struct object result = vm_make_integer(vm, -obj_int(regs[read_uint8((ip + 2))]));
+        regs[read_uint8((ip + 1))] = result;
+        ip += 3;
+        DISPATCH_REGISTERS();
     }
 
-    GOTO_OPCODE_SLICE: {
-        struct object end = vm_stack_pop(vm);
-        struct object start = vm_stack_pop(vm);
-        struct object left = vm_stack_pop(vm);
-        struct object obj = build_slice(left, start, end);
-        gc_add(vm, obj);
-        vm_stack_push(vm, obj);
-        frame->ip++;
-        DISPATCH();
+    GOTO_OPCODE_R_BANG: {
+        regs[read_uint8((ip + 1))] = vm_bang(regs[read_uint8((ip + 2))]);
+        ip += 3;
+        DISPATCH_REGISTERS();
     }
 
-    GOTO_OPCODE_INDEX_GET: {
-        struct object index = vm_stack_pop(vm);
-        struct object left = vm_stack_pop(vm);
-        frame->ip++;
+    GOTO_OPCODE_R_JUMP: {
+        ip = frame->fn->instructions.bytes + read_uint16((ip + 1));
+        DISPATCH_REGISTERS();
+    }
 
-        if (index.type != OBJ_INT) {
-            struct object obj = make_error_object("Array index must be integer or slice");
-            vm_stack_push(vm, obj);
-            gc_add(vm, obj);
-            DISPATCH();
+    GOTO_OPCODE_R_JUMP_NOT_TRUE: {
+        struct object condition = regs[read_uint8((ip + 1))];
+        if (obj_type(condition) == OBJ_NULL || (obj_type(condition) == OBJ_BOOL && obj_bool(condition) == false)) {
+            ip = frame->fn->instructions.bytes + read_uint16((ip + 2));
+        } else {
+            ip += 4;
         }
+        DISPATCH_REGISTERS();
+    }
 
-        switch (left.type) {
-            case OBJ_ARRAY: {
-                struct object_list* list = left.value.list;
-                unsigned idx = (unsigned) (index.value.integer < 0 ? list->size + index.value.integer : index.value.integer);
-                if (idx >= list->size) {
-                    vm_stack_push(vm, make_error_object("Array index out of bounds"));
-                    gc_add(vm, vm_stack_cur(vm));
-                } else {
-                    vm_stack_push(vm, list->values[idx]);
+    GOTO_OPCODE_R_JUMP_IF_NOT_EQUAL: 
+        REGISTER_COMPARE_AND_BRANCH(OPCODE_EQUAL, ==, regs[read_uint8((ip + 2))], 5);
+
+    GOTO_OPCODE_R_JUMP_IF_EQUAL: 
+        REGISTER_COMPARE_AND_BRANCH(OPCODE_NOT_EQUAL, !=, regs[read_uint8((ip + 2))], 5);
+
+    GOTO_OPCODE_R_JUMP_IF_NOT_GREATER_THAN: 
+        REGISTER_COMPARE_AND_BRANCH(OPCODE_GREATER_THAN, >, regs[read_uint8((ip + 2))], 5);
+
+    GOTO_OPCODE_R_JUMP_IF_NOT_GREATER_THAN_OR_EQUALS: 
+        REGISTER_COMPARE_AND_BRANCH(OPCODE_GREATER_THAN_OR_EQUALS, >=, regs[read_uint8((ip + 2))], 5);
+
+    GOTO_OPCODE_R_JUMP_IF_NOT_LESS_THAN: 
+        REGISTER_COMPARE_AND_BRANCH(OPCODE_LESS_THAN, <, regs[read_uint8((ip + 2))], 5);
+
+    GOTO_OPCODE_R_JUMP_IF_NOT_LESS_THAN_OR_EQUALS: 
+        REGISTER_COMPARE_AND_BRANCH(OPCODE_LESS_THAN_OR_EQUALS, <=, regs[read_uint8((ip + 2))], 5);
+
+    GOTO_OPCODE_R_JUMP_IF_NOT_LESS_THAN_CONST: 
+        REGISTER_COMPARE_AND_BRANCH(OPCODE_LESS_THAN, <, vm->constants[read_uint16((ip + 2))], 6);
+
+    GOTO_OPCODE_R_JUMP_IF_NOT_EQUAL_CONST: 
+        REGISTER_COMPARE_AND_BRANCH(OPCODE_EQUAL, ==, vm->constants[read_uint16((ip + 2))], 6);
+
+    // call the function in register A with the arguments in the registers after it
+    GOTO_OPCODE_R_CALL: {
+        uint8_t callee_reg = read_uint8((ip + 1));
+        uint8_t num_args = read_uint8((ip + 2));
+        struct object callee = regs[callee_reg];
+        switch (obj_type(callee)) {
+            case OBJ_COMPILED_FUNCTION: {
+                // the arguments become the callee's first registers, its remaining registers start out as null
+                struct compiled_function* fn = obj_fn(callee);
+                unsigned base_pointer = frame->base_pointer + callee_reg + 1;
+                frame->ip = ip;
+                frame = vm_push_frame(vm);
+                vm_reserve_stack(vm, base_pointer + fn->num_locals);
+                ip = fn->instructions.bytes;
+                frame->fn = fn;
+                frame->base_pointer = base_pointer;
+                vm->stack_pointer = base_pointer + fn->num_locals;
+                regs = &vm->stack[base_pointer];
+                for (unsigned i = num_args; i < fn->num_locals; i++) {
+                    regs[i] = make_null_object();
                 }
             }
             break;
 
-            case OBJ_STRING: {
-                const char *str = left.value.string->value;
-                unsigned idx = (unsigned) (index.value.integer < 0 ? (int) left.value.string->length + index.value.integer : index.value.integer);
-                if (idx >= left.value.string->length) {
-                    vm_stack_push(vm, make_error_object("String index out of bounds"));
-                    gc_add(vm, vm_stack_cur(vm));
-                } else {
-                    /* TODO: Create char object? Bit wasteful here for a single byte */
-                    char buf[2];
-                    buf[0] = (char) str[idx];
-                    buf[1] = '\0';
-                    struct object obj = make_string_object(buf);
-                    vm_stack_push(vm, obj);
-                    gc_add(vm, obj);
-                }   
-            }
+            case OBJ_BUILTIN:
+                regs[callee_reg] = vm_call_builtin(vm, obj_builtin(callee), &regs[callee_reg + 1], num_args);
+                ip += 3;
             break;
 
-            default: {
-                struct object obj = make_error_object("Invalid left-hand side for indexing operation");
-                vm_stack_push(vm, obj);
-                gc_add(vm, obj);
+            default:
+                err(VM_ERR_INVALID_FUNCTION_CALL, "Invalid function call.");
+            break;
+        }
+        DISPATCH_REGISTERS();
+    }
+
+    // the callee and its arguments replace our function and registers, reusing the frame
+    GOTO_OPCODE_R_TAIL_CALL: {
+        uint8_t callee_reg = read_uint8((ip + 1));
+        uint8_t num_args = read_uint8((ip + 2));
+        struct object callee = regs[callee_reg];
+        switch (obj_type(callee)) {
+            case OBJ_COMPILED_FUNCTION: {
+                struct compiled_function* fn = obj_fn(callee);
+                vm_reserve_stack(vm, frame->base_pointer + fn->num_locals);
+                regs = &vm->stack[frame->base_pointer];
+                memmove(regs - 1, &regs[callee_reg], (num_args + 1u) * sizeof(struct object));
+                ip = fn->instructions.bytes;
+                frame->fn = fn;
+                vm->stack_pointer = frame->base_pointer + fn->num_locals;
+                for (unsigned i = num_args; i < fn->num_locals; i++) {
+                    regs[i] = make_null_object();
+                }
             }
             break;
+
+            // built-in functions do not get a frame of their own, so return their result (in the call register) right away
+            case OBJ_BUILTIN:
+                regs[callee_reg] = vm_call_builtin(vm, obj_builtin(callee), &regs[callee_reg + 1], num_args);
+                goto GOTO_OPCODE_R_RETURN_VALUE;
+
+            default:
+                err(VM_ERR_INVALID_FUNCTION_CALL, "Invalid function call.");
+            break;
         }
-        
-        DISPATCH();
-    }
-
-    GOTO_OPCODE_INDEX_SET: {
-        struct object value = vm_stack_pop(vm);
-        struct object index = vm_stack_pop(vm);
-        struct object array = vm_stack_pop(vm);
-        assert(index.type == OBJ_INT);
-        assert(array.type == OBJ_ARRAY);
-        struct object_list* list = array.value.list;
-        if (index.value.integer < 0 || index.value.integer >= list->size) {
-            vm_stack_push(vm, make_error_object("Array assignment index out of bounds"));
-            gc_add(vm, vm_stack_cur(vm));
-        } else {
-            list->values[index.value.integer] = copy_object(&value);
+        DISPATCH_REGISTERS();
+    }
+
+    // the return value replaces the function in the caller's call register, right below our frame
+    GOTO_OPCODE_R_RETURN_VALUE: {
+        vm->stack[frame->base_pointer - 1] = regs[read_uint8((ip + 1))];
+        frame = &vm->frames[--vm->frame_index];
+        ip = frame->ip + 3;
+        regs = &vm->stack[frame->base_pointer];
+        vm->stack_pointer = frame->base_pointer + frame->fn->num_locals;
+        DISPATCH_REGISTERS();
+    }
 
-            // Push value on stack ???
-            vm_stack_push(vm, value);
+    GOTO_OPCODE_R_RETURN: {
+        vm->stack[frame->base_pointer - 1] = make_null_object();
+        frame = &vm->frames[--vm->frame_index];
+        ip = frame->ip + 3;
+        regs = &vm->stack[frame->base_pointer];
+        vm->stack_pointer = frame->base_pointer + frame->fn->num_locals;
+        DISPATCH_REGISTERS();
+    }
+
+    GOTO_OPCODE_R_ARRAY: {
+        unsigned start = frame->base_pointer + read_uint8((ip + 2));
+        struct object array = vm_build_array(vm, start, start + read_uint16((ip + 3)));
+        gc_add(vm, array);
+        regs[read_uint8((ip + 1))] = array;
+        ip += 5;
+        DISPATCH_REGISTERS();
+    }
+
+    GOTO_OPCODE_R_INDEX_GET: {
+        struct object left = regs[read_uint8((ip + 2))];
+        struct object index = regs[read_uint8((ip + 3))];
+        struct object* dest = &regs[read_uint8((ip + 1))];
+        ip += 4;
+        if (obj_type(left) == OBJ_ARRAY && obj_type(index) == OBJ_INT && (uint64_t) obj_int(index) < obj_list(left)->size) {
+            *dest = obj_list(left)->values[obj_int(index)];
+        } else {
+            *dest = vm_index_get(vm, left, index);
         }
-        
-        frame->ip++;
-        DISPATCH();
+        DISPATCH_REGISTERS();
+    }
+
+    GOTO_OPCODE_R_INDEX_SET: {
+        struct object result = vm_index_set(vm, regs[read_uint8((ip + 2))], regs[read_uint8((ip + 3))], regs[read_uint8((ip + 4))]);
+        regs[read_uint8((ip + 1))] = result;
+        ip += 5;
+        DISPATCH_REGISTERS();
+    }
+
+    GOTO_OPCODE_R_SLICE: {
+        const struct object* operands = &regs[read_uint8((ip + 2))];
+        struct object obj = build_slice(operands[0], operands[1], operands[2]);
+        gc_add(vm, obj);
+        regs[read_uint8((ip + 1))] = obj;
+        ip += 3;
+        DISPATCH_REGISTERS();
     }
 
     GOTO_OPCODE_HALT: ;
 
+    // the main program left its result in register 0, which is where vm_stack_last_popped() looks for it
+    vm->stack_pointer = frame->base_pointer;
     return VM_SUCCESS;
 }
 
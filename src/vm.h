@@ -1,12 +1,15 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 #include "opcode.h"
 #include "object.h"
 
+// initial number of frames and stack slots, both grow on demand up to their maximum
 #define FRAMES_SIZE 64u
-#define GLOBALS_SIZE 64u
+#define MAX_FRAMES_SIZE (1u << 20)
 #define STACK_SIZE 256u
+#define MAX_STACK_SIZE (1u << 22)
 
 enum result {
     VM_SUCCESS = 0,
@@ -28,15 +31,30 @@ struct vm {
     unsigned stack_pointer;
     unsigned frame_index;
     unsigned nconstants;
-    struct object stack[STACK_SIZE];
-    struct object constants[GLOBALS_SIZE];
-    struct frame frames[FRAMES_SIZE];
-    struct object globals[GLOBALS_SIZE];
+    unsigned nglobals;
+    unsigned stack_cap;
+    unsigned frames_cap;
+    /* reallocated when a call needs more room, so pointers into the stack or frames do not survive a call */
+    struct object *stack;
+    struct frame *frames;
+    /* read straight from the bytecode's constants, which outlive the VM */
+    struct object *constants;
+    /* one slot for every global in the symbol table, stored in the list passed to vm_new_with_globals() */
+    struct object *globals;
+    /* the globals list created by vm_new(), NULL if the globals belong to the caller */
+    struct object_list *owned_globals;
     struct object_list *heap;
+
+    /* compile hot functions to native code, see jit.c */
+    bool jit;
+    uint32_t jit_threshold;
+    /* number of native code activations on the C stack, see JIT_MAX_DEPTH */
+    uint32_t jit_depth;
 };
 
 struct vm *vm_new(struct bytecode *bc);
-struct vm *vm_new_with_globals(struct bytecode *bc, struct object globals[GLOBALS_SIZE]);
+struct vm *vm_new_with_globals(struct bytecode *bc, struct object_list *globals);
 enum result vm_run(struct vm *vm);
+enum result vm_run_registers(struct vm *vm);
 struct object vm_stack_last_popped(struct vm *vm);
 void vm_free(struct vm *vm);
@@ -0,0 +1,685 @@
+/*
+ * Handlers for the opcodes of the stack machine, see vm_run()
+ *
+ * Each handler starts with TARGET(name) and ends every path through it with DISPATCH() to continue with the next
+ * instruction, or JUMP_TO(name) to continue in another handler. It runs with the VM state of vm_run in scope:
+ * vm, the current frame, the instruction pointer ip, the stack pointer sp and the frame's locals.
+ * vm.c includes this file once: either inside vm_run, where handlers are labels dispatched to with computed gotos,
+ * or at file scope when built with TAIL_CALL_DISPATCH, where every handler is a function that tail calls the next.
+ */
+
+// pushes a constant on the stack
+TARGET(CONST) {
+    uint16_t idx = read_uint16((ip + 1));
+    ip += 3;
+    *sp++ = vm->constants[idx]; 
+    DISPATCH();
+}
+
+// pushes a small integer stored in the instruction itself
+TARGET(PUSH_INT8) {
+    int8_t value = (int8_t) read_uint8((ip + 1));
+    ip += 2;
+    *sp++ = make_integer_object(value);
+    DISPATCH();
+}
+
+TARGET(PUSH_INT16) {
+    int16_t value = (int16_t) read_uint16((ip + 1));
+    ip += 3;
+    *sp++ = make_integer_object(value);
+    DISPATCH();
+}
+
+TARGET(INC_LOCAL) {
+    uint8_t idx = read_uint8((ip + 1));
+    ip += 2;
+    if (obj_type(locals[idx]) == OBJ_INT) {
+        locals[idx] = MAKE_INTEGER(obj_int(locals[idx]) + 1);
+    } else {
+        SAVE_STATE();
+        vm_increment(vm, &locals[idx], 1);
+        LOAD_STATE();
+    }
+    DISPATCH();
+}
+
+TARGET(DEC_LOCAL) {
+    uint8_t idx = read_uint8((ip + 1));
+    ip += 2;
+    if (obj_type(locals[idx]) == OBJ_INT) {
+        locals[idx] = MAKE_INTEGER(obj_int(locals[idx]) - 1);
+    } else {
+        SAVE_STATE();
+        vm_increment(vm, &locals[idx], -1);
+        LOAD_STATE();
+    }
+    DISPATCH();
+}
+
+TARGET(INC_GLOBAL) {
+    uint16_t idx = read_uint16((ip + 1));
+    ip += 3;
+    if (obj_type(vm->globals[idx]) == OBJ_INT) {
+        vm->globals[idx] = MAKE_INTEGER(obj_int(vm->globals[idx]) + 1);
+    } else {
+        SAVE_STATE();
+        vm_increment(vm, &vm->globals[idx], 1);
+        LOAD_STATE();
+    }
+    DISPATCH();
+}
+
+// pop last value off the stack and discard it
+TARGET(POP) {
+    sp--;
+    ip++;
+    DISPATCH();
+}
+
+/*
+ * call a (user-defined or built-in) function and quicken the call site for the type of callee
+ * Only the kind of callee is cached, not the callee itself: the instruction has no room for a pointer and the callee is
+ * on the stack anyway, so the quickened forms load it and check its type. Calls do not check arity either, so there is
+ * no arity to cache.
+ */
+TARGET(CALL) {
+    uint8_t num_args = read_uint8((ip + 1));
+    switch (obj_type(sp[-1 - num_args])) {
+        case OBJ_COMPILED_FUNCTION: *ip = OPCODE_CALL_FUNCTION; break;
+        case OBJ_BUILTIN: *ip = OPCODE_CALL_BUILTIN; break;
+        default: break;
+    }
+    ip++;
+    SAVE_STATE();
+    vm_do_call(vm, num_args);
+    LOAD_STATE();
+    DISPATCH();
+}
+
+// call sites that called a function of the same type before go straight to it
+TARGET(CALL_FUNCTION) {
+    uint8_t num_args = read_uint8((ip + 1));
+    const struct object* callee = &sp[-1 - num_args];
+    if (obj_type(*callee) != OBJ_COMPILED_FUNCTION) {
+        *ip = OPCODE_CALL;
+        DISPATCH();
+    }
+    ip++;
+    SAVE_STATE();
+    vm_do_call_function(vm, obj_fn(*callee), num_args);
+    LOAD_STATE();
+    DISPATCH();
+}
+
+TARGET(CALL_BUILTIN) {
+    uint8_t num_args = read_uint8((ip + 1));
+    const struct object* callee = &sp[-1 - num_args];
+    if (obj_type(*callee) != OBJ_BUILTIN) {
+        *ip = OPCODE_CALL;
+        DISPATCH();
+    }
+    ip++;
+    SAVE_STATE();
+    vm_do_call_builtin(vm, obj_builtin(*callee), num_args);
+    LOAD_STATE();
+    DISPATCH();
+}
+
+// call the function running in the current frame, which does not need to be looked up
+TARGET(CALL_SELF) {
+    uint8_t num_args = read_uint8((++ip));
+    SAVE_STATE();
+    vm_do_call_self(vm, num_args);
+    LOAD_STATE();
+    DISPATCH();
+}
+
+TARGET(TAIL_CALL_SELF) {
+    SAVE_STATE();
+    vm_do_tail_call_self(vm, read_uint8((ip + 1)));
+    LOAD_STATE();
+    DISPATCH();
+}
+
+// call a function in tail position, reusing the current frame
+TARGET(TAIL_CALL) {
+    uint8_t num_args = read_uint8((ip + 1));
+    const struct object callee = sp[-1 - num_args];
+    if (obj_type(callee) != OBJ_COMPILED_FUNCTION) {
+        // built-in functions do not get a frame of their own, so return their result right away
+        ip++;
+        SAVE_STATE();
+        vm_do_call(vm, num_args);
+        LOAD_STATE();
+        JUMP_TO(RETURN_VALUE);
+    }
+    SAVE_STATE();
+    vm_do_tail_call_function(vm, obj_fn(callee), num_args);
+    LOAD_STATE();
+    DISPATCH();
+}
+
+TARGET(JUMP) {
+    uint16_t pos = read_uint16((ip + 1));
+    uint8_t* target = frame->fn->instructions.bytes + pos;
+
+    // continue a hot loop in native code
+    if (vm->jit && target < ip && vm_jit_compiled(vm, frame->fn)) {
+        ip = target;
+        SAVE_STATE();
+        vm_jit_run(vm, frame);
+        LOAD_STATE();
+        DISPATCH();
+    }
+
+    ip = target;
+    DISPATCH();
+}
+
+TARGET(JUMP_NOT_TRUE) {
+    struct object condition = *--sp;
+    if (obj_type(condition) == OBJ_NULL || (obj_type(condition) == OBJ_BOOL && obj_bool(condition) == false)) {
+        uint16_t pos = read_uint16((ip + 1));
+        ip = frame->fn->instructions.bytes + pos;
+    } else {
+        ip += 3;
+    }
+    DISPATCH();
+}
+
+TARGET(JUMP_TRUE) {
+    struct object condition = *--sp;
+    if (obj_type(condition) == OBJ_NULL || (obj_type(condition) == OBJ_BOOL && obj_bool(condition) == false)) {
+        ip += 3;
+    } else {
+        uint16_t pos = read_uint16((ip + 1));
+        ip = frame->fn->instructions.bytes + pos;
+    }
+    DISPATCH();
+}
+
+TARGET(JUMP_IF_NOT_EQUAL) {
+    sp -= 2;
+    COMPARE_AND_BRANCH(OPCODE_EQUAL, ==, sp[0], sp[1], 3);
+}
+
+TARGET(JUMP_IF_EQUAL) {
+    sp -= 2;
+    COMPARE_AND_BRANCH(OPCODE_NOT_EQUAL, !=, sp[0], sp[1], 3);
+}
+
+TARGET(JUMP_IF_NOT_GREATER_THAN) {
+    sp -= 2;
+    COMPARE_AND_BRANCH(OPCODE_GREATER_THAN, >, sp[0], sp[1], 3);
+}
+
+TARGET(JUMP_IF_NOT_GREATER_THAN_OR_EQUALS) {
+    sp -= 2;
+    COMPARE_AND_BRANCH(OPCODE_GREATER_THAN_OR_EQUALS, >=, sp[0], sp[1], 3);
+}
+
+TARGET(JUMP_IF_NOT_LESS_THAN) {
+    sp -= 2;
+    COMPARE_AND_BRANCH(OPCODE_LESS_THAN, <, sp[0], sp[1], 3);
+}
+
+TARGET(JUMP_IF_NOT_LESS_THAN_OR_EQUALS) {
+    sp -= 2;
+    COMPARE_AND_BRANCH(OPCODE_LESS_THAN_OR_EQUALS, <=, sp[0], sp[1], 3);
+}
+
+TARGET(JUMP_IF_NOT_LESS_THAN_LOCAL_CONST)
+    COMPARE_AND_BRANCH(OPCODE_LESS_THAN, <, locals[read_uint8((ip + 3))], vm->constants[read_uint16((ip + 4))], 6);
+
+TARGET(JUMP_IF_NOT_LESS_THAN_LOCAL_LOCAL)
+    COMPARE_AND_BRANCH(OPCODE_LESS_THAN, <, locals[read_uint8((ip + 3))], locals[read_uint8((ip + 4))], 5);
+
+TARGET(JUMP_IF_NOT_EQUAL_LOCAL_CONST)
+    COMPARE_AND_BRANCH(OPCODE_EQUAL, ==, locals[read_uint8((ip + 3))], vm->constants[read_uint16((ip + 4))], 6);
+
+TARGET(SET_GLOBAL) {
+    uint16_t idx = read_uint16((ip + 1));
+    ip += 3;
+    vm->globals[idx] = *--sp;
+    DISPATCH();
+}
+
+TARGET(GET_GLOBAL) {
+    uint16_t idx = read_uint16((ip + 1));
+    ip += 3;
+    *sp++ = vm->globals[idx];
+    DISPATCH();
+}
+
+// the result replaces the callee on the stack, the caller continues after its call instruction
+TARGET(RETURN_VALUE) {
+    struct object obj = *--sp; 
+    sp = locals - 1;
+    frame = &vm->frames[--vm->frame_index];
+    ip = frame->ip + 1;
+    locals = &vm->stack[frame->base_pointer];
+    *sp++ = obj;
+    DISPATCH();
+}
+
+TARGET(RETURN) {
+    sp = locals - 1;
+    frame = &vm->frames[--vm->frame_index];
+    ip = frame->ip + 1;
+    locals = &vm->stack[frame->base_pointer];
+    *sp++ = make_null_object();
+    DISPATCH();
+}
+
+TARGET(SET_LOCAL) {
+    uint8_t idx = read_uint8((ip + 1));
+    ip += 2;
+    locals[idx] = *--sp;
+    DISPATCH();
+}
+
+TARGET(GET_LOCAL) {
+    uint8_t idx = read_uint8((ip + 1));
+    ip += 2;
+    *sp++ = locals[idx];
+    DISPATCH();
+}
+
+// operators on anything but integers, which quicken their instruction for the types of the operands
+TARGET(AND)
+    GENERIC_OPERATION(OPCODE_AND, vm_do_binary_operation)
+
+TARGET(OR)
+    GENERIC_OPERATION(OPCODE_OR, vm_do_binary_operation)
+
+TARGET(ADD)
+    GENERIC_OPERATION(OPCODE_ADD, vm_do_binary_operation)
+
+TARGET(SUBTRACT)
+    GENERIC_OPERATION(OPCODE_SUBTRACT, vm_do_binary_operation)
+
+TARGET(MULTIPLY)
+    GENERIC_OPERATION(OPCODE_MULTIPLY, vm_do_binary_operation)
+
+TARGET(DIVIDE)
+    GENERIC_OPERATION(OPCODE_DIVIDE, vm_do_binary_operation)
+
+TARGET(MODULO)
+    GENERIC_OPERATION(OPCODE_MODULO, vm_do_binary_operation)
+
+TARGET(BANG) {
+    sp[-1] = vm_bang(sp[-1]);
+    ip++;
+    DISPATCH();
+}
+
+TARGET(MINUS) {
+    sp[-1] = MAKE_INTEGER(-obj_int(sp[-1]));
+    ip++;
+    DISPATCH();
+}
+
+TARGET(EQUAL)
+    GENERIC_OPERATION(OPCODE_EQUAL, vm_do_comparision)
+
+TARGET(NOT_EQUAL)
+    GENERIC_OPERATION(OPCODE_NOT_EQUAL, vm_do_comparision)
+
+TARGET(GREATER_THAN)
+    GENERIC_OPERATION(OPCODE_GREATER_THAN, vm_do_comparision)
+
+TARGET(GREATER_THAN_OR_EQUALS)
+    GENERIC_OPERATION(OPCODE_GREATER_THAN_OR_EQUALS, vm_do_comparision)
+
+TARGET(LESS_THAN)
+    GENERIC_OPERATION(OPCODE_LESS_THAN, vm_do_comparision)
+
+TARGET(LESS_THAN_OR_EQUALS)
+    GENERIC_OPERATION(OPCODE_LESS_THAN_OR_EQUALS, vm_do_comparision)
+
+TARGET(TRUE) {
+    *sp++ = make_boolean_object(true);
+    ip++;
+    DISPATCH();
+}
+
+TARGET(FALSE) {
+    *sp++ = make_boolean_object(false);
+    ip++;
+    DISPATCH();
+}
+
+TARGET(NULL) {
+    *sp++ = make_null_object();
+    ip++;
+    DISPATCH();
+}
+
+TARGET(GET_BUILTIN) {
+    uint8_t idx = read_uint8((ip + 1));
+    ip += 2;
+    *sp++ = get_builtin_by_index(idx);
+    DISPATCH();
+}
+
+TARGET(LEN) {
+    sp = vm_intrinsic(vm, OPCODE_LEN, sp);
+    ip++;
+    DISPATCH();
+}
+
+TARGET(INT) {
+    sp = vm_intrinsic(vm, OPCODE_INT, sp);
+    ip++;
+    DISPATCH();
+}
+
+TARGET(ARRAY_PUSH) {
+    sp = vm_intrinsic(vm, OPCODE_ARRAY_PUSH, sp);
+    ip++;
+    DISPATCH();
+}
+
+TARGET(ARRAY_POP) {
+    sp = vm_intrinsic(vm, OPCODE_ARRAY_POP, sp);
+    ip++;
+    DISPATCH();
+}
+
+TARGET(ARRAY) {
+    uint16_t num_elements = read_uint16((ip + 1));
+    ip += 3;
+    SAVE_STATE();
+    vm_do_array(vm, num_elements);
+    LOAD_STATE();
+    DISPATCH();
+}
+
+TARGET(SLICE) {
+    SAVE_STATE();
+    vm_do_slice(vm);
+    LOAD_STATE();
+    ip++;
+    DISPATCH();
+}
+
+TARGET(INDEX_GET) {
+    struct object index = *--sp;
+    struct object left = *--sp;
+    if (obj_type(left) == OBJ_ARRAY && obj_type(index) == OBJ_INT) {
+        *ip = OPCODE_INDEX_GET_ARRAY_INT;
+    }
+    ip++;
+    SAVE_STATE();
+    vm_do_index_get(vm, left, index);
+    LOAD_STATE();
+    DISPATCH();
+}
+
+TARGET(ADD_INT)
+    QUICKENED_INT_OPERATION(OPCODE_ADD, true, MAKE_INTEGER(obj_int(*left) + obj_int(*right)));
+
+TARGET(SUBTRACT_INT)
+    QUICKENED_INT_OPERATION(OPCODE_SUBTRACT, true, MAKE_INTEGER(obj_int(*left) - obj_int(*right)));
+
+TARGET(MULTIPLY_INT)
+    QUICKENED_INT_OPERATION(OPCODE_MULTIPLY, true, MAKE_INTEGER(obj_int(*left) * obj_int(*right)));
+
+TARGET(DIVIDE_INT)
+    QUICKENED_INT_OPERATION(OPCODE_DIVIDE, obj_int(*right) != 0, MAKE_INTEGER(obj_int(*left) / obj_int(*right)));
+
+TARGET(MODULO_INT)
+    QUICKENED_INT_OPERATION(OPCODE_MODULO, obj_int(*right) != 0, MAKE_INTEGER(obj_int(*left) % obj_int(*right)));
+
+TARGET(EQUAL_INT)
+    QUICKENED_INT_OPERATION(OPCODE_EQUAL, true, make_boolean_object(obj_int(*left) == obj_int(*right)));
+
+TARGET(NOT_EQUAL_INT)
+    QUICKENED_INT_OPERATION(OPCODE_NOT_EQUAL, true, make_boolean_object(obj_int(*left) != obj_int(*right)));
+
+TARGET(GREATER_THAN_INT)
+    QUICKENED_INT_OPERATION(OPCODE_GREATER_THAN, true, make_boolean_object(obj_int(*left) > obj_int(*right)));
+
+TARGET(GREATER_THAN_OR_EQUALS_INT)
+    QUICKENED_INT_OPERATION(OPCODE_GREATER_THAN_OR_EQUALS, true, make_boolean_object(obj_int(*left) >= obj_int(*right)));
+
+TARGET(LESS_THAN_INT)
+    QUICKENED_INT_OPERATION(OPCODE_LESS_THAN, true, make_boolean_object(obj_int(*left) < obj_int(*right)));
+
+TARGET(LESS_THAN_OR_EQUALS_INT)
+    QUICKENED_INT_OPERATION(OPCODE_LESS_THAN_OR_EQUALS, true, make_boolean_object(obj_int(*left) <= obj_int(*right)));
+
+TARGET(INDEX_GET_ARRAY_INT) {
+    struct object* index = &sp[-1];
+    struct object* left = index - 1;
+    if (obj_type(*left) != OBJ_ARRAY || obj_type(*index) != OBJ_INT || (uint64_t) obj_int(*index) >= obj_list(*left)->size) {
+        *ip = OPCODE_INDEX_GET;
+        DISPATCH();
+    }
+    *left = obj_list(*left)->values[obj_int(*index)];
+    sp--;
+    ip++;
+    DISPATCH();
+}
+
+TARGET(INT_ADD)
+    UNCHECKED_BINARY_OPERATION(MAKE_INTEGER(obj_int(*left) + obj_int(*right)));
+
+TARGET(INT_SUBTRACT)
+    UNCHECKED_BINARY_OPERATION(MAKE_INTEGER(obj_int(*left) - obj_int(*right)));
+
+TARGET(INT_MULTIPLY)
+    UNCHECKED_BINARY_OPERATION(MAKE_INTEGER(obj_int(*left) * obj_int(*right)));
+
+TARGET(INT_EQUAL)
+    UNCHECKED_BINARY_OPERATION(make_boolean_object(obj_int(*left) == obj_int(*right)));
+
+TARGET(INT_NOT_EQUAL)
+    UNCHECKED_BINARY_OPERATION(make_boolean_object(obj_int(*left) != obj_int(*right)));
+
+TARGET(INT_GREATER_THAN)
+    UNCHECKED_BINARY_OPERATION(make_boolean_object(obj_int(*left) > obj_int(*right)));
+
+TARGET(INT_GREATER_THAN_OR_EQUALS)
+    UNCHECKED_BINARY_OPERATION(make_boolean_object(obj_int(*left) >= obj_int(*right)));
+
+TARGET(INT_LESS_THAN)
+    UNCHECKED_BINARY_OPERATION(make_boolean_object(obj_int(*left) < obj_int(*right)));
+
+TARGET(INT_LESS_THAN_OR_EQUALS)
+    UNCHECKED_BINARY_OPERATION(make_boolean_object(obj_int(*left) <= obj_int(*right)));
+
+TARGET(INT_INC_LOCAL) {
+    struct object* slot = &locals[read_uint8((ip + 1))];
+    *slot = MAKE_INTEGER(obj_int(*slot) + 1);
+    ip += 2;
+    DISPATCH();
+}
+
+TARGET(INT_DEC_LOCAL) {
+    struct object* slot = &locals[read_uint8((ip + 1))];
+    *slot = MAKE_INTEGER(obj_int(*slot) - 1);
+    ip += 2;
+    DISPATCH();
+}
+
+TARGET(BOOL_EQUAL)
+    UNCHECKED_BINARY_OPERATION(make_boolean_object(obj_bool(*left) == obj_bool(*right)));
+
+TARGET(BOOL_NOT_EQUAL)
+    UNCHECKED_BINARY_OPERATION(make_boolean_object(obj_bool(*left) != obj_bool(*right)));
+
+TARGET(BOOL_BANG) {
+    sp[-1] = make_boolean_object(!obj_bool(sp[-1]));
+    ip++;
+    DISPATCH();
+}
+
+TARGET(INDEX_SET) {
+    SAVE_STATE();
+    vm_do_index_set(vm);
+    LOAD_STATE();
+    ip++;
+    DISPATCH();
+}
+
+TARGET(ADD_LOCAL_CONST) {
+    struct object left = locals[read_uint8((ip + 1))];
+    struct object right = vm->constants[read_uint16((ip + 2))];
+    ip += 4;
+    if (obj_type(left) == OBJ_INT && obj_type(right) == OBJ_INT) {
+        struct object result = MAKE_INTEGER(obj_int(left) + obj_int(right));
+        *sp++ = result;
+    } else {
+        *sp++ = left;
+        *sp++ = right;
+        SAVE_STATE();
+        vm_do_binary_operation(vm, OPCODE_ADD);
+        LOAD_STATE();
+    }
+    DISPATCH();
+}
+
+TARGET(SUBTRACT_LOCAL_CONST) {
+    struct object left = locals[read_uint8((ip + 1))];
+    struct object right = vm->constants[read_uint16((ip + 2))];
+    ip += 4;
+    if (obj_type(left) == OBJ_INT && obj_type(right) == OBJ_INT) {
+        struct object result = MAKE_INTEGER(obj_int(left) - obj_int(right));
+        *sp++ = result;
+    } else {
+        *sp++ = left;
+        *sp++ = right;
+        SAVE_STATE();
+        vm_do_binary_operation(vm, OPCODE_SUBTRACT);
+        LOAD_STATE();
+    }
+    DISPATCH();
+}
+
+TARGET(LESS_THAN_LOCAL_CONST) {
+    struct object left = locals[read_uint8((ip + 1))];
+    struct object right = vm->constants[read_uint16((ip + 2))];
+    ip += 4;
+    if (obj_type(left) == OBJ_INT && obj_type(right) == OBJ_INT) {
+        *sp++ = make_boolean_object(obj_int(left) < obj_int(right));
+    } else {
+        *sp++ = left;
+        *sp++ = right;
+        SAVE_STATE();
+        vm_do_comparision(vm, OPCODE_LESS_THAN);
+        LOAD_STATE();
+    }
+    DISPATCH();
+}
+
+TARGET(EQUAL_LOCAL_CONST) {
+    struct object left = locals[read_uint8((ip + 1))];
+    struct object right = vm->constants[read_uint16((ip + 2))];
+    ip += 4;
+    if (obj_type(left) == OBJ_INT && obj_type(right) == OBJ_INT) {
+        *sp++ = make_boolean_object(obj_int(left) == obj_int(right));
+    } else {
+        *sp++ = left;
+        *sp++ = right;
+        SAVE_STATE();
+        vm_do_comparision(vm, OPCODE_EQUAL);
+        LOAD_STATE();
+    }
+    DISPATCH();
+}
+
+TARGET(ADD_LOCAL_LOCAL) {
+    struct object left = locals[read_uint8((ip + 1))];
+    struct object right = locals[read_uint8((ip + 2))];
+    ip += 3;
+    if (obj_type(left) == OBJ_INT && obj_type(right) == OBJ_INT) {
+        struct object result = MAKE_INTEGER(obj_int(left) + obj_int(right));
+        *sp++ = result;
+    } else {
+        *sp++ = left;
+        *sp++ = right;
+        SAVE_STATE();
+        vm_do_binary_operation(vm, OPCODE_ADD);
+        LOAD_STATE();
+    }
+    DISPATCH();
+}
+
+TARGET(LESS_THAN_LOCAL_LOCAL) {
+    struct object left = locals[read_uint8((ip + 1))];
+    struct object right = locals[read_uint8((ip + 2))];
+    ip += 3;
+    if (obj_type(left) == OBJ_INT && obj_type(right) == OBJ_INT) {
+        *sp++ = make_boolean_object(obj_int(left) < obj_int(right));
+    } else {
+        *sp++ = left;
+        *sp++ = right;
+        SAVE_STATE();
+        vm_do_comparision(vm, OPCODE_LESS_THAN);
+        LOAD_STATE();
+    }
+    DISPATCH();
+}
+
+TARGET(INDEX_GET_LOCAL_LOCAL) {
+    struct object left = locals[read_uint8((ip + 1))];
+    struct object index = locals[read_uint8((ip + 2))];
+    ip += 3;
+    SAVE_STATE();
+    vm_do_index_get(vm, left, index);
+    LOAD_STATE();
+    DISPATCH();
+}
+
+TARGET(INDEX_GET_IN_BOUNDS) {
+    struct object index = *--sp;
+    struct object* left = &sp[-1];
+    ip++;
+    if (obj_type(*left) == OBJ_ARRAY) {
+        *left = obj_list(*left)->values[obj_int(index)];
+    } else {
+        sp--;
+        SAVE_STATE();
+        vm_do_index_get(vm, *left, index);
+        LOAD_STATE();
+    }
+    DISPATCH();
+}
+
+TARGET(INDEX_SET_IN_BOUNDS) {
+    const struct object* value = &sp[-1];
+    struct object* array = &sp[-3];
+    ip++;
+    if (obj_type(*array) == OBJ_ARRAY) {
+        obj_list(*array)->values[obj_int(sp[-2])] = copy_object(value);
+        *array = *value;
+        sp -= 2;
+    } else {
+        SAVE_STATE();
+        vm_do_index_set(vm);
+        LOAD_STATE();
+    }
+    DISPATCH();
+}
+
+TARGET(INDEX_GET_LOCAL_LOCAL_IN_BOUNDS) {
+    struct object left = locals[read_uint8((ip + 1))];
+    struct object index = locals[read_uint8((ip + 2))];
+    ip += 3;
+    if (obj_type(left) == OBJ_ARRAY) {
+        *sp++ = obj_list(left)->values[obj_int(index)];
+    } else {
+        SAVE_STATE();
+        vm_do_index_get(vm, left, index);
+        LOAD_STATE();
+    }
+    DISPATCH();
+}
+
+TARGET(HALT) {
+    (void) locals;
+    SAVE_STATE();
+    return VM_SUCCESS;
+}
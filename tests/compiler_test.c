@@ -10,18 +10,18 @@ struct compiler_test_case {
 };
 
 static void test_object(struct object expected, struct object actual) {
-    assertf(actual.type == expected.type, "invalid object type: expected %s, got %s", object_type_to_str(expected.type), object_type_to_str(actual.type));
+    assertf(obj_type(actual) == obj_type(expected), "invalid object type: expected %s, got %s", object_type_to_str(obj_type(expected)), object_type_to_str(obj_type(actual)));
     
-    switch (expected.type) {
+    switch (obj_type(expected)) {
         case OBJ_INT:
-            assertf(actual.value.integer == expected.value.integer, "invalid integer value: expected %d, got %d", expected.value.integer, actual.value.integer);
+            assertf(obj_int(actual) == obj_int(expected), "invalid integer value: expected %d, got %d", obj_int(expected), obj_int(actual));
         break;
         case OBJ_BOOL:
-            assertf(actual.value.boolean == expected.value.boolean, "invalid boolean value: expected %d, got %d", expected.value.boolean, actual.value.boolean);
+            assertf(obj_bool(actual) == obj_bool(expected), "invalid boolean value: expected %d, got %d", obj_bool(expected), obj_bool(actual));
         break;
         case OBJ_COMPILED_FUNCTION: {
-            struct compiled_function* af = actual.value.fn_compiled;
-            struct compiled_function* ef = expected.value.fn_compiled;
+            struct compiled_function* af = obj_fn(actual);
+            struct compiled_function* ef = obj_fn(expected);
             char *expected_str = instruction_to_str(&ef->instructions);
             char *actual_str = instruction_to_str(&af->instructions);
             assertf(ef->instructions.size == af->instructions.size, "wrong instructions length: \nexpected\n\"%s\"\ngot\n\"%s\"", expected_str, actual_str);
@@ -33,10 +33,10 @@ static void test_object(struct object expected, struct object actual) {
         }
         break;
         case OBJ_STRING: 
-            assertf(strcmp(expected.value.string->value, actual.value.string->value) == 0, "invalid string value: expected \"%s\", got \"%s\"", expected.value.string->value, actual.value.string->value);
+            assertf(strcmp(obj_string(expected)->value, obj_string(actual)->value) == 0, "invalid string value: expected \"%s\", got \"%s\"", obj_string(expected)->value, obj_string(actual)->value);
         break;
         default: 
-            assertf(false, "missing test implementation for object of type %s", object_type_to_str(actual.type));
+            assertf(false, "missing test implementation for object of type %s", object_type_to_str(obj_type(actual)));
         break;
     }
 }
@@ -81,95 +81,78 @@ static void integer_arithmetic(void) {
     struct compiler_test_case tests[] = {
         {
             .input = "1 + 2",
-            .constants = {
-                make_integer_object(1), 
-                make_integer_object(2),
-            },
-            .constants_size = 2,
+            .constants = {{0}},
+            .constants_size = 0,
             .instructions = {
-                make_instruction(OPCODE_CONST, 0),
-                make_instruction(OPCODE_CONST, 1),
-                make_instruction(OPCODE_ADD),
+                make_instruction(OPCODE_PUSH_INT8, 3),
                 make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_HALT),
             },
-            .instructions_size = 5,
+            .instructions_size = 3,
         },
         {
             .input = "1 - 2",
-            .constants = {
-                make_integer_object(1), 
-                make_integer_object(2),
-            },
-            .constants_size = 2,
+            .constants = {{0}},
+            .constants_size = 0,
             .instructions = {
-                make_instruction(OPCODE_CONST, 0),
-                make_instruction(OPCODE_CONST, 1),
-                make_instruction(OPCODE_SUBTRACT),
+                make_instruction(OPCODE_PUSH_INT8, -1),
                 make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_HALT),
             },
-            .instructions_size = 5,
+            .instructions_size = 3,
         },
         {
             .input = "1 * 2",
-            .constants = {
-                make_integer_object(1), 
-                make_integer_object(2),
-            },
-            .constants_size = 2,
+            .constants = {{0}},
+            .constants_size = 0,
             .instructions = {
-                make_instruction(OPCODE_CONST, 0),
-                make_instruction(OPCODE_CONST, 1),
-                make_instruction(OPCODE_MULTIPLY),
+                make_instruction(OPCODE_PUSH_INT8, 2),
                 make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_HALT),
             },
-            .instructions_size = 5,
+            .instructions_size = 3,
         },
         {
             .input = "2 / 1",
-            .constants = {
-                make_integer_object(2), 
-                make_integer_object(1),
-            },
-            .constants_size = 2,
+            .constants = {{0}},
+            .constants_size = 0,
             .instructions = {
-                make_instruction(OPCODE_CONST, 0),
-                make_instruction(OPCODE_CONST, 1),
-                make_instruction(OPCODE_DIVIDE),
+                make_instruction(OPCODE_PUSH_INT8, 2),
                 make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_HALT),
             },
-            .instructions_size = 5,
+            .instructions_size = 3,
         },
         {
             .input = "2 / 1",
-            .constants = {
-                make_integer_object(2), 
-                make_integer_object(1),
-            },
-            .constants_size = 2,
+            .constants = {{0}},
+            .constants_size = 0,
             .instructions = {
-                make_instruction(OPCODE_CONST, 0),
-                make_instruction(OPCODE_CONST, 1),
-                make_instruction(OPCODE_DIVIDE),
+                make_instruction(OPCODE_PUSH_INT8, 2),
                 make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_HALT),
             },
-            .instructions_size = 5,
+            .instructions_size = 3,
         },
         {
             .input = "-1",
+            .constants = {{0}}, 0,
+            .instructions = {
+                make_instruction(OPCODE_PUSH_INT8, -1),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_HALT),
+            }, 3,
+        },
+        {
+            .input = "1000 + 100000",
             .constants = {
-                make_integer_object(1), 
+                make_integer_object(101000), 
             }, 1,
             .instructions = {
                 make_instruction(OPCODE_CONST, 0),
-                make_instruction(OPCODE_MINUS),
                 make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_HALT),
-            }, 4,
+            }, 3,
         },
     };
 
@@ -202,156 +185,180 @@ static void boolean_expressions(void) {
         },
         {
             "1 > 2", 
+            {{0}}, 0,
             {
-                make_integer_object(1),
-                make_integer_object(2),
-            }, 2,
-            {
-                make_instruction(OPCODE_CONST, 0),
-                make_instruction(OPCODE_CONST, 1),
-                make_instruction(OPCODE_GREATER_THAN),
+                make_instruction(OPCODE_FALSE),
                 make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_HALT),
-            }, 5
+            }, 3
         },
         {
             "1 < 2", 
+            {{0}}, 0,
             {
-                make_integer_object(1),
-                make_integer_object(2),
-            }, 2,
-            {
-                make_instruction(OPCODE_CONST, 0),
-                make_instruction(OPCODE_CONST, 1),
-                make_instruction(OPCODE_LESS_THAN),
+                make_instruction(OPCODE_TRUE),
                 make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_HALT),
-            }, 5
+            }, 3
         },
         {
             "1 == 2", 
+            {{0}}, 0,
             {
-                make_integer_object(1),
-                make_integer_object(2),
-            }, 2,
-            {
-                make_instruction(OPCODE_CONST, 0),
-                make_instruction(OPCODE_CONST, 1),
-                make_instruction(OPCODE_EQUAL),
+                make_instruction(OPCODE_FALSE),
                 make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_HALT),
-            }, 5
+            }, 3
         },
         {
             "1 != 2", 
+            {{0}}, 0,
             {
-                make_integer_object(1),
-                make_integer_object(2),
-            }, 2,
-            {
-                make_instruction(OPCODE_CONST, 0),
-                make_instruction(OPCODE_CONST, 1),
-                make_instruction(OPCODE_NOT_EQUAL),
+                make_instruction(OPCODE_TRUE),
                 make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_HALT),
-            }, 5
+            }, 3
         },
         {
             "true == false", 
             {{0}}, 0,
             {
-                make_instruction(OPCODE_TRUE),
                 make_instruction(OPCODE_FALSE),
-                make_instruction(OPCODE_EQUAL),
                 make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_HALT),
-            }, 5
+            }, 3
         },
         {
             "true != false", 
             {{0}}, 0,
             {
                 make_instruction(OPCODE_TRUE),
-                make_instruction(OPCODE_FALSE),
-                make_instruction(OPCODE_NOT_EQUAL),
                 make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_HALT),
-            }, 5
+            }, 3
         },
          {
             "!true", 
             {{0}}, 0,
             {
-                make_instruction(OPCODE_TRUE),
-                make_instruction(OPCODE_BANG),
+                make_instruction(OPCODE_FALSE),
                 make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_HALT),
-            }, 4
+            }, 3
         },
     };
 
     run_compiler_tests(tests, ARRAY_SIZE(tests));
 }
 
+static void short_circuit_evaluation(void) {
+    {
+        // the boolean is only materialised where it is used as a value
+        struct instruction *fn_body = flatten_instructions_array((struct instruction *[]) {
+            make_instruction(OPCODE_GET_LOCAL, 0),
+            make_instruction(OPCODE_JUMP_NOT_TRUE, 14),
+            make_instruction(OPCODE_GET_LOCAL, 1),
+            make_instruction(OPCODE_JUMP_NOT_TRUE, 14),
+            make_instruction(OPCODE_TRUE),
+            make_instruction(OPCODE_JUMP, 15),
+            make_instruction(OPCODE_FALSE),
+            make_instruction(OPCODE_RETURN_VALUE),
+        }, 8);
+        struct compiler_test_case t = {
+            .input = "fn(a, b) { a && b }",
+            .constants = {
+                make_compiled_function_object(fn_body, 0),
+            }, 1,
+            .instructions = {
+                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_HALT),
+            }, 3,
+        };
+        run_compiler_test(t);
+        free_instruction(fn_body);
+    }
+    {
+        struct instruction *fn_body = flatten_instructions_array((struct instruction *[]) {
+            make_instruction(OPCODE_GET_LOCAL, 0),
+            make_instruction(OPCODE_JUMP_TRUE, 10),
+            make_instruction(OPCODE_GET_LOCAL, 1),
+            make_instruction(OPCODE_JUMP_NOT_TRUE, 15),
+            make_instruction(OPCODE_PUSH_INT8, 1),
+            make_instruction(OPCODE_JUMP, 17),
+            make_instruction(OPCODE_PUSH_INT8, 2),
+            make_instruction(OPCODE_RETURN_VALUE),
+        }, 8);
+        struct compiler_test_case t = {
+            .input = "fn(a, b) { if (a || b) { 1 } else { 2 } }",
+            .constants = {
+                make_compiled_function_object(fn_body, 0),
+            }, 1,
+            .instructions = {
+                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_HALT),
+            }, 3,
+        };
+        run_compiler_test(t);
+        free_instruction(fn_body);
+    }
+}
+
 static void if_expressions(void) {
 
     struct compiler_test_case tests[] = {
         {
-            .input = "if (true) { 10; } 3333;",
-            .constants = {
-                make_integer_object(10),
-                make_integer_object(3333),
-            }, 2,
+            .input = "let c = true; if (c) { 10; } 3333;",
+            .constants = {{0}}, 0,
             .instructions = {
-                make_instruction(OPCODE_TRUE),              
-                make_instruction(OPCODE_JUMP_NOT_TRUE, 10),  
-                make_instruction(OPCODE_CONST, 0),          
-                make_instruction(OPCODE_JUMP, 11),          
-                make_instruction(OPCODE_NULL),              
+                make_instruction(OPCODE_TRUE),
+                make_instruction(OPCODE_SET_GLOBAL, 0),
+                make_instruction(OPCODE_GET_GLOBAL, 0),
+                make_instruction(OPCODE_JUMP_NOT_TRUE, 13),  
+                make_instruction(OPCODE_PUSH_INT8, 10),          
                 make_instruction(OPCODE_POP),               
-                make_instruction(OPCODE_CONST, 1),          
+                make_instruction(OPCODE_PUSH_INT16, 3333),          
                 make_instruction(OPCODE_POP),               
                 make_instruction(OPCODE_HALT),
             }, 9
         },
         {
-            .input = "if (true) { 10; } else { 20; }; 3333;",
-            .constants = {
-                make_integer_object(10),
-                make_integer_object(20),
-                make_integer_object(3333),
-            }, 3,
+            .input = "let c = true; if (c) { 10; } else { 20; }; 3333;",
+            .constants = {{0}}, 0,
             .instructions = {
-                make_instruction(OPCODE_TRUE),              
-                make_instruction(OPCODE_JUMP_NOT_TRUE, 10), 
-                make_instruction(OPCODE_CONST, 0),          
-                make_instruction(OPCODE_JUMP, 13),          
-                make_instruction(OPCODE_CONST, 1),          
+                make_instruction(OPCODE_TRUE),
+                make_instruction(OPCODE_SET_GLOBAL, 0),
+                make_instruction(OPCODE_GET_GLOBAL, 0),
+                make_instruction(OPCODE_JUMP_NOT_TRUE, 16), 
+                make_instruction(OPCODE_PUSH_INT8, 10),          
+                make_instruction(OPCODE_POP),               
+                make_instruction(OPCODE_JUMP, 19),          
+                make_instruction(OPCODE_PUSH_INT8, 20),          
                 make_instruction(OPCODE_POP),               
-                make_instruction(OPCODE_CONST, 2),          
+                make_instruction(OPCODE_PUSH_INT16, 3333),          
                 make_instruction(OPCODE_POP),               
                 make_instruction(OPCODE_HALT),
-            }, 9
+            }, 12
         },
         {
-            .input = "if (true) { 10; } else if (true) { 20; };",
-            .constants = {
-                make_integer_object(10),
-                make_integer_object(20),
-            }, 2,
+            .input = "let c = true; if (c) { 10; } else if (c) { 20; };",
+            .constants = {{0}}, 0,
             .instructions = {
-                make_instruction(OPCODE_TRUE),              
-                make_instruction(OPCODE_JUMP_NOT_TRUE, 10), 
-                make_instruction(OPCODE_CONST, 0),          
-                make_instruction(OPCODE_JUMP, 21),          
-                make_instruction(OPCODE_TRUE),  
-                make_instruction(OPCODE_JUMP_NOT_TRUE, 20),    
-                make_instruction(OPCODE_CONST, 1),   
-                make_instruction(OPCODE_JUMP, 21),  
+                make_instruction(OPCODE_TRUE),
+                make_instruction(OPCODE_SET_GLOBAL, 0),
+                make_instruction(OPCODE_GET_GLOBAL, 0),
+                make_instruction(OPCODE_JUMP_NOT_TRUE, 15), 
+                make_instruction(OPCODE_PUSH_INT8, 10),          
+                make_instruction(OPCODE_JUMP, 27),          
+                make_instruction(OPCODE_GET_GLOBAL, 0),  
+                make_instruction(OPCODE_JUMP_NOT_TRUE, 26),    
+                make_instruction(OPCODE_PUSH_INT8, 20),   
+                make_instruction(OPCODE_JUMP, 27),  
                 make_instruction(OPCODE_NULL),    
                 make_instruction(OPCODE_POP),                           
                 make_instruction(OPCODE_HALT),
-            }, 11
+            }, 13
         },
     };
     run_compiler_tests(tests, ARRAY_SIZE(tests));
@@ -361,25 +368,20 @@ static void global_let_statements(void) {
     struct compiler_test_case tests[] = {
         {
             .input = "let one = 1; let two = 2;",
-            .constants = {
-                make_integer_object(1),
-                make_integer_object(2),
-            }, 2,
+            .constants = {{0}}, 0,
             .instructions = {
-                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_PUSH_INT8, 1),
                 make_instruction(OPCODE_SET_GLOBAL, 0),
-                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_PUSH_INT8, 2),
                 make_instruction(OPCODE_SET_GLOBAL, 1),
                 make_instruction(OPCODE_HALT),
             }, 5,
         },
         {
             .input = "let one = 1; one;",
-            .constants = {
-                make_integer_object(1),
-            }, 1,
+            .constants = {{0}}, 0,
             .instructions = {
-                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_PUSH_INT8, 1),
                 make_instruction(OPCODE_SET_GLOBAL, 0),
                 make_instruction(OPCODE_GET_GLOBAL, 0),
                 make_instruction(OPCODE_POP),
@@ -388,11 +390,9 @@ static void global_let_statements(void) {
         },
         {
             .input = "let one = 1; let two = one; two;",
-            .constants = {
-                make_integer_object(1),
-            }, 1,
+            .constants = {{0}}, 0,
             .instructions = {
-                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_PUSH_INT8, 1),
                 make_instruction(OPCODE_SET_GLOBAL, 0),
                 make_instruction(OPCODE_GET_GLOBAL, 0),
                 make_instruction(OPCODE_SET_GLOBAL, 1),
@@ -403,15 +403,12 @@ static void global_let_statements(void) {
         },
         {
             .input = "let one = 1; let two = one + 1; two",
-            .constants = {
-                make_integer_object(1),
-                make_integer_object(1),
-            }, 2,
+            .constants = {{0}}, 0,
             .instructions = {
-                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_PUSH_INT8, 1),
                 make_instruction(OPCODE_SET_GLOBAL, 0),
                 make_instruction(OPCODE_GET_GLOBAL, 0),
-                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_PUSH_INT8, 1),
                 make_instruction(OPCODE_ADD),
                 make_instruction(OPCODE_SET_GLOBAL, 1),
                 make_instruction(OPCODE_GET_GLOBAL, 1),
@@ -427,20 +424,16 @@ static void global_let_statements(void) {
 static void functions(void) {
     {
         struct instruction *fn_body = flatten_instructions_array((struct instruction *[]) {
-            make_instruction(OPCODE_CONST, 0),
-            make_instruction(OPCODE_CONST, 1),
-            make_instruction(OPCODE_ADD),
+            make_instruction(OPCODE_PUSH_INT8, 15),
             make_instruction(OPCODE_RETURN_VALUE),
-        }, 4);
+        }, 2);
         struct compiler_test_case t = {
             .input = "fn() { return 5 + 10 }",
             .constants = {
-                make_integer_object(5),
-                make_integer_object(10),
                 make_compiled_function_object(fn_body, 0),
-            }, 3,
+            }, 1,
             .instructions = {
-                make_instruction(OPCODE_CONST, 2),
+                make_instruction(OPCODE_CONST, 0),
                 make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_HALT),
             }, 3,
@@ -450,20 +443,16 @@ static void functions(void) {
    }
    {
        struct instruction *fn_body = flatten_instructions_array((struct instruction *[]) {
-            make_instruction(OPCODE_CONST, 0),
-            make_instruction(OPCODE_CONST, 1),
-            make_instruction(OPCODE_ADD),
+            make_instruction(OPCODE_PUSH_INT8, 15),
             make_instruction(OPCODE_RETURN_VALUE),
-        }, 4);
+        }, 2);
         struct compiler_test_case t = {
             .input = "fn() { 5 + 10 }",
             .constants = {
-                make_integer_object(5),
-                make_integer_object(10),
                 make_compiled_function_object(fn_body, 0),
-            }, 3,
+            }, 1,
             .instructions = {
-                make_instruction(OPCODE_CONST, 2),
+                make_instruction(OPCODE_CONST, 0),
                 make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_HALT),
             }, 3,
@@ -473,20 +462,16 @@ static void functions(void) {
     }
     {
         struct instruction *fn_body = flatten_instructions_array((struct instruction *[]) {
-            make_instruction(OPCODE_CONST, 0),
-            make_instruction(OPCODE_POP),
-            make_instruction(OPCODE_CONST, 1),
+            make_instruction(OPCODE_PUSH_INT8, 2),
             make_instruction(OPCODE_RETURN_VALUE),
-        }, 4);
+        }, 2);
         struct compiler_test_case t = {
             .input = "fn() { 1; 2 }",
             .constants = {
-                make_integer_object(1),
-                make_integer_object(2),
                 make_compiled_function_object(fn_body, 0),
-            }, 3,
+            }, 1,
             .instructions = {
-                make_instruction(OPCODE_CONST, 2),
+                make_instruction(OPCODE_CONST, 0),
                 make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_HALT),
             }, 3,
@@ -546,17 +531,16 @@ static void compiler_scopes(void) {
 static void function_calls(void) {
     {
         struct instruction *fn_body = flatten_instructions_array((struct instruction *[]) {
-            make_instruction(OPCODE_CONST, 0),
+            make_instruction(OPCODE_PUSH_INT8, 24),
             make_instruction(OPCODE_RETURN_VALUE),
         }, 2);
         struct compiler_test_case t = {
             .input = "fn() { 24 }();",
             .constants = {
-                make_integer_object(24),
                 make_compiled_function_object(fn_body, 0),
-            }, 2,
+            }, 1,
             .instructions = {
-                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_CONST, 0),
                 make_instruction(OPCODE_CALL, 0),
                 make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_HALT),
@@ -567,17 +551,16 @@ static void function_calls(void) {
    }
    {
        struct instruction *fn_body = flatten_instructions_array((struct instruction *[]) {
-            make_instruction(OPCODE_CONST, 0),
+            make_instruction(OPCODE_PUSH_INT8, 24),
             make_instruction(OPCODE_RETURN_VALUE),
         }, 2);
         struct compiler_test_case t = {
             .input = "let noArg = fn() { 24 }; noArg();",
             .constants = {
-                make_integer_object(24),
                 make_compiled_function_object(fn_body, 0),
-            }, 2,
+            }, 1,
             .instructions = {
-                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_CONST, 0),
                 make_instruction(OPCODE_SET_GLOBAL, 0),
                 make_instruction(OPCODE_GET_GLOBAL, 0),
                 make_instruction(OPCODE_CALL, 0),
@@ -597,13 +580,12 @@ static void function_calls(void) {
             .input = "let oneArg = fn(a) { a; }; oneArg(24);",
             .constants = {
                 make_compiled_function_object(fn_body, 0),
-                make_integer_object(24),
-            }, 2,
+            }, 1,
             .instructions = {
                 make_instruction(OPCODE_CONST, 0),
                 make_instruction(OPCODE_SET_GLOBAL, 0),
                 make_instruction(OPCODE_GET_GLOBAL, 0),
-                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_PUSH_INT8, 24),
                 make_instruction(OPCODE_CALL, 1),
                 make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_HALT),
@@ -614,28 +596,21 @@ static void function_calls(void) {
    }
    {
         struct instruction *fn_body = flatten_instructions_array((struct instruction *[]) {
-            make_instruction(OPCODE_GET_LOCAL, 0),
-            make_instruction(OPCODE_POP),
-            make_instruction(OPCODE_GET_LOCAL, 1),
-            make_instruction(OPCODE_POP),
             make_instruction(OPCODE_GET_LOCAL, 2),
             make_instruction(OPCODE_RETURN_VALUE),
-        }, 6);
+        }, 2);
         struct compiler_test_case t = {
             .input = "let manyArg = fn(a, b, c) { a; b; c; }; manyArg(24, 25, 26);",
             .constants = {
                 make_compiled_function_object(fn_body, 0),
-                make_integer_object(24),
-                make_integer_object(25),
-                make_integer_object(26),
-            }, 4,
+            }, 1,
             .instructions = {
                 make_instruction(OPCODE_CONST, 0),
                 make_instruction(OPCODE_SET_GLOBAL, 0),
                 make_instruction(OPCODE_GET_GLOBAL, 0),
-                make_instruction(OPCODE_CONST, 1),
-                make_instruction(OPCODE_CONST, 2),
-                make_instruction(OPCODE_CONST, 3),
+                make_instruction(OPCODE_PUSH_INT8, 24),
+                make_instruction(OPCODE_PUSH_INT8, 25),
+                make_instruction(OPCODE_PUSH_INT8, 26),
                 make_instruction(OPCODE_CALL, 3),
                 make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_HALT),
@@ -647,25 +622,23 @@ static void function_calls(void) {
    {
         // test code with multiple functions to exercise scope logic (entering and leaving scopes)
         struct instruction *fn_one = flatten_instructions_array((struct instruction *[]) {
-            make_instruction(OPCODE_CONST, 0),
+            make_instruction(OPCODE_PUSH_INT8, 1),
             make_instruction(OPCODE_RETURN_VALUE),
         }, 2);
         struct instruction *fn_two = flatten_instructions_array((struct instruction *[]) {
-            make_instruction(OPCODE_CONST, 2),
+            make_instruction(OPCODE_PUSH_INT8, 2),
             make_instruction(OPCODE_RETURN_VALUE),
         }, 2);
         struct compiler_test_case t = {
             .input = "let one = fn() { 1; }; let two = fn() { 2; } one() + two();",
             .constants = {
-                make_integer_object(1),
                 make_compiled_function_object(fn_one, 0),
-                make_integer_object(2),
                 make_compiled_function_object(fn_two, 0),                
-            }, 4,
+            }, 2,
             .instructions = {
-                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_CONST, 0),
                 make_instruction(OPCODE_SET_GLOBAL, 0),
-                make_instruction(OPCODE_CONST, 3),
+                make_instruction(OPCODE_CONST, 1),
                 make_instruction(OPCODE_SET_GLOBAL, 1),
                 make_instruction(OPCODE_GET_GLOBAL, 0),
                 make_instruction(OPCODE_CALL, 0),
@@ -692,13 +665,12 @@ static void let_statement_scopes(void) {
         struct compiler_test_case t = {
             .input = "let num = 55;\nfn() { num }",
             .constants = {
-                make_integer_object(55),
                 make_compiled_function_object(fn_body, 0),
-            }, 2,
+            }, 1,
             .instructions = {
-                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_PUSH_INT8, 55),
                 make_instruction(OPCODE_SET_GLOBAL, 0),
-                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_CONST, 0),
                 make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_HALT),
             }, 5,
@@ -708,7 +680,7 @@ static void let_statement_scopes(void) {
    }
    {
        struct instruction *fn_body = flatten_instructions_array((struct instruction *[]) {
-            make_instruction(OPCODE_CONST, 0),
+            make_instruction(OPCODE_PUSH_INT8, 55),
             make_instruction(OPCODE_SET_LOCAL, 0),
             make_instruction(OPCODE_GET_LOCAL, 0),
             make_instruction(OPCODE_RETURN_VALUE),
@@ -716,11 +688,10 @@ static void let_statement_scopes(void) {
         struct compiler_test_case t = {
             .input = "fn() { let num = 55; num }",
             .constants = {
-                make_integer_object(55),
                 make_compiled_function_object(fn_body, 0),
-            }, 2,
+            }, 1,
             .instructions = {
-                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_CONST, 0),
                 make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_HALT),
             }, 3,
@@ -730,24 +701,28 @@ static void let_statement_scopes(void) {
    }
    {
        struct instruction *fn_body = flatten_instructions_array((struct instruction *[]) {
-            make_instruction(OPCODE_CONST, 0),
+            make_instruction(OPCODE_PUSH_INT8, 55),
             make_instruction(OPCODE_SET_LOCAL, 0),
-            make_instruction(OPCODE_CONST, 1),
+            make_instruction(OPCODE_PUSH_INT8, 77),
             make_instruction(OPCODE_SET_LOCAL, 1),
+            #ifndef NO_SUPERINSTRUCTIONS
+            make_instruction(OPCODE_ADD_LOCAL_LOCAL, 0, 1),
+            make_instruction(OPCODE_RETURN_VALUE),
+        }, 6);
+            #else
             make_instruction(OPCODE_GET_LOCAL, 0),
             make_instruction(OPCODE_GET_LOCAL, 1),
             make_instruction(OPCODE_ADD),
             make_instruction(OPCODE_RETURN_VALUE),
         }, 8);
+            #endif
         struct compiler_test_case t = {
             .input = "fn() { let a = 55; let b = 77; a + b }",
             .constants = {
-                make_integer_object(55),
-                make_integer_object(77),
                 make_compiled_function_object(fn_body, 0),
-            }, 3,
+            }, 1,
             .instructions = {
-                make_instruction(OPCODE_CONST, 2),
+                make_instruction(OPCODE_CONST, 0),
                 make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_HALT),
             }, 3,
@@ -760,26 +735,40 @@ static void let_statement_scopes(void) {
 }
 
 static void recursive_functions(void) {
+    // the function calls itself without looking up the global it is bound to
     struct instruction *fn_body = flatten_instructions_array((struct instruction *[]) {
-        make_instruction(OPCODE_GET_GLOBAL, 0),
+        #ifndef NO_SUPERINSTRUCTIONS
+        make_instruction(OPCODE_SUBTRACT_LOCAL_CONST, 0, 0),
+        make_instruction(OPCODE_TAIL_CALL_SELF, 1),
+        }, 2);
+        #else
         make_instruction(OPCODE_GET_LOCAL, 0),
-        make_instruction(OPCODE_CONST, 0),
+        make_instruction(OPCODE_PUSH_INT8, 1),
         make_instruction(OPCODE_SUBTRACT),
-        make_instruction(OPCODE_CALL, 1),
-        make_instruction(OPCODE_RETURN_VALUE),
-        }, 6);
+        make_instruction(OPCODE_TAIL_CALL_SELF, 1),
+        }, 4);
+        #endif
     struct compiler_test_case t = {
         .input = "let countdown = fn(x) { return countdown(x-1); }; countdown(1);",
         .constants = {
+            #ifndef NO_SUPERINSTRUCTIONS
+            // the superinstruction takes its operand from the constants
             make_integer_object(1),
             make_compiled_function_object(fn_body, 0),
-            make_integer_object(1),
-        }, 3,
+        }, 2,
+            #else
+            make_compiled_function_object(fn_body, 0),
+        }, 1,
+            #endif
         .instructions = {   
+            #ifndef NO_SUPERINSTRUCTIONS
             make_instruction(OPCODE_CONST, 1),
+            #else
+            make_instruction(OPCODE_CONST, 0),
+            #endif
             make_instruction(OPCODE_SET_GLOBAL, 0),
             make_instruction(OPCODE_GET_GLOBAL, 0),
-            make_instruction(OPCODE_CONST, 2),
+            make_instruction(OPCODE_PUSH_INT8, 1),
             make_instruction(OPCODE_CALL, 1),
             make_instruction(OPCODE_POP),
             make_instruction(OPCODE_HALT),
@@ -787,9 +776,84 @@ static void recursive_functions(void) {
     };
     run_compiler_test(t);
     free_instruction(fn_body);
-}
 
-static void string_expressions(void) {
+    // a global that is assigned again may hold another function by the time it is called
+    fn_body = flatten_instructions_array((struct instruction *[]) {
+        make_instruction(OPCODE_GET_GLOBAL, 0),
+        make_instruction(OPCODE_GET_LOCAL, 0),
+        make_instruction(OPCODE_TAIL_CALL, 1),
+    }, 3);
+    struct compiler_test_case reassigned = {
+        .input = "let f = fn(x) { f(x) }; f = 1;",
+        .constants = {
+            make_compiled_function_object(fn_body, 0),
+        }, 1,
+        .instructions = {
+            make_instruction(OPCODE_CONST, 0),
+            make_instruction(OPCODE_SET_GLOBAL, 0),
+            make_instruction(OPCODE_PUSH_INT8, 1),
+            make_instruction(OPCODE_SET_GLOBAL, 0),
+            make_instruction(OPCODE_GET_GLOBAL, 0),
+            make_instruction(OPCODE_POP),
+            make_instruction(OPCODE_HALT),
+        }, 7,
+    };
+    run_compiler_test(reassigned);
+    free_instruction(fn_body);
+}
+
+static void superinstructions(void) {
+    #ifndef NO_SUPERINSTRUCTIONS
+    {
+        struct instruction *fn_body = flatten_instructions_array((struct instruction *[]) {
+            make_instruction(OPCODE_LESS_THAN_LOCAL_CONST, 0, 0),
+            make_instruction(OPCODE_RETURN_VALUE),
+        }, 2);
+        struct compiler_test_case t = {
+            .input = "fn(a) { a < 5 }",
+            .constants = {
+                make_integer_object(5),
+                make_compiled_function_object(fn_body, 0),
+            }, 2,
+            .instructions = {
+                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_HALT),
+            }, 3,
+        };
+        run_compiler_test(t);
+        free_instruction(fn_body);
+    }
+    #endif
+    {
+        // instructions are not fused when a jump lands in between them
+        struct instruction *fn_body = flatten_instructions_array((struct instruction *[]) {
+            make_instruction(OPCODE_GET_LOCAL, 0),
+            make_instruction(OPCODE_JUMP_NOT_TRUE, 10),
+            make_instruction(OPCODE_GET_LOCAL, 0),
+            make_instruction(OPCODE_JUMP, 12),
+            make_instruction(OPCODE_GET_LOCAL, 1),
+            make_instruction(OPCODE_PUSH_INT8, 1),
+            make_instruction(OPCODE_ADD),
+            make_instruction(OPCODE_RETURN_VALUE),
+        }, 8);
+        struct compiler_test_case t = {
+            .input = "fn(a, b) { (if (a) { a } else { b }) + 1 }",
+            .constants = {
+                make_compiled_function_object(fn_body, 0),
+            }, 1,
+            .instructions = {
+                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_HALT),
+            }, 3,
+        };
+        run_compiler_test(t);
+        free_instruction(fn_body);
+    }
+}
+
+static void string_expressions(void) {
     struct compiler_test_case tests[] = {
         {
             .input = "\"monkey\"",
@@ -805,16 +869,13 @@ static void string_expressions(void) {
         {
             .input = "\"mon\" + \"key\"",
             .constants = {
-               make_string_object("mon"),
-               make_string_object("key"),
-            }, 2,
+               make_string_object("monkey"),
+            }, 1,
             .instructions = {
                 make_instruction(OPCODE_CONST, 0),
-                make_instruction(OPCODE_CONST, 1),
-                make_instruction(OPCODE_ADD),
                 make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_HALT),
-            }, 5,
+            }, 3,
         },
     };
 
@@ -826,33 +887,57 @@ static void builtin_functions(void) {
     struct compiler_test_case tests[] = {
         {
             .input = "len(\"monkey\")",
-            .constants = {
-                make_string_object("monkey"),
-            }, 1,
+            .constants = {{0}}, 0,
             .instructions = {
-                make_instruction(OPCODE_GET_BUILTIN, 1),
-                make_instruction(OPCODE_CONST, 0),
-                make_instruction(OPCODE_CALL, 1),
+                make_instruction(OPCODE_PUSH_INT8, 6),
                 make_instruction(OPCODE_POP, 0),
                 make_instruction(OPCODE_HALT),
-            }, 5,
+            }, 3,
         },
         {
             .input = "print(\"length = \", len(\"monkey\"))",
             .constants = {
                 make_string_object("length = "),
-                make_string_object("monkey"),
-            }, 2,
+            }, 1,
             .instructions = {
                 make_instruction(OPCODE_GET_BUILTIN, 0), 
                 make_instruction(OPCODE_CONST, 0),
-                make_instruction(OPCODE_GET_BUILTIN, 1), 
-                make_instruction(OPCODE_CONST, 1),
-                make_instruction(OPCODE_CALL, 1),
+                make_instruction(OPCODE_PUSH_INT8, 6),
                 make_instruction(OPCODE_CALL, 2),
                 make_instruction(OPCODE_POP, 0),
                 make_instruction(OPCODE_HALT),
-            }, 8,
+            }, 6,
+        },
+    };
+
+    run_compiler_tests(tests, ARRAY_SIZE(tests));
+}
+
+static void intrinsics(void) {
+    struct compiler_test_case tests[] = {
+        {
+            // a call with the wrong number of arguments still goes through the built-in function for its error
+            .input = "let a = []; array_push(a, len(a)); int(array_pop(a)); len(a, a);",
+            .constants = {{0}}, 0,
+            .instructions = {
+                make_instruction(OPCODE_ARRAY, 0),
+                make_instruction(OPCODE_SET_GLOBAL, 0),
+                make_instruction(OPCODE_GET_GLOBAL, 0),
+                make_instruction(OPCODE_GET_GLOBAL, 0),
+                make_instruction(OPCODE_LEN),
+                make_instruction(OPCODE_ARRAY_PUSH),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_GET_GLOBAL, 0),
+                make_instruction(OPCODE_ARRAY_POP),
+                make_instruction(OPCODE_INT),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_GET_BUILTIN, 1),
+                make_instruction(OPCODE_GET_GLOBAL, 0),
+                make_instruction(OPCODE_GET_GLOBAL, 0),
+                make_instruction(OPCODE_CALL, 2),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_HALT),
+            }, 17,
         },
     };
 
@@ -862,69 +947,65 @@ static void builtin_functions(void) {
 static void while_expressions(void) {
     struct compiler_test_case tests[] = {
         {
-            .input = "while (true) { 10; } 3333;",
-            .constants = {
-                make_integer_object(10),
-                make_integer_object(3333),
-            }, 2,
+            .input = "let c = true; while (c) { 10; } 3333;",
+            .constants = {{0}}, 0,
             .instructions = {
-                make_instruction(OPCODE_NULL),              
-                make_instruction(OPCODE_TRUE),              
-                make_instruction(OPCODE_JUMP_NOT_TRUE, 12),  
-                make_instruction(OPCODE_POP),        
-                make_instruction(OPCODE_CONST, 0),          
-                make_instruction(OPCODE_JUMP, 1),  
-                make_instruction(OPCODE_POP),  
-                make_instruction(OPCODE_CONST, 1),          
-                make_instruction(OPCODE_POP),               
+                make_instruction(OPCODE_TRUE),
+                make_instruction(OPCODE_SET_GLOBAL, 0),
+                make_instruction(OPCODE_GET_GLOBAL, 0),
+                make_instruction(OPCODE_JUMP_NOT_TRUE, 16),
+                make_instruction(OPCODE_PUSH_INT8, 10),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_JUMP, 4),
+                make_instruction(OPCODE_PUSH_INT16, 3333),
+                make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_HALT),
             }, 10
         },
         {
-            .input = "while (true) { 10; };",
-            .constants = {
-                make_integer_object(10),
-            }, 1,
+            .input = "let c = true; while (c) { 10; };",
+            .constants = {{0}}, 0,
             .instructions = {
-                make_instruction(OPCODE_NULL),              
-                make_instruction(OPCODE_TRUE),              
-                make_instruction(OPCODE_JUMP_NOT_TRUE, 12),  
-                make_instruction(OPCODE_POP),        
-                make_instruction(OPCODE_CONST, 0),          
-                make_instruction(OPCODE_JUMP, 1),  
-                make_instruction(OPCODE_POP),  
+                make_instruction(OPCODE_TRUE),
+                make_instruction(OPCODE_SET_GLOBAL, 0),
+                make_instruction(OPCODE_NULL),
+                make_instruction(OPCODE_GET_GLOBAL, 0),
+                make_instruction(OPCODE_JUMP_NOT_TRUE, 17),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_PUSH_INT8, 10),
+                make_instruction(OPCODE_JUMP, 5),
+                make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_HALT),
-            }, 8
+            }, 10
         },
         {
-            .input = "while (true) { break; };",
+            .input = "let c = true; while (c) { break; };",
             .constants = {{0}}, 0,
             .instructions = {
-                make_instruction(OPCODE_NULL),              
-                make_instruction(OPCODE_TRUE),              
-                make_instruction(OPCODE_JUMP_NOT_TRUE, 14),
+                make_instruction(OPCODE_TRUE),
+                make_instruction(OPCODE_SET_GLOBAL, 0),
+                make_instruction(OPCODE_NULL),
+                make_instruction(OPCODE_GET_GLOBAL, 0),
+                make_instruction(OPCODE_JUMP_NOT_TRUE, 13),
                 make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_NULL),
-                make_instruction(OPCODE_JUMP, 14),  
-                make_instruction(OPCODE_NULL),             
-                make_instruction(OPCODE_JUMP, 1),  
-                make_instruction(OPCODE_POP),  
+                make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_HALT),
-            }, 10
+            }, 9
         },
         {
-            .input = "while (true) { continue; };",
+            .input = "let c = true; while (c) { continue; };",
             .constants = {{0}}, 0,
             .instructions = {
-                make_instruction(OPCODE_NULL),              
-                make_instruction(OPCODE_TRUE),              
-                make_instruction(OPCODE_JUMP_NOT_TRUE, 14),
+                make_instruction(OPCODE_TRUE),
+                make_instruction(OPCODE_SET_GLOBAL, 0),
+                make_instruction(OPCODE_NULL),
+                make_instruction(OPCODE_GET_GLOBAL, 0),
+                make_instruction(OPCODE_JUMP_NOT_TRUE, 16),
                 make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_NULL),
-                make_instruction(OPCODE_JUMP, 1),  
-                make_instruction(OPCODE_NULL),             
-                make_instruction(OPCODE_JUMP, 1),  
-                make_instruction(OPCODE_POP),  
+                make_instruction(OPCODE_JUMP, 5),
+                make_instruction(OPCODE_POP),
                 make_instruction(OPCODE_HALT),
             }, 10
         },
@@ -937,92 +1018,88 @@ static void for_expressions(void) {
     struct compiler_test_case tests[] = {
         {
             .input = "for (let i = 0; i < 10; i = i + 1) { 5 }",
-            .constants = {
-                make_integer_object(0),
-                make_integer_object(10),
-                make_integer_object(5),
-                make_integer_object(1),
-            }, 4,
+            .constants = {{0}}, 0,
             .instructions = {
                 make_instruction(OPCODE_NULL),              
-                make_instruction(OPCODE_CONST, 0), 
+                make_instruction(OPCODE_PUSH_INT8, 0), 
                 make_instruction(OPCODE_SET_GLOBAL, 0),
                 make_instruction(OPCODE_GET_GLOBAL, 0),
-                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_PUSH_INT8, 10),
+                #ifndef NO_SUPERINSTRUCTIONS
+                make_instruction(OPCODE_JUMP_IF_NOT_LESS_THAN, 29),
+                #else
                 make_instruction(OPCODE_LESS_THAN),
-                make_instruction(OPCODE_JUMP_NOT_TRUE, 38), 
+                make_instruction(OPCODE_JUMP_NOT_TRUE, 30), 
+                #endif
                 make_instruction(OPCODE_POP), 
-                make_instruction(OPCODE_CONST, 2), 
+                make_instruction(OPCODE_PUSH_INT8, 5), 
                 make_instruction(OPCODE_GET_GLOBAL, 0),        
-                make_instruction(OPCODE_CONST, 3),          
+                make_instruction(OPCODE_PUSH_INT8, 1),          
                 make_instruction(OPCODE_ADD),  
                 make_instruction(OPCODE_SET_GLOBAL, 0), 
-                make_instruction(OPCODE_GET_GLOBAL, 0), 
-                make_instruction(OPCODE_POP),
-                make_instruction(OPCODE_JUMP, 0007),            
+                make_instruction(OPCODE_JUMP, 0006),            
                 make_instruction(OPCODE_POP),               
                 make_instruction(OPCODE_HALT),
-            }, 18
+            #ifndef NO_SUPERINSTRUCTIONS
+            }, 15
+            #else
+            }, 16
+            #endif
         },
         {
             .input = "for (let i = 0; i < 10; i = i + 1) { break; }",
-            .constants = {
-                make_integer_object(0),
-                make_integer_object(10),
-                make_integer_object(1),
-            }, 3,
+            .constants = {{0}}, 0,
             .instructions = {
-                make_instruction(OPCODE_NULL),              
-                make_instruction(OPCODE_CONST, 0), 
+                make_instruction(OPCODE_NULL),
+                make_instruction(OPCODE_PUSH_INT8, 0),
                 make_instruction(OPCODE_SET_GLOBAL, 0),
                 make_instruction(OPCODE_GET_GLOBAL, 0),
-                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_PUSH_INT8, 10),
+                #ifndef NO_SUPERINSTRUCTIONS
+                make_instruction(OPCODE_JUMP_IF_NOT_LESS_THAN, 16),
+                #else
                 make_instruction(OPCODE_LESS_THAN),
-                make_instruction(OPCODE_JUMP_NOT_TRUE, 40), 
-                make_instruction(OPCODE_POP), 
-                make_instruction(OPCODE_NULL), 
-                make_instruction(OPCODE_JUMP, 40), 
-                make_instruction(OPCODE_NULL), 
-                make_instruction(OPCODE_GET_GLOBAL, 0),        
-                make_instruction(OPCODE_CONST, 2),          
-                make_instruction(OPCODE_ADD),  
-                make_instruction(OPCODE_SET_GLOBAL, 0), 
-                make_instruction(OPCODE_GET_GLOBAL, 0), 
+                make_instruction(OPCODE_JUMP_NOT_TRUE, 17),
+                #endif
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_NULL),
                 make_instruction(OPCODE_POP),
-                make_instruction(OPCODE_JUMP, 0007),            
-                make_instruction(OPCODE_POP),               
                 make_instruction(OPCODE_HALT),
-            }, 20
+            #ifndef NO_SUPERINSTRUCTIONS
+            }, 10
+            #else
+            }, 11
+            #endif
         },
         {
             .input = "for (let i = 0; i < 10; i = i + 1) { continue; }",
-            .constants = {
-                make_integer_object(0),
-                make_integer_object(10),
-                make_integer_object(1),
-            }, 3,
+            .constants = {{0}}, 0,
             .instructions = {
-                make_instruction(OPCODE_NULL),              
-                make_instruction(OPCODE_CONST, 0), 
+                make_instruction(OPCODE_NULL),
+                make_instruction(OPCODE_PUSH_INT8, 0),
                 make_instruction(OPCODE_SET_GLOBAL, 0),
                 make_instruction(OPCODE_GET_GLOBAL, 0),
-                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_PUSH_INT8, 10),
+                #ifndef NO_SUPERINSTRUCTIONS
+                make_instruction(OPCODE_JUMP_IF_NOT_LESS_THAN, 28),
+                #else
                 make_instruction(OPCODE_LESS_THAN),
-                make_instruction(OPCODE_JUMP_NOT_TRUE, 40), 
-                make_instruction(OPCODE_POP), 
-                make_instruction(OPCODE_NULL), 
-                make_instruction(OPCODE_JUMP, 23), 
-                make_instruction(OPCODE_NULL), 
-                make_instruction(OPCODE_GET_GLOBAL, 0),        
-                make_instruction(OPCODE_CONST, 2),          
-                make_instruction(OPCODE_ADD),  
-                make_instruction(OPCODE_SET_GLOBAL, 0), 
-                make_instruction(OPCODE_GET_GLOBAL, 0), 
+                make_instruction(OPCODE_JUMP_NOT_TRUE, 29),
+                #endif
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_NULL),
+                make_instruction(OPCODE_GET_GLOBAL, 0),
+                make_instruction(OPCODE_PUSH_INT8, 1),
+                make_instruction(OPCODE_ADD),
+                make_instruction(OPCODE_SET_GLOBAL, 0),
+                make_instruction(OPCODE_JUMP, 6),
                 make_instruction(OPCODE_POP),
-                make_instruction(OPCODE_JUMP, 0007),            
-                make_instruction(OPCODE_POP),               
                 make_instruction(OPCODE_HALT),
-            }, 20
+            #ifndef NO_SUPERINSTRUCTIONS
+            }, 15
+            #else
+            }, 16
+            #endif
         },
     };
 
@@ -1042,15 +1119,11 @@ static void array_literals(void) {
         },
         {
             .input = "[1, 2, 3]",
-            .constants = {
-                make_integer_object(1),
-                make_integer_object(2),
-                make_integer_object(3),
-            }, 3,
+            .constants = {{0}}, 0,
             .instructions = {
-                make_instruction(OPCODE_CONST, 0),     
-                make_instruction(OPCODE_CONST, 1),     
-                make_instruction(OPCODE_CONST, 2),     
+                make_instruction(OPCODE_PUSH_INT8, 1),     
+                make_instruction(OPCODE_PUSH_INT8, 2),     
+                make_instruction(OPCODE_PUSH_INT8, 3),     
                 make_instruction(OPCODE_ARRAY, 3),              
                 make_instruction(OPCODE_POP),       
                 make_instruction(OPCODE_HALT),         
@@ -1058,28 +1131,15 @@ static void array_literals(void) {
         },
         {
             .input = "[1 + 2, 3 - 4, 5 * 6]",
-            .constants = {
-                make_integer_object(1),
-                make_integer_object(2),
-                make_integer_object(3),
-                make_integer_object(4),
-                make_integer_object(5),
-                make_integer_object(6),
-            }, 6,
+            .constants = {{0}}, 0,
             .instructions = {
-                make_instruction(OPCODE_CONST, 0),     
-                make_instruction(OPCODE_CONST, 1),    
-                make_instruction(OPCODE_ADD), 
-                make_instruction(OPCODE_CONST, 2),  
-                make_instruction(OPCODE_CONST, 3),       
-                make_instruction(OPCODE_SUBTRACT),
-                make_instruction(OPCODE_CONST, 4),  
-                make_instruction(OPCODE_CONST, 5),       
-                make_instruction(OPCODE_MULTIPLY),    
+                make_instruction(OPCODE_PUSH_INT8, 3),     
+                make_instruction(OPCODE_PUSH_INT8, -1),  
+                make_instruction(OPCODE_PUSH_INT8, 30),  
                 make_instruction(OPCODE_ARRAY, 3),         
                 make_instruction(OPCODE_POP),  
                 make_instruction(OPCODE_HALT),            
-            }, 12
+            }, 6
         },
     };
 
@@ -1090,16 +1150,12 @@ static void index_get(void) {
     struct compiler_test_case tests[] = {
         {
             .input = "[1, 2][1]",
-            .constants = {
-                make_integer_object(1),
-                make_integer_object(2),
-                make_integer_object(1),
-            }, 3,
+            .constants = {{0}}, 0,
             .instructions = {
-                make_instruction(OPCODE_CONST, 0),     
-                make_instruction(OPCODE_CONST, 1),     
+                make_instruction(OPCODE_PUSH_INT8, 1),     
+                make_instruction(OPCODE_PUSH_INT8, 2),     
                 make_instruction(OPCODE_ARRAY, 2),  
-                make_instruction(OPCODE_CONST, 2),   
+                make_instruction(OPCODE_PUSH_INT8, 1),   
                 make_instruction(OPCODE_INDEX_GET),         
                 make_instruction(OPCODE_POP),       
                 make_instruction(OPCODE_HALT),              
@@ -1114,14 +1170,11 @@ static void var_assignment(void) {
      struct compiler_test_case tests[] = {
         {
             .input = "let a = 1; a = 2;",
-            .constants = {
-                make_integer_object(1),
-                make_integer_object(2),
-            }, 2,
+            .constants = {{0}}, 0,
             .instructions = {
-                make_instruction(OPCODE_CONST, 0),     
+                make_instruction(OPCODE_PUSH_INT8, 1),     
                 make_instruction(OPCODE_SET_GLOBAL, 0),
-                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_PUSH_INT8, 2),
                 make_instruction(OPCODE_SET_GLOBAL, 0), 
                 make_instruction(OPCODE_GET_GLOBAL, 0),     
                 make_instruction(OPCODE_POP),       
@@ -1137,18 +1190,14 @@ static void index_set(void) {
      struct compiler_test_case tests[] = {
         {
             .input = "let arr = [1]; arr[0] = 2;",
-            .constants = {
-                make_integer_object(1),
-                make_integer_object(0),
-                make_integer_object(2),
-            }, 3,
+            .constants = {{0}}, 0,
             .instructions = {
-                make_instruction(OPCODE_CONST, 0),     
+                make_instruction(OPCODE_PUSH_INT8, 1),     
                 make_instruction(OPCODE_ARRAY, 1), 
                 make_instruction(OPCODE_SET_GLOBAL, 0), 
                 make_instruction(OPCODE_GET_GLOBAL, 0),  
-                make_instruction(OPCODE_CONST, 1), 
-                make_instruction(OPCODE_CONST, 2), 
+                make_instruction(OPCODE_PUSH_INT8, 0), 
+                make_instruction(OPCODE_PUSH_INT8, 2), 
                 make_instruction(OPCODE_INDEX_SET),         
                 make_instruction(OPCODE_POP),       
                 make_instruction(OPCODE_HALT),              
@@ -1164,20 +1213,14 @@ static void slices(void) {
      struct compiler_test_case tests[] = {
         {
             .input = "[0, 1, 2][0:1]",
-            .constants = {
-                make_integer_object(0),
-                make_integer_object(1),
-                make_integer_object(2),
-                make_integer_object(0),
-                make_integer_object(1),
-            }, 5,
+            .constants = {{0}}, 0,
             .instructions = {
-                make_instruction(OPCODE_CONST, 0),  
-                make_instruction(OPCODE_CONST, 1),  
-                make_instruction(OPCODE_CONST, 2),     
+                make_instruction(OPCODE_PUSH_INT8, 0),  
+                make_instruction(OPCODE_PUSH_INT8, 1),  
+                make_instruction(OPCODE_PUSH_INT8, 2),     
                 make_instruction(OPCODE_ARRAY, 3), 
-                make_instruction(OPCODE_CONST, 3), 
-                make_instruction(OPCODE_CONST, 4), 
+                make_instruction(OPCODE_PUSH_INT8, 0), 
+                make_instruction(OPCODE_PUSH_INT8, 1), 
                 make_instruction(OPCODE_SLICE),         
                 make_instruction(OPCODE_POP),       
                 make_instruction(OPCODE_HALT),              
@@ -1192,16 +1235,13 @@ static void postfix_expressions(void) {
     struct compiler_test_case tests[] = {
         {
             .input = "let foo = 0; foo--;",
-            .constants = {
-                make_integer_object(0),
-                make_integer_object(1),
-            }, 2,
+            .constants = {{0}}, 0,
             .instructions = {
-                make_instruction(OPCODE_CONST, 0),     
+                make_instruction(OPCODE_PUSH_INT8, 0),     
                 make_instruction(OPCODE_SET_GLOBAL, 0), 
                 make_instruction(OPCODE_GET_GLOBAL, 0),  
                 make_instruction(OPCODE_GET_GLOBAL, 0),  
-                make_instruction(OPCODE_CONST, 1), 
+                make_instruction(OPCODE_PUSH_INT8, 1), 
                 make_instruction(OPCODE_SUBTRACT), 
                 make_instruction(OPCODE_SET_GLOBAL, 0),  
                 make_instruction(OPCODE_POP),       
@@ -1210,31 +1250,739 @@ static void postfix_expressions(void) {
         },
         {
             .input = "let foo = 0; foo++;",
-            .constants = {
-                make_integer_object(0),
-                make_integer_object(1),
-            }, 2,
+            .constants = {{0}}, 0,
             .instructions = {
-                make_instruction(OPCODE_CONST, 0),     
+                make_instruction(OPCODE_PUSH_INT8, 0),     
                 make_instruction(OPCODE_SET_GLOBAL, 0), 
                 make_instruction(OPCODE_GET_GLOBAL, 0),  
-                make_instruction(OPCODE_GET_GLOBAL, 0),  
-                make_instruction(OPCODE_CONST, 1), 
-                make_instruction(OPCODE_ADD), 
-                make_instruction(OPCODE_SET_GLOBAL, 0),  
+                make_instruction(OPCODE_INC_GLOBAL, 0), 
                 make_instruction(OPCODE_POP),       
                 make_instruction(OPCODE_HALT),              
-            }, 9
+            }, 6
         },
     };
 
     run_compiler_tests(tests, ARRAY_SIZE(tests));
+
+    // the value of a++ is not used, so it is not loaded
+    struct instruction *fn_body = flatten_instructions_array((struct instruction *[]) {
+        make_instruction(OPCODE_INC_LOCAL, 0),
+        make_instruction(OPCODE_GET_LOCAL, 0),
+        make_instruction(OPCODE_DEC_LOCAL, 0),
+        make_instruction(OPCODE_RETURN_VALUE),
+    }, 4);
+    struct compiler_test_case t = {
+        .input = "fn(a) { a++; a-- }",
+        .constants = {
+            make_compiled_function_object(fn_body, 0),
+        }, 1,
+        .instructions = {
+            make_instruction(OPCODE_CONST, 0),
+            make_instruction(OPCODE_POP),
+            make_instruction(OPCODE_HALT),
+        }, 3,
+    };
+    run_compiler_test(t);
+    free_instruction(fn_body);
+}
+
+static void constant_deduplication(void) {
+    struct compiler_test_case tests[] = {
+        {
+            .input = "\"a\"; \"a\"; 100000; 100000; \"b\"; \"a\"",
+            .constants = {
+                make_string_object("a"),
+                make_integer_object(100000),
+                make_string_object("b"),
+            }, 3,
+            .instructions = {
+                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_CONST, 2),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_HALT),
+            }, 13,
+        },
+    };
+    run_compiler_tests(tests, ARRAY_SIZE(tests));
+
+    // constants stay deduplicated after the index grows
+    char input[8192] = "";
+    for (unsigned round=0; round < 2; round++) {
+        for (unsigned i=0; i < 300; i++) {
+            sprintf(input + strlen(input), "%d; ", 100000 + i);
+        }
+    }
+    struct program *program = parse_program_str(input);
+    struct compiler *compiler = compiler_new();
+    int err = compile_program(compiler, program);
+    assertf(err == 0, "compiler error: %s", compiler_error_str(err));
+    assertf(compiler->constants->size == 300, "wrong constants size: expected %d, got %d", 300, compiler->constants->size);
+    free_program(program);
+    compiler_free(compiler);
+}
+
+static void constant_folding(void) {
+    struct compiler_test_case tests[] = {
+        {
+            .input = "60 * 60 * 24",
+            .constants = {
+                make_integer_object(86400),
+            }, 1,
+            .instructions = {
+                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_HALT),
+            }, 3,
+        },
+        {
+            .input = "len(\"abc\") + 1",
+            .constants = {{0}}, 0,
+            .instructions = {
+                make_instruction(OPCODE_PUSH_INT8, 4),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_HALT),
+            }, 3,
+        },
+        {
+            .input = "\"a\" + \"b\" == \"ab\"",
+            .constants = {{0}}, 0,
+            .instructions = {
+                make_instruction(OPCODE_TRUE),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_HALT),
+            }, 3,
+        },
+        {
+            // errors are left to the VM
+            .input = "1 / 0",
+            .constants = {{0}}, 0,
+            .instructions = {
+                make_instruction(OPCODE_PUSH_INT8, 1),
+                make_instruction(OPCODE_PUSH_INT8, 0),
+                make_instruction(OPCODE_DIVIDE),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_HALT),
+            }, 5,
+        },
+        {
+            .input = "let a = 2; a * 3; -a; !a",
+            .constants = {{0}}, 0,
+            .instructions = {
+                make_instruction(OPCODE_PUSH_INT8, 2),
+                make_instruction(OPCODE_SET_GLOBAL, 0),
+                make_instruction(OPCODE_GET_GLOBAL, 0),
+                make_instruction(OPCODE_PUSH_INT8, 3),
+                make_instruction(OPCODE_MULTIPLY),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_GET_GLOBAL, 0),
+                make_instruction(OPCODE_MINUS),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_GET_GLOBAL, 0),
+                make_instruction(OPCODE_BANG),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_HALT),
+            }, 13,
+        },
+        {
+            // built-in functions with side effects are always called at runtime
+            .input = "print(1 + 1)",
+            .constants = {{0}}, 0,
+            .instructions = {
+                make_instruction(OPCODE_GET_BUILTIN, 0),
+                make_instruction(OPCODE_PUSH_INT8, 2),
+                make_instruction(OPCODE_CALL, 1),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_HALT),
+            }, 5,
+        },
+    };
+    run_compiler_tests(tests, ARRAY_SIZE(tests));
+
+    // a parameter may shadow a built-in function
+    struct instruction *fn_body = flatten_instructions_array((struct instruction *[]) {
+        make_instruction(OPCODE_GET_LOCAL, 0),
+        make_instruction(OPCODE_CONST, 0),
+        make_instruction(OPCODE_TAIL_CALL, 1),
+    }, 3);
+    struct compiler_test_case t = {
+        .input = "fn(len) { len(\"abc\") }",
+        .constants = {
+            make_string_object("abc"),
+            make_compiled_function_object(fn_body, 0),
+        }, 2,
+        .instructions = {
+            make_instruction(OPCODE_CONST, 1),
+            make_instruction(OPCODE_POP),
+            make_instruction(OPCODE_HALT),
+        }, 3,
+    };
+    run_compiler_test(t);
+    free_instruction(fn_body);
+}
+
+static void peephole_optimization(void) {
+    struct compiler_test_case tests[] = {
+        {
+            // the jump over the inner else branch goes straight to the end of the outer if
+            .input = "let a = 1; if (a) { if (a) { 1 } else { 2 } } else { 3 }",
+            .constants = {{0}}, 0,
+            .instructions = {
+                make_instruction(OPCODE_PUSH_INT8, 1),
+                make_instruction(OPCODE_SET_GLOBAL, 0),
+                make_instruction(OPCODE_GET_GLOBAL, 0),
+                make_instruction(OPCODE_JUMP_NOT_TRUE, 27),
+                make_instruction(OPCODE_GET_GLOBAL, 0),
+                make_instruction(OPCODE_JUMP_NOT_TRUE, 22),
+                make_instruction(OPCODE_PUSH_INT8, 1),
+                make_instruction(OPCODE_JUMP, 29),
+                make_instruction(OPCODE_PUSH_INT8, 2),
+                make_instruction(OPCODE_JUMP, 29),
+                make_instruction(OPCODE_PUSH_INT8, 3),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_HALT),
+            }, 13,
+        },
+        {
+            .input = "if (false) { 1 } else { 2 }",
+            .constants = {{0}}, 0,
+            .instructions = {
+                make_instruction(OPCODE_PUSH_INT8, 2),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_HALT),
+            }, 3,
+        },
+        {
+            // the main program keeps its pops, the REPL shows the last popped value
+            .input = "while (true) { break; }",
+            .constants = {{0}}, 0,
+            .instructions = {
+                make_instruction(OPCODE_NULL),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_NULL),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_HALT),
+            }, 5,
+        },
+    };
+    run_compiler_tests(tests, ARRAY_SIZE(tests));
+
+    {
+        struct instruction *fn_body = flatten_instructions_array((struct instruction *[]) {
+            make_instruction(OPCODE_PUSH_INT8, 2),
+            make_instruction(OPCODE_SET_LOCAL, 0),
+            make_instruction(OPCODE_GET_LOCAL, 0),
+            make_instruction(OPCODE_RETURN_VALUE),
+        }, 4);
+        struct compiler_test_case t = {
+            .input = "fn(a) { a = 2; a }",
+            .constants = {
+                make_compiled_function_object(fn_body, 1),
+            }, 1,
+            .instructions = {
+                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_HALT),
+            }, 3,
+        };
+        run_compiler_test(t);
+        free_instruction(fn_body);
+    }
+    {
+        struct instruction *fn_body = flatten_instructions_array((struct instruction *[]) {
+            make_instruction(OPCODE_PUSH_INT8, 1),
+            make_instruction(OPCODE_RETURN_VALUE),
+        }, 2);
+        struct compiler_test_case t = {
+            .input = "fn() { return 1; 2; }",
+            .constants = {
+                make_compiled_function_object(fn_body, 0),
+            }, 1,
+            .instructions = {
+                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_HALT),
+            }, 3,
+        };
+        run_compiler_test(t);
+        free_instruction(fn_body);
+    }
+}
+
+static void compare_and_branch(void) {
+    #ifndef NO_SUPERINSTRUCTIONS
+    {
+        // the comparison jumps itself instead of pushing a boolean for OpJumpNotTrue
+        struct instruction *fn_body = flatten_instructions_array((struct instruction *[]) {
+            make_instruction(OPCODE_GET_LOCAL, 0),
+            make_instruction(OPCODE_GET_LOCAL, 1),
+            make_instruction(OPCODE_JUMP_IF_NOT_LESS_THAN_OR_EQUALS, 19),
+            make_instruction(OPCODE_GET_LOCAL, 0),
+            make_instruction(OPCODE_PUSH_INT8, 0),
+            make_instruction(OPCODE_JUMP_IF_EQUAL, 19),
+            make_instruction(OPCODE_PUSH_INT8, 1),
+            make_instruction(OPCODE_JUMP, 21),
+            make_instruction(OPCODE_PUSH_INT8, 2),
+            make_instruction(OPCODE_RETURN_VALUE),
+        }, 10);
+        struct compiler_test_case t = {
+            .input = "fn(a, b) { if (a <= b && a != 0) { 1 } else { 2 } }",
+            .constants = {
+                make_compiled_function_object(fn_body, 0),
+            }, 1,
+            .instructions = {
+                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_HALT),
+            }, 3,
+        };
+        run_compiler_test(t);
+        free_instruction(fn_body);
+    }
+    {
+        // superinstructions are fused with the jump as well
+        struct instruction *fn_body = flatten_instructions_array((struct instruction *[]) {
+            make_instruction(OPCODE_JUMP_IF_NOT_EQUAL_LOCAL_CONST, 11, 0, 0),
+            make_instruction(OPCODE_PUSH_INT8, 1),
+            make_instruction(OPCODE_JUMP, 13),
+            make_instruction(OPCODE_PUSH_INT8, 2),
+            make_instruction(OPCODE_RETURN_VALUE),
+        }, 5);
+        struct compiler_test_case t = {
+            .input = "fn(a) { if (a == 5) { 1 } else { 2 } }",
+            .constants = {
+                make_integer_object(5),
+                make_compiled_function_object(fn_body, 0),
+            }, 2,
+            .instructions = {
+                make_instruction(OPCODE_CONST, 1),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_HALT),
+            }, 3,
+        };
+        run_compiler_test(t);
+        free_instruction(fn_body);
+    }
+    {
+        struct instruction *fn_body = flatten_instructions_array((struct instruction *[]) {
+            make_instruction(OPCODE_PUSH_INT8, 0),
+            make_instruction(OPCODE_SET_LOCAL, 1),
+            make_instruction(OPCODE_JUMP_IF_NOT_LESS_THAN_LOCAL_LOCAL, 14, 1, 0),
+            make_instruction(OPCODE_INC_LOCAL, 1),
+            make_instruction(OPCODE_JUMP, 4),
+            make_instruction(OPCODE_GET_LOCAL, 1),
+            make_instruction(OPCODE_RETURN_VALUE),
+        }, 7);
+        struct compiler_test_case t = {
+            .input = "fn(n) { let i = 0; while (i < n) { i++ }; i }",
+            .constants = {
+                make_compiled_function_object(fn_body, 0),
+            }, 1,
+            .instructions = {
+                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_HALT),
+            }, 3,
+        };
+        run_compiler_test(t);
+        free_instruction(fn_body);
+    }
+    #endif
+    {
+        // a comparison that is used as a value is not fused
+        struct instruction *fn_body = flatten_instructions_array((struct instruction *[]) {
+            make_instruction(OPCODE_GET_LOCAL, 0),
+            make_instruction(OPCODE_GET_LOCAL, 1),
+            make_instruction(OPCODE_GREATER_THAN),
+            make_instruction(OPCODE_RETURN_VALUE),
+        }, 4);
+        struct compiler_test_case t = {
+            .input = "fn(a, b) { a > b }",
+            .constants = {
+                make_compiled_function_object(fn_body, 0),
+            }, 1,
+            .instructions = {
+                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_HALT),
+            }, 3,
+        };
+        run_compiler_test(t);
+        free_instruction(fn_body);
+    }
+}
+
+static void stack_depth(void) {
+    struct {
+        const char *input;
+        uint32_t expected;
+        uint32_t expected_function;
+    } tests[] = {
+        {"let a = 1; a + 2 * a", 3, 0},
+        {"[1, 2, 3, 4]; 5", 4, 0},
+        {"if (true) { 1 } else { 2 }; 3", 1, 0},
+        {"let c = false; while (c) { 1; }", 2, 0},
+        {"fn(a) { let b = a + 1; b * (a - 1) }", 1, 3},
+        {"fn(a, b) { return [a, b, a + b]; }", 1, 4},
+    };
+
+    for (unsigned t=0; t < ARRAY_SIZE(tests); t++) {
+        struct program *program = parse_program_str(tests[t].input);
+        struct compiler *compiler = compiler_new();
+        int err = compile_program(compiler, program);
+        assertf(err == 0, "compiler error: %s", compiler_error_str(err));
+        struct bytecode *bytecode = get_bytecode(compiler);
+        assertf(bytecode->max_stack_depth == tests[t].expected, "wrong stack depth for %s: expected %d, got %d", tests[t].input, tests[t].expected, bytecode->max_stack_depth);
+        for (unsigned i=0; i < bytecode->constants->size; i++) {
+            struct object obj = bytecode->constants->values[i];
+            if (obj_type(obj) == OBJ_COMPILED_FUNCTION) {
+                assertf(obj_fn(obj)->max_stack_depth == tests[t].expected_function, "wrong function stack depth for %s: expected %d, got %d", tests[t].input, tests[t].expected_function, obj_fn(obj)->max_stack_depth);
+            }
+        }
+        free(bytecode);
+        free_program(program);
+        compiler_free(compiler);
+    }
+}
+
+static void loop_invariant_code_motion(void) {
+    struct compiler_test_case tests[] = {
+        {
+            // len(s) is computed once and kept in an anonymous global
+            .input = "let s = \"ab\"; let n = 0; while (n < len(s)) { n++; }",
+            .constants = {
+                make_string_object("ab"),
+            }, 1,
+            .instructions = {
+                make_instruction(OPCODE_CONST, 0),
+                make_instruction(OPCODE_SET_GLOBAL, 0),
+                make_instruction(OPCODE_PUSH_INT8, 0),
+                make_instruction(OPCODE_SET_GLOBAL, 1),
+                make_instruction(OPCODE_GET_GLOBAL, 0),
+                make_instruction(OPCODE_LEN),
+                make_instruction(OPCODE_SET_GLOBAL, 2),
+                make_instruction(OPCODE_NULL),
+                make_instruction(OPCODE_GET_GLOBAL, 1),
+                make_instruction(OPCODE_GET_GLOBAL, 2),
+                #ifndef NO_SUPERINSTRUCTIONS
+                make_instruction(OPCODE_JUMP_IF_NOT_LESS_THAN, 38),
+                #else
+                make_instruction(OPCODE_LESS_THAN),
+                make_instruction(OPCODE_JUMP_NOT_TRUE, 39),
+                #endif
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_GET_GLOBAL, 1),
+                make_instruction(OPCODE_INC_GLOBAL, 1),
+                make_instruction(OPCODE_JUMP, 19),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_HALT),
+            #ifndef NO_SUPERINSTRUCTIONS
+            }, 17,
+            #else
+            }, 18,
+            #endif
+        },
+        {
+            // the loop changes the array, so its length is not invariant
+            .input = "let a = [1]; while (len(a) < 3) { array_push(a, 1); }",
+            .constants = {{0}}, 0,
+            .instructions = {
+                make_instruction(OPCODE_PUSH_INT8, 1),
+                make_instruction(OPCODE_ARRAY, 1),
+                make_instruction(OPCODE_SET_GLOBAL, 0),
+                make_instruction(OPCODE_NULL),
+                make_instruction(OPCODE_GET_GLOBAL, 0),
+                make_instruction(OPCODE_LEN),
+                make_instruction(OPCODE_PUSH_INT8, 3),
+                #ifndef NO_SUPERINSTRUCTIONS
+                make_instruction(OPCODE_JUMP_IF_NOT_LESS_THAN, 28),
+                #else
+                make_instruction(OPCODE_LESS_THAN),
+                make_instruction(OPCODE_JUMP_NOT_TRUE, 29),
+                #endif
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_GET_GLOBAL, 0),
+                make_instruction(OPCODE_PUSH_INT8, 1),
+                make_instruction(OPCODE_ARRAY_PUSH),
+                make_instruction(OPCODE_JUMP, 9),
+                make_instruction(OPCODE_POP),
+                make_instruction(OPCODE_HALT),
+            #ifndef NO_SUPERINSTRUCTIONS
+            }, 15,
+            #else
+            }, 16,
+            #endif
+        },
+    };
+    run_compiler_tests(tests, ARRAY_SIZE(tests));
+}
+
+static void optimized_functions(void) {
+    struct {
+        const char *input;
+        struct instruction *instructions[20];
+        uint32_t instructions_size;
+        uint32_t num_locals;
+    } tests[] = {
+        {
+            // copy propagation, after which the store to b is dead and b is pruned
+            "fn(a) { let b = a; b }",
+            {
+                make_instruction(OPCODE_GET_LOCAL, 0),
+                make_instruction(OPCODE_RETURN_VALUE),
+            }, 2, 1,
+        },
+        {
+            "fn(a) { let b = 1; b = a * 2; b }",
+            {
+                make_instruction(OPCODE_GET_LOCAL, 0),
+                make_instruction(OPCODE_PUSH_INT8, 2),
+                make_instruction(OPCODE_MULTIPLY),
+                make_instruction(OPCODE_RETURN_VALUE),
+            }, 4, 1,
+        },
+        {
+            // the common subexpression is read back from the local that already holds it
+            "fn(a) { let b = a * 2; b + a * 2 }",
+            {
+                make_instruction(OPCODE_GET_LOCAL, 0),
+                make_instruction(OPCODE_PUSH_INT8, 2),
+                make_instruction(OPCODE_MULTIPLY),
+                make_instruction(OPCODE_SET_LOCAL, 1),
+                #ifndef NO_SUPERINSTRUCTIONS
+                make_instruction(OPCODE_ADD_LOCAL_LOCAL, 1, 1),
+                make_instruction(OPCODE_RETURN_VALUE),
+            }, 6, 2,
+                #else
+                make_instruction(OPCODE_GET_LOCAL, 1),
+                make_instruction(OPCODE_GET_LOCAL, 1),
+                make_instruction(OPCODE_ADD),
+                make_instruction(OPCODE_RETURN_VALUE),
+            }, 8, 2,
+                #endif
+        },
+        {
+            // or spilled to a new local
+            "fn(a, b) { (a * b + 1) * (a * b + 1) }",
+            {
+                make_instruction(OPCODE_GET_LOCAL, 0),
+                make_instruction(OPCODE_GET_LOCAL, 1),
+                make_instruction(OPCODE_MULTIPLY),
+                make_instruction(OPCODE_PUSH_INT8, 1),
+                make_instruction(OPCODE_ADD),
+                make_instruction(OPCODE_SET_LOCAL, 2),
+                make_instruction(OPCODE_GET_LOCAL, 2),
+                make_instruction(OPCODE_GET_LOCAL, 2),
+                make_instruction(OPCODE_MULTIPLY),
+                make_instruction(OPCODE_RETURN_VALUE),
+            }, 10, 3,
+        },
+        {
+            "fn(a) { a = a + 1; a * a }",
+            {
+                make_instruction(OPCODE_INC_LOCAL, 0),
+                make_instruction(OPCODE_GET_LOCAL, 0),
+                make_instruction(OPCODE_GET_LOCAL, 0),
+                make_instruction(OPCODE_MULTIPLY),
+                make_instruction(OPCODE_RETURN_VALUE),
+            }, 5, 1,
+        },
+        {
+            // a local that is read once right after it is stored stays on the stack
+            "fn(a) { a = a + 1; a }",
+            {
+                #ifndef NO_SUPERINSTRUCTIONS
+                make_instruction(OPCODE_ADD_LOCAL_CONST, 0, 0),
+                make_instruction(OPCODE_RETURN_VALUE),
+            }, 2, 1,
+                #else
+                make_instruction(OPCODE_GET_LOCAL, 0),
+                make_instruction(OPCODE_PUSH_INT8, 1),
+                make_instruction(OPCODE_ADD),
+                make_instruction(OPCODE_RETURN_VALUE),
+            }, 4, 1,
+                #endif
+        },
+        {
+            // values do not survive a jump, the local is read again after the branch
+            "fn(a) { let b = a * 2; if (a) { b = 3; } b }",
+            {
+                make_instruction(OPCODE_GET_LOCAL, 0),
+                make_instruction(OPCODE_PUSH_INT8, 2),
+                make_instruction(OPCODE_MULTIPLY),
+                make_instruction(OPCODE_SET_LOCAL, 1),
+                make_instruction(OPCODE_GET_LOCAL, 0),
+                make_instruction(OPCODE_JUMP_NOT_TRUE, 16),
+                make_instruction(OPCODE_PUSH_INT8, 3),
+                make_instruction(OPCODE_SET_LOCAL, 1),
+                make_instruction(OPCODE_GET_LOCAL, 1),
+                make_instruction(OPCODE_RETURN_VALUE),
+            }, 10, 2,
+        },
+        {
+            // i is an integer on every path into the loop, so its operations do not check types
+            "fn(a) { let i = 1; while (a) { i = i * 3; } !(i > 5) }",
+            {
+                make_instruction(OPCODE_PUSH_INT8, 1),
+                make_instruction(OPCODE_SET_LOCAL, 1),
+                make_instruction(OPCODE_GET_LOCAL, 0),
+                make_instruction(OPCODE_JUMP_NOT_TRUE, 19),
+                make_instruction(OPCODE_GET_LOCAL, 1),
+                make_instruction(OPCODE_PUSH_INT8, 3),
+                make_instruction(OPCODE_INT_MULTIPLY),
+                make_instruction(OPCODE_SET_LOCAL, 1),
+                make_instruction(OPCODE_JUMP, 4),
+                make_instruction(OPCODE_GET_LOCAL, 1),
+                make_instruction(OPCODE_PUSH_INT8, 5),
+                make_instruction(OPCODE_INT_GREATER_THAN),
+                make_instruction(OPCODE_BOOL_BANG),
+                make_instruction(OPCODE_RETURN_VALUE),
+            }, 14, 2,
+        },
+    };
+
+    for (unsigned t=0; t < ARRAY_SIZE(tests); t++) {
+        struct program *program = parse_program_str(tests[t].input);
+        struct compiler *compiler = compiler_new();
+        compiler->optimize = true;
+        int err = compile_program(compiler, program);
+        assertf(err == 0, "compiler error: %s", compiler_error_str(err));
+        struct bytecode *bytecode = get_bytecode(compiler);
+        struct instruction *expected = flatten_instructions_array(tests[t].instructions, tests[t].instructions_size);
+        for (unsigned i=0; i < bytecode->constants->size; i++) {
+            struct object obj = bytecode->constants->values[i];
+            if (obj_type(obj) != OBJ_COMPILED_FUNCTION) {
+                continue;
+            }
+
+            struct compiled_function *fn = obj_fn(obj);
+            char *expected_str = instruction_to_str(expected);
+            char *actual_str = instruction_to_str(&fn->instructions);
+            assertf(fn->instructions.size == expected->size && memcmp(fn->instructions.bytes, expected->bytes, expected->size) == 0, "wrong instructions for %s: \nexpected\n\"%s\"\ngot\n\"%s\"", tests[t].input, expected_str, actual_str);
+            assertf(fn->num_locals == tests[t].num_locals, "wrong number of locals for %s: expected %d, got %d", tests[t].input, tests[t].num_locals, fn->num_locals);
+            free(expected_str);
+            free(actual_str);
+        }
+        free_instruction(expected);
+        free(bytecode);
+        free_program(program);
+        compiler_free(compiler);
+    }
+}
+
+static void inlining(void) {
+    // the call to add is replaced by its body, after which the parameters of add are optimized away
+    struct program *program = parse_program_str("let add = fn(a, b) { a + b }; let f = fn(x) { add(x, 1) }");
+    struct compiler *compiler = compiler_new();
+    compiler->optimize = true;
+    int err = compile_program(compiler, program);
+    assertf(err == 0, "compiler error: %s", compiler_error_str(err));
+    struct bytecode *bytecode = get_bytecode(compiler);
+    struct instruction *expected = flatten_instructions_array((struct instruction *[]) {
+        #ifndef NO_SUPERINSTRUCTIONS
+        make_instruction(OPCODE_ADD_LOCAL_CONST, 0, 1),
+        make_instruction(OPCODE_RETURN_VALUE),
+    }, 2);
+        #else
+        make_instruction(OPCODE_GET_LOCAL, 0),
+        make_instruction(OPCODE_PUSH_INT8, 1),
+        make_instruction(OPCODE_ADD),
+        make_instruction(OPCODE_RETURN_VALUE),
+    }, 4);
+        #endif
+
+    struct compiled_function *f = NULL;
+    for (unsigned i=0; i < bytecode->constants->size; i++) {
+        if (obj_type(bytecode->constants->values[i]) == OBJ_COMPILED_FUNCTION) {
+            f = obj_fn(bytecode->constants->values[i]);
+        }
+    }
+    assertf(f != NULL, "missing compiled function");
+    char *expected_str = instruction_to_str(expected);
+    char *actual_str = instruction_to_str(&f->instructions);
+    assertf(f->instructions.size == expected->size && memcmp(f->instructions.bytes, expected->bytes, expected->size) == 0, "wrong instructions: \nexpected\n\"%s\"\ngot\n\"%s\"", expected_str, actual_str);
+    assertf(f->num_locals == 1, "wrong number of locals: expected 1, got %d", f->num_locals);
+    free(expected_str);
+    free(actual_str);
+    free_instruction(expected);
+    free(bytecode);
+    free_program(program);
+    compiler_free(compiler);
+}
+
+static bool has_unchecked_index(const struct instruction *ins) {
+    for (unsigned i=0; i < ins->size; i += instruction_width(ins->bytes[i])) {
+        switch (ins->bytes[i]) {
+            case OPCODE_INDEX_GET_IN_BOUNDS:
+            case OPCODE_INDEX_SET_IN_BOUNDS:
+            case OPCODE_INDEX_GET_LOCAL_LOCAL_IN_BOUNDS:
+                return true;
+            default:
+            break;
+        }
+    }
+    return false;
+}
+
+static void bounds_check_elimination(void) {
+    struct {
+        const char *input;
+        bool eliminated;
+    } tests[] = {
+        {"fn(a) { let s = 0; for (let i = 0; i < len(a); i++) { s = s + a[i]; } s }", true},
+        {"fn(a) { for (let i = 0; i < len(a); i++) { a[i] = 0; } }", true},
+        {"fn(a) { let n = len(a); for (let i = 0; i < n; i++) { a[i] } }", true},
+        {"fn(a) { for (let i = 0; i < len(a); i++) { for (let j = i + 1; j < len(a); j++) { a[j] } } }", true},
+        {"let a = [1, 2]; for (let i = 0; i < len(a); i++) { a[i] }", true},
+        // the loop body can make the array shorter or change what the index or array refer to
+        {"fn(a, f) { for (let i = 0; i < len(a); i++) { f(); a[i] } }", false},
+        {"fn(a) { for (let i = 0; i < len(a); i++) { array_pop(a); a[i] } }", false},
+        {"fn(a) { for (let i = 0; i < len(a); i++) { i = i + 1; a[i] } }", false},
+        {"fn(a) { for (let i = 0; i < len(a); i++) { a = [1]; a[i] } }", false},
+        // the index can be negative or reach the length
+        {"fn(a) { for (let i = -1; i < len(a); i++) { a[i] } }", false},
+        {"fn(a) { for (let i = 0; i <= len(a); i++) { a[i] } }", false},
+        {"fn(a) { for (let i = 0; i < len(a); i--) { a[i] } }", false},
+        // the bound is not the length of the indexed array
+        {"fn(a, b) { for (let i = 0; i < len(a); i++) { b[i] } }", false},
+        {"fn(a) { let n = len(a); n = n + 1; for (let i = 0; i < n; i++) { a[i] } }", false},
+        {"fn(a, f) { let n = len(a); f(a); for (let i = 0; i < n; i++) { a[i] } }", false},
+        {"fn(a) { let len = fn(x) { 5 }; for (let i = 0; i < len(a); i++) { a[i] } }", false},
+    };
+
+    for (unsigned t=0; t < ARRAY_SIZE(tests); t++) {
+        struct program *program = parse_program_str(tests[t].input);
+        struct compiler *compiler = compiler_new();
+        int err = compile_program(compiler, program);
+        assertf(err == 0, "compiler error: %s", compiler_error_str(err));
+        struct bytecode *bytecode = get_bytecode(compiler);
+        bool eliminated = has_unchecked_index(bytecode->instructions);
+        for (unsigned i=0; i < bytecode->constants->size; i++) {
+            struct object obj = bytecode->constants->values[i];
+            if (obj_type(obj) == OBJ_COMPILED_FUNCTION) {
+                eliminated = eliminated || has_unchecked_index(&obj_fn(obj)->instructions);
+            }
+        }
+        assertf(eliminated == tests[t].eliminated, "wrong bounds checks for %s: expected eliminated=%d, got %d", tests[t].input, tests[t].eliminated, eliminated);
+        free(bytecode);
+        free_program(program);
+        compiler_free(compiler);
+    }
 }
 
 int main(int argc, char *argv[]) {    
     TEST(integer_arithmetic);
     TEST(boolean_expressions);
     TEST(if_expressions);
+    TEST(short_circuit_evaluation);
     TEST(while_expressions);
     TEST(for_expressions);
     TEST(global_let_statements);
@@ -1245,10 +1993,21 @@ int main(int argc, char *argv[]) {
     TEST(string_expressions);
     TEST(recursive_functions);
     TEST(builtin_functions);
+    TEST(intrinsics);
     TEST(array_literals);
     TEST(index_get);
     TEST(var_assignment);
     TEST(index_set);
     TEST(postfix_expressions);
     TEST(slices);
+    TEST(superinstructions);
+    TEST(compare_and_branch);
+    TEST(stack_depth);
+    TEST(constant_deduplication);
+    TEST(constant_folding);
+    TEST(peephole_optimization);
+    TEST(optimized_functions);
+    TEST(loop_invariant_code_motion);
+    TEST(inlining);
+    TEST(bounds_check_elimination);
 }
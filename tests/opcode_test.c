@@ -26,11 +26,16 @@ static void test_make_instruction(void) {
             .opcode = OPCODE_GET_LOCAL,
             .operands = {255},
             .expected = {OPCODE_GET_LOCAL, 255}, 2
+        },
+        {
+            .opcode = OPCODE_SUBTRACT_LOCAL_CONST,
+            .operands = {1, 65534},
+            .expected = {OPCODE_SUBTRACT_LOCAL_CONST, 1, 255, 254}, 4
         }
     };
 
     for (unsigned i=0; i < ARRAY_SIZE(tests); i++) {
-        struct instruction *ins = make_instruction(tests[i].opcode, tests[i].operands[0]);
+        struct instruction *ins = make_instruction(tests[i].opcode, tests[i].operands[0], tests[i].operands[1]);
         
         assertf(ins->size == tests[i].expected_size, "wrong length: expected %d, got %d", tests[i].expected_size, ins->size);
         for (unsigned j=0; j < tests[i].expected_size; j++) {
@@ -46,11 +51,12 @@ static void test_instruction_string(void) {
         make_instruction(OPCODE_ADD),
         make_instruction(OPCODE_GET_LOCAL, 1),
         make_instruction(OPCODE_CONST, 2),
-        make_instruction(OPCODE_CONST, 65535)
+        make_instruction(OPCODE_CONST, 65535),
+        make_instruction(OPCODE_ADD_LOCAL_LOCAL, 1, 2),
     };
 
-    char *expected_str = "0000 OpAdd | 0001 OpGetLocal 1 | 0003 OpConstant 2 | 0006 OpConstant 65535";
-    struct instruction *ins = flatten_instructions_array(instructions, 4);
+    char *expected_str = "0000 OpAdd | 0001 OpGetLocal 1 | 0003 OpConstant 2 | 0006 OpConstant 65535 | 0009 OpAddLocalLocal 1 2";
+    struct instruction *ins = flatten_instructions_array(instructions, 5);
     char *str = instruction_to_str(ins);
     assertf(strcmp(expected_str, str) == 0, "wrong instruction string: expected \"%s\", got \"%s\"", expected_str, str);
     free_instruction(ins);
@@ -66,10 +72,11 @@ static void test_read_operands(void) {
         {OPCODE_CONST, {65535}, 2},
         {OPCODE_CONST, {1}, 2},
         {OPCODE_GET_LOCAL, {255}, 1},
+        {OPCODE_LESS_THAN_LOCAL_CONST, {3, 300}, 3},
     };
 
     for (unsigned t = 0; t < ARRAY_SIZE(tests); t++) {
-        struct instruction *ins = make_instruction(tests[t].opcode, tests[t].operands[0]);
+        struct instruction *ins = make_instruction(tests[t].opcode, tests[t].operands[0], tests[t].operands[1]);
         struct definition def = lookup(tests[t].opcode);
         uint32_t operands[3] = {0};
         uint32_t bytes_read = read_operands(operands, def, ins, 0);
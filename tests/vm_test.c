@@ -34,11 +34,22 @@ static struct object
 run_vm_test(const char *program_str) {
     struct program *p = parse_program_str(program_str);
     struct compiler *c = compiler_new();
+    #ifdef TEST_REGISTERS
+    c->registers = true;
+    #endif
+    #ifdef TEST_OPTIMIZE
+    c->optimize = true;
+    #endif
     int err = compile_program(c, p);
     assertf(err == 0, "compiler error: %s", compiler_error_str(err));
     struct bytecode *bc = get_bytecode(c);
     struct vm *vm = vm_new(bc);
-    err = vm_run(vm);
+    #ifdef TEST_JIT
+    // compile every function to native code the first time it runs
+    vm->jit = true;
+    vm->jit_threshold = 1;
+    #endif
+    err = c->registers ? vm_run_registers(vm) : vm_run(vm);
     assertf(err == 0, "vm error: %d", err);
     struct object obj = vm_stack_last_popped(vm);
     obj = copy_object(&obj);
@@ -50,25 +61,25 @@ run_vm_test(const char *program_str) {
 }
 
 static void test_object(struct object obj, object_type expected_type, object_value expected_value) {
-    assertf(obj.type == expected_type, "invalid object type: expected \"%s\", got \"%s\"", object_type_to_str(expected_type), object_type_to_str(obj.type));
+    assertf(obj_type(obj) == expected_type, "invalid object type: expected \"%s\", got \"%s\"", object_type_to_str(expected_type), object_type_to_str(obj_type(obj)));
     switch (expected_type) {
         case OBJ_INT:
-            assertf(obj.value.integer == expected_value.integer, "invalid integer value: expected %d, got %d", expected_value.integer, obj.value.integer);
+            assertf(obj_int(obj) == expected_value.integer, "invalid integer value: expected %d, got %d", expected_value.integer, obj_int(obj));
         break;
         case OBJ_BOOL:
-            assertf(obj.value.boolean == expected_value.boolean, "invalid boolean value: expected %d, got %d", expected_value.boolean, obj.value.boolean);
+            assertf(obj_bool(obj) == expected_value.boolean, "invalid boolean value: expected %d, got %d", expected_value.boolean, obj_bool(obj));
         break;
         case OBJ_NULL: 
             // nothing to do as null objects have no further contents and type has already been checked
         break;
         case OBJ_STRING: 
-            assertf(strcmp(expected_value.string, obj.value.string->value) == 0, "invalid string value: expected \"%s\", got \"%s\"", expected_value.string, obj.value.string->value);
+            assertf(strcmp(expected_value.string, obj_string(obj)->value) == 0, "invalid string value: expected \"%s\", got \"%s\"", expected_value.string, obj_string(obj)->value);
         break;
         case OBJ_ERROR:
-            assertf(strncasecmp(obj.value.error->value, expected_value.error, strlen(expected_value.error)) == 0, "invalid error value: expected \"%s\", got \"%s\"", expected_value.error, obj.value.error->value);
+            assertf(strncasecmp(obj_error(obj)->value, expected_value.error, strlen(expected_value.error)) == 0, "invalid error value: expected \"%s\", got \"%s\"", expected_value.error, obj_error(obj)->value);
         break;
         default: 
-            assertf(false, "missing test implementation for object of type %s", object_type_to_str(obj.type));
+            assertf(false, "missing test implementation for object of type %s", object_type_to_str(obj_type(obj)));
         break;
     }
 
@@ -104,6 +115,9 @@ static void integer_arithmetic(void) {
         {"6 % 5", EXPECT_INT(1)},
         {"5 + 1 % 5", EXPECT_INT(6)},
         {"-10 + -50", EXPECT_INT(-60)},
+        {"127 + 128", EXPECT_INT(255)},
+        {"32767 + 32768", EXPECT_INT(65535)},
+        {"-129 * 300", EXPECT_INT(-38700)},
 
         // division by zero should errror
         {"1 / 0", EXPECT_ERROR("division by zero")},
@@ -113,6 +127,159 @@ static void integer_arithmetic(void) {
     run_tests(tests, ARRAY_SIZE(tests));
 }
 
+static void constant_folding(void) {
+    test_case_t tests[] = {
+        {"60 * 60 * 24", EXPECT_INT(86400)},
+        {"len(\"abc\") * 2", EXPECT_INT(6)},
+        {"int(\"12\") + 1", EXPECT_INT(13)},
+        {"str_contains(\"abc\", \"b\") && !false", EXPECT_BOOL(true)},
+        {"\"a\" + \"b\" != \"ab\"", EXPECT_BOOL(false)},
+        {"9223372036854775807 + 1 < 0", EXPECT_BOOL(true)},
+        {"let f = fn(len) { len(\"abc\") }; f(fn(s) { 5 })", EXPECT_INT(5)},
+    };
+
+    run_tests(tests, ARRAY_SIZE(tests));
+}
+
+static void runtime_operators(void) {
+    // operands that are not known at compile time
+    test_case_t tests[] = {
+        {"let f = fn(a, b) { a + b * a - b / 2 }; f(3, 4)", EXPECT_INT(13)},
+        {"let f = fn(a, b) { a % b }; f(7, 4)", EXPECT_INT(3)},
+        {"let f = fn(a, b) { a >= b }; f(4, 4)", EXPECT_BOOL(true)},
+        {"let f = fn(a, b) { a > b }; f(4, 4)", EXPECT_BOOL(false)},
+        {"let f = fn(a, b) { a != b }; f(3, 4)", EXPECT_BOOL(true)},
+        {"let f = fn(a) { -a }; f(3)", EXPECT_INT(-3)},
+        {"let f = fn(a) { !a }; f(true)", EXPECT_BOOL(false)},
+        {"let f = fn(a, b) { a + b }; f(\"mon\", \"key\") == \"monkey\"", EXPECT_BOOL(true)},
+        {"let f = fn(a) { len(a) }; f(\"monkey\")", EXPECT_INT(6)},
+    };
+
+    run_tests(tests, ARRAY_SIZE(tests));
+}
+
+static void peephole_optimization(void) {
+    test_case_t tests[] = {
+        {"let f = fn(n) { let i = 0; while (true) { i = i + 1; if (i == n) { break; } } i }; f(5)", EXPECT_INT(5)},
+        {"let f = fn(a) { if (a) { if (a) { 1 } else { 2 } } else { 3 } }; f(true) + f(false) * 10", EXPECT_INT(31)},
+        {"let f = fn(a) { if (false) { return 1; } a; 2; a }; f(3)", EXPECT_INT(3)},
+        {"let f = fn() { return 1; 2; }; f()", EXPECT_INT(1)},
+        {"let f = fn() { let a = 1; for (let i = 0; i < 10; i++) { if (i > 3) { continue; } a = a * 2; } a }; f()", EXPECT_INT(16)},
+        {"while (true) { break; }", EXPECT_NULL()},
+    };
+
+    run_tests(tests, ARRAY_SIZE(tests));
+}
+
+static void optimized_functions(void) {
+    test_case_t tests[] = {
+        {"let f = fn(a, b) { (a * b + 1) * (a * b + 1) }; f(2, 3)", EXPECT_INT(49)},
+        {"let f = fn(a) { let b = a * 2; b + a * 2 }; f(5)", EXPECT_INT(20)},
+        {"let f = fn(a) { let b = a; b = b + 1; let c = b; c * b }; f(2)", EXPECT_INT(9)},
+        {"let f = fn(a) { let b = 1; if (a) { b = 2; } b }; f(true) * 10 + f(false)", EXPECT_INT(21)},
+        {"let f = fn(arr) { let a = arr[0] + 1; arr[0] = 5; let b = arr[0] + 1; a * 10 + b }; f([1])", EXPECT_INT(26)},
+        {"let g = 1; let inc = fn() { g = g + 1; }; let f = fn() { let a = g * 3; inc(); a + g * 3 }; f()", EXPECT_INT(9)},
+        {"let f = fn(n) { let s = 0; let i = 0; while (i < n) { s = s + i * i; i = i + 1; } s }; f(4)", EXPECT_INT(14)},
+        {"let f = fn(a) { let b = a + 1; a = 10; b + (a + 1) }; f(1)", EXPECT_INT(13)},
+        {"let f = fn(s) { let t = s + \"b\"; t + (s + \"b\") }; f(\"a\")", EXPECT_STRING("abab")},
+        {"let f = fn(a) { let x = a; let y = a; a = 0; x + y }; f(4)", EXPECT_INT(8)},
+        // a value carried across the join of an if expression, stored and read right away
+        {"let f = fn(c) { let s = 0; for (let i = 0; i < 1; i++) { let t = if (c) { 1 } else { 2 }; s = t + 1; } return s; }; f(true)", EXPECT_INT(2)},
+        {"let g = fn(c) { let t = if (c) { 1 } else { 2 }; t + 1 }; let h = fn(f) { f(true) * 10 + f(false) }; h(g)", EXPECT_INT(23)},
+    };
+
+    run_tests(tests, ARRAY_SIZE(tests));
+}
+
+static void loop_invariant_code_motion(void) {
+    test_case_t tests[] = {
+        {"let s = \"abc\"; let n = 0; for (let i = 0; i < len(s); i++) { n = n + len(s); } n", EXPECT_INT(9)},
+        {"let f = fn(a, b) { let t = 0; for (let i = 0; i < a * b; i++) { t = t + i; } t }; f(2, 3)", EXPECT_INT(15)},
+        {"let f = fn(s) { let n = 0; while (n < len(s)) { s = s + \"x\"; n = n + 2; } n }; f(\"ab\")", EXPECT_INT(4)},
+        {"let a = [1]; while (len(a) < 3) { array_push(a, 1); }; len(a)", EXPECT_INT(3)},
+        {"let a = [1]; let grow = fn() { array_push(a, 1); }; let n = 0; while (len(a) < 4) { grow(); n++; }; n", EXPECT_INT(3)},
+        {"let n = 2; let dec = fn() { n = n - 1; }; let i = 0; while (i < n * 2) { dec(); i++; }; i", EXPECT_INT(2)},
+        {"let f = fn() { let n = 0; for (let i = 0; i < 3; i++) { let len = fn(x) { 10 }; n = n + len(\"a\"); } n }; f()", EXPECT_INT(30)},
+        {"let f = fn(a) { let n = 0; while (n < 3) { for (let i = 0; i < len(a); i++) { n = n + a[i]; } } n }; f([1, 1])", EXPECT_INT(4)},
+        {"let f = fn(x) { let n = 0; while (false) { n = n + x * 2; } n }; f(\"a\")", EXPECT_INT(0)},
+    };
+
+    run_tests(tests, ARRAY_SIZE(tests));
+}
+
+static void inlining(void) {
+    test_case_t tests[] = {
+        {"let add = fn(a, b) { a + b }; let f = fn(x) { add(x, 1) * 2 }; f(3) + add(1, 2)", EXPECT_INT(11)},
+        {"let g = 10; let h = fn(x) { x + g }; let f = fn(g) { h(1) + g }; f(5)", EXPECT_INT(16)},
+        {"let sq = fn(x) { let y = x * x; return y; }; let f = fn(a) { sq(sq(a)) }; f(2)", EXPECT_INT(16)},
+        {"let f = fn(x) { if (x > 1) { 1 } else { 2 } }; let g = fn(a) { f(a) }; g(5) * 10 + g(0)", EXPECT_INT(12)},
+        {"let one = fn() { 1 }; let two = fn() { 2 }; let f = fn(x) { if (x) { one() } else { two() } }; let g = fn(x) { f(x) }; g(true) * 10 + g(false)", EXPECT_INT(12)},
+        {"let f = fn(x) { x + 1 }; let g = fn() { f(1) }; f = fn(x) { x + 2 }; g()", EXPECT_INT(3)},
+        {"let fact = fn(n) { if (n < 2) { 1 } else { n * fact(n - 1) } }; fact(5)", EXPECT_INT(120)},
+        {"let f = fn(x) { x }; let g = fn() { f(1, 2) }; g()", EXPECT_INT(1)},
+        {"let f = fn() { let a = 1; }; let g = fn() { f() }; g()", EXPECT_NULL()},
+        {"let f = fn(a) { a[0] = a[0] + 1; }; let arr = [1]; f(arr); f(arr); arr[0]", EXPECT_INT(3)},
+        {"let n = 0; let inc = fn() { n = n + 1; }; for (let i = 0; i < 5; i++) { inc(); } n", EXPECT_INT(5)},
+        {"let k = fn(x, s) { if (x) { 1 } else { len(s) } }; let g = fn(x) { k(x, \"abc\") }; g(true) + g(false)", EXPECT_INT(4)},
+        {"let k = fn(x, y) { if (x > y) { x } else { y } }; let f = fn() { let s = 0; for (let i = 0; i < 1; i++) { s = k(0, k(0, 0)); } return s; }; f()", EXPECT_INT(0)},
+        {"let k = fn(x, y) { if (x > y) { x } else { y } }; let f = fn() { let s = 0; for (let i = 0; i < 3; i++) { s = s + k(1, k(i, 2)); } return s; }; f()", EXPECT_INT(6)},
+    };
+
+    run_tests(tests, ARRAY_SIZE(tests));
+}
+
+static void type_inference(void) {
+    test_case_t tests[] = {
+        {"let f = fn(n) { let s = 0; for (let i = 0; i < n; i++) { s = s + i * 2; } s }; f(4)", EXPECT_INT(12)},
+        {"let f = fn(n) { let i = 10; while (i > n) { i--; } i }; f(7)", EXPECT_INT(7)},
+        {"let f = fn(a) { let b = a > 1; !b == true }; f(3)", EXPECT_BOOL(false)},
+        {"let f = fn(a) { let b = true; b != !(a < 2) }; f(0)", EXPECT_BOOL(true)},
+        {"let f = fn(a) { let b = 1; if (a) { b = \"x\"; } b + b }; f(true)", EXPECT_STRING("xx")},
+        {"let f = fn(a) { let b = 1; if (a) { b = \"x\"; } b + b }; f(false)", EXPECT_INT(2)},
+        {"let f = fn(a) { let b = 1; let i = 0; while (i < 2) { b = b + b; b = a; i++; } b }; f(\"y\")", EXPECT_STRING("y")},
+        {"let f = fn(a) { let b = 0; let i = 0; while (i < 2) { b = b + 1; if (i == 1) { b = a; } i++; } b + b }; f(\"z\")", EXPECT_STRING("zz")},
+        {"let f = fn(a) { let b = 6 / a; b * 2 }; f(3)", EXPECT_INT(4)},
+        {"let f = fn(a) { let b = -(a * 2); b - 1 }; f(3)", EXPECT_INT(-7)},
+    };
+
+    run_tests(tests, ARRAY_SIZE(tests));
+}
+
+static void bounds_check_elimination(void) {
+    test_case_t tests[] = {
+        {"let f = fn(a) { let s = 0; for (let i = 0; i < len(a); i++) { s = s + a[i]; } s }; f([1, 2, 3])", EXPECT_INT(6)},
+        {"let f = fn(a) { for (let i = 0; i < len(a); i++) { a[i] = a[i] * 2; } a[2] }; f([1, 2, 3])", EXPECT_INT(6)},
+        {"let f = fn(a) { let n = len(a); let s = 0; for (let i = 1; i < n; i++) { s = s + a[i]; } s }; f([1, 2, 3])", EXPECT_INT(5)},
+        {"let f = fn(a) { let c = 0; for (let i = 0; i < len(a); i++) { for (let j = i + 1; j < len(a); j++) { if (a[i] > a[j]) { c++; } } } c }; f([3, 1, 2])", EXPECT_INT(2)},
+        {"let a = [4, 5]; let s = 0; for (let i = 0; i < len(a); i++) { s = s + a[i]; }; s", EXPECT_INT(9)},
+        // strings pass the same checks but are indexed through the checked path
+        {"let f = fn(a) { let s = \"\"; for (let i = 0; i < len(a); i++) { s = s + a[i]; } s }; f(\"abc\")", EXPECT_STRING("abc")},
+        {"let f = fn(a) { let c = 0; for (let i = 0; i < len(a); i++) { array_pop(a); c++; } c }; f([1, 2, 3, 4])", EXPECT_INT(2)},
+    };
+
+    run_tests(tests, ARRAY_SIZE(tests));
+}
+
+static void large_integers(void) {
+    // integers that do not fit in a tagged object's immediate need to keep working
+    test_case_t tests[] = {
+        {"9223372036854775807", EXPECT_INT(9223372036854775807)},
+        {"4611686018427387903 + 1", EXPECT_INT(4611686018427387904)},
+        {"-4611686018427387904 - 1", EXPECT_INT(-4611686018427387905)},
+        {"4611686018427387904 / 2", EXPECT_INT(2305843009213693952)},
+        {"-(4611686018427387904 + 4611686018427387903)", EXPECT_INT(-9223372036854775807)},
+        {"let a = [9223372036854775807]; a[0] - 9223372036854775806", EXPECT_INT(1)},
+        {"let f = fn(a) { a + 4611686018427387904 }; f(1) == f(1)", EXPECT_BOOL(true)},
+        {"let a = 4611686018427387903; a++; a", EXPECT_INT(4611686018427387904)},
+        {"fn() { let a = -4611686018427387904; a--; a }()", EXPECT_INT(-4611686018427387905)},
+        // built-in functions must not hand the garbage collector a boxed integer it already tracks
+        {"let f = int; let a = 4611686018427387903 + 1; let b = f(a); [a, b]; b - 4611686018427387903", EXPECT_INT(1)},
+        {"let f = int; let b = f(4611686018427387904); [b]; b - 4611686018427387903", EXPECT_INT(1)},
+    };
+
+    run_tests(tests, ARRAY_SIZE(tests));
+}
+
 static void boolean_expressions(void) {
     struct {
         const char *input;
@@ -184,6 +351,83 @@ static void if_expressions(void) {
 }
 
 
+static void short_circuit_evaluation(void) {
+    test_case_t tests[] = {
+        {"let n = 0; let f = fn() { n = n + 1; true }; let a = false && f(); let b = true || f(); n", EXPECT_INT(0)},
+        {"let n = 0; let f = fn() { n = n + 1; true }; let a = true && f(); let b = false || f(); n", EXPECT_INT(2)},
+        {"let f = fn(a, b) { a && b }; f(true, true) && !f(true, false) && !f(false, true)", EXPECT_BOOL(true)},
+        {"let f = fn(a, b) { a || b }; f(false, false)", EXPECT_BOOL(false)},
+        {"let f = fn(a, b, c) { a && b || c }; f(true, false, true)", EXPECT_BOOL(true)},
+        {"let f = fn(a, b, c) { a && (b || c) }; f(true, false, false)", EXPECT_BOOL(false)},
+        {"let f = fn(a) { if (len(a) > 0 && a[0] > 1) { a[0] } else { 0 } }; f([]) + f([5])", EXPECT_INT(5)},
+        {"let a = [1, 2, 3, 4]; let s = 0; let i = 0; while (i < len(a) && a[i] < 3) { s = s + a[i]; i++; }; s", EXPECT_INT(3)},
+        {"let s = 0; for (let i = 0; i < 10 && !(i == 4 || i == 6); i++) { s = s + i; }; s", EXPECT_INT(6)},
+        {"let f = fn(a) { if (!(a > 1 && a < 4)) { 1 } else { 2 } }; f(2) * 10 + f(5)", EXPECT_INT(21)},
+
+        // operands are tested like conditions: anything but false and null is true, and the result is a boolean
+        {"1 && 2", EXPECT_BOOL(true)},
+        {"0 || false", EXPECT_BOOL(true)},
+        {"let x = 3; x || 5", EXPECT_BOOL(true)},
+        {"\"\" && true", EXPECT_BOOL(true)},
+        {"let n = if (false) { 1 }; n || false", EXPECT_BOOL(false)},
+        {"let f = fn(x) { x && true }; f(1) && !f(if (false) { 1 })", EXPECT_BOOL(true)},
+        {"let f = fn(x, y) { x || y }; f(false, 5)", EXPECT_BOOL(true)},
+    };
+
+    run_tests(tests, ARRAY_SIZE(tests));
+}
+
+static void statement_context(void) {
+    // expressions whose value is not used leave nothing on the stack, including when leaving a loop early
+    test_case_t tests[] = {
+        {"let s = 0; for (let i = 0; i < 10; i++) { if (i == 5) { break; } s = s + i; }; s", EXPECT_INT(10)},
+        {"let s = 0; for (let i = 0; i < 10; i++) { if (i % 2 == 0) { continue; } s = s + i; }; s", EXPECT_INT(25)},
+        {"let f = fn() { let s = 0; let i = 0; while (true) { i++; if (i > 3) { break; } s = s + i; } s }; f()", EXPECT_INT(6)},
+        {"let f = fn() { let n = 0; for (let i = 0; i < 3; i++) { let x = while (n < i) { n++; break; }; } n }; f()", EXPECT_INT(2)},
+        {"let f = fn() { let i = 0; i++; i-- }; f()", EXPECT_INT(1)},
+        {"let g = 3; g--; g", EXPECT_INT(2)},
+        {"let a = [1, 2]; a[0] = 5; a[0]", EXPECT_INT(5)},
+        {"let f = fn(a) { if (a) { 1; } else { 2; }; 3 }; f(true)", EXPECT_INT(3)},
+        {"let f = fn() { let s = 0; for (let i = 0; i < 5; i++) { if (i == 2) { continue; } s = s + i; }; s }; f()", EXPECT_INT(8)},
+        {"let f = fn() { let n = 0; while (n < 3) { if (n < 5) { n++ } }; n }; f()", EXPECT_INT(3)},
+        {"let f = fn() { for (let i = 0; i < 3; i++) { i * 10 } }; f()", EXPECT_INT(20)},
+    };
+
+    run_tests(tests, ARRAY_SIZE(tests));
+}
+
+static void compare_and_branch(void) {
+    test_case_t tests[] = {
+        {"let f = fn(a, b) { let n = 0; if (a == b) { n = n + 1 }; if (a != b) { n = n + 10 }; if (a < b) { n = n + 100 }; if (a <= b) { n = n + 1000 }; if (a > b) { n = n + 10000 }; if (a >= b) { n = n + 100000 }; n }; f(1, 2)", EXPECT_INT(1110)},
+        {"let f = fn(a, b) { let n = 0; if (a == b) { n = n + 1 }; if (a != b) { n = n + 10 }; if (a < b) { n = n + 100 }; if (a <= b) { n = n + 1000 }; if (a > b) { n = n + 10000 }; if (a >= b) { n = n + 100000 }; n }; f(2, 2)", EXPECT_INT(101001)},
+        {"let f = fn(a, b) { let n = 0; if (a == b) { n = n + 1 }; if (a != b) { n = n + 10 }; if (a < b) { n = n + 100 }; if (a <= b) { n = n + 1000 }; if (a > b) { n = n + 10000 }; if (a >= b) { n = n + 100000 }; n }; f(3, 2)", EXPECT_INT(110010)},
+        {"let f = fn(s) { if (s == \"a\") { 1 } else { 2 } }; f(\"a\") + f(\"b\") * 10", EXPECT_INT(21)},
+        {"let f = fn(a, b) { if (a != b) { 1 } else { 2 } }; f(true, false) * 10 + f(true, true)", EXPECT_INT(12)},
+        {"let f = fn() { let i = 0; while (i < 10) { i++ }; i }; f()", EXPECT_INT(10)},
+        {"let f = fn(n) { let s = 0; for (let i = 0; i < n; i++) { s = s + i }; s }; f(5)", EXPECT_INT(10)},
+        {"let n = 0; while (n != 5) { n++ }; n", EXPECT_INT(5)},
+        {"let a = 1; if (a > 0 && a < 2) { 3 } else { 4 }", EXPECT_INT(3)},
+        {"let a = 1; a <= 2 && a >= 1", EXPECT_BOOL(true)},
+    };
+
+    run_tests(tests, ARRAY_SIZE(tests));
+}
+
+static void self_calls(void) {
+    test_case_t tests[] = {
+        {"let fib = fn(n) { if (n < 2) { return n; }; fib(n - 1) + fib(n - 2) }; fib(15)", EXPECT_INT(610)},
+        {"let f = fn(n) { if (n == 0) { return 0; }; f(n - 1) }; f(100000)", EXPECT_INT(0)},
+        {"let f = fn(n, acc) { let d = n * 2; if (n == 0) { return acc; }; f(n - 1, acc + d) }; f(10, 0)", EXPECT_INT(110)},
+        {"let f = fn(n) { if (n == 0) { return 0; }; 1 + f(n - 1) }; let g = f; g(10)", EXPECT_INT(10)},
+        {"let g = fn(x) { x * 10 }; let f = fn(n) { if (n == 0) { return g(1); }; f(n - 1) + 1 }; f(5)", EXPECT_INT(15)},
+        {"let f = fn(n, x, s) { if (n == 0) { return s; }; f(n - 1, x, s + x) }; f(3, \"x\", \"\")", EXPECT_STRING("xxx")},
+        {"let h = fn(f, x) { f(x) }; let g = fn(x) { x + 1 }; h(len, \"ab\") * 10 + h(g, 1) + h(len, [1, 2, 3]) * 100", EXPECT_INT(322)},
+        {"let calls = fn(fns) { let n = 0; for (let i = 0; i < len(fns); i++) { n = n + fns[i](\"abc\") }; n }; calls([len, fn(s) { 10 }, len])", EXPECT_INT(16)},
+    };
+
+    run_tests(tests, ARRAY_SIZE(tests));
+}
+
 static void while_expressions(void) {
     test_case_t tests[] = {
         {"while (false) { 10 }; 5", EXPECT_INT(5)},
@@ -209,7 +453,7 @@ static void nulls(void) {
 
     for (unsigned t=0; t < ARRAY_SIZE(tests); t++) {
         struct object obj = run_vm_test(tests[t].input);
-        assertf(obj.type == OBJ_NULL, "expected NULL, got %s", object_type_to_str(obj.type));
+        assertf(obj_type(obj) == OBJ_NULL, "expected NULL, got %s", object_type_to_str(obj_type(obj)));
      }
 }
 
@@ -348,6 +592,65 @@ static void recursive_functions(void) {
      }
 }
 
+static void tail_calls(void) {
+    struct {
+        const char *input;
+        int expected;
+    } tests[] = {
+        // recursion far deeper than the number of frames
+        {"let sum = fn(n, acc) { if (n == 0) { return acc; } return sum(n - 1, acc + n); }; sum(1000, 0);", 500500},
+        {"let countdown = fn(x) { if (x == 0) { return 0; } countdown(x - 1) }; countdown(1000);", 0},
+        {"let add = fn(a, b) { a + b }; let f = fn(x) { let y = x * 2; return add(y, 1); }; f(5);", 11},
+        {"let f = fn(x) { return x; }; let g = fn(a, b, c) { let d = a + b; return f(d + c); }; g(1, 2, 3) + g(4, 5, 6);", 21},
+        {"let f = fn(a) { return len(a); }; f([1, 2, 3]) + 1;", 4},
+    };
+    
+    for (unsigned t=0; t < ARRAY_SIZE(tests); t++) {
+        struct object obj = run_vm_test(tests[t].input);
+        test_object(obj, OBJ_INT, (object_value) { .integer = tests[t].expected });
+     }
+}
+
+static void deep_recursion(void) {
+    struct object obj = run_vm_test("let depth = fn(n) { if (n == 0) { return 0; } 1 + depth(n - 1) }; depth(5000);");
+    test_object(obj, OBJ_INT, (object_value) { .integer = 5000 });
+
+    // calls from native code nest on the C stack, deeper ones have to stay in the interpreter
+    obj = run_vm_test("let depth = fn(n) { if (n == 0) { return 0; } return 1 + depth(n - 1); }; depth(100000);");
+    test_object(obj, OBJ_INT, (object_value) { .integer = 100000 });
+
+    // an array literal larger than the initial stack, which also needs more registers than register code can address
+    char input[4096] = "let a = 1; len([";
+    for (unsigned i=0; i < 600; i++) {
+        strcat(input, "a, ");
+    }
+    strcat(input, "a])");
+    obj = run_vm_test(input);
+    test_object(obj, OBJ_INT, (object_value) { .integer = 601 });
+
+    // calls nested deeper than the number of registers
+    strcpy(input, "let f = fn(x) { x + 1 }; ");
+    for (unsigned i=0; i < 300; i++) {
+        strcat(input, "f(");
+    }
+    strcat(input, "0");
+    for (unsigned i=0; i < 300; i++) {
+        strcat(input, ")");
+    }
+    obj = run_vm_test(input);
+    test_object(obj, OBJ_INT, (object_value) { .integer = 300 });
+}
+
+static void many_globals_and_constants(void) {
+    char input[4096] = "";
+    for (unsigned i=0; i < 200; i++) {
+        sprintf(input + strlen(input), "let g%d = %d; ", i, 100000 + i);
+    }
+    strcat(input, "g0 + g100 + g199");
+    struct object obj = run_vm_test(input);
+    test_object(obj, OBJ_INT, (object_value) { .integer = 300299 });
+}
+
 static void string_expressions(void) {
     struct {
         const char *input;
@@ -385,6 +688,24 @@ static void builtin_functions(void) {
     run_tests(tests, ARRAY_SIZE(tests)); 
 }
 
+static void intrinsics(void) {
+    test_case_t tests[] = {
+        {"let f = fn(x) { len(x) }; f([1, 2]) + f(\"abc\") * 10", EXPECT_INT(32)},
+        {"let f = fn(x) { len(x) }; f(1)", EXPECT_ERROR("argument to len() not supported: got INTEGER")},
+        {"let f = fn(x) { int(x) }; f(7) + f(\"8\") + f(true)", EXPECT_INT(16)},
+        {"let f = fn(x) { int(x) }; f([1])", EXPECT_ERROR("invalid object type")},
+        {"let a = []; let f = fn(x) { array_push(a, x) }; f(1); f(2) * 100 + a[1] + len(a) * 10", EXPECT_INT(222)},
+        {"let f = fn(a) { array_push(a, 1) }; f(1)", EXPECT_ERROR("invalid argument: expected ARRAY, got INTEGER")},
+        {"let a = [1, 2]; let f = fn() { array_pop(a) }; f() * 10 + f()", EXPECT_INT(21)},
+        {"let a = [1]; let f = fn() { array_pop(a) }; f(); f()", EXPECT_NULL()},
+        {"let f = fn(a) { array_pop(a) }; f(\"a\")", EXPECT_ERROR("invalid argument: expected ARRAY, got STRING")},
+        {"let f = fn(len) { len(1) }; f(fn(x) { x + 1 })", EXPECT_INT(2)},
+        {"let f = fn(a) { let n = 0; for (let i = 0; i < len(a); i++) { n = n + len(a[i]) }; n }; f([\"a\", \"bc\"])", EXPECT_INT(3)},
+    };
+
+    run_tests(tests, ARRAY_SIZE(tests));
+}
+
 static void array_literals(void) {
     struct
     {
@@ -399,14 +720,14 @@ static void array_literals(void) {
 
     for (unsigned i = 0; i < sizeof tests / sizeof tests[0]; i++) {
         struct object obj = run_vm_test(tests[i].input);
-        assertf(obj.type == OBJ_ARRAY, "invalid obj type: expected \"%s\", got \"%s\"", object_type_to_str(OBJ_ARRAY), object_type_to_str(obj.type));
+        assertf(obj_type(obj) == OBJ_ARRAY, "invalid obj type: expected \"%s\", got \"%s\"", object_type_to_str(OBJ_ARRAY), object_type_to_str(obj_type(obj)));
 
-        struct object_list* arr = obj.value.list;
+        struct object_list* arr = obj_list(obj);
         assertf(tests[i].nexpected == arr->size, "invalid array size");
 
         for (unsigned j=0; j < tests[i].nexpected; j++) {
-            assertf(arr->values[j].type == OBJ_INT, "invalid element type");
-            assertf(arr->values[j].value.integer == tests[i].expected[j], "invalid integer value: expected %d, got %d", tests[i].expected[j], arr->values[j].value.integer);
+            assertf(obj_type(arr->values[j]) == OBJ_INT, "invalid element type");
+            assertf(obj_int(arr->values[j]) == tests[i].expected[j], "invalid integer value: expected %d, got %d", tests[i].expected[j], obj_int(arr->values[j]));
         }
         free_object(&obj);
     }
@@ -429,14 +750,14 @@ static void mixed_arrays(void) {
 
     for (unsigned i = 0; i < sizeof tests / sizeof tests[0]; i++) {
         struct object obj = run_vm_test(tests[i].input);
-        assertf(obj.type == OBJ_ARRAY, "invalid obj type: expected \"%s\", got \"%s\"", object_type_to_str(OBJ_ARRAY), object_type_to_str(obj.type));
+        assertf(obj_type(obj) == OBJ_ARRAY, "invalid obj type: expected \"%s\", got \"%s\"", object_type_to_str(OBJ_ARRAY), object_type_to_str(obj_type(obj)));
 
-        struct object_list* arr = obj.value.list;
+        struct object_list* arr = obj_list(obj);
         assertf(arr->size == 4, "invalid array size");
 
         for (int j=0; j < 4; j++) {
-            assertf(arr->values[j].type == tests[i].types[j], "invalid element type");
-            // assertf(arr->values[j].value.integer == tests[i].values[j], "invalid integer value: expected %d, got %d", tests[i].expected[j], arr->values[j].value.integer);
+            assertf(obj_type(arr->values[j]) == tests[i].types[j], "invalid element type");
+            // assertf(obj_int(arr->values[j]) == tests[i].values[j], "invalid integer value: expected %d, got %d", tests[i].expected[j], obj_int(arr->values[j]));
         }
         free_object(&obj);
     }
@@ -598,12 +919,12 @@ static void str_split(void) {
 
     for (unsigned i = 0; i < sizeof tests / sizeof tests[0]; i++) {
         struct object obj = run_vm_test(tests[i].input);
-        assertf(obj.type == OBJ_ARRAY, "invalid obj type: expected \"%s\", got \"%s\"", object_type_to_str(OBJ_ARRAY), object_type_to_str(obj.type));
-        struct object_list* arr = obj.value.list;
+        assertf(obj_type(obj) == OBJ_ARRAY, "invalid obj type: expected \"%s\", got \"%s\"", object_type_to_str(OBJ_ARRAY), object_type_to_str(obj_type(obj)));
+        struct object_list* arr = obj_list(obj);
         assertf(arr->size == tests[i].nexpected, "invalid array size: expected 3, got %d", arr->size);
         for (unsigned j=0; j < tests[i].nexpected; j++) {
-            assertf(arr->values[j].type == OBJ_STRING, "invalid type");
-            assertf(strcmp(arr->values[j].value.string->value, tests[i].expected[j]) == 0, "invalid string value: expected \"%s\", got \"%s\"", tests[i].expected[j], arr->values[j].value.string->value);
+            assertf(obj_type(arr->values[j]) == OBJ_STRING, "invalid type");
+            assertf(strcmp(obj_string(arr->values[j])->value, tests[i].expected[j]) == 0, "invalid string value: expected \"%s\", got \"%s\"", tests[i].expected[j], obj_string(arr->values[j])->value);
         }
         free_object(&obj);
     }
@@ -792,6 +1113,9 @@ static void postfix_expressions(void) {
         { "fn() { let foo = 1; foo-- }()", EXPECT_INT(1) },
         { "let foo = 1; let sub = fn() { foo-- }; sub();", EXPECT_INT(1) },
         { "let foo = 1; let sub = fn() { foo-- }; sub(); sub();", EXPECT_INT(0) },
+        { "fn() { let foo = 1; foo++; foo }()", EXPECT_INT(2) },
+        { "fn() { let n = 0; for (let i = 0; i < 100; i++) { n++; }; n }()", EXPECT_INT(100) },
+        { "let n = 0; for (let i = 0; i < 100; i++) { n++; }; n", EXPECT_INT(100) },
     };
 
     run_tests(tests, sizeof(tests) / sizeof(tests[0]));    
@@ -842,13 +1166,63 @@ static void copies(void) {
     run_tests(tests, sizeof(tests) / sizeof(tests[0]));    
 }
 
+static void superinstructions(void) {
+    test_case_t tests[] = {
+        { "let f = fn(a) { a - 1 }; f(10);", EXPECT_INT(9) },
+        { "let f = fn(a) { a + 1 }; f(10);", EXPECT_INT(11) },
+        { "let f = fn(a) { a + \"bar\" }; f(\"foo\");", EXPECT_STRING("foobar") },
+        { "let f = fn(a) { a < 5 }; f(4);", EXPECT_BOOL(true) },
+        { "let f = fn(a) { a == 5 }; f(5);", EXPECT_BOOL(true) },
+        { "let f = fn(a) { a == \"foo\" }; f(\"foo\");", EXPECT_BOOL(true) },
+        { "let f = fn(a, b) { a + b }; f(1, 2);", EXPECT_INT(3) },
+        { "let f = fn(a, b) { a + b }; f(\"foo\", \"bar\");", EXPECT_STRING("foobar") },
+        { "let f = fn(a, b) { a < b }; f(2, 1);", EXPECT_BOOL(false) },
+        { "let f = fn(a, i) { a[i] }; f([1, 2, 3], 1);", EXPECT_INT(2) },
+        { "let f = fn(a, i) { a[i] }; f(\"foo\", -1);", EXPECT_STRING("o") },
+        { "let f = fn(a, i) { a[i] }; f([1], 1);", EXPECT_ERROR("array index out of ") },
+        { "let f = fn(a, b) { (if (a) { a } else { b }) + 1 }; f(false, 5);", EXPECT_INT(6) },
+    };
+
+    run_tests(tests, ARRAY_SIZE(tests));
+}
+
+static void quickening(void) {
+    test_case_t tests[] = {
+        { "let x = 1; let y = 2; let add = fn() { x + y }; add(); add();", EXPECT_INT(3) },
+        { "let x = 1; let y = 2; let add = fn() { x + y }; add(); x = \"a\"; y = \"b\"; add();", EXPECT_STRING("ab") },
+        { "let x = 5; let y = 1; let div = fn() { x / y }; div(); y = 0; div();", EXPECT_ERROR("division by zero") },
+        { "let x = 5; let y = 1; let mod = fn() { x % y }; mod(); y = 0; mod();", EXPECT_ERROR("division by zero") },
+        { "let x = 1; let y = 1; let eq = fn() { x == y }; eq(); x = true; y = false; eq();", EXPECT_BOOL(false) },
+        { "let x = 1; let y = 2; let gt = fn() { x > y }; gt(); x = 3; gt();", EXPECT_BOOL(true) },
+        { "let a = [1, 2]; let i = 1; let get = fn() { a[i] }; get(); get();", EXPECT_INT(2) },
+        { "let a = [1, 2]; let i = 1; let get = fn() { a[i] }; get(); i = 5; get();", EXPECT_ERROR("array index out of ") },
+        { "let a = [1, 2]; let i = 1; let get = fn() { a[i] }; get(); i = -1; get();", EXPECT_INT(2) },
+        { "let a = [1, 2]; let i = 1; let get = fn() { a[i] }; get(); a = \"foo\"; get();", EXPECT_STRING("o") },
+    };
+
+    run_tests(tests, ARRAY_SIZE(tests));
+}
+
 int main(int argc, const char *argv[]) {
     TEST(integer_arithmetic);
+    TEST(large_integers);
+    TEST(constant_folding);
+    TEST(runtime_operators);
+    TEST(peephole_optimization);
+    TEST(optimized_functions);
+    TEST(loop_invariant_code_motion);
+    TEST(inlining);
+    TEST(type_inference);
+    TEST(bounds_check_elimination);
     TEST(boolean_expressions);
     TEST(if_expressions);
+    TEST(short_circuit_evaluation);
     TEST(nulls);
     TEST(global_let_statements);
     TEST(while_expressions);
+    TEST(statement_context);
+    TEST(compare_and_branch);
+    TEST(self_calls);
     TEST(string_expressions);
     TEST(function_calls);
     TEST(functions_without_return_value);
@@ -856,8 +1230,12 @@ int main(int argc, const char *argv[]) {
     TEST(function_calls_with_bindings);
     TEST(function_calls_with_args_and_bindings);
     TEST(recursive_functions);
+    TEST(tail_calls);
+    TEST(deep_recursion);
+    TEST(many_globals_and_constants);
     TEST(fib);
     TEST(builtin_functions);
+    TEST(intrinsics);
     TEST(array_literals);
     TEST(mixed_arrays);
     TEST(array_indexing);
@@ -880,4 +1258,6 @@ int main(int argc, const char *argv[]) {
     TEST(string_slices);
     TEST(builtin_str_contains);
     TEST(copies);
+    TEST(superinstructions);
+    TEST(quickening);
 }